@@ -0,0 +1,91 @@
+#!/bin/bash
+
+echo "[TEST] resource sealing of a large bundle"
+
+FILES=${1:-50000}
+DIRS=100
+# set LARGE_RESOURCES=1 to also seal four 64MB files (256MB of disk)
+LARGE=${LARGE_RESOURCES:-0}
+
+MY_TEMP=$(mktemp -d /tmp/codesign.XXXXXX)
+APP=$MY_TEMP/Large.app
+
+# synthetic bundle: $FILES small resources spread over $DIRS directories,
+# plus a handful of large ones when LARGE_RESOURCES is set
+mkdir -p $APP/Contents/MacOS $APP/Contents/Resources
+cp /usr/bin/true $APP/Contents/MacOS/Large
+cat > $APP/Contents/Info.plist <<EOF
+<?xml version="1.0" encoding="UTF-8"?>
+<!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN" "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+<plist version="1.0">
+<dict>
+	<key>CFBundleExecutable</key>
+	<string>Large</string>
+	<key>CFBundleIdentifier</key>
+	<string>com.apple.security.codesign-test.large</string>
+</dict>
+</plist>
+EOF
+for ((d = 0; d < DIRS; d++)); do
+	dir=$APP/Contents/Resources/dir$d.lproj
+	mkdir -p $dir
+	for ((f = 0; f < FILES / DIRS; f++)); do
+		echo "resource $d/$f" > $dir/file$f.strings
+	done
+done
+if [ "$LARGE" != "0" ]
+then
+	for ((f = 0; f < 4; f++)); do
+		dd if=/dev/urandom of=$APP/Contents/Resources/large$f.bin bs=1m count=64 2> /dev/null
+	done
+fi
+
+now() {
+	perl -MTime::HiRes=time -e 'printf "%.3f\n", time'
+}
+
+echo "[BEGIN] sign a bundle with $FILES resources"
+start=$(now)
+codesign -s - -f $APP
+res=$?
+echo "sign: $(perl -e "printf '%.3f', $(now) - $start") seconds"
+if [ $res -ne 0 ]
+then
+	echo "[FAIL]"
+else
+	echo "[PASS]"
+fi
+
+echo "[BEGIN] verify a bundle with $FILES resources"
+start=$(now)
+codesign --verify --strict $APP
+res=$?
+echo "verify: $(perl -e "printf '%.3f', $(now) - $start") seconds"
+if [ $res -ne 0 ]
+then
+	echo "[FAIL]"
+else
+	echo "[PASS]"
+fi
+
+echo "[BEGIN] resource seal is deterministic"
+cp $APP/Contents/_CodeSignature/CodeResources $MY_TEMP/CodeResources.1
+codesign -s - -f $APP
+if cmp -s $APP/Contents/_CodeSignature/CodeResources $MY_TEMP/CodeResources.1
+then
+	echo "[PASS]"
+else
+	echo "[FAIL]"
+fi
+
+echo "[BEGIN] modified resource is detected"
+echo "tampered" >> $APP/Contents/Resources/dir7.lproj/file3.strings
+codesign --verify --strict $APP 2> /dev/null
+if [ $? -ne 0 ]
+then
+	echo "[PASS]"
+else
+	echo "[FAIL]"
+fi
+
+rm -rf $MY_TEMP
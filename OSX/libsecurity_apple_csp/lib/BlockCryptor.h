@@ -144,6 +144,12 @@ protected:
 	 *
 	 * The subclass throws CSSMERR_CSP_INPUT_LENGTH_ERROR if the above
 	 * conditions are not met.  
+	 *
+	 * Subclasses which call multiBlockCapable(true) may also be handed any 
+	 * whole number of blocks at once, in both directions; update() passes 
+	 * all the whole blocks it has in one call whenever it isn't doing the 
+	 * CBC chaining itself (i.e. in ECB mode, or if cbcCapable(true)).
+	 * This is the bulk path for implementations which can pipeline blocks.
 	 */
 	virtual void encryptBlock(
 		const void		*plainText,			// length implied (one block)
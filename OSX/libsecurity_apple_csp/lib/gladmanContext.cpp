@@ -32,10 +32,15 @@ GAESContext::GAESContext(AppleCSPSession &session) :
 	mAesKey(NULL),
 	mInitFlag(false),
 	mRawKeySize(0),
-	mWasEncrypting(false)
+	mWasEncrypting(false),
+	mWasCbc(false)
 { 
-	cbcCapable(false);
-	multiBlockCapable(false);
+	/* 
+	 * CommonCrypto does the chaining and takes any number of blocks at once, 
+	 * using the hardware AES instructions where the CPU has them.
+	 */
+	cbcCapable(true);
+	multiBlockCapable(true);
 }
 
 GAESContext::~GAESContext()
@@ -97,29 +102,15 @@ void GAESContext::init(
 		deleteKey();
 	}
 	
-	/* 
-	 * Init key only if key size or key bits have changed, or 
-	 * we're doing a different operation than the previous key
-	 * was scheduled for.
-	 */
-	if(!sameKeySize || (mWasEncrypting != encrypting) ||
-		memcmp(mRawKey, keyData, mRawKeySize)) {
-        (void) CCCryptorCreateWithMode(0, kCCModeECB, kCCAlgorithmAES128, ccDefaultPadding, NULL, keyData, keyLen, NULL, 0, 0, 0, &mAesKey);
-
-		/* save this raw key data */
-		memmove(mRawKey, keyData, keyLen); 
-		mRawKeySize = (uint32)keyLen;
-		mWasEncrypting = encrypting;
-	}
-
-	/* we handle CBC, and hence the IV, ourselves */
+	/* we let CommonCrypto handle CBC, and hence the IV */
+	CssmData *iv = NULL;
 	CSSM_ENCRYPT_MODE cssmMode = context.getInt(CSSM_ATTRIBUTE_MODE);
     switch (cssmMode) {
 		/* no mode attr --> 0 == CSSM_ALGMODE_NONE, not currently supported */
  		case CSSM_ALGMODE_CBCPadIV8:
 		case CSSM_ALGMODE_CBC_IV8:
 		{
-			CssmData *iv = context.get<CssmData>(CSSM_ATTRIBUTE_INIT_VECTOR);
+			iv = context.get<CssmData>(CSSM_ATTRIBUTE_INIT_VECTOR);
 			if(iv == NULL) {
 				CssmError::throwMe(CSSMERR_CSP_MISSING_ATTR_INIT_VECTOR);
 			}
@@ -131,6 +122,40 @@ void GAESContext::init(
 		default:
 		break;
 	}
+	bool cbc = (iv != NULL);
+	
+	/* 
+	 * Init key only if key size or key bits have changed, or 
+	 * we're doing a different operation or mode than the previous key
+	 * was scheduled for. Otherwise just restart the chain from the
+	 * (possibly new) IV.
+	 */
+	if(!sameKeySize || (mWasEncrypting != encrypting) || (mWasCbc != cbc) ||
+		memcmp(mRawKey, keyData, mRawKeySize)) {
+		if(mAesKey) {
+			CCCryptorRelease(mAesKey);
+			mAesKey = NULL;
+		}
+		CCCryptorStatus crtn = CCCryptorCreateWithMode(
+			encrypting ? kCCEncrypt : kCCDecrypt, 
+			cbc ? kCCModeCBC : kCCModeECB, 
+			kCCAlgorithmAES128, ccNoPadding, 
+			cbc ? iv->Data : NULL, 
+			keyData, keyLen, NULL, 0, 0, 0, &mAesKey);
+		if(crtn) {
+			errorLog1("GAESContext::init: CCCryptorCreateWithMode error %d\n", (int)crtn);
+			CssmError::throwMe(CSSMERR_CSP_INTERNAL_ERROR);
+		}
+
+		/* save this raw key data */
+		memmove(mRawKey, keyData, keyLen); 
+		mRawKeySize = (uint32)keyLen;
+		mWasEncrypting = encrypting;
+		mWasCbc = cbc;
+	}
+	else {
+		CCCryptorReset(mAesKey, cbc ? iv->Data : NULL);
+	}
 	
 	/* Finally, have BlockCryptor do its setup */
 	setup(GLADMAN_BLOCK_SIZE_BYTES, context);
@@ -138,35 +163,49 @@ void GAESContext::init(
 }	
 
 /*
- * Functions called by BlockCryptor
- * FIXME make this multi-block capabl3e 
+ * Functions called by BlockCryptor. Since we're multi-block capable these
+ * get any whole number of blocks, and since we're CBC capable, the chaining
+ * state carries over from one call to the next in mAesKey.
  */
 void GAESContext::encryptBlock(
-	const void		*plainText,			// length implied (one block)
+	const void		*plainText,			// length implied (whole blocks)
 	size_t			plainTextLen,
 	void 			*cipherText,	
 	size_t			&cipherTextLen,		// in/out, throws on overflow
 	bool			final)				// ignored
 {
+	if((plainTextLen % GLADMAN_BLOCK_SIZE_BYTES) != 0) {
+		CssmError::throwMe(CSSMERR_CSP_INPUT_LENGTH_ERROR);
+	}
 	if(cipherTextLen < plainTextLen) {
 		CssmError::throwMe(CSSMERR_CSP_OUTPUT_LENGTH_ERROR);
 	}
-    (void) CCCryptorEncryptDataBlock(mAesKey, NULL, plainText, plainTextLen, cipherText);
-
-	cipherTextLen = plainTextLen;
+	size_t moved = 0;
+	if(CCCryptorUpdate(mAesKey, plainText, plainTextLen, 
+			cipherText, cipherTextLen, &moved)) {
+		CssmError::throwMe(CSSMERR_CSP_INTERNAL_ERROR);
+	}
+	cipherTextLen = moved;
 }
 
 void GAESContext::decryptBlock(
-	const void		*cipherText,		// length implied (one cipher block)
+	const void		*cipherText,		// length implied (whole blocks)
 	size_t			cipherTextLen,	
 	void			*plainText,	
 	size_t			&plainTextLen,		// in/out, throws on overflow
 	bool			final)				// ignored
 {
+	if((cipherTextLen % GLADMAN_BLOCK_SIZE_BYTES) != 0) {
+		CssmError::throwMe(CSSMERR_CSP_INPUT_LENGTH_ERROR);
+	}
 	if(plainTextLen < cipherTextLen) {
 		CssmError::throwMe(CSSMERR_CSP_OUTPUT_LENGTH_ERROR);
 	}
-    (void) CCCryptorDecryptDataBlock(mAesKey, NULL, cipherText, cipherTextLen, plainText);
-	plainTextLen = cipherTextLen;
+	size_t moved = 0;
+	if(CCCryptorUpdate(mAesKey, cipherText, cipherTextLen, 
+			plainText, plainTextLen, &moved)) {
+		CssmError::throwMe(CSSMERR_CSP_INTERNAL_ERROR);
+	}
+	plainTextLen = moved;
 }
 
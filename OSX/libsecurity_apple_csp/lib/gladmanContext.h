@@ -64,7 +64,7 @@ public:
 private:
 	void deleteKey();
 	
-	/* scheduled key */
+	/* scheduled key, with CommonCrypto doing the ECB or CBC chaining */
     CCCryptorRef	mAesKey;	
 	bool				mInitFlag;			// for easy reuse
 	
@@ -72,11 +72,12 @@ private:
 	 * Raw key bits saved here and checked on re-init to avoid extra key 
 	 * schedule on re-init. We also have to do a new key schedule if 
 	 * changing between encrypting and decrypting since the key schedules
-	 * differ for the two.
+	 * differ for the two, or between ECB and CBC.
 	 */
 	uint8				mRawKey[MAX_AES_KEY_BITS / 8];
 	uint32				mRawKeySize;
 	bool				mWasEncrypting;
+	bool				mWasCbc;
 };	/* AESContext */
 
 #endif //_H_GLADMAN_CONTEXT
@@ -32,6 +32,12 @@
 #include <security_utilities/threading.h>
 #include <security_ocspd/ocspdUtils.h>
 #include <assert.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /*
  * Set this flag nonzero to turn off this cache module. Generally used to debug
@@ -46,6 +52,15 @@
  
 #pragma mark ---- single cache entry ----
 
+class OcspCacheEntry;
+
+/* LRU order, most recently used first */
+typedef std::list<OcspCacheEntry *> OcspLruList;
+/* entries by expiration time, soonest first */
+typedef std::multimap<CFAbsoluteTime, OcspCacheEntry *> OcspExpiryMap;
+/* entries by the serial numbers of the certs they cover */
+typedef std::unordered_multimap<std::string, OcspCacheEntry *> OcspSerialIndex;
+
 /* 
  * One cache entry, just a parsed OCSPResponse plus an optional URI and a 
  * "latest" nextUpdate time. An entry is stale when its nextUpdate time has 
@@ -61,12 +76,19 @@ public:
 	
 	/* a trusting environment, this module...all public */
 	CSSM_DATA		mLocalResponder;			// we new[]
+
+	/* OcspCache's bookkeeping */
+	std::vector<std::string> mSerials;			// index keys
+	uint64			mSequence;					// order of addition
+	size_t			mSize;						// approximate memory footprint
+	OcspLruList::iterator	mLruPos;
+	OcspExpiryMap::iterator	mExpiryPos;
 };
 
 OcspCacheEntry::OcspCacheEntry(
 	const CSSM_DATA derEncoded,
 	const CSSM_DATA *localResponder)			// optional
-	: OCSPResponse(derEncoded, TP_OCSP_CACHE_TTL)
+	: OCSPResponse(derEncoded, TP_OCSP_CACHE_TTL), mSequence(0)
 {
 	if(localResponder) {
 		mLocalResponder.Data = new uint8[localResponder->Length];
@@ -77,6 +99,20 @@ OcspCacheEntry::OcspCacheEntry(
 		mLocalResponder.Data = NULL;
 		mLocalResponder.Length = 0;
 	}
+
+	/* the cert serial numbers we have responses for, each once */
+	SecAsn1OCSPSingleResponse **responses = responseData().responses;
+	unsigned numResponses = ocspdArraySize((const void **)responses);
+	for(unsigned dex=0; dex<numResponses; dex++) {
+		const CSSM_DATA &serial = responses[dex]->certID.serialNumber;
+		std::string key((const char *)serial.Data, serial.Length);
+		if(std::find(mSerials.begin(), mSerials.end(), key) == mSerials.end()) {
+			mSerials.push_back(key);
+		}
+	}
+
+	/* decoded copy lives in the coder, hence twice the encoded size */
+	mSize = sizeof(*this) + 2 * derEncoded.Length + mLocalResponder.Length;
 }
 
 OcspCacheEntry::~OcspCacheEntry()
@@ -90,6 +126,12 @@ OcspCacheEntry::~OcspCacheEntry()
  * The cache object; ModuleNexus provides each task with at most of of these.
  * All ops which affect the contents of the cache hold the (essentially) global
  * mCacheLock.
+ *
+ * Entries are indexed by cert serial number; an OCSPClientCertID can only 
+ * match a SingleResponse with the same serial, whatever hash algorithm the
+ * responder used for the issuer. Separately, entries are kept in LRU order
+ * (bounded by TP_OCSP_CACHE_MAX_BYTES) and in order of expiration, so neither
+ * eviction nor stale purging has to look at entries which don't go away.
  */
 class OcspCache
 {
@@ -108,28 +150,25 @@ public:
 		OCSPClientCertID	&certID);
 
 private:
-	void removeEntry(unsigned dex);
+	void removeEntry(OcspCacheEntry *entry);
 	void scanForStale();
+	void trimToSize();
 	OCSPSingleResponse *lookupPriv(
 		OCSPClientCertID	&certID,
 		const CSSM_DATA		*localResponderURI,		// optional 
-		unsigned			&rtnDex);				// RETURNED on success
+		OcspCacheEntry		*&rtnEntry);			// RETURNED on success
 
 	Mutex			mCacheLock;
 	
-	/*
-	 * NOTE: I am aware that most folks would just use an array<> here, but
-	 * gdb is so lame that it doesn't even let one examine the contents
-	 * of an array<> (or just about anything else in the STL). I prefer
-	 * debuggability over saving a few lines of trivial code.
-	 */
-	OcspCacheEntry	**mEntries;			// just an array of pointers
-	unsigned		mNumEntries;		// valid entries in mEntries
-	unsigned		mSizeofEntries;		// mallocd space in mEntries
+	OcspLruList		mLru;				// owns all entries
+	OcspExpiryMap	mExpiry;
+	OcspSerialIndex	mSerialIndex;
+	size_t			mTotalSize;			// sum of entries' mSize
+	uint64			mNextSequence;
 };
 
 OcspCache::OcspCache()
-	: mEntries(NULL), mNumEntries(0), mSizeofEntries(0)
+	: mTotalSize(0), mNextSequence(0)
 {
 
 }
@@ -137,69 +176,94 @@ OcspCache::OcspCache()
 /* As of Tiger I believe that this code never runs */
 OcspCache::~OcspCache()
 {
-	for(unsigned dex=0; dex<mNumEntries; dex++) {
-		delete mEntries[dex];
-	}
-	if(mEntries) {
-		free(mEntries);
+	for(OcspLruList::iterator it = mLru.begin(); it != mLru.end(); ++it) {
+		delete *it;
 	}
 }
 
 /* 
- * Private routine, remove entry 'n' from cache.
- * -- caller must hold mCacheLock
- * -- if caller is traversing mEntries, they must start over because we
- *    manipulate it.
+ * Private routine, remove an entry from cache and delete it.
+ * Caller must hold mCacheLock.
  */
 void OcspCache::removeEntry(
-	unsigned dex)
+	OcspCacheEntry *entry)
 {
-	assert(dex <= (mNumEntries - 1));
-	
-	/* removed requested element and compact remaining array */
-	delete mEntries[dex];
-	for(unsigned i=dex; i<(mNumEntries - 1); i++) {
-		mEntries[i] = mEntries[i+1];
+	for(std::vector<std::string>::const_iterator serial = entry->mSerials.begin();
+	    serial != entry->mSerials.end(); ++serial) {
+		std::pair<OcspSerialIndex::iterator, OcspSerialIndex::iterator> range =
+			mSerialIndex.equal_range(*serial);
+		for(OcspSerialIndex::iterator it = range.first; it != range.second; ++it) {
+			if(it->second == entry) {
+				mSerialIndex.erase(it);
+				break;
+			}
+		}
 	}
-	mNumEntries--;
+	mExpiry.erase(entry->mExpiryPos);
+	mLru.erase(entry->mLruPos);
+	mTotalSize -= entry->mSize;
+	delete entry;
 }
 
 /* 
- * Private routine to scan cache, deleting stale entries.
- * Caller must hold mCacheLock, and not be traversing mEntries.
+ * Private routine to delete stale entries.
+ * Caller must hold mCacheLock.
  */
 void OcspCache::scanForStale()
 {
 	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
-	bool foundOne;
-	do {
-		/* restart every time we delete a stale entry */
-		foundOne = false;
-		for(unsigned dex=0; dex<mNumEntries; dex++) {
-			OcspCacheEntry *entry = mEntries[dex];
-			if(entry->expireTime() < now) {
-				tpOcspCacheDebug("OcspCache::scanForStale: deleting stale entry %p",
-					entry);
-				removeEntry(dex);
-				foundOne = true;
-				break;
-			}
-		}
-	} while(foundOne);
+	while(!mExpiry.empty() && (mExpiry.begin()->first < now)) {
+		OcspCacheEntry *entry = mExpiry.begin()->second;
+		tpOcspCacheDebug("OcspCache::scanForStale: deleting stale entry %p",
+			entry);
+		removeEntry(entry);
+	}
+}
+
+/* 
+ * Private routine to evict least recently used entries until we're within
+ * TP_OCSP_CACHE_MAX_BYTES, always keeping the most recent one.
+ * Caller must hold mCacheLock.
+ */
+void OcspCache::trimToSize()
+{
+	while((mTotalSize > TP_OCSP_CACHE_MAX_BYTES) && (mLru.size() > 1)) {
+		OcspCacheEntry *entry = mLru.back();
+		tpOcspCacheDebug("OcspCache::trimToSize: evicting entry %p", entry);
+		removeEntry(entry);
+	}
+}
+
+static bool olderEntry(
+	const OcspCacheEntry *a,
+	const OcspCacheEntry *b)
+{
+	return a->mSequence < b->mSequence;
 }
 
 /* 
  * Private lookup routine. Caller holds mCacheLock. We return both an
- * OCSPSingleResponse and the index into mEntries at which we found it. 
+ * OCSPSingleResponse and the entry in which we found it. As ever, if 
+ * several entries match, the one added first wins.
  */
  OCSPSingleResponse *OcspCache::lookupPriv(
 	OCSPClientCertID	&certID,
 	const CSSM_DATA		*localResponderURI,		// optional 
-	unsigned			&rtnDex)				// RETURNED on success
+	OcspCacheEntry		*&rtnEntry)				// RETURNED on success
 {
+	const CSSM_DATA &serial = certID.subjectSerial();
+	std::pair<OcspSerialIndex::iterator, OcspSerialIndex::iterator> range =
+		mSerialIndex.equal_range(std::string((const char *)serial.Data, serial.Length));
+	std::vector<OcspCacheEntry *> candidates;
+	for(OcspSerialIndex::iterator it = range.first; it != range.second; ++it) {
+		candidates.push_back(it->second);
+	}
+	std::sort(candidates.begin(), candidates.end(), olderEntry);
+
 	OCSPSingleResponse *resp = NULL;
-	for(unsigned dex=0; dex<mNumEntries; dex++) {
-		OcspCacheEntry *entry = mEntries[dex];
+	for(std::vector<OcspCacheEntry *>::iterator it = candidates.begin();
+	    it != candidates.end(); ++it) {
+		OcspCacheEntry *entry = *it;
 		if(localResponderURI) {
 			/* if caller specifies, it must match */
 			if(entry->mLocalResponder.Data == NULL) {
@@ -217,7 +281,7 @@ void OcspCache::scanForStale()
 		resp = entry->singleResponseFor(certID);
 		if(resp) {
 			tpOcspCacheDebug("OcspCache::lookupPriv: cache HIT on entry %p", entry);
-			rtnDex=dex;
+			rtnEntry = entry;
 			return resp;
 		}
 	}
@@ -234,8 +298,13 @@ OCSPSingleResponse *OcspCache::lookup(
 	/* take care of stale entries right away */
 	scanForStale();
 	
-	unsigned rtnDex;
-	return lookupPriv(certID, localResponderURI, rtnDex);
+	OcspCacheEntry *entry;
+	OCSPSingleResponse *resp = lookupPriv(certID, localResponderURI, entry);
+	if(resp) {
+		/* now the most recently used */
+		mLru.splice(mLru.begin(), mLru, entry->mLruPos);
+	}
+	return resp;
 }
 
 void OcspCache::addResponse(
@@ -245,19 +314,16 @@ void OcspCache::addResponse(
 	StLock<Mutex> _(mCacheLock);
 
 	OcspCacheEntry *entry = new OcspCacheEntry(ocspResp, localResponderURI);
-	if(mNumEntries == mSizeofEntries) {
-		if(mSizeofEntries == 0) {
-			/* appending to empty array */
-			mSizeofEntries = 1;
-		}
-		else {
-			mSizeofEntries *= 2;
-		}
-		mEntries = (OcspCacheEntry **)realloc(mEntries, 
-			mSizeofEntries * sizeof(OcspCacheEntry *));
+	entry->mSequence = mNextSequence++;
+	entry->mLruPos = mLru.insert(mLru.begin(), entry);
+	entry->mExpiryPos = mExpiry.insert(std::make_pair(entry->expireTime(), entry));
+	for(std::vector<std::string>::const_iterator serial = entry->mSerials.begin();
+	    serial != entry->mSerials.end(); ++serial) {
+		mSerialIndex.insert(std::make_pair(*serial, entry));
 	}
-	mEntries[mNumEntries++] = entry;
+	mTotalSize += entry->mSize;
 	tpOcspCacheDebug("OcspCache::addResponse: add entry %p", entry);
+	trimToSize();
 }
 
 void OcspCache::flush(
@@ -268,15 +334,15 @@ void OcspCache::flush(
 	/* take care of all stale entries */
 	scanForStale();
 	
-	unsigned rtnDex;
+	OcspCacheEntry *entry;
 	OCSPSingleResponse *resp;
 	do {
 		/* execute as until we find no more entries matching */
-		resp = lookupPriv(certID, NULL, rtnDex);
+		resp = lookupPriv(certID, NULL, entry);
 		if(resp) {
-			assert((rtnDex >= 0) && (rtnDex < mNumEntries));
-			tpOcspCacheDebug("OcspCache::flush: deleting entry %p", mEntries[rtnDex]);
-			removeEntry(rtnDex);
+			tpOcspCacheDebug("OcspCache::flush: deleting entry %p", entry);
+			delete resp;
+			removeEntry(entry);
 		}
 	} while(resp != NULL);
 }
@@ -33,6 +33,14 @@
 /* max default TTL currently 12 hours */
 #define TP_OCSP_CACHE_TTL	(60.0 * 60.0 * 12.0)
 
+/* 
+ * Approximate memory cap for cached responses; least recently used entries
+ * are discarded beyond this.
+ */
+#ifndef	TP_OCSP_CACHE_MAX_BYTES
+#define TP_OCSP_CACHE_MAX_BYTES	(4 * 1024 * 1024)
+#endif
+
 extern "C" {
 
 /*
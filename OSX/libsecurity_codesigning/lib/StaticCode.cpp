@@ -51,6 +51,7 @@
 #include <dirent.h>
 #include <sys/xattr.h>
 #include <sstream>
+#include <atomic>
 #include <IOKit/storage/IOStorageDeviceCharacteristics.h>
 #include <dispatch/private.h>
 
@@ -68,6 +69,51 @@ static const char developerID[] = "anchor apple generic and certificate 1[field.
 static const char distributionCertificate[] =	"anchor apple generic and certificate leaf[field.1.2.840.113635.100.6.1.7] exists";
 static const char iPhoneDistributionCert[] =	"anchor apple generic and certificate leaf[field.1.2.840.113635.100.6.1.4] exists";
 
+// Code slots hashed by each concurrent work item when validating an executable:
+// as many pages as fit in one scanFileData chunk (64 slots with 4K pages).
+// Executables with no more slots than this are just read and hashed in one pass.
+static uint32_t validationSlotsPerBatch(size_t pageSize)
+{
+	return uint32_t(max(size_t(1), scanFileDataChunk / pageSize));
+}
+
+//
+// Consult and update the persistent validation cache.
+// Strict validation always looks at the actual contents, but still records what it finds.
+// Verdicts are collected in a batch and written when the validation pass is done.
+// Trouble with the cache itself never affects the outcome of a validation.
+//
+static bool cachedValidation(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const ValidationCache::Identity &file, SecCSFlags flags)
+{
+	if (flags & kSecCSStrictValidate)
+		return false;
+	try {
+		return validationCache().lookup(digest, length, hashType, file, flags);
+	} catch (...) {
+		secinfo("staticCode", "validation cache lookup failed");
+		return false;
+	}
+}
+
+static void cacheValidation(ValidationCache::Batch &batch, const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const ValidationCache::Identity &file, SecCSFlags flags)
+{
+	try {
+		batch.add(digest, length, hashType, file, flags);
+	} catch (...) {
+		secinfo("staticCode", "validation cache update failed");
+	}
+}
+
+static void commitValidations(ValidationCache::Batch &batch)
+{
+	try {
+		batch.commit();
+	} catch (...) {
+		secinfo("staticCode", "validation cache update failed");
+	}
+}
+
+
 //
 // Map a component slot number to a suitable error code for a failure
 //
@@ -169,19 +215,20 @@ void SecStaticCode::prepareProgress(unsigned int workload)
 
 void SecStaticCode::reportProgress(unsigned amount /* = 1 */)
 {
-	if (mMonitor && (mValidationFlags & kSecCSReportProgress)) {
-		// update progress and report
-		__block bool cancel = false;
-		dispatch_sync(mProgressQueue, ^{
-			if (mCancelPending)
-				cancel = true;
+	// update progress and report, if asked to
+	bool report = mMonitor && (mValidationFlags & kSecCSReportProgress);
+	__block bool cancel = false;
+	dispatch_sync(mProgressQueue, ^{
+		if (mCancelPending)
+			cancel = true;
+		if (report) {
 			mCurrentWork += amount;
 			mMonitor(this->handle(false), CFSTR("progress"), CFTemp<CFDictionaryRef>("{current=%d,total=%d}", mCurrentWork, mTotalWork));
-		});
-		// if cancellation is pending, abort now
-		if (cancel)
-			MacOSError::throwMe(errSecCSCancelled);
-	}
+		}
+	});
+	// if cancellation is pending, abort now
+	if (cancel)
+		MacOSError::throwMe(errSecCSCancelled);
 }
 
 
@@ -211,12 +258,11 @@ void SecStaticCode::setValidationModifiers(CFDictionaryRef conditions)
 
 //
 // Request cancellation of a validation in progress.
-// We do this by posting an abort flag that is checked periodically.
+// We do this by posting an abort flag that is checked periodically,
+// whether or not progress is being reported.
 //
 void SecStaticCode::cancelValidation()
 {
-	if (!(mValidationFlags & kSecCSReportProgress))		// not using progress reporting; cancel won't make it through
-		MacOSError::throwMe(errSecCSInvalidFlags);
 	dispatch_assert_queue(mProgressQueue);
 	mCancelPending = true;
 }
@@ -869,28 +915,41 @@ void SecStaticCode::validateExecutable()
 			if (!cd)
 				MacOSError::throwMe(errSecCSUnsigned);
 			AutoFileDesc fd(mainExecutablePath(), O_RDONLY);
-			fd.fcntl(F_NOCACHE, true);		// turn off page caching (one-pass)
-			if (Universal *fat = mRep->mainExecutableImage())
-				fd.seek(fat->archOffset());
+			ValidationCache::Identity identity(fd);		// before we read any of it
+			CFDataRef cdhash = this->cdHash();
 			size_t pageSize = cd->pageSize ? (1 << cd->pageSize) : 0;
-			size_t remaining = cd->signingLimit();
-			for (uint32_t slot = 0; slot < cd->nCodeSlots; ++slot) {
-				size_t thisPage = remaining;
-				if (pageSize)
-					thisPage = min(thisPage, pageSize);
-				__block bool good = true;
-				CodeDirectory::multipleHashFileData(fd, thisPage, hashAlgorithms(), ^(CodeDirectory::HashAlgorithm type, Security::DynamicHash *hasher) {
-					const CodeDirectory* cd = (const CodeDirectory*)CFDataGetBytePtr(mCodeDirectories[type]);
-					if (!hasher->verify((*cd)[slot]))
-						good = false;
-				});
-				if (!good) {
-					CODESIGN_EVAL_STATIC_EXECUTABLE_FAIL(this, (int)slot);
-					MacOSError::throwMe(errSecCSSignatureFailed);
+			if (cachedValidation(CFDataGetBytePtr(cdhash), CFDataGetLength(cdhash), hashAlgorithm(), identity, mValidationFlags)) {
+				secinfo("staticCode", "%p executable unchanged since last validated", this);
+			} else {
+				fd.fcntl(F_NOCACHE, true);		// turn off page caching (one-pass)
+				if (pageSize && cd->nCodeSlots > validationSlotsPerBatch(pageSize)) {
+					validateExecutableChunks(fd, cd, pageSize);
+				} else {
+					if (Universal *fat = mRep->mainExecutableImage())
+						fd.seek(fat->archOffset());
+					size_t remaining = cd->signingLimit();
+					for (uint32_t slot = 0; slot < cd->nCodeSlots; ++slot) {
+						size_t thisPage = remaining;
+						if (pageSize)
+							thisPage = min(thisPage, pageSize);
+						__block bool good = true;
+						CodeDirectory::multipleHashFileData(fd, thisPage, hashAlgorithms(), ^(CodeDirectory::HashAlgorithm type, Security::DynamicHash *hasher) {
+							const CodeDirectory* cd = (const CodeDirectory*)CFDataGetBytePtr(mCodeDirectories[type]);
+							if (!hasher->verify((*cd)[slot]))
+								good = false;
+						});
+						if (!good) {
+							CODESIGN_EVAL_STATIC_EXECUTABLE_FAIL(this, (int)slot);
+							MacOSError::throwMe(errSecCSSignatureFailed);
+						}
+						remaining -= thisPage;
+					}
+					assert(remaining == 0);
 				}
-				remaining -= thisPage;
+				ValidationCache::Batch verdicts;
+				cacheValidation(verdicts, CFDataGetBytePtr(cdhash), CFDataGetLength(cdhash), hashAlgorithm(), identity, mValidationFlags);
+				commitValidations(verdicts);
 			}
-			assert(remaining == 0);
 			mExecutableValidated = true;
 			mExecutableValidResult = errSecSuccess;
 		} catch (const CommonError &err) {
@@ -911,6 +970,89 @@ void SecStaticCode::validateExecutable()
 }
 
 
+//
+// Validate the code pages of the main executable in batches of
+// validationSlotsPerBatch() slots, hashed concurrently. Each batch preads its
+// own scanFileDataChunk-sized piece of the file. The executable is not mapped:
+// it is untrusted and may be truncated under us, and a short read simply fails
+// the affected slots where touching a mapping past EOF would raise SIGBUS.
+// The first failure (or a pending cancellation) stops the remaining batches.
+//
+static void recordValidationFailure(std::atomic<OSStatus> &status, OSStatus rc)
+{
+	OSStatus expected = errSecSuccess;
+	status.compare_exchange_strong(expected, rc);	// first failure wins
+}
+
+void SecStaticCode::validateExecutableChunks(FileDesc fd, const CodeDirectory *cd, size_t pageSize)
+{
+	size_t offset = 0;
+	if (Universal *fat = mRep->mainExecutableImage())
+		offset = fat->archOffset();
+	size_t limit = cd->signingLimit();
+
+	// look up the CodeDirectory for each hash type up front; the workers mustn't touch mCodeDirectories
+	typedef std::vector<std::pair<CodeDirectory::HashAlgorithm, const CodeDirectory *> > Directories;
+	Directories directories;
+	CodeDirectory::HashAlgorithms types = hashAlgorithms();
+	for (auto it = types.begin(); it != types.end(); ++it)
+		if (CodeDirectory::viableHash(*it))
+			directories.push_back(make_pair(*it, (const CodeDirectory *)CFDataGetBytePtr(mCodeDirectories[*it])));
+	const Directories &directoriesRef = directories;	// (into block)
+
+	std::atomic<OSStatus> status(errSecSuccess);
+	std::atomic<OSStatus> &statusRef = status;			// (into block)
+	std::atomic<uint32_t> failedSlot(0);
+	std::atomic<uint32_t> &failedSlotRef = failedSlot;	// (into block)
+	uint32_t nSlots = cd->nCodeSlots;
+	uint32_t slotsPerBatch = validationSlotsPerBatch(pageSize);
+	size_t batches = (nSlots + slotsPerBatch - 1) / slotsPerBatch;
+	dispatch_apply(batches, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t batch) {
+		if (statusRef != errSecSuccess)
+			return;		// some other batch failed already
+		__block bool cancel = false;
+		dispatch_sync(mProgressQueue, ^{ cancel = mCancelPending; });
+		if (cancel)
+			return recordValidationFailure(statusRef, errSecCSCancelled);
+		try {
+			uint32_t first = uint32_t(batch * slotsPerBatch);
+			uint32_t end = min(nSlots, first + slotsPerBatch);
+			size_t batchStart = min(limit, first * pageSize);
+			size_t batchSize = min(limit, end * pageSize) - batchStart;
+			std::vector<uint8_t> buffer(max(batchSize, size_t(1)));
+			size_t got = 0;
+			while (got < batchSize) {
+				size_t n = fd.read(&buffer[got], batchSize - got, offset + batchStart + got);
+				if (n == 0)
+					break;		// truncated; the short pages fail to verify
+				got += n;
+			}
+			for (uint32_t slot = first; slot < end; ++slot) {
+				size_t start = slot * pageSize - batchStart;
+				size_t thisPage = (start < got) ? min(pageSize, got - start) : 0;
+				for (auto it = directoriesRef.begin(); it != directoriesRef.end(); ++it) {
+					RefPointer<DynamicHash> hasher = CodeDirectory::hashFor(it->first);
+					hasher->update(&buffer[0] + start, thisPage);
+					if (!hasher->verify((*it->second)[slot])) {
+						failedSlotRef = slot;
+						return recordValidationFailure(statusRef, errSecCSSignatureFailed);
+					}
+				}
+			}
+		} catch (const CommonError &err) {
+			recordValidationFailure(statusRef, err.osStatus());
+		} catch (...) {
+			recordValidationFailure(statusRef, errSecCSInternalError);
+		}
+	});
+
+	if (status == errSecCSSignatureFailed)
+		CODESIGN_EVAL_STATIC_EXECUTABLE_FAIL(this, (int)failedSlot);
+	if (status != errSecSuccess)
+		MacOSError::throwMe(status);
+}
+
+
 //
 // Perform static validation of sealed resources and nested code.
 //
@@ -989,6 +1131,7 @@ void SecStaticCode::validateResources(SecCSFlags flags)
 				mLimitedAsync->perform(groupRef, validate);
 			});
 			group.wait();	// wait until all async resources have been validated as well
+			commitValidations(mResourceVerdicts);
 
 			unsigned leftovers = unsigned(CFDictionaryGetCount(resourceMap));
 			if (leftovers > 0) {
@@ -1250,6 +1393,11 @@ void SecStaticCode::validateResource(CFDictionaryRef files, string path, bool is
 				return ctx.reportProblem(errSecCSBadResource, kSecCFErrorResourceAltered, fullpath); // changed type
 			AutoFileDesc fd(cfString(fullpath), O_RDONLY, FileDesc::modeMissingOk);	// open optional file
 			if (fd) {
+				ValidationCache::Identity identity(fd);		// before we read any of it
+				const Byte *digest = seal.hash(hashAlgorithm());
+				size_t digestLength = RefPointer<DynamicHash>(CodeDirectory::hashFor(hashAlgorithm()))->digestLength();
+				if (cachedValidation(digest, digestLength, hashAlgorithm(), identity, flags))
+					return;		// unchanged since it was last found to match
 				__block bool good = true;
 				CodeDirectory::multipleHashFileData(fd, 0, hashAlgorithms(), ^(CodeDirectory::HashAlgorithm type, Security::DynamicHash *hasher) {
 					if (!hasher->verify(rseal.hash(type)))
@@ -1257,6 +1405,8 @@ void SecStaticCode::validateResource(CFDictionaryRef files, string path, bool is
 				});
 				if (!good)
 					ctx.reportProblem(errSecCSBadResource, kSecCFErrorResourceAltered, fullpath); // altered
+				else
+					cacheValidation(mResourceVerdicts, digest, digestLength, hashAlgorithm(), identity, flags);
 			} else {
 				if (!seal.optional())
 					ctx.reportProblem(errSecCSBadResource, kSecCFErrorResourceMissing, fullpath); // was sealed but is now missing
@@ -1764,8 +1914,11 @@ void SecStaticCode::CollectingContext::throwMe()
 // validation matrix based on which options it is given, creating temporary
 // SecStaticCode objects on the fly to complete the task.
 // (The point, of course, is to do as little duplicate work as possible.)
+// If validated is given, it collects every SecStaticCode that was validated here. A
+// requirement is met if satisfiesRequirement holds for all of them, so callers with many
+// requirements to check can validate once and then just run each requirement.
 //
-void SecStaticCode::staticValidate(SecCSFlags flags, const SecRequirement *req)
+void SecStaticCode::staticValidate(SecCSFlags flags, const SecRequirement *req, ValidatedCodes *validated /* = NULL */)
 {
 	setValidationFlags(flags);
 
@@ -1775,6 +1928,8 @@ void SecStaticCode::staticValidate(SecCSFlags flags, const SecRequirement *req)
 
 	// core components: once per architecture (if any)
 	this->staticValidateCore(flags, req);
+	if (validated)
+		validated->push_back(this);
 	if (flags & kSecCSCheckAllArchitectures)
 		handleOtherArchitectures(^(SecStaticCode* subcode) {
 			if (flags & kSecCSCheckGatekeeperArchitectures) {
@@ -1786,6 +1941,8 @@ void SecStaticCode::staticValidate(SecCSFlags flags, const SecRequirement *req)
 			}
 			subcode->detachedSignature(this->mDetachedSig);	// carry over explicit (but not implicit) detached signature
 			subcode->staticValidateCore(flags, req);
+			if (validated)
+				validated->push_back(subcode);
 		});
 	reportProgress();
 
@@ -33,9 +33,11 @@
 #include "requirement.h"
 #include "diskrep.h"
 #include "codedirectory.h"
+#include "csdatabase.h"
 #include <Security/SecTrust.h>
 #include <CoreFoundation/CFData.h>
 #include <security_utilities/dispatch.h>
+#include <vector>
 
 namespace Security {
 namespace CodeSigning {
@@ -175,6 +177,7 @@ public:
 	unsigned estimateResourceWorkload();
 	void validateResources(SecCSFlags flags);
 	void validateExecutable();
+	void validateExecutableChunks(UnixPlusPlus::FileDesc fd, const CodeDirectory *cd, size_t pageSize);
 	void validateNestedCode(CFURLRef path, const ResourceSeal &seal, SecCSFlags flags, bool isFramework);
 	
 	void validatePlainMemoryResource(string path, CFDataRef fileData, SecCSFlags flags);
@@ -198,7 +201,10 @@ public:
 	static bool isAppleDeveloperCert(CFArrayRef certs); // determines if this is an apple developer certificate for library validation
 
 public:
-	void staticValidate(SecCSFlags flags, const SecRequirement *req);
+	// the code objects (this one and any other architectures) a static validation looked at
+	typedef std::vector<SecPointer<SecStaticCode> > ValidatedCodes;
+
+	void staticValidate(SecCSFlags flags, const SecRequirement *req, ValidatedCodes *validated = NULL);
 	void staticValidateCore(SecCSFlags flags, const SecRequirement *req);
 	
 protected:
@@ -246,6 +252,7 @@ private:
 	bool mResourcesDeep;				// cached validation was deep
 	OSStatus mResourcesValidResult;			// outcome if mResourceValidated or...
 	ValidationContext *mResourcesValidContext; // resource error reporting funnel
+	ValidationCache::Batch mResourceVerdicts; // resources found to match, for the validation cache
 	
 	// validation progress state (set when static validation starts)
 	SecCSFlags mValidationFlags;		// API flags passed to static validation
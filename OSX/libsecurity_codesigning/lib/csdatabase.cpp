@@ -26,6 +26,7 @@
 //
 #include "csdatabase.h"
 #include "detachedrep.h"
+#include <sys/mount.h>
 
 namespace Security {
 namespace CodeSigning {
@@ -39,6 +40,7 @@ using namespace SQLite;
 //
 ModuleNexus<SignatureDatabase> signatureDatabase;
 ModuleNexus<SignatureDatabaseWriter> signatureDatabaseWriter;
+ModuleNexus<ValidationCache> validationCache;
 
 
 //
@@ -176,5 +178,198 @@ void SignatureDatabaseWriter::insertCode(int64 globid, int arch, const EmbeddedS
 
 
 
+//
+// Default path to the validation cache.
+//
+const char ValidationCache::defaultPath[] = "/var/db/CodeValidationCache";
+
+
+//
+// Creation commands for the validation cache.
+//
+const char validationSchema[] = "\
+	create table if not exists verdict ( \n\
+		digest blob not null, \n\
+		hashType integer not null, \n\
+		device integer not null, \n\
+		inode integer not null, \n\
+		size integer not null, \n\
+		mtime integer not null, \n\
+		ctime integer not null, \n\
+		flags integer not null, \n\
+		created text default current_timestamp, \n\
+		primary key (digest, hashType, device, inode, flags) on conflict replace \n\
+	); \n\
+	create index if not exists verdict_created on verdict (created); \n\
+";
+
+
+//
+// Flags that can change the outcome of a validation, and so are part of the key.
+//
+static const SecCSFlags validationCacheFlags =
+	kSecCSCheckNestedCode | kSecCSRestrictSymlinks | kSecCSRestrictToAppLike | kSecCSRestrictSidebandData;
+
+
+//
+// The lookup, prepared once when the cache is opened.
+//
+static const char validationLookup[] =
+	"select 1 from verdict where digest = ?1 and hashType = ?2 and device = ?3 and inode = ?4 \
+	 and size = ?5 and mtime = ?6 and ctime = ?7 and flags = ?8;";
+
+
+//
+// Open the cache. Root opens it for writing (creating it as needed); everyone
+// else can only consult it. A cache file that could have been written by
+// anyone other than root is ignored.
+// Whether the schema exists is checked once, here; a cache that is empty when
+// we open it has nothing to find until the next process opens it.
+//
+ValidationCache::ValidationCache(const char *path)
+	: SQLite::Database(path, (geteuid() == 0) ? (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) : SQLITE_OPEN_READONLY, true),
+	  mTrusted(false), mPruned(false), mHasSchema(false), mLookup(NULL)
+{
+	struct stat st;
+	if (this->isOpen() && ::stat(path, &st) == 0)
+		mTrusted = st.st_uid == 0 && !(st.st_mode & (S_IWGRP | S_IWOTH));
+	if (mTrusted && !this->empty()) {
+		mHasSchema = true;
+		if (::sqlite3_prepare_v2(this->sql(), validationLookup, -1, &mLookup, NULL) != SQLITE_OK)
+			mLookup = NULL;		// not a schema we know; never hit
+	}
+}
+
+ValidationCache::~ValidationCache()
+{
+	if (mLookup)
+		::sqlite3_finalize(mLookup);
+}
+
+
+//
+// Take the identity of an open file.
+// A file whose mtime or ctime falls in the current second is not cacheable: with
+// one-second timestamps (HFS+), it could still be rewritten without changing them.
+//
+ValidationCache::Identity::Identity(UnixPlusPlus::FileDesc fd)
+{
+	time_t now = ::time(NULL);
+	UnixPlusPlus::FileDesc::UnixStat st;
+	fd.fstat(st);
+	device = st.st_dev;
+	inode = st.st_ino;
+	size = st.st_size;
+	mtime = SQLite::int64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+	ctime = SQLite::int64(st.st_ctimespec.tv_sec) * 1000000000 + st.st_ctimespec.tv_nsec;
+
+	struct statfs fs;
+	bool bootVolume = ::fstatfs(fd, &fs) == 0
+		&& (fs.f_flags & MNT_LOCAL) && (fs.f_flags & MNT_ROOTFS);
+	cacheable = bootVolume && st.st_mtimespec.tv_sec < now && st.st_ctimespec.tv_sec < now;
+}
+
+
+//
+// Check whether a file with this identity was found to match this digest before.
+//
+bool ValidationCache::lookup(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const Identity &file, SecCSFlags flags)
+{
+	if (!file.cacheable || !mLookup)
+		return false;
+	StLock<Mutex> _(mLookupLock);
+	::sqlite3_bind_blob(mLookup, 1, digest, (int)length, SQLITE_STATIC);
+	::sqlite3_bind_int64(mLookup, 2, hashType);
+	::sqlite3_bind_int64(mLookup, 3, file.device);
+	::sqlite3_bind_int64(mLookup, 4, file.inode);
+	::sqlite3_bind_int64(mLookup, 5, file.size);
+	::sqlite3_bind_int64(mLookup, 6, file.mtime);
+	::sqlite3_bind_int64(mLookup, 7, file.ctime);
+	::sqlite3_bind_int64(mLookup, 8, flags & validationCacheFlags);
+	int rc = ::sqlite3_step(mLookup);
+	::sqlite3_reset(mLookup);
+	::sqlite3_clear_bindings(mLookup);		// don't hold on to the caller's digest
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+		this->check(rc);
+	return rc == SQLITE_ROW;
+}
+
+
+//
+// Record that files with these identities matched these digests.
+// The identities must have been taken before the files were read.
+// All verdicts go into one transaction, so a validation costs one commit.
+//
+void ValidationCache::store(const std::vector<Verdict> &verdicts)
+{
+	if (verdicts.empty() || !mTrusted || !(this->openFlags() & SQLITE_OPEN_READWRITE))
+		return;
+	if (!mHasSchema) {
+		this->execute(validationSchema);
+		mHasSchema = true;
+	}
+	SQLite::Transaction xact(*this, SQLite::Transaction::deferred, "verdicts");
+	SQLite::Statement insert(*this,
+		"insert into verdict (digest, hashType, device, inode, size, mtime, ctime, flags) \
+		 values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);");
+	for (auto it = verdicts.begin(); it != verdicts.end(); ++it) {
+		insert.reset();
+		insert.bind(1).blob(it->digest.data(), it->digest.size(), true);
+		insert.bind(2) = SQLite::int64(it->hashType);
+		insert.bind(3) = it->file.device;
+		insert.bind(4) = it->file.inode;
+		insert.bind(5) = it->file.size;
+		insert.bind(6) = it->file.mtime;
+		insert.bind(7) = it->file.ctime;
+		insert.bind(8) = SQLite::int64(it->flags & validationCacheFlags);
+		insert.execute();
+	}
+	if (!mPruned)
+		prune();
+	xact.commit();
+}
+
+
+//
+// Drop entries that are too old, and all but the newest maxEntries.
+// Done once per process, with the first store.
+//
+void ValidationCache::prune()
+{
+	SQLite::Statement aged(*this,
+		"delete from verdict where created < datetime('now', ?1);");
+	aged.bind(1) = "-" + std::to_string(maxAgeDays) + " days";
+	aged.execute();
+	SQLite::Statement excess(*this,
+		"delete from verdict where rowid in \
+		 (select rowid from verdict order by created desc limit -1 offset ?1);");
+	excess.bind(1) = SQLite::int64(maxEntries);
+	excess.execute();
+	mPruned = true;
+}
+
+
+//
+// Collect verdicts as a validation finds them, and store them all at the end.
+//
+void ValidationCache::Batch::add(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const Identity &file, SecCSFlags flags)
+{
+	if (!file.cacheable)
+		return;
+	StLock<Mutex> _(mLock);
+	mVerdicts.push_back(Verdict(digest, length, hashType, file, flags));
+}
+
+void ValidationCache::Batch::commit()
+{
+	std::vector<Verdict> verdicts;
+	{
+		StLock<Mutex> _(mLock);
+		verdicts.swap(mVerdicts);
+	}
+	validationCache().store(verdicts);
+}
+
+
 } // end namespace CodeSigning
 } // end namespace Security
@@ -33,6 +33,7 @@
 #include <security_utilities/globalizer.h>
 #include <security_utilities/sqlite++.h>
 #include <security_utilities/cfutilities.h>
+#include <security_utilities/unix++.h>
 
 
 namespace Security {
@@ -68,6 +69,66 @@ private:
 };
 
 
+//
+// A cache of files whose contents have been found to match a digest.
+// Entries are keyed by the digest, its hash type, the flags that can change a
+// verdict, and the identity of the file on disk, which changes whenever the
+// file does, so a hit means the file still holds what was validated. Only a cache that nobody but root can write is used.
+// Only files on the boot volume are cached: on images, removable media and
+// network volumes the device, inode and timestamps are the attacker's to choose.
+//
+class ValidationCache : public SQLite::Database {
+public:
+	ValidationCache(const char *path = defaultPath);
+	virtual ~ValidationCache();
+
+	struct Identity {
+		Identity(UnixPlusPlus::FileDesc fd);
+		SQLite::int64 device, inode, size, mtime, ctime;
+		bool cacheable;					// on the boot volume, and not changed in the current second
+	};
+
+	struct Verdict {
+		Verdict(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const Identity &file, SecCSFlags flags)
+			: digest((const char *)digest, length), hashType(hashType), file(file), flags(flags) { }
+		std::string digest;
+		CodeDirectory::HashAlgorithm hashType;
+		Identity file;
+		SecCSFlags flags;
+	};
+
+	// Verdicts collected during one validation (from any thread), stored in one transaction.
+	class Batch {
+	public:
+		void add(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const Identity &file, SecCSFlags flags);
+		void commit();
+
+	private:
+		Mutex mLock;
+		std::vector<Verdict> mVerdicts;
+	};
+
+	bool lookup(const void *digest, size_t length, CodeDirectory::HashAlgorithm hashType, const Identity &file, SecCSFlags flags);
+	void store(const std::vector<Verdict> &verdicts);
+
+public:
+	static const char defaultPath[];
+	static const unsigned maxAgeDays = 30;	// entries older than this are dropped
+	static const unsigned maxEntries = 100000; // and only this many of the newest are kept
+
+private:
+	void prune();
+
+	bool mTrusted;						// safe to believe what's in the database
+	bool mPruned;						// prune() has run in this process
+	bool mHasSchema;					// the verdict table exists
+	sqlite3_stmt *mLookup;				// prepared lookup query (NULL if unusable)
+	Mutex mLookupLock;					// serializes use of mLookup
+};
+
+extern ModuleNexus<ValidationCache> validationCache;
+
+
 } // end namespace CodeSigning
 } // end namespace Security
 
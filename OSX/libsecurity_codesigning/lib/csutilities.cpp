@@ -33,6 +33,7 @@
 #include <security_utilities/debugging.h>
 #include <security_utilities/errors.h>
 #include <sys/utsname.h>
+#include <Block.h>
 
 namespace Security {
 namespace CodeSigning {
@@ -214,6 +215,7 @@ void MessageTrace::send(const char *format, ...)
 
 // Resource limited async workers for doing work on nested bundles
 LimitedAsync::LimitedAsync(bool async)
+	: mActive(0), mGroup(NULL)
 {
 	// validate multiple resources concurrently if bundle resides on solid-state media
 
@@ -226,34 +228,92 @@ LimitedAsync::LimitedAsync(bool async)
 		async_workers = ncpu - 1; // one less because this thread also validates
 
 	mResourceSemaphore = new Dispatch::Semaphore(async_workers);
+	mBacklog = 8 * async_workers;
 }
 
 LimitedAsync::LimitedAsync(LimitedAsync &limitedAsync)
+	: mBacklog(limitedAsync.mBacklog), mActive(0), mGroup(NULL)
 {
 	mResourceSemaphore = new Dispatch::Semaphore(*limitedAsync.mResourceSemaphore);
 }
 
 LimitedAsync::~LimitedAsync()
 {
+	assert(mPending.empty());
 	delete mResourceSemaphore;
 }
 
+//
+// Run a block on a worker if one is free. If not, and workers of ours are already
+// running for this group, leave it in a bounded backlog for them to pick up, so the
+// caller (typically a directory walk) can keep going. Only when the backlog is full
+// too does the caller do the work itself. This never blocks, so nested users sharing
+// our semaphore cannot deadlock against each other.
+//
 bool LimitedAsync::perform(Dispatch::Group &groupRef, void (^block)()) {
 	__block Dispatch::SemaphoreWait wait(*mResourceSemaphore, DISPATCH_TIME_NOW);
 
 	if (wait.acquired()) {
 		dispatch_queue_t defaultQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+		Dispatch::Group *group = &groupRef;
 
 		groupRef.enqueue(defaultQueue, ^{
 			// Hold the semaphore count until the worker is done validating.
 			Dispatch::SemaphoreWait innerWait(wait);
-			block();
+			bool draining = false;
+			{
+				StLock<Mutex> _(mLock);
+				if (mActive == 0)
+					mGroup = group;
+				if (mGroup == group) {
+					mActive++;
+					draining = true;
+				}
+			}
+			if (!draining) {
+				block();
+				return;
+			}
+			// work through the backlog; after a failure, just empty it and report the first error
+			std::exception_ptr failure;
+			for (dispatch_block_t work = block; work; work = nextPending()) {
+				if (!failure) {
+					try {
+						work();
+					} catch (...) {
+						failure = std::current_exception();
+					}
+				}
+				if (work != block)
+					Block_release(work);
+			}
+			if (failure)
+				std::rethrow_exception(failure);
 		});
 		return true;
-	} else {
-		block();
-		return false;
 	}
+
+	{
+		StLock<Mutex> _(mLock);
+		if (mActive > 0 && mGroup == &groupRef && mPending.size() < mBacklog) {
+			mPending.push_back(Block_copy(block));
+			return true;
+		}
+	}
+	block();
+	return false;
+}
+
+dispatch_block_t LimitedAsync::nextPending()
+{
+	StLock<Mutex> _(mLock);
+	if (mPending.empty()) {
+		mActive--;
+		return NULL;
+	}
+	dispatch_block_t work = mPending.front();
+	mPending.pop_front();
+	return work;
 }
 
 } // end namespace CodeSigning
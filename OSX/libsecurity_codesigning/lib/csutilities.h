@@ -38,6 +38,9 @@
 #include <copyfile.h>
 #include <asl.h>
 #include <cstdarg>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 namespace Security {
 namespace CodeSigning {
@@ -57,13 +60,33 @@ void hashOfCertificate(const void *certData, size_t certLength, SHA1::Digest dig
 void hashOfCertificate(SecCertificateRef cert, SHA1::Digest digest);
 bool verifyHash(SecCertificateRef cert, const Hashing::Byte *digest);
 
-	
+
+//
+// Read (a section of) a file and pass it to a block, chunk by chunk.
+// Whole files are read in large chunks (F_NOCACHE readers in particular pay
+// per call), but never into a buffer larger than the file or limit can fill.
+//
+static const size_t scanFileDataChunk = 256 * 1024;
+
 inline size_t scanFileData(UnixPlusPlus::FileDesc fd, size_t limit, void (^handle)(const void *buffer, size_t size))
 {
-	unsigned char buffer[4096];
+	unsigned char small[4096];
+	std::vector<unsigned char> large;
+	unsigned char *buffer = small;
+	size_t bufferSize = sizeof(small);
+	if (limit == 0 || limit > bufferSize) {
+		size_t want = std::min(fd.fileSize(), scanFileDataChunk);
+		if (limit && limit < want)
+			want = limit;
+		if (want > bufferSize) {
+			large.resize(want);
+			buffer = &large[0];
+			bufferSize = want;
+		}
+	}
 	size_t total = 0;
 	for (;;) {
-		size_t size = sizeof(buffer);
+		size_t size = bufferSize;
 		if (limit && limit < size)
 			size = limit;
 		size_t got = fd.read(buffer, size);
@@ -199,7 +222,16 @@ public:
 	bool perform(Dispatch::Group &groupRef, void (^block)());
 
 private:
+	dispatch_block_t nextPending();
+
 	Dispatch::Semaphore *mResourceSemaphore;
+
+	// work queued for our running workers instead of stalling the caller
+	Mutex mLock;
+	std::deque<dispatch_block_t> mPending;	// (copied) blocks, all for mGroup
+	size_t mBacklog;				// maximum size of mPending
+	unsigned mActive;				// workers draining mPending
+	Dispatch::Group *mGroup;		// group those workers belong to
 };
 
 
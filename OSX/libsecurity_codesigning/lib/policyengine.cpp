@@ -39,6 +39,9 @@
 #include "codedirectory.h"
 #include "csutilities.h"
 #include "StaticCode.h"
+#include "Requirements.h"
+#include "reqreader.h"
+#include <security_utilities/threading.h>
 
 #include <CoreServices/CoreServicesPriv.h>
 #include "SecCodePriv.h"
@@ -151,17 +154,109 @@ static std::string createWhitelistScreen(SecStaticCodeRef code)
 }
 
 
+//
+// Compiled authority rules.
+// Parsing requirement text is by far the most expensive part of scanning the authority
+// table, so compiled requirements are kept for the life of the process, keyed by rule id.
+// An entry is reused only while the rule's mtime and text are unchanged.
+// Each entry also records the identifier and cdhash the rule insists on (if any, as
+// top-level "and" terms), so rules that can't match the code at hand are skipped cheaply.
+//
+struct CompiledRule {
+	double mtime;
+	std::string text;
+	CFCopyRef<SecRequirementRef> requirement;
+	std::string identifier;				// required identifier (empty if none)
+	CFCopyRef<CFDataRef> cdhash;		// required cdhash (NULL if none)
+
+	void compile(const char *reqString);
+	bool mayMatch(const std::string &codeIdentifier, CFDataRef codeHash) const;
+};
+
+void CompiledRule::compile(const char *reqString)
+{
+	CFRef<SecRequirementRef> req;
+	MacOSError::check(SecRequirementCreateWithString(CFTempString(reqString), kSecCSDefaultFlags, &req.aref()));
+	requirement = req.get();
+	text = reqString;
+	identifier.clear();
+	cdhash = NULL;
+	
+	// collect identifier and cdhash terms from the top-level chain of ands, stopping at anything else
+	try {
+		Requirement::Reader reader(SecRequirement::required(req)->requirement());
+		for (;;) {
+			ExprOp op = ExprOp(reader.get<uint32_t>());
+			if (op == opAnd)
+				continue;
+			else if (op == opIdent)
+				identifier = reader.getString();
+			else if (op == opCDHash)
+				cdhash.take(reader.getHash());
+			else
+				break;
+		}
+	} catch (...) {
+		// ran off the end (or something odd) - whatever we collected so far is still valid
+	}
+}
+
+bool CompiledRule::mayMatch(const std::string &codeIdentifier, CFDataRef codeHash) const
+{
+	if (!identifier.empty() && identifier != codeIdentifier)
+		return false;
+	if (cdhash && !(codeHash && CFEqual(cdhash, codeHash)))
+		return false;
+	return true;
+}
+
+class CompiledRuleCache {
+public:
+	CompiledRule rule(SQLite3::int64 id, double mtime, const char *reqString);
+
+private:
+	Mutex mLock;
+	std::map<SQLite3::int64, CompiledRule> mRules;
+};
+
+CompiledRule CompiledRuleCache::rule(SQLite3::int64 id, double mtime, const char *reqString)
+{
+	{
+		StLock<Mutex> _(mLock);
+		std::map<SQLite3::int64, CompiledRule>::const_iterator it = mRules.find(id);
+		if (it != mRules.end() && it->second.mtime == mtime && it->second.text == reqString)
+			return it->second;
+	}
+	
+	// compile outside the lock; racing compiles of the same rule produce the same result
+	CompiledRule compiled;
+	compiled.mtime = mtime;
+	compiled.compile(reqString);
+	StLock<Mutex> _(mLock);
+	mRules[id] = compiled;
+	return compiled;
+}
+
+static ModuleNexus<CompiledRuleCache> compiledRules;
+
+
 void PolicyEngine::evaluateCodeItem(SecStaticCodeRef code, CFURLRef path, AuthorityType type, SecAssessmentFlags flags, bool nested, CFMutableDictionaryRef result)
 {
 	
 	SQLite::Statement query(*this,
-		"SELECT allow, requirement, id, label, expires, flags, disabled, filter_unsigned, remarks FROM scan_authority"
+		"SELECT allow, requirement, id, label, expires, flags, disabled, filter_unsigned, remarks, mtime FROM scan_authority"
 		" WHERE type = :type"
 		" ORDER BY priority DESC;");
 	query.bind(":type").integer(type);
 	
 	SQLite3::int64 latentID = 0;		// first (highest priority) disabled matching ID
 	std::string latentLabel;			// ... and associated label, if any
+	
+	// The code is validated once (when the first rule is reached), and each rule after that
+	// only runs its requirement against the code (and any other architectures) validated.
+	SecStaticCode::ValidatedCodes validated;
+	std::string codeIdentifier;
+	CFDataRef codeHash = NULL;			// owned by validated.front()
 
 	while (query.nextRow()) {
 		bool allow = int(query[0]);
@@ -173,20 +268,31 @@ void PolicyEngine::evaluateCodeItem(SecStaticCodeRef code, CFURLRef path, Author
 		SQLite3::int64 disabled = query[6];
 //		const char *filter = query[7];
 //		const char *remarks = query[8];
+		double mtime = query[9];
 		
-		CFRef<SecRequirementRef> requirement;
-		MacOSError::check(SecRequirementCreateWithString(CFTempString(reqString), kSecCSDefaultFlags, &requirement.aref()));
-		switch (OSStatus rc = SecStaticCodeCheckValidity(code, kSecCSBasicValidateOnly | kSecCSCheckGatekeeperArchitectures, requirement)) {
-		case errSecSuccess:
-			break;						// rule match; process below
-		case errSecCSReqFailed:
-			continue;					// rule does not apply
-		case errSecCSVetoed:
-			return;						// nested code has failed to pass
-		default:
-			MacOSError::throwMe(rc);	// general error; pass to caller
+		CompiledRule rule = compiledRules().rule(id, mtime, reqString);
+		if (validated.empty()) {
+			try {
+				SecStaticCode *staticCode = SecStaticCode::requiredStatic(code);
+				staticCode->staticValidate(kSecCSBasicValidateOnly | kSecCSCheckGatekeeperArchitectures, NULL, &validated);
+				codeIdentifier = staticCode->identifier();
+				codeHash = staticCode->cdHash();
+			} catch (const CommonError &err) {
+				if (err.osStatus() == errSecCSVetoed)
+					return;				// nested code has failed to pass
+				throw;					// general error; pass to caller
+			}
 		}
 		
+		if (!rule.mayMatch(codeIdentifier, codeHash))
+			continue;					// rule can not apply
+		const Requirement *req = SecRequirement::required(rule.requirement)->requirement();
+		bool satisfied = true;
+		for (SecStaticCode::ValidatedCodes::const_iterator it = validated.begin(); satisfied && it != validated.end(); ++it)
+			satisfied = (*it)->satisfiesRequirement(req, errSecCSReqFailed);
+		if (!satisfied)
+			continue;					// rule does not apply
+		
 		// if this rule is disabled, skip it but record the first matching one for posterity
 		if (disabled && latentID == 0) {
 			latentID = id;
@@ -31,6 +31,7 @@
 #include <Security/CSCommon.h>
 #include <security_utilities/unix++.h>
 #include <security_utilities/cfmunge.h>
+#include <algorithm>
 
 // These are pretty nasty, but are a quick safe fix
 // to pass information down to the gatekeeper collection tool
@@ -241,25 +242,45 @@ bool ResourceBuilder::includes(string path) const
 }
 
 
+//
+// Keep the rules in the order findRule wants to try them: all exclusions first
+// (the first matching one wins), then everything else by descending weight.
+// The sort is stable, so ties still go to the rule listed first in mRules.
+//
+static bool matchesBefore(const ResourceBuilder::Rule *a, const ResourceBuilder::Rule *b)
+{
+	bool aExcl = a->flags & ResourceBuilder::exclusion;
+	bool bExcl = b->flags & ResourceBuilder::exclusion;
+	if (aExcl != bExcl)
+		return aExcl;
+	return !aExcl && a->weight > b->weight;
+}
+
+void ResourceBuilder::reorder()
+{
+	mMatchOrder = mRules;
+	std::stable_sort(mMatchOrder.begin(), mMatchOrder.end(), matchesBefore);
+}
+
+
 //
 // Find the best-matching resource rule for an alleged resource file.
 // Returns NULL if no rule matches, or an exclusion rule applies.
+// Since mMatchOrder is sorted by precedence, the first match is the answer.
 //
 ResourceBuilder::Rule *ResourceBuilder::findRule(string path) const
 {
 	Rule *bestRule = NULL;
 	secinfo("rscan", "test %s", path.c_str());
-	for (Rules::const_iterator it = mRules.begin(); it != mRules.end(); ++it) {
+	for (Rules::const_iterator it = mMatchOrder.begin(); it != mMatchOrder.end(); ++it) {
 		Rule *rule = *it;
 		secinfo("rscan", "try %s", rule->source.c_str());
 		if (rule->match(path.c_str())) {
 			secinfo("rscan", "match");
-			if (rule->flags & exclusion) {
+			if (rule->flags & exclusion)
 				secinfo("rscan", "excluded");
-				return rule;
-			}
-			if (!bestRule || rule->weight > bestRule->weight)
-				bestRule = rule;
+			bestRule = rule;
+			break;
 		}
 	}
 	secinfo("rscan", "choosing %s (%d,0x%x)",
@@ -328,6 +349,7 @@ ResourceBuilder::Rule::Rule(const std::string &pattern, unsigned w, uint32_t f)
 {
 	if (::regcomp(this, pattern.c_str(), REG_EXTENDED | REG_NOSUB))	//@@@ REG_ICASE?
 		MacOSError::throwMe(errSecCSResourceRulesInvalid);
+	analyze(pattern);
 	secinfo("csresource", "%p rule %s added (weight %d, flags 0x%x)",
 		this, pattern.c_str(), w, f);
 }
@@ -339,6 +361,17 @@ ResourceBuilder::Rule::~Rule()
 
 bool ResourceBuilder::Rule::match(const char *s) const
 {
+	if (mLiteral)
+		return mPrefix == s;
+	if (!mPrefix.empty() && strncmp(s, mPrefix.c_str(), mPrefix.size()) != 0)
+		return false;
+	if (!mSuffix.empty()) {
+		size_t length = strlen(s);
+		if (length < mSuffix.size() || memcmp(s + length - mSuffix.size(), mSuffix.data(), mSuffix.size()) != 0)
+			return false;
+	}
+	if (!mInfix.empty() && strstr(s, mInfix.c_str()) == NULL)
+		return false;
 	switch (::regexec(this, s, 0, NULL, 0)) {
 	case 0:
 		return true;
@@ -350,6 +383,143 @@ bool ResourceBuilder::Rule::match(const char *s) const
 }
 
 
+//
+// Skip a bracket expression. Takes a pointer just past the opening '['
+// and returns a pointer just past the closing ']', or NULL if malformed.
+//
+static const char *skipBracket(const char *p, const char *end)
+{
+	if (p < end && *p == '^')
+		p++;
+	if (p < end && *p == ']')	// leading ']' is literal
+		p++;
+	while (p < end) {
+		if (*p == ']')
+			return p + 1;
+		if (*p == '[' && p + 1 < end && strchr(":.=", p[1])) {	// [:class:], [.coll.], [=equiv=]
+			char kind = p[1];
+			for (p += 2; p + 1 < end && !(p[0] == kind && p[1] == ']'); p++) ;
+			if (p + 1 >= end)
+				return NULL;
+			p += 2;
+		} else
+			p++;
+	}
+	return NULL;
+}
+
+//
+// Derive literal hints from the rule's pattern, so that match() can reject most
+// paths with a string compare instead of running the regex engine.
+// Only top-level concatenations are analyzed; a pattern with top-level alternation,
+// or anything else we don't fully understand, simply gets no hints. The hints are
+// necessary conditions only - regexec still has the final word.
+//
+void ResourceBuilder::Rule::analyze(const std::string &pattern)
+{
+	mLiteral = false;
+
+	// tokenize into top-level atoms; a NUL stands for anything that isn't a single literal character
+	const char *p = pattern.c_str(), *end = p + strlen(p);	// what regcomp saw
+	bool anchoredStart = false, anchoredEnd = false;
+	if (p < end && *p == '^') {
+		anchoredStart = true;
+		p++;
+	}
+	string atoms;
+	unsigned depth = 0;
+	while (p < end) {
+		char c = *p++;
+		switch (c) {
+		case '\\':
+			if (p == end)
+				return;
+			c = *p++;
+			if (depth == 0)
+				atoms.push_back(strchr("\\[]{}().+*?^$|", c) ? c : '\0');
+			break;
+		case '[':
+			if (!(p = skipBracket(p, end)))
+				return;
+			if (depth == 0)
+				atoms.push_back('\0');
+			break;
+		case '(':
+			if (depth++ == 0)
+				atoms.push_back('\0');		// the whole group
+			break;
+		case ')':
+			if (depth-- == 0)
+				return;
+			break;
+		case '|':
+			if (depth == 0)
+				return;				// top-level alternation; no common literals
+			break;
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			if (c == '{') {			// interval; skip its bounds
+				if (!(p = strchr(p, '}')))
+					return;
+				p++;
+			}
+			if (depth == 0) {
+				if (atoms.empty())
+					return;
+				atoms[atoms.size() - 1] = '\0';	// quantified, so no longer a fixed character
+			}
+			break;
+		case '$':
+			if (depth == 0) {
+				if (p == end)
+					anchoredEnd = true;
+				else
+					atoms.push_back('\0');
+			}
+			break;
+		case '^':
+		case '.':
+			if (depth == 0)
+				atoms.push_back('\0');
+			break;
+		default:
+			if (depth == 0)
+				atoms.push_back(c);
+			break;
+		}
+	}
+	if (depth != 0)
+		return;
+
+	// split into runs of literal characters
+	string::size_type first = atoms.find('\0');
+	if (first == string::npos && anchoredStart && anchoredEnd) {
+		mPrefix = atoms;
+		mLiteral = true;
+		return;
+	}
+	string::size_type last = atoms.rfind('\0');
+	if (anchoredStart)
+		mPrefix = atoms.substr(0, first);
+	if (anchoredEnd)
+		mSuffix = (last == string::npos) ? atoms : atoms.substr(last + 1);
+
+	// remember the longest run not already covered by prefix or suffix
+	string::size_type start = anchoredStart ? first : 0;
+	string::size_type limit = anchoredEnd ? ((last == string::npos) ? 0 : last) : atoms.size();
+	while (start != string::npos && start < limit) {
+		string::size_type stop = atoms.find('\0', start);
+		if (stop == string::npos || stop > limit)
+			stop = limit;
+		if (stop - start > mInfix.size())
+			mInfix = atoms.substr(start, stop - start);
+		start = (stop < limit) ? stop + 1 : string::npos;
+	}
+}
+
+
 std::string ResourceBuilder::escapeRE(const std::string &s)
 {
 	string r;
@@ -76,9 +76,18 @@ public:
 		const Weight weight;
 		const uint32_t flags;
 		std::string source;
+
+	private:
+		void analyze(const std::string &pattern);
+
+		// literal hints screening paths before regexec (empty if none)
+		std::string mPrefix;			// anchored literal prefix
+		std::string mSuffix;			// anchored literal suffix
+		std::string mInfix;				// literal run required somewhere
+		bool mLiteral;					// pattern is exactly ^mPrefix$
 	};
-	void addRule(Rule *rule) { mRules.push_back(rule); }
-	void addExclusion(const std::string &pattern, uint32_t flags = 0) { mRules.insert(mRules.begin(), new Rule(pattern, 0, exclusion | flags)); }
+	void addRule(Rule *rule) { mRules.push_back(rule); reorder(); }
+	void addExclusion(const std::string &pattern, uint32_t flags = 0) { mRules.insert(mRules.begin(), new Rule(pattern, 0, exclusion | flags)); reorder(); }
 
 	static std::string escapeRE(const std::string &s);
 	
@@ -103,6 +112,8 @@ private:
 	CFCopyRef<CFDictionaryRef> mRawRules;
 	typedef std::vector<Rule *> Rules;
 	Rules mRules;
+	Rules mMatchOrder;		// exclusions, then by descending weight
+	void reorder();
 	bool mCheckUnreadable;
 	bool mCheckUnknownType;
 };
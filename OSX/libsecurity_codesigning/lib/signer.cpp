@@ -309,11 +309,11 @@ void SecCodeSigner::Signer::buildResources(std::string root, std::string relBase
 	assert(rules);
 
 	if (this->state.mLimitedAsync == NULL) {
+		/* rdar://problem/20299541: The paths for signing (nested) code are not ready for
+		 * parallelization yet, so nested code is signed on the scanning thread below.
+		 * Plain resources are only read and hashed, and can be sealed by async workers. */
 		this->state.mLimitedAsync =
-			/* rdar://problem/20299541: Async workers (i.e. parallelization) are currently
-			 * turned off, because the paths for signing code are not ready for it yet. */
-			// new LimitedAsync(rep->fd().mediumType() == kIOPropertyMediumTypeSolidStateKey);
-			new LimitedAsync(false);
+			new LimitedAsync(rep->fd().mediumType() == kIOPropertyMediumTypeSolidStateKey);
 	}
 
 	CFDictionaryRef files2 = NULL;
@@ -341,7 +341,7 @@ void SecCodeSigner::Signer::buildResources(std::string root, std::string relBase
 			bool isSymlink = (ent->fts_info == FTS_SL);
 			const std::string path(ent->fts_path);
 			const std::string accpath(ent->fts_accpath);
-			this->state.mLimitedAsync->perform(groupRef, ^{
+			void (^sealOne)() = ^{
 				CFRef<CFMutableDictionaryRef> seal;
 				if (ruleFlags & ResourceBuilder::nested) {
 					seal.take(signNested(path, relpath));
@@ -364,7 +364,11 @@ void SecCodeSigner::Signer::buildResources(std::string root, std::string relBase
 				else
 					CFDictionaryAddValue(filesRef, CFTempString(relpath).get(), seal.get());
 				code->reportProgress();
-			});
+			};
+			if (ruleFlags & ResourceBuilder::nested)
+				sealOne();
+			else
+				this->state.mLimitedAsync->perform(groupRef, sealOne);
 		});
 		group.wait();
 		CFDictionaryAddValue(result, CFSTR("rules2"), resourceBuilder.rules());
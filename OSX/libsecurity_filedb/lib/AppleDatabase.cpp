@@ -35,6 +35,7 @@
 #include <Security/cssmapplePriv.h>
 #include <syslog.h>
 #include <copyfile.h>
+#include <CommonCrypto/CommonDigest.h>
 
 static const char *kAppleDatabaseChanged = "com.apple.AppleDatabaseChanged";
 
@@ -44,6 +45,15 @@ static const char *kAppleDatabaseChanged = "com.apple.AppleDatabaseChanged";
    that any db on the system has changed. */
 static const CFTimeInterval kForceReReadTime = 15.0;
 
+/* In journal mode the journal is folded back into the database by the next
+   commit once it grows past this many bytes or a quarter of the size of the
+   database, whichever is larger. */
+static const uint32 kJournalFoldSize = 256 * 1024;
+
+/* How many times a reader reopens the database file and its journal when a
+   full commit replaced the file between the two opens. */
+static const int kJournalOpenAttempts = 4;
+
 /* Token on which we receive notifications and the pthread_once_t protecting
    it's initialization. */
 pthread_once_t gCommonInitMutex = PTHREAD_ONCE_INIT;
@@ -560,7 +570,7 @@ ModifiedTable::writeIndexSection(WriteSection &tableSection, uint32 offset)
 }
 
 uint32
-ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffset)
+ModifiedTable::writeTable(AtomicWriter &inOutputFile, uint32 inSectionOffset)
 {
 	if (mTable && !mIsModified) {
 		// the table has not been modified, so we can just dump the old table
@@ -569,7 +579,7 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 		const ReadSection &tableSection = mTable->getTableSection();
 		uint32 tableSize = tableSection.at(Table::OffsetSize);
 
-		inAtomicTempFile.write(AtomicFile::FromStart, inSectionOffset,
+		inOutputFile.write(AtomicFile::FromStart, inSectionOffset,
 			tableSection.range(Range(0, tableSize)), tableSize);
 
 		return inSectionOffset + tableSize;
@@ -629,7 +639,7 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 				// to but not including the current one to the new file.
 				if (aBlockSize > 0)
 				{
-					inAtomicTempFile.write(AtomicFile::FromStart, anOffset,
+					inOutputFile.write(AtomicFile::FromStart, anOffset,
 									   aRecordsSection.range(Range(aBlockStart,
 																   aBlockSize)),
 									   aBlockSize);
@@ -646,7 +656,7 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 		// Copy all records that have not yet been copied to the new file.
 		if (aBlockSize > 0)
 		{
-			inAtomicTempFile.write(AtomicFile::FromStart, anOffset,
+			inOutputFile.write(AtomicFile::FromStart, anOffset,
 							   aRecordsSection.range(Range(aBlockStart,
 														   aBlockSize)),
 							   aBlockSize);
@@ -666,7 +676,7 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 		// Put offset relative to start of this table in recordNumber array.
 		aTableSection.put(Table::OffsetRecordNumbers + AtomSize * aRecordNumber,
 						  anOffset - inSectionOffset);
-		inAtomicTempFile.write(AtomicFile::FromStart, anOffset,
+		inOutputFile.write(AtomicFile::FromStart, anOffset,
 						   aRecord.address(), aRecord.size());
 		anOffset += aRecord.size();
 		aRecordsCount++;
@@ -704,7 +714,7 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 	{
 		uint32 indexOffset = anOffset;
 		anOffset = writeIndexSection(aTableSection, anOffset);
-		inAtomicTempFile.write(AtomicFile::FromStart, inSectionOffset + indexOffset,
+		inOutputFile.write(AtomicFile::FromStart, inSectionOffset + indexOffset,
 			aTableSection.address() + indexOffset, anOffset - indexOffset);
 	}
 
@@ -713,12 +723,89 @@ ModifiedTable::writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffs
 	aTableSection.put(Table::OffsetRecordsCount, aRecordsCount);
 
 	// Write out aTableSection header.
-	inAtomicTempFile.write(AtomicFile::FromStart, inSectionOffset,
+	inOutputFile.write(AtomicFile::FromStart, inSectionOffset,
 					   aTableSection.address(), aTableSection.size());
 
     return anOffset + inSectionOffset;
 }
 
+uint32
+ModifiedTable::writeJournal(WriteSection &ioSegment, uint32 inOffset) const
+{
+	inOffset = ioSegment.put(inOffset, getMetaRecord().dataRecordType());
+
+	// Records that were deleted or modified, by record number.
+	inOffset = ioSegment.put(inOffset, (uint32)mDeletedSet.size());
+	DeletedSet::const_iterator aDeletedIt = mDeletedSet.begin();
+	for (; aDeletedIt != mDeletedSet.end(); aDeletedIt++)
+		inOffset = ioSegment.put(inOffset, *aDeletedIt);
+
+	// Records that were inserted or modified, packed as they will be in the table.
+	inOffset = ioSegment.put(inOffset, (uint32)mInsertedMap.size());
+	InsertedMap::const_iterator anInsertedIt = mInsertedMap.begin();
+	for (; anInsertedIt != mInsertedMap.end(); anInsertedIt++)
+	{
+		const WriteSection &aRecord = *anInsertedIt->second;
+		inOffset = ioSegment.put(inOffset, aRecord.size(), aRecord.address());
+	}
+
+	return inOffset;
+}
+
+uint32
+ModifiedTable::replayJournal(const ReadSection &inSegment, uint32 inOffset)
+{
+	modifyTable();
+
+	uint32 aDeletedCount = inSegment[inOffset];
+	inOffset += AtomSize;
+	if (aDeletedCount > (inSegment.size() - inOffset) / AtomSize)
+		CssmError::throwMe(CSSMERR_DL_DATABASE_CORRUPT);
+
+	for (uint32 anIndex = 0; anIndex < aDeletedCount; anIndex++, inOffset += AtomSize)
+	{
+		uint32 aRecordNumber = inSegment[inOffset];
+
+		MutableIndexMap::iterator it;
+		for (it = mIndexMap.begin(); it != mIndexMap.end(); it++)
+			it->second->removeRecord(aRecordNumber);
+
+		// A record inserted by an earlier segment only exists in mInsertedMap.
+		InsertedMap::iterator anIt = mInsertedMap.find(aRecordNumber);
+		if (anIt == mInsertedMap.end())
+			mDeletedSet.insert(aRecordNumber);
+		else
+		{
+			delete anIt->second;
+			mInsertedMap.erase(anIt);
+		}
+	}
+
+	uint32 anInsertedCount = inSegment[inOffset];
+	inOffset += AtomSize;
+	for (uint32 anIndex = 0; anIndex < anInsertedCount; anIndex++)
+	{
+		const ReadSection aRecordSection = MetaRecord::readSection(inSegment, inOffset);
+		uint32 aRecordSize = aRecordSection.size();
+		uint32 aRecordNumber = MetaRecord::unpackRecordNumber(aRecordSection);
+
+		auto_ptr<WriteSection> aWriteSection(new WriteSection(Allocator::standard(), aRecordSize));
+		aWriteSection->size(aWriteSection->put(0, aRecordSize, aRecordSection.range(Range(0, aRecordSize))));
+
+		MutableIndexMap::iterator it;
+		for (it = mIndexMap.begin(); it != mIndexMap.end(); it++)
+			it->second->insertRecord(aRecordNumber, *(aWriteSection.get()));
+
+		if (!mInsertedMap.insert(InsertedMap::value_type(aRecordNumber, aWriteSection.get())).second)
+			CssmError::throwMe(CSSMERR_DL_DATABASE_CORRUPT);
+		aWriteSection.release();
+
+		inOffset = ReadSection::align(inOffset + aRecordSize);
+	}
+
+	return inOffset;
+}
+
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-const-variable"
@@ -863,11 +950,47 @@ static const CSSM_DB_ATTRIBUTE_INFO AttrSchemaParsingModule[] =
 #undef ATTRIBUTE
 #pragma clang diagnostic pop
 
+//
+// Journal helpers
+//
+
+// Checksum stored in the last atom of every journal segment.
+static uint32
+journalChecksum(const uint8 *inData, uint32 inLength)
+{
+	uint8 aDigest[CC_SHA1_DIGEST_LENGTH];
+	CC_SHA1(inData, inLength, aDigest);
+	return ReadSection(aDigest, sizeof(aDigest)).at(0);
+}
+
+// An AtomicWriter that builds the database in memory, used to apply a journal.
+class WriteSectionWriter : public AtomicWriter
+{
+public:
+	WriteSectionWriter(WriteSection &inSection) : mSection(inSection) {}
+
+	using AtomicWriter::write;
+	virtual void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint8 *inData, size_t inLength)
+	{
+		uint32 anOffset = inOffsetType == AtomicFile::FromEnd ? mSection.size() : (uint32)inOffset;
+		uint32 anEnd = CheckUInt32Add(anOffset, (uint32)inLength);
+		mSection.put(anOffset, (uint32)inLength, inData);
+		if (anEnd > mSection.size())
+			mSection.size(anEnd);
+	}
+
+private:
+	WriteSection &mSection;
+};
+
+
 //
 // DbVersion
 //
-DbVersion::DbVersion(const AppleDatabase &db, const RefPointer <AtomicBufferedFile> &inAtomicBufferedFile) :
+DbVersion::DbVersion(const AppleDatabase &db, const RefPointer <AtomicBufferedFile> &inAtomicBufferedFile,
+					 const RefPointer <AtomicBufferedFile> &inJournalFile) :
 	mDatabase(reinterpret_cast<const uint8 *>(NULL), 0),
+	mJournalLength(0),
 	mDb(db),
 	mBufferedFile(inAtomicBufferedFile)
 {
@@ -877,6 +1000,14 @@ DbVersion::DbVersion(const AppleDatabase &db, const RefPointer <AtomicBufferedFi
 	mBufferedFile->close();
 	mDatabase = ReadSection(ptr, (size_t)bytesRead);
 	open();
+
+	if (inJournalFile)
+	{
+		aLength = inJournalFile->length();
+		ptr = inJournalFile->read(0, aLength, bytesRead);
+		inJournalFile->close();
+		replayJournal(ReadSection(ptr, (size_t)bytesRead));
+	}
 }
 
 DbVersion::~DbVersion()
@@ -1106,6 +1237,92 @@ DbVersion::open()
 	}
 }
 
+uint32
+DbVersion::journalVersion(const ReadSection &inJournal, uint32 inBaseVersionId, uint32 &outValidLength)
+{
+	// Follow the chain of segments starting at inBaseVersionId.  Anything after
+	// the first segment that is torn, corrupt or based on another version (a
+	// journal left behind by a full commit) is ignored.
+	uint32 aVersionId = inBaseVersionId;
+	uint32 anOffset = 0;
+	while (inJournal.size() - anOffset >= JournalOffsetTables + AtomSize)
+	{
+		const ReadSection aSegment = inJournal.subsection(anOffset);
+		uint32 aSize = aSegment[JournalOffsetSize];
+		if (aSegment[JournalOffsetMagic] != JournalMagic
+			|| aSize < JournalOffsetTables + AtomSize || aSize > aSegment.size() || aSize % AtomSize
+			|| aSegment[JournalOffsetBaseVersion] != aVersionId
+			|| aSegment[aSize - AtomSize] != journalChecksum(aSegment.range(Range(0, aSize - AtomSize)), aSize - AtomSize))
+			break;
+
+		aVersionId = aSegment[JournalOffsetVersion];
+		anOffset += aSize;
+	}
+
+	outValidLength = anOffset;
+	return aVersionId;
+}
+
+void
+DbVersion::replayJournal(const ReadSection &inJournal)
+{
+	uint32 aVersionId = journalVersion(inJournal, mVersionId, mJournalLength);
+	if (mJournalLength == 0)
+		return;
+
+	// Apply every segment to the tables we just read and write the result out as
+	// if it had been committed in full.
+	ModifiedTableMap aModifiedTableMap;
+	auto_ptr<WriteSection> aDatabase(new WriteSection(Allocator::standard(), mDatabase.size() + mJournalLength));
+	try
+	{
+		TableMap::const_iterator aTableIt = mTableMap.begin();
+		for (; aTableIt != mTableMap.end(); ++aTableIt)
+		{
+			auto_ptr<ModifiedTable> aTable(new ModifiedTable(aTableIt->second));
+			aModifiedTableMap.insert(ModifiedTableMap::value_type(aTableIt->first, aTable.get()));
+			aTable.release();
+		}
+
+		for (uint32 anOffset = 0; anOffset < mJournalLength;)
+		{
+			const ReadSection aSegment = inJournal.subsection(anOffset, inJournal[anOffset + JournalOffsetSize]);
+			uint32 aTablesCount = aSegment[JournalOffsetTablesCount];
+			uint32 aTableOffset = JournalOffsetTables;
+			for (uint32 aTableNumber = 0; aTableNumber < aTablesCount; aTableNumber++)
+			{
+				// Schema changes are never journaled, so the table must already exist.
+				ModifiedTableMap::iterator anIt = aModifiedTableMap.find(aSegment[aTableOffset]);
+				if (anIt == aModifiedTableMap.end())
+					CssmError::throwMe(CSSMERR_DL_DATABASE_CORRUPT);
+				aTableOffset = anIt->second->replayJournal(aSegment, aTableOffset + AtomSize);
+			}
+
+			anOffset += aSegment.size();
+		}
+
+		WriteSectionWriter aWriter(*aDatabase);
+		DbModifier::writeDatabase(aWriter, aModifiedTableMap, aVersionId);
+	}
+	catch(...)
+	{
+		for_each_map_delete(aModifiedTableMap.begin(), aModifiedTableMap.end());
+		throw;
+	}
+
+	// The modified tables refer to the tables of the old image, so drop them first.
+	for_each_map_delete(aModifiedTableMap.begin(), aModifiedTableMap.end());
+	for_each_map_delete(mTableMap.begin(), mTableMap.end());
+	mTableMap.clear();
+
+	mReplayedDatabase = aDatabase;
+	mDatabase = ReadSection(mReplayedDatabase->address(), mReplayedDatabase->size());
+	mBufferedFile = NULL;
+	open();
+
+	secinfo("integrity", "applied %u bytes of journal, now at version %u", mJournalLength, mVersionId);
+}
+
 const RecordId
 DbVersion::getRecord(Table::Id inTableId, const RecordId &inRecordId,
 							CSSM_DB_RECORD_ATTRIBUTE_DATA *inoutAttributes,
@@ -1375,6 +1592,8 @@ DbModifier::DbModifier(AtomicFile &inAtomicFile, const AppleDatabase &db) :
 	Metadata(),
 	mDbVersion(),
     mAtomicFile(inAtomicFile),
+	mJournalMode(false),
+	mSchemaModified(false),
 	mDb(db)
 {
 }
@@ -1408,36 +1627,80 @@ DbModifier::getDbVersion(bool force)
         mNotifyCount != *gSegment ||
         CFAbsoluteTimeGetCurrent() > mDbLastRead + kForceReReadTime)
     {
-        RefPointer <AtomicBufferedFile> atomicBufferedFile(mAtomicFile.read());
-        off_t length = atomicBufferedFile->open();
-        /* Record the number of notifications we've seen and when we last
-           opened the file.  */
-		if (gSegment != NULL)
-		{
-			mNotifyCount = *gSegment;
-		}
-
-        mDbLastRead = CFAbsoluteTimeGetCurrent();
-
-        /* If we already have a mDbVersion, let's check if we can reuse it. */
-        if (mDbVersion)
+        /* Open the journal before the database file.  A full commit renames
+           the new file into place before it removes the journal, so if there
+           is no journal the file we open next already holds every journaled
+           change.  A journal that doesn't continue the version of the file
+           we open next raced with a full commit (the file is newer than the
+           journal, and a new journal may already sit on top of it), so open
+           both again rather than read an older state than we have seen. */
+        RefPointer <AtomicBufferedFile> atomicBufferedFile;
+        RefPointer <AtomicBufferedFile> journalFile;
+        uint32 aVersionId = 0;
+        for (int attempt = 1;; attempt++)
         {
+            /* Whether or not we are in journal mode now, a journal left by
+               another client has to be applied. */
+            journalFile = mAtomicFile.readJournal();
+            try
+            {
+                journalFile->open();
+            }
+            catch (const CssmError &e)
+            {
+                if (e.osStatus() != CSSMERR_DL_DATASTORE_DOESNOT_EXIST)
+                    throw;
+                journalFile = NULL;
+            }
+
+            atomicBufferedFile = mAtomicFile.read();
+            off_t length = atomicBufferedFile->open();
             if (length < AtomSize)
-                CssmError::throwMe(CSSMERR_DL_DATABASE_CORRUPT);
+            {
+                /* Let DbVersion decide what to make of it if we don't reuse ours. */
+                if (mDbVersion)
+                    CssmError::throwMe(CSSMERR_DL_DATABASE_CORRUPT);
+                break;
+            }
 
             off_t bytesRead = 0;
             const uint8 *ptr = atomicBufferedFile->read(length - AtomSize,
                 AtomSize, bytesRead);
             ReadSection aVersionSection(ptr, (size_t)bytesRead);
-            uint32 aVersionId = aVersionSection[0];
+            aVersionId = aVersionSection[0];
 
-            /* If the version stamp hasn't changed the old mDbVersion is still
-               current. */
-            if (aVersionId == mDbVersion->getVersionId())
-                return mDbVersion;
+            if (!journalFile)
+                break;
+
+            ptr = journalFile->read(0, journalFile->length(), bytesRead);
+            ReadSection aJournal(ptr, (size_t)bytesRead);
+            uint32 aJournalLength;
+            uint32 aJournalVersionId = DbVersion::journalVersion(aJournal, aVersionId, aJournalLength);
+            if (aJournalLength || aJournal.size() < JournalOffsetTables + AtomSize
+                || attempt == kJournalOpenAttempts)
+            {
+                aVersionId = aJournalVersionId;
+                break;
+            }
+
+            secinfo("integrity", "journal doesn't continue database version %u, reopening", aVersionId);
         }
 
-	mDbVersion = new DbVersion(mDb, atomicBufferedFile);
+        /* Record the number of notifications we've seen and when we last
+           opened the file.  */
+		if (gSegment != NULL)
+		{
+			mNotifyCount = *gSegment;
+		}
+
+        mDbLastRead = CFAbsoluteTimeGetCurrent();
+
+        /* If the version stamp hasn't changed the old mDbVersion is still
+           current. */
+        if (mDbVersion && aVersionId == mDbVersion->getVersionId())
+            return mDbVersion;
+
+	mDbVersion = new DbVersion(mDb, atomicBufferedFile, journalFile);
     }
 
     return mDbVersion;
@@ -1603,6 +1866,7 @@ DbModifier::createTable(MetaRecord *inMetaRecord)
 {
 	auto_ptr<MetaRecord> aMetaRecord(inMetaRecord);
 	auto_ptr<ModifiedTable> aModifiedTable(new ModifiedTable(inMetaRecord));
+	mSchemaModified = true;
 	// Now that aModifiedTable is fully constructed it owns inMetaRecord
 	aMetaRecord.release();
 
@@ -1635,10 +1899,11 @@ DbModifier::deleteTable(Table::Id inTableId)
 
     delete it->second;
     mModifiedTableMap.erase(it);
+	mSchemaModified = true;
 }
 
 uint32
-DbModifier::writeAuthSection(uint32 inSectionOffset)
+DbModifier::writeAuthSection(AtomicWriter &inOutputFile, uint32 inSectionOffset)
 {
 	WriteSection anAuthSection;
 
@@ -1646,15 +1911,16 @@ DbModifier::writeAuthSection(uint32 inSectionOffset)
 	uint32 anOffset = anAuthSection.put(0, 0);
 	anAuthSection.size(anOffset);
 
-	mAtomicTempFile->write(AtomicFile::FromStart, inSectionOffset,
+	inOutputFile.write(AtomicFile::FromStart, inSectionOffset,
 					anAuthSection.address(), anAuthSection.size());
     return inSectionOffset + anOffset;
 }
 
 uint32
-DbModifier::writeSchemaSection(uint32 inSectionOffset)
+DbModifier::writeSchemaSection(AtomicWriter &inOutputFile, const ModifiedTableMap &inTables,
+							   uint32 inSectionOffset)
 {
-	uint32 aTableCount = (uint32) mModifiedTableMap.size();
+	uint32 aTableCount = (uint32) inTables.size();
 	WriteSection aTableSection(Allocator::standard(),
 							   OffsetTables + AtomSize * aTableCount);
 	// Set aTableSection to the correct size.
@@ -1662,24 +1928,99 @@ DbModifier::writeSchemaSection(uint32 inSectionOffset)
 	aTableSection.put(OffsetTablesCount, aTableCount);
 
 	uint32 anOffset = inSectionOffset + OffsetTables + AtomSize * aTableCount;
-	ModifiedTableMap::const_iterator anIt = mModifiedTableMap.begin();
-	ModifiedTableMap::const_iterator anEnd = mModifiedTableMap.end();
+	ModifiedTableMap::const_iterator anIt = inTables.begin();
+	ModifiedTableMap::const_iterator anEnd = inTables.end();
 	for (uint32 aTableNumber = 0; anIt != anEnd; anIt++, aTableNumber++)
 	{
 		// Put the offset to the current table relative to the start of
 		// this section into the tables array
 		aTableSection.put(OffsetTables + AtomSize * aTableNumber,
 						  anOffset - inSectionOffset);
-		anOffset = anIt->second->writeTable(*mAtomicTempFile, anOffset);
+		anOffset = anIt->second->writeTable(inOutputFile, anOffset);
 	}
 
 	aTableSection.put(OffsetSchemaSize, anOffset - inSectionOffset);
-	mAtomicTempFile->write(AtomicFile::FromStart, inSectionOffset,
+	inOutputFile.write(AtomicFile::FromStart, inSectionOffset,
 					aTableSection.address(), aTableSection.size());
 
 	return anOffset;
 }
 
+void
+DbModifier::writeDatabase(AtomicWriter &inOutputFile, const ModifiedTableMap &inTables,
+						  uint32 inVersionId)
+{
+	WriteSection aHeaderSection(Allocator::standard(), size_t(HeaderSize));
+	// Set aHeaderSection to the correct size.
+	aHeaderSection.size(HeaderSize);
+
+    // Start writing sections after the header
+    uint32 anOffset = HeaderOffset + HeaderSize;
+
+    // Write auth section
+	aHeaderSection.put(OffsetAuthOffset, anOffset);
+    anOffset = writeAuthSection(inOutputFile, anOffset);
+    // Write schema section
+	aHeaderSection.put(OffsetSchemaOffset, anOffset);
+    anOffset = writeSchemaSection(inOutputFile, inTables, anOffset);
+
+	// Write out the file header.
+	aHeaderSection.put(OffsetMagic, HeaderMagic);
+	aHeaderSection.put(OffsetVersion, HeaderVersion);
+    inOutputFile.write(AtomicFile::FromStart, HeaderOffset,
+						   aHeaderSection.address(), aHeaderSection.size());
+
+	// Write out the versionId.
+	WriteSection aVersionSection(Allocator::standard(), size_t(AtomSize));
+	anOffset = aVersionSection.put(0, inVersionId);
+	aVersionSection.size(anOffset);
+
+    inOutputFile.write(AtomicFile::FromEnd, 0,
+						   aVersionSection.address(), aVersionSection.size());
+}
+
+// Append the changes made since modifyDatabase() to the journal.  Returns false
+// if they have to be written out as a complete new database instead.
+bool
+DbModifier::commitJournal()
+{
+	if (!mJournalMode || mSchemaModified || !mDbVersion || !mAtomicFile.isOnLocalFileSystem())
+		return false;
+
+	// Once the journal gets big enough fold it back into the database.
+	uint32 aJournalLength = mDbVersion->journalLength();
+	if (aJournalLength > max(kJournalFoldSize, mDbVersion->databaseLength() / 4))
+		return false;
+
+	WriteSection aSegment;
+	uint32 anOffset = JournalOffsetTables;
+	uint32 aTablesCount = 0;
+	ModifiedTableMap::const_iterator anIt = mModifiedTableMap.begin();
+	for (; anIt != mModifiedTableMap.end(); anIt++)
+	{
+		if (!anIt->second->isModified())
+			continue;
+
+		if (CSSM_DB_RECORDTYPE_SCHEMA_START <= anIt->first
+			&& anIt->first < CSSM_DB_RECORDTYPE_SCHEMA_END)
+			return false;
+
+		anOffset = anIt->second->writeJournal(aSegment, anOffset);
+		aTablesCount++;
+	}
+
+	aSegment.put(JournalOffsetMagic, JournalMagic);
+	aSegment.put(JournalOffsetSize, anOffset + AtomSize);
+	aSegment.put(JournalOffsetBaseVersion, mDbVersion->getVersionId());
+	aSegment.put(JournalOffsetVersion, mVersionId);
+	aSegment.put(JournalOffsetTablesCount, aTablesCount);
+	anOffset = aSegment.put(anOffset, journalChecksum(aSegment.address(), anOffset));
+	aSegment.size(anOffset);
+
+	mAtomicFile.appendJournal(aJournalLength, aSegment.address(), aSegment.size());
+	return true;
+}
+
 void
 DbModifier::commit()
 {
@@ -1689,36 +2030,19 @@ DbModifier::commit()
     {
         secnotice("integrity", "committing to %s", mAtomicFile.path().c_str());
 
-		WriteSection aHeaderSection(Allocator::standard(), size_t(HeaderSize));
-		// Set aHeaderSection to the correct size.
-		aHeaderSection.size(HeaderSize);
-
-        // Start writing sections after the header
-        uint32 anOffset = HeaderOffset + HeaderSize;
-
-        // Write auth section
-		aHeaderSection.put(OffsetAuthOffset, anOffset);
-        anOffset = writeAuthSection(anOffset);
-        // Write schema section
-		aHeaderSection.put(OffsetSchemaOffset, anOffset);
-        anOffset = writeSchemaSection(anOffset);
-
-		// Write out the file header.
-		aHeaderSection.put(OffsetMagic, HeaderMagic);
-		aHeaderSection.put(OffsetVersion, HeaderVersion);
-        mAtomicTempFile->write(AtomicFile::FromStart, HeaderOffset,
-							   aHeaderSection.address(), aHeaderSection.size());
-
-		// Write out the versionId.
-		WriteSection aVersionSection(Allocator::standard(), size_t(AtomSize));
-		anOffset = aVersionSection.put(0, mVersionId);
-		aVersionSection.size(anOffset);
-
-        mAtomicTempFile->write(AtomicFile::FromEnd, 0,
-							   aVersionSection.address(), aVersionSection.size());
+		if (commitJournal())
+		{
+			secinfo("integrity", "appended version %u to %s", mVersionId, mAtomicFile.journalPath().c_str());
+		}
+		else
+		{
+			writeDatabase(*mAtomicTempFile, mModifiedTableMap, mVersionId);
+			mAtomicTempFile->commit();
+		}
 
-		mAtomicTempFile->commit();
+		// In journal mode this discards the unused temp file and releases the lock.
 		mAtomicTempFile = NULL;
+		mSchemaModified = false;
 	   /* Initialize the shared memory file change mechanism */
 	   pthread_once(&gCommonInitMutex, initCommon);
 
@@ -1748,6 +2072,7 @@ DbModifier::rollback() throw()
 {
 	// This will destroy the AtomicTempFile if we have one causing it to rollback.
 	mAtomicTempFile = NULL;
+	mSchemaModified = false;
 }
 
 const RecordId
@@ -2558,6 +2883,13 @@ AppleDatabase::passThrough(DbContext &dbContext,
         dbDeleteFile();
         break;
 
+	case CSSM_APPLEFILEDL_TOGGLE_JOURNAL:
+		// Return the old state of the journal flag if requested
+		if (outputParams)
+			*reinterpret_cast<CSSM_BOOL *>(outputParams) = mDbModifier.journalMode();
+		mDbModifier.journalMode(inputParams ? true : false);
+		break;
+
 	case CSSM_APPLECSPDL_DB_RELATION_EXISTS:
 	{
 		CSSM_BOOL returnValue;
@@ -2598,10 +2930,17 @@ AppleDatabase::dbMakeCopy(const char* path) {
     if(copyfile(mAtomicFile.path().c_str(), path, NULL, COPYFILE_UNLINK | COPYFILE_ALL) < 0) {
         UnixError::throwMe(errno);
     }
+
+    // The copy isn't complete without the changes still in the journal.
+    string journalPath = string(path) + "-journal";
+    if(copyfile(mAtomicFile.journalPath().c_str(), journalPath.c_str(), NULL, COPYFILE_UNLINK | COPYFILE_ALL) < 0 && errno != ENOENT) {
+        UnixError::throwMe(errno);
+    }
 }
 
 void AppleDatabase::dbDeleteFile() {
     if(unlink(mAtomicFile.path().c_str()) < 0) {
         UnixError::throwMe(errno);
     }
+    unlink(mAtomicFile.journalPath().c_str());
 }
@@ -160,7 +160,17 @@ public:
 	DbMutableIndex &findIndex(uint32 indexId, const MetaRecord &metaRecord, bool isUniqueIndex);
 
 	// Write this table to inOutputFile at inSectionOffset and return the new offset.
-    uint32 writeTable(AtomicTempFile &inAtomicTempFile, uint32 inSectionOffset);
+    uint32 writeTable(AtomicWriter &inOutputFile, uint32 inSectionOffset);
+
+	bool isModified() const { return mIsModified; }
+
+	// Append the records deleted and inserted in this table to a journal segment
+	// at inOffset and return the new offset.
+	uint32 writeJournal(WriteSection &ioSegment, uint32 inOffset) const;
+
+	// Apply the changes written by writeJournal() at inOffset of inSegment and
+	// return the offset past them.
+	uint32 replayJournal(const ReadSection &inSegment, uint32 inOffset);
 
 private:
 	// Return the next available record number for this table.
@@ -201,6 +211,8 @@ private:
 	MutableIndexMap mIndexMap;
 };
 
+typedef map<Table::Id, ModifiedTable *> ModifiedTableMap;
+
 //
 // Read only snapshot of a database.
 //
@@ -228,6 +240,21 @@ protected:
 		OffsetTablesCount	= AtomSize * 1,
 		OffsetTables		= AtomSize * 2
 	};
+
+	// Each commit made in journal mode appends one segment to the journal.  A
+	// segment turns the database with versionId BaseVersion into Version and
+	// ends with a checksum atom over the rest of the segment.
+	enum
+	{
+		JournalOffsetMagic			= AtomSize * 0,
+		JournalOffsetSize			= AtomSize * 1,
+		JournalOffsetBaseVersion	= AtomSize * 2,
+		JournalOffsetVersion		= AtomSize * 3,
+		JournalOffsetTablesCount	= AtomSize * 4,
+		JournalOffsetTables			= AtomSize * 5,
+
+		JournalMagic				= FOUR_CHAR_CODE('kjnl')
+	};
 };
 
 //
@@ -237,10 +264,20 @@ class DbVersion : public Metadata, public RefCount
 {
 	NOCOPY(DbVersion)
 public:
-    DbVersion(const class AppleDatabase &db, const RefPointer <AtomicBufferedFile> &inAtomicBufferedFile);
+    DbVersion(const class AppleDatabase &db, const RefPointer <AtomicBufferedFile> &inAtomicBufferedFile,
+			  const RefPointer <AtomicBufferedFile> &inJournalFile = RefPointer <AtomicBufferedFile>());
     ~DbVersion();
 
 	uint32 getVersionId() const { return mVersionId; }
+
+	// Size of the database image and of the part of the journal that was applied to it.
+	uint32 databaseLength() const { return mDatabase.size(); }
+	uint32 journalLength() const { return mJournalLength; }
+
+	// Return the versionId reached by applying the intact segments of inJournal
+	// to a database with inBaseVersionId, and set outValidLength to their size.
+	static uint32 journalVersion(const ReadSection &inJournal, uint32 inBaseVersionId,
+								 uint32 &outValidLength);
 	const RecordId getRecord(Table::Id inTableId, const RecordId &inRecordId,
 							 CSSM_DB_RECORD_ATTRIBUTE_DATA *inoutAttributes,
 							 CssmData *inoutData, Allocator &inAllocator) const;
@@ -251,9 +288,14 @@ protected:
 
 private:
     void open(); // Part of constructor contract.
+	void replayJournal(const ReadSection &inJournal);
 
 	ReadSection mDatabase;
     uint32 mVersionId;
+	uint32 mJournalLength;
+
+	// The database with the journal applied, if there was one.
+	auto_ptr<WriteSection> mReplayedDatabase;
 
 	friend class DbModifier; // XXX Fixme
     typedef map<Table::Id, Table *> TableMap;
@@ -415,6 +457,17 @@ public:
     void commit();
     void rollback() throw();
 
+	// Append commits to the journal rather than rewriting the database file.
+	// The database file alone then lags behind: anything that reads it without
+	// replaying the journal (older releases of this library, tools that parse
+	// the file directly) misses every change made since the last full commit.
+	bool journalMode() const { return mJournalMode; }
+	void journalMode(bool on) { mJournalMode = on; }
+
+	// Write a complete database containing inTables with inVersionId to inOutputFile.
+	static void writeDatabase(AtomicWriter &inOutputFile, const ModifiedTableMap &inTables,
+							  uint32 inVersionId);
+
 	// Record changing members
 	void deleteRecord(Table::Id inTableId, const RecordId &inRecordId);
 	const RecordId insertRecord(Table::Id inTableId,
@@ -456,8 +509,11 @@ protected:
 
     ModifiedTable &findTable(Table::Id inTableId);
 
-    uint32 writeAuthSection(uint32 inSectionOffset);
-    uint32 writeSchemaSection(uint32 inSectionOffset);
+    static uint32 writeAuthSection(AtomicWriter &inOutputFile, uint32 inSectionOffset);
+    static uint32 writeSchemaSection(AtomicWriter &inOutputFile, const ModifiedTableMap &inTables,
+									 uint32 inSectionOffset);
+
+	bool commitJournal();
 	
 private:
 	
@@ -475,8 +531,11 @@ private:
     uint32 mVersionId;
 	RefPointer<AtomicTempFile> mAtomicTempFile;
 
-    typedef map<Table::Id, ModifiedTable *> ModifiedTableMap;
     ModifiedTableMap mModifiedTableMap;
+
+	bool mJournalMode;
+	// Tables were created or deleted since the last commit; these are never journaled.
+	bool mSchemaModified;
 	
 	const class AppleDatabase &mDb;
 };
@@ -58,6 +58,8 @@ AtomicFile::AtomicFile(const std::string &inPath) :
     
     mDir += '/';
 
+	mJournalPath = mPath + "-journal";
+
 	// determine if the path is on a local or a networked volume
 	struct statfs info;
 	int result = statfs(mDir.c_str(), &info);
@@ -105,7 +107,8 @@ AtomicFile::performDelete()
 			UnixError::throwMe(error);
 	}
 
-	// unlink our lock file
+	// unlink our journal and lock file
+	::unlink(mJournalPath.c_str());
 	::unlink(mLockFilePath.c_str());
 }
 
@@ -124,6 +127,13 @@ AtomicFile::rename(const std::string &inNewPath)
 		secnotice("atomicfile", "rename(%s, %s): %s", path, newPath, strerror(error));
 		UnixError::throwMe(error);
 	}
+
+	// The journal belongs to the file, so it moves with it.
+	string newJournalPath = inNewPath + "-journal";
+	if (::rename(mJournalPath.c_str(), newJournalPath.c_str()) != 0 && errno != ENOENT)
+	{
+		secnotice("atomicfile", "rename(%s, %s): %s", mJournalPath.c_str(), newJournalPath.c_str(), strerror(errno));
+	}
 }
 
 // Lock the file for writing and return a newly created AtomicTempFile.
@@ -194,6 +204,92 @@ AtomicFile::read()
 	return new AtomicBufferedFile(mPath, mIsLocalFileSystem);
 }
 
+// Return a bufferedFile for reading the journal.  Opening it throws
+// CSSMERR_DL_DATASTORE_DOESNOT_EXIST if there is no journal.
+RefPointer<AtomicBufferedFile>
+AtomicFile::readJournal()
+{
+	// The journal is truncated in place by writers, so never map it.
+	return new AtomicBufferedFile(mJournalPath, false);
+}
+
+// Drop anything past inValidLength (a torn or stale tail) and append a new segment.
+// The segment is on disk when this returns.
+void
+AtomicFile::appendJournal(off_t inValidLength, const uint8 *inData, size_t inLength)
+{
+	const char *path = mJournalPath.c_str();
+	int fileRef = ropen(path, O_WRONLY|O_CREAT, mode() & ~S_IFMT);
+	if (fileRef == -1)
+	{
+		int error = errno;
+		secnotice("atomicfile", "open %s: %s", path, strerror(error));
+		if (error == EACCES)
+			CssmError::throwMe(CSSM_ERRCODE_OS_ACCESS_DENIED);
+		else
+			UnixError::throwMe(error);
+	}
+
+	try
+	{
+		if (::ftruncate(fileRef, inValidLength) == -1)
+		{
+			int error = errno;
+			secnotice("atomicfile", "ftruncate %s: %s", path, strerror(error));
+			UnixError::throwMe(error);
+		}
+
+		off_t pos = inValidLength;
+		const uint8 *ptr = inData;
+		size_t bytesLeft = inLength;
+		while (bytesLeft)
+		{
+			size_t toWrite = bytesLeft > kAtomicFileMaxBlockSize ? kAtomicFileMaxBlockSize : bytesLeft;
+			ssize_t bytesWritten = ::pwrite(fileRef, ptr, toWrite, pos);
+			if (bytesWritten == -1)
+			{
+				int error = errno;
+				if (error == EINTR)
+					continue;
+
+				secnotice("atomicfile", "write %s: %s", path, strerror(error));
+				UnixError::throwMe(error);
+			}
+
+			if (bytesWritten == 0)
+			{
+				secnotice("atomicfile", "write %s: 0 bytes written", path);
+				CssmError::throwMe(CSSMERR_DL_INTERNAL_ERROR);
+			}
+
+			bytesLeft -= bytesWritten;
+			ptr += bytesWritten;
+			pos += bytesWritten;
+		}
+
+		int result;
+		do
+		{
+			result = ::fsync(fileRef);
+		} while (result && errno == EINTR);
+
+		if (result == -1)
+		{
+			int error = errno;
+			secnotice("atomicfile", "fsync %s: %s", path, strerror(error));
+			UnixError::throwMe(error);
+		}
+	}
+	catch (...)
+	{
+		rclose(fileRef);
+		throw;
+	}
+
+	rclose(fileRef);
+	secinfo("atomicfile", "%p appended %zu bytes to %s at %qd", this, inLength, path, inValidLength);
+}
+
 mode_t
 AtomicFile::mode() const
 {
@@ -381,7 +477,9 @@ AtomicBufferedFile::AtomicBufferedFile(const std::string &inPath, bool isLocal)
 	mPath(inPath),
 	mFileRef(-1),
 	mBuffer(NULL),
-	mLength(0)
+	mLength(0),
+	mIsLocalFileSystem(isLocal),
+	mMappedLength(0)
 {
 }
 
@@ -415,6 +513,10 @@ AtomicBufferedFile::open()
 		close();
 	}
 
+	// A mapping belongs to the file we had open before, which may since have been replaced.
+	if (mMappedLength)
+		unloadBuffer();
+
 	mFileRef = AtomicFile::ropen(path, O_RDONLY, 0);
     if (mFileRef == -1)
     {
@@ -457,7 +559,11 @@ AtomicBufferedFile::open()
 void
 AtomicBufferedFile::unloadBuffer()
 {
-    if(mBuffer) {
+    if(mBuffer && mMappedLength) {
+        ::munmap(mBuffer, mMappedLength);
+        mBuffer = NULL;
+        mMappedLength = 0;
+    } else if(mBuffer) {
         delete [] mBuffer;
         mBuffer = NULL;
     }
@@ -468,6 +574,22 @@ AtomicBufferedFile::unloadBuffer()
 void
 AtomicBufferedFile::loadBuffer()
 {
+    // Writers never modify a database file in place, they rename a new one over
+    // it, so a mapping stays valid for as long as we hold it.  Pages are only
+    // faulted in for the sections that actually get looked at.
+    if (mIsLocalFileSystem && mLength > 0)
+    {
+        void *mapping = ::mmap(NULL, (size_t)mLength, PROT_READ, MAP_FILE | MAP_PRIVATE, mFileRef, 0);
+        if (mapping != MAP_FAILED)
+        {
+            mBuffer = reinterpret_cast<uint8 *>(mapping);
+            mMappedLength = (size_t)mLength;
+            return;
+        }
+
+        secnotice("atomicfile", "mmap(%s, %qd): %s, reading instead", mPath.c_str(), mLength, strerror(errno));
+    }
+
     // make a buffer big enough to hold the entire file
     mBuffer = new uint8[(size_t) mLength];
     if(lseek(mFileRef, 0, SEEK_SET) < 0) {
@@ -511,22 +633,27 @@ AtomicBufferedFile::loadBuffer()
 const uint8 *
 AtomicBufferedFile::read(off_t inOffset, off_t inLength, off_t &outLength)
 {
-	if (mFileRef < 0)
+	if (mFileRef < 0 && !mMappedLength)
 	{
 		secinfo("atomicfile", "read %s: file yet not opened, opening", mPath.c_str());
 		open();
 	}
 
 	off_t bytesLeft = inLength;
-	if (mBuffer)
+
+	// A mapping of the whole file can be handed out again; a buffer is reread.
+	if (!mBuffer || mMappedLength != (size_t)mLength)
 	{
-		secinfo("atomicfile", "%p free %s buffer %p", this, mPath.c_str(), mBuffer);
-		unloadBuffer();
-	}
+		if (mBuffer)
+		{
+			secinfo("atomicfile", "%p free %s buffer %p", this, mPath.c_str(), mBuffer);
+			unloadBuffer();
+		}
 
-	loadBuffer();
-	
-	secinfo("atomicfile", "%p allocated %s buffer %p size %qd", this, mPath.c_str(), mBuffer, bytesLeft);
+		loadBuffer();
+
+		secinfo("atomicfile", "%p allocated %s buffer %p size %qd", this, mPath.c_str(), mBuffer, bytesLeft);
+	}
 	
 	off_t maxEnd = inOffset + inLength;
 	if (maxEnd > mLength)
@@ -651,15 +778,22 @@ AtomicTempFile::create(mode_t mode)
 	secnotice("atomicfile", "%p created %s", this, path);
 }
 
+//
+// AtomicWriter
+//
+AtomicWriter::~AtomicWriter()
+{
+}
+
 void
-AtomicTempFile::write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 inData)
+AtomicWriter::write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 inData)
 {
     uint32 aData = htonl(inData);
     write(inOffsetType, inOffset, reinterpret_cast<uint8 *>(&aData), sizeof(aData));
 }
 
 void
-AtomicTempFile::write(AtomicFile::OffsetType inOffsetType, off_t inOffset,
+AtomicWriter::write(AtomicFile::OffsetType inOffsetType, off_t inOffset,
 				  const uint32 *inData, uint32 inCount)
 {
 #ifdef HOST_LONG_IS_NETWORK_LONG
@@ -816,6 +950,12 @@ AtomicTempFile::commit()
 
         secnotice("atomicfile", "%p commited %s to %s", this, oldPath, newPath);
 
+		// The new file already contains everything in the journal, so drop it
+		// before anyone else can append to it.
+		const char *journalPath = mFile.journalPath().c_str();
+		if (::unlink(journalPath) == -1 && errno != ENOENT)
+			secnotice("atomicfile", "unlink %s: %s", journalPath, strerror(errno));
+
 		// Unlock the lockfile
 		mLockedFile = NULL;
 	}
@@ -55,10 +55,18 @@ public:
 	// Return a bufferedFile containing current version of the file for reading.
 	RefPointer<AtomicBufferedFile> read();
 
+	// Return a bufferedFile for reading the append journal that sits next to the file.
+	RefPointer<AtomicBufferedFile> readJournal();
+
+	// Truncate the journal to inValidLength bytes, append inData and fsync it.
+	// The caller must be holding the write lock.
+	void appendJournal(off_t inValidLength, const uint8 *inData, size_t inLength);
+
 	const string& path() const { return mPath; }
 	const string& dir() const { return mDir; }
 	const string& file() const { return mFile; }
 	const string& lockFileName() { return mLockFilePath; }
+	const string& journalPath() const { return mJournalPath; }
 
 	mode_t mode() const;
 	bool isOnLocalFileSystem() {return mIsLocalFileSystem;}
@@ -80,13 +88,15 @@ private:
 	string mDir;
 	string mFile;
 	string mLockFilePath;
+	string mJournalPath;
 };
 
 
 //
 // AtomicBufferedFile - This represents an instance of a file opened for reading.
-// The file is read into memory and closed after this is done.
-// The memory is released when this object is destroyed.
+// Files on local volumes are mapped, anything else is read into memory.  Either
+// way the file may be closed once read() returns; the memory is released when
+// this object is destroyed.
 //
 class AtomicBufferedFile : public RefCount
 {
@@ -125,13 +135,34 @@ private:
 
 	// Length of file in bytes.
 	off_t mLength;
+
+	// Map the file instead of reading it; only safe when it's on a local volume.
+	bool mIsLocalFileSystem;
+
+	// Length of the mapping if mBuffer is mapped rather than allocated, or 0.
+	size_t mMappedLength;
+};
+
+
+//
+// AtomicWriter - Something the sections of a database file can be written to.
+//
+class AtomicWriter
+{
+public:
+	virtual ~AtomicWriter();
+
+    virtual void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint8 *inData, size_t inLength) = 0;
+
+    void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 *inData, uint32 inCount);
+    void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 inData);
 };
 
 
 //
 // AtomicTempFile - A temporary file to write changes to.
 //
-class AtomicTempFile : public RefCount
+class AtomicTempFile : public RefCount, public AtomicWriter
 {
 public:
 	// Start a write for a new file.
@@ -145,9 +176,8 @@ public:
     // Commit the current create or write and close the write file.
     void commit();
 
-    void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 *inData, uint32 inCount);
-    void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint8 *inData, size_t inLength);
-    void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint32 inData);
+    using AtomicWriter::write;
+    virtual void write(AtomicFile::OffsetType inOffsetType, off_t inOffset, const uint8 *inData, size_t inLength);
 
 private:
 	// Called by both constructors.
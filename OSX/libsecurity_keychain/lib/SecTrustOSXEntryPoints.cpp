@@ -48,11 +48,32 @@
 #include <AssertMacros.h>
 #include <pthread.h>
 #include <notify.h>
+#include <atomic>
 
 /*
  * MARK: CFRunloop
  */
 
+/* Keychain event callbacks are delivered on the runloop of the thread that
+ * registered them, so they are registered from the thread below.  Until that
+ * has succeeded, nobody can tell when legacy keychains or trust settings change. */
+static std::atomic<bool> sLegacySourcesEventsRegistered(false);
+static std::atomic<uint64_t> sLegacySourcesEventGeneration(0);
+
+static OSStatus SecTrustOSXKeychainEvent(SecKeychainEvent keychainEvent __unused,
+    SecKeychainCallbackInfo *info __unused, void *context __unused) {
+    sLegacySourcesEventGeneration++;
+    return errSecSuccess;
+}
+
+bool SecTrustLegacySourcesGetEventGeneration(uint64_t *generation) {
+    if (!sLegacySourcesEventsRegistered) {
+        return false;
+    }
+    *generation = sLegacySourcesEventGeneration;
+    return true;
+}
+
 static void *SecTrustOSXCFRunloop(__unused void *unused) {
     CFRunLoopTimerRef timer = CFRunLoopTimerCreateWithHandler(kCFAllocatorDefault, (CFTimeInterval) UINT_MAX, 0, 0, 0, ^(__unused CFRunLoopTimerRef _timer) {
         /* do nothing */
@@ -73,6 +94,16 @@ static void *SecTrustOSXCFRunloop(__unused void *unused) {
 
                              });
 
+    /* Register for changes to legacy keychains and trust settings */
+    OSStatus status = SecKeychainAddCallback(SecTrustOSXKeychainEvent,
+        kSecTrustSettingsChangedEventMask | kSecAddEventMask | kSecDeleteEventMask |
+        kSecUpdateEventMask | kSecKeychainListChangedMask, NULL);
+    if (status) {
+        secerror("SecKeychainAddCallback returned %d", (int)status);
+    } else {
+        sLegacySourcesEventsRegistered = true;
+    }
+
     try {
         CFRunLoopRun();
     }
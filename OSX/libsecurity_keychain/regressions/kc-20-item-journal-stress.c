@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016 Apple Inc. All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "keychain_regressions.h"
+#include "kc-helpers.h"
+#include "kc-item-helpers.h"
+
+#include <Security/Security.h>
+#include <Security/cssmapple.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// Readers in other processes list the keychain while we add items to it,
+// mixing journaled commits with full ones that fold the journal into the
+// database file and remove it.  A reader that pairs the database file with
+// the wrong journal sees fewer items than had been committed when it started.
+
+#define ROUNDS 50
+#define ITEMS_PER_ROUND 4
+
+static pid_t startReader(const char *outPath) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char *argv[] = { "/usr/bin/security", "dump-keychain", keychainFile, NULL };
+    pid_t pid = 0;
+    if (posix_spawn(&pid, argv[0], &actions, NULL, argv, environ))
+        pid = 0;
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
+// Every item in a dump-keychain listing starts with its keychain's path.
+static int countItems(const char *outPath) {
+    FILE *f = fopen(outPath, "r");
+    if (!f)
+        return -1;
+    int count = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "keychain: ", 10) == 0)
+            count++;
+    }
+    fclose(f);
+    return count;
+}
+
+static void tests() {
+    SecKeychainRef kc = getEmptyTestKeychain();
+
+    CSSM_DL_DB_HANDLE cspdl_dldb = {};
+    ok_status(SecKeychainGetDLDBHandle(kc, &cspdl_dldb), "%s: SecKeychainGetDLDBHandle", testName);
+    CSSM_DL_DB_HANDLE dldb = {};
+    ok_status(CSSM_DL_PassThrough(cspdl_dldb, CSSM_APPLECSPDL_DB_GET_HANDLE, NULL, (void **)&dldb),
+        "%s: get dl handle", testName);
+
+    int committed = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        int before = committed;
+        pid_t reader = startReader(keychainTempFile);
+
+        for (int ix = 0; ix < ITEMS_PER_ROUND; ix++, committed++) {
+            // Every third commit is a full one.
+            CSSM_DL_PassThrough(dldb, CSSM_APPLEFILEDL_TOGGLE_JOURNAL,
+                (const void *)(uintptr_t)(committed % 3 != 0), NULL);
+
+            CFStringRef label = CFStringCreateWithFormat(NULL, NULL, CFSTR("testItem%05d"), committed);
+            CFStringRef service = CFStringCreateWithFormat(NULL, NULL, CFSTR("testService%05d"), committed);
+            SecKeychainItemRef item = createCustomItem(testName, kc, createAddCustomItemDictionaryWithService(kc, kSecClassGenericPassword, label, CFSTR("testAccount"), service));
+            CFReleaseNull(item);
+            CFReleaseNull(label);
+            CFReleaseNull(service);
+        }
+
+        int status = 0;
+        ok(reader && waitpid(reader, &status, 0) == reader && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+            "%s: reader %d exited", testName, round);
+        int count = countItems(keychainTempFile);
+        ok(count >= before && count <= committed, "%s: reader %d saw %d items, %d to %d were committed",
+            testName, round, count, before, committed);
+    }
+    unlink(keychainTempFile);
+
+    ok_status(SecKeychainDelete(kc), "%s: SecKeychainDelete", testName);
+    CFReleaseNull(kc);
+}
+
+int kc_20_item_journal_stress(int argc, char *const *argv)
+{
+    plan_tests(getEmptyTestKeychainTests + 2 + (createCustomItemTests * ITEMS_PER_ROUND + 2) * ROUNDS + 1);
+    initializeKeychainTests(__FUNCTION__);
+
+    tests();
+
+    deleteTestFiles();
+    return 0;
+}
@@ -30,6 +30,7 @@ ONE_TEST(kc_20_key_find_stress)
 ONE_TEST(kc_20_item_add_stress)
 ONE_TEST(kc_20_item_find_stress)
 ONE_TEST(kc_20_item_delete_stress)
+ONE_TEST(kc_20_item_journal_stress)
 ONE_TEST(kc_21_item_use_callback)
 ONE_TEST(kc_21_item_xattrs)
 ONE_TEST(kc_23_key_export_symmetric)
@@ -81,6 +81,12 @@ public:
 	bool compareToExist(
 		const CSSM_DATA	&exist);
 
+	/*
+	 * The subject's serial number. Unlike the issuer hashes this doesn't depend
+	 * on any hash algorithm, so it is a handy key for indexing responses.
+	 */
+	const CSSM_DATA &subjectSerial() const		{ return mSubjectSerial; }
+
 private:
 	CSSM_DATA mIssuerName;
 	CSSM_DATA mIssuerPubKey;
@@ -35,10 +35,20 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 /* Maximum encrypted record size, defined in TLS 1.2 RFC, section 6.2.3 */
 #define DEFAULT_BUFFER_SIZE (16384 + 2048)
 
+/* Smallest encrypted record that counts as full size and may be kept for reuse. */
+#define FULL_RECORD_SIZE        16384
+
+/* Most records handed to the gather write callback at once. */
+#define MAX_WRITEV_RECORDS      16
+
+/* Size of the read-ahead buffer: room for a few full records. */
+#define READ_AHEAD_BUFFER_SIZE  (4 * DEFAULT_BUFFER_SIZE)
+
 
 /*
  * Redirect SSLBuffer-based I/O call to user-supplied I/O.
@@ -89,6 +99,195 @@ int sslIoWrite(SSLBuffer                       buf,
 	return ortn;
 }
 
+static
+int sslIoWritev(const struct iovec             *iov,
+                int                            iovcnt,
+                size_t                         *actualLength,
+                struct SSLRecordInternalContext *ctx)
+{
+	int     ortn;
+    SSLContextRef sslCtx = ctx->sslCtx;
+
+	*actualLength = 0;
+
+    ortn = sslCtx->ioCtx.writev(sslCtx->ioCtx.ioRef, iov, iovcnt, actualLength);
+
+    /* We may need to translate error codes at this layer */
+    if(ortn==errSSLWouldBlock) {
+        ortn=errSSLRecordWouldBlock;
+    }
+
+    sslLogRecordIo("sslIoWritev: [%p] iovcnt %d actual %4lu status %d",
+                   ctx, iovcnt, *actualLength, (int)ortn);
+
+	return ortn;
+}
+
+/* Get a record with room for len bytes, reusing the spare one if it fits. */
+static WaitingRecord *
+SSLAllocWaitingRecord(struct SSLRecordInternalContext *ctx, size_t len)
+{
+    WaitingRecord *rec = ctx->recordSpare;
+
+    if (rec != NULL && rec->capacity >= len) {
+        ctx->recordSpare = NULL;
+    } else {
+        /* Only full size records get a full buffer, small ones aren't worth keeping. */
+        size_t capacity = (len >= FULL_RECORD_SIZE && len < DEFAULT_BUFFER_SIZE) ? DEFAULT_BUFFER_SIZE : len;
+        rec = (WaitingRecord *)sslMalloc(offsetof(WaitingRecord, data) + capacity);
+        if (rec == NULL)
+            return NULL;
+        rec->capacity = capacity;
+    }
+
+    rec->next = NULL;
+    rec->sent = 0;
+    rec->length = len;
+    return rec;
+}
+
+static void
+SSLFreeWaitingRecord(struct SSLRecordInternalContext *ctx, WaitingRecord *rec)
+{
+    if (ctx->recordSpare == NULL && rec->capacity == DEFAULT_BUFFER_SIZE) {
+        ctx->recordSpare = rec;
+    } else {
+        sslFree(rec);
+    }
+}
+
+/*
+ * Decrypt a complete record. In read-ahead mode the plaintext goes to the
+ * caller's SSLRead buffer when it fits, or else to plaintextBuffer; either
+ * way it is lent out until SSLRecordFreeInternal.
+ */
+static int SSLRecordDecryptInternal(struct SSLRecordInternalContext *ctx, tls_buffer record, SSLRecord *rec)
+{
+    int err;
+
+    if(rec->contentType==tls_record_type_SSL2) {
+        /* Just copy the SSL2 record, dont decrypt since this is only for SSL2 Client Hello */
+        return SSLCopyBuffer(&record, &rec->contents);
+    }
+
+    size_t sz = tls_record_decrypted_size(ctx->filter, record.length);
+
+    /* There was an underflow - For TLS, we return errSSLRecordClosedAbort for historical reason - see ssl-44-crashes test */
+    if(sz==0) {
+        sslErrorLog("underflow in SSLReadRecordInternal");
+        if(ctx->sslCtx->isDTLS) {
+            // For DTLS, we should just drop it.
+            return errSSLRecordUnexpectedRecord;
+        } else {
+            // For TLS, we are going to close the connection.
+            return errSSLRecordClosedAbort;
+        }
+    }
+
+    if (ctx->readAhead && ctx->lentPlaintext == NULL && sz <= DEFAULT_BUFFER_SIZE) {
+        if (sz <= ctx->readDestLength) {
+            rec->contents.data = ctx->readDest;
+        } else {
+            if (ctx->plaintextBuffer.data == NULL &&
+                (err = SSLAllocBuffer(&ctx->plaintextBuffer, DEFAULT_BUFFER_SIZE)))
+                return err;
+            rec->contents.data = ctx->plaintextBuffer.data;
+        }
+        rec->contents.length = sz;
+        ctx->lentPlaintext = rec->contents.data;
+
+        if ((err = tls_record_decrypt(ctx->filter, record, &rec->contents, NULL)))
+            ctx->lentPlaintext = NULL;
+        return err;
+    }
+
+    /* Allocate a buffer for the plaintext */
+    if ((err = SSLAllocBuffer(&rec->contents, sz)))
+    {
+        return err;
+    }
+
+    return tls_record_decrypt(ctx->filter, record, &rec->contents, NULL);
+}
+
+/*
+ * Read-ahead variant of SSLRecordReadInternal: ask the transport for as
+ * much as fits in readAheadBuffer, then hand out the complete records in
+ * there one at a time, going back to the transport only when we are left
+ * with a partial record.
+ */
+static int SSLRecordReadAheadInternal(struct SSLRecordInternalContext *ctx, SSLRecord *rec)
+{
+    int     err;
+    size_t  head, avail, len, contentLen = 0;
+    uint8_t content_type = 0;
+    SSLBuffer readData;
+    tls_buffer header, record;
+
+    if (ctx->readAheadBuffer.data == NULL &&
+        (err = SSLAllocBuffer(&ctx->readAheadBuffer, READ_AHEAD_BUFFER_SIZE)))
+        return err;
+
+    for (;;) {
+        head = tls_record_get_header_size(ctx->filter);
+        avail = ctx->readAheadEnd - ctx->readAheadStart;
+
+        if (avail >= head) {
+            header.data = ctx->readAheadBuffer.data + ctx->readAheadStart;
+            header.length = head;
+
+            tls_record_parse_header(ctx->filter, header, &contentLen, &content_type);
+
+            if(content_type&0x80) {
+                sslDebugLog("Detected SSL2 record in SSLRecordReadAheadInternal");
+                // Looks like SSL2 record, reset expectations.
+                head = 2;
+                err=tls_record_parse_ssl2_header(ctx->filter, header, &contentLen, &content_type);
+                if(err!=0) return errSSLRecordUnexpectedRecord;
+            }
+
+            if(head+contentLen>DEFAULT_BUFFER_SIZE) {
+                sslDebugLog("overflow in SSLRecordReadAheadInternal");
+                return errSSLRecordRecordOverflow;
+            }
+
+            if (avail >= head + contentLen)
+                break;
+        }
+
+        /* Move the partial record to the front, and fill up the rest */
+        if (ctx->readAheadStart) {
+            memmove(ctx->readAheadBuffer.data, ctx->readAheadBuffer.data + ctx->readAheadStart, avail);
+            ctx->readAheadStart = 0;
+            ctx->readAheadEnd = avail;
+        }
+
+        readData.data = ctx->readAheadBuffer.data + ctx->readAheadEnd;
+        readData.length = ctx->readAheadBuffer.length - ctx->readAheadEnd;
+        err = sslIoRead(readData, &len, ctx);
+        ctx->readAheadEnd += len;
+
+        if (len == 0) {
+            if (err == 0 || err == errSSLRecordWouldBlock)
+                return errSSLRecordWouldBlock;
+            /* Like SSLRecordReadInternal: failing to get a header is an abort */
+            return (avail < head) ? errSSLRecordClosedAbort : err;
+        }
+        /* Got something: parse again. Any error will come back on the next read. */
+    }
+
+    record.data = ctx->readAheadBuffer.data + ctx->readAheadStart;
+    record.length = head + contentLen;
+
+    ctx->readAheadStart += record.length;
+    if (ctx->readAheadStart == ctx->readAheadEnd)
+        ctx->readAheadStart = ctx->readAheadEnd = 0;
+
+    rec->contentType = content_type;
+
+    return SSLRecordDecryptInternal(ctx, record, rec);
+}
+
 /* Entry points to Record Layer */
 
 static int SSLRecordReadInternal(SSLRecordContextRef ref, SSLRecord *rec)
@@ -99,6 +298,9 @@ static int SSLRecordReadInternal(SSLRecordContextRef ref, SSLRecord *rec)
     size_t  len, contentLen;
     SSLBuffer readData;
 
+    if (ctx->readAhead)
+        return SSLRecordReadAheadInternal(ctx, rec);
+
     size_t head=tls_record_get_header_size(ctx->filter);
 
     if (ctx->amountRead < head)
@@ -176,39 +378,14 @@ static int SSLRecordReadInternal(SSLRecordContextRef ref, SSLRecord *rec)
 
     ctx->amountRead = 0;        /* We've used all the data in the cache */
 
-    if(content_type==tls_record_type_SSL2) {
-        /* Just copy the SSL2 record, dont decrypt since this is only for SSL2 Client Hello */
-        return SSLCopyBuffer(&record, &rec->contents);
-    } else {
-        size_t sz = tls_record_decrypted_size(ctx->filter, record.length);
-
-        /* There was an underflow - For TLS, we return errSSLRecordClosedAbort for historical reason - see ssl-44-crashes test */
-        if(sz==0) {
-            sslErrorLog("underflow in SSLReadRecordInternal");
-            if(ctx->sslCtx->isDTLS) {
-                // For DTLS, we should just drop it.
-                return errSSLRecordUnexpectedRecord;
-            } else {
-                // For TLS, we are going to close the connection.
-                return errSSLRecordClosedAbort;
-            }
-        }
-
-        /* Allocate a buffer for the plaintext */
-        if ((err = SSLAllocBuffer(&rec->contents, sz)))
-        {
-            return err;
-        }
-
-        return tls_record_decrypt(ctx->filter, record, &rec->contents, NULL);
-    }
+    return SSLRecordDecryptInternal(ctx, record, rec);
 }
 
 static int SSLRecordWriteInternal(SSLRecordContextRef ref, SSLRecord rec)
 {
     int err;
     struct SSLRecordInternalContext *ctx = ref;
-    WaitingRecord *queue, *out;
+    WaitingRecord *out = NULL;
     tls_buffer data;
     tls_buffer content;
     size_t len;
@@ -216,10 +393,7 @@ static int SSLRecordWriteInternal(SSLRecordContextRef ref, SSLRecord rec)
     err = errSSLRecordInternal; /* FIXME: allocation error */
     len=tls_record_encrypted_size(ctx->filter, rec.contentType, rec.contents.length);
 
-    require((out = (WaitingRecord *)sslMalloc(offsetof(WaitingRecord, data) + len)), fail);
-    out->next = NULL;
-	out->sent = 0;
-	out->length = len;
+    require((out = SSLAllocWaitingRecord(ctx, len)), fail);
 
     data.data=&out->data[0];
     data.length=out->length;
@@ -235,16 +409,13 @@ static int SSLRecordWriteInternal(SSLRecordContextRef ref, SSLRecord rec)
     if (ctx->recordWriteQueue == 0)
         ctx->recordWriteQueue = out;
     else
-    {   queue = ctx->recordWriteQueue;
-        while (queue->next != 0)
-            queue = queue->next;
-        queue->next = out;
-    }
+        ctx->recordWriteQueueTail->next = out;
+    ctx->recordWriteQueueTail = out;
 
     return 0;
 fail:
     if(out)
-        sslFree(out);
+        SSLFreeWaitingRecord(ctx, out);
     return err;
 }
 
@@ -288,6 +459,14 @@ SSLSetInternalRecordLayerProtocolVersion(SSLRecordContextRef ref, SSLProtocolVer
 static int
 SSLRecordFreeInternal(SSLRecordContextRef ref, SSLRecord rec)
 {
+    struct SSLRecordInternalContext *ctx = ref;
+
+    /* Lent plaintext is not ours to free, just take it back */
+    if (rec.contents.data != NULL && rec.contents.data == ctx->lentPlaintext) {
+        ctx->lentPlaintext = NULL;
+        return 0;
+    }
+
     return SSLFreeBuffer(&rec.contents);
 }
 
@@ -301,16 +480,39 @@ SSLRecordServiceWriteQueueInternal(SSLRecordContextRef ref)
     struct SSLRecordInternalContext *ctx= ref;
 
     while (!werr && ((rec = ctx->recordWriteQueue) != 0))
-    {   buf.data = rec->data + rec->sent;
-        buf.length = rec->length - rec->sent;
-        werr = sslIoWrite(buf, &written, ctx);
-        rec->sent += written;
-        if (rec->sent >= rec->length)
+    {
+        if (ctx->sslCtx->ioCtx.writev && rec->next)
+        {   /* Hand as many waiting records as we can to a single gather write. */
+            struct iovec iov[MAX_WRITEV_RECORDS];
+            int iovcnt = 0;
+            for (; rec && iovcnt < MAX_WRITEV_RECORDS; rec = rec->next, iovcnt++) {
+                iov[iovcnt].iov_base = rec->data + rec->sent;
+                iov[iovcnt].iov_len = rec->length - rec->sent;
+            }
+            werr = sslIoWritev(iov, iovcnt, &written, ctx);
+        }
+        else
+        {   buf.data = rec->data + rec->sent;
+            buf.length = rec->length - rec->sent;
+            werr = sslIoWrite(buf, &written, ctx);
+        }
+
+        /* Retire every record that is now completely written. */
+        while (written && ((rec = ctx->recordWriteQueue) != 0))
         {
-            check(rec->sent == rec->length);
+            size_t n = rec->length - rec->sent;
+            if (n > written)
+                n = written;
+            rec->sent += n;
+            written -= n;
+            if (rec->sent < rec->length)
+                break;
             ctx->recordWriteQueue = rec->next;
-			sslFree(rec);
+            if (ctx->recordWriteQueue == 0)
+                ctx->recordWriteQueueTail = 0;
+            SSLFreeWaitingRecord(ctx, rec);
         }
+        check(written == 0);
     }
 
     return werr;
@@ -323,6 +525,15 @@ SSLRecordSetOption(SSLRecordContextRef ref, SSLRecordOption option, bool value)
     switch (option) {
         case kSSLRecordOptionSendOneByteRecord:
             return tls_record_set_record_splitting(ctx->filter, value);
+        case kSSLRecordOptionReadAhead:
+            /* Only changed before the first read, nothing is buffered yet */
+            ctx->readAhead = value;
+            if (!value) {
+                SSLFreeBuffer(&ctx->readAheadBuffer);
+                SSLFreeBuffer(&ctx->plaintextBuffer);
+                ctx->readAheadStart = ctx->readAheadEnd = 0;
+            }
+            return 0;
         default:
             return 0;
     }
@@ -330,6 +541,26 @@ SSLRecordSetOption(SSLRecordContextRef ref, SSLRecordOption option, bool value)
 
 /***** Internal Record Layer APIs *****/
 
+/*
+ * Same as the read entry point, but in read-ahead mode the record may be
+ * decrypted straight into data when it is big enough, in which case
+ * rec->contents points into data. SSLRecordFreeInternal handles both.
+ */
+int
+SSLRecordReadIntoInternal(SSLRecordContextRef ref, SSLRecord *rec, uint8_t *data, size_t length)
+{
+    struct SSLRecordInternalContext *ctx = ref;
+    int err;
+
+    ctx->readDest = data;
+    ctx->readDestLength = length;
+    err = SSLRecordReadInternal(ref, rec);
+    ctx->readDest = NULL;
+    ctx->readDestLength = 0;
+
+    return err;
+}
+
 #include <CommonCrypto/CommonRandomSPI.h>
 #define CCRNGSTATE ccDRBGGetRngState()
 
@@ -366,12 +597,16 @@ SSLDestroyInternalRecordLayer(SSLRecordContextRef ref)
 
     /* RecordContext cleanup : */
     SSLFreeBuffer(&ctx->partialReadBuffer);
+    SSLFreeBuffer(&ctx->readAheadBuffer);
+    SSLFreeBuffer(&ctx->plaintextBuffer);
     waitRecord = ctx->recordWriteQueue;
     while (waitRecord)
     {   next = waitRecord->next;
         sslFree(waitRecord);
         waitRecord = next;
     }
+    if (ctx->recordSpare)
+        sslFree(ctx->recordSpare);
 
     if(ctx->filter)
         tls_record_destroy(ctx->filter);
@@ -39,6 +39,10 @@ SSLCreateInternalRecordLayer(SSLContextRef ctx);
 void
 SSLDestroyInternalRecordLayer(SSLRecordContextRef ctx);
 
+/* Read a record, possibly decrypting it straight into data (read-ahead mode only) */
+int
+SSLRecordReadIntoInternal(SSLRecordContextRef ctx, SSLRecord *rec, uint8_t *data, size_t length);
+
 
 extern struct SSLRecordFuncs SSLRecordLayerInternal;
 
@@ -30,6 +30,7 @@
 
 #include <Security/SecureTransport.h>
 #include <Security/SecTrust.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -441,6 +442,45 @@ OSStatus SSLSetDHEEnabled(SSLContextRef ctx, bool enabled);
 
 OSStatus SSLGetDHEEnabled(SSLContextRef ctx, bool *enabled);
 
+/*
+ * Gather write callback: write the iovcnt buffers in order, as much as
+ * possible, and return the total number of bytes written in *dataLength.
+ * Return values are the same as for SSLWriteFunc.
+ */
+typedef OSStatus
+(*SSLWritevFunc)			(SSLConnectionRef 	connection,
+							 const struct iovec	*iov,
+							 int				iovcnt,
+							 size_t 			*dataLength);	/* RETURNED */
+
+/*
+ * Optional companion to SSLSetIOFuncs. When set, all the records waiting
+ * to be sent are handed to writevFunc in one call instead of one
+ * SSLWriteFunc call per record. Pass NULL to go back to SSLWriteFunc only.
+ * Like SSLSetIOFuncs, this can not be called when a session is active.
+ */
+OSStatus
+SSLSetIOVecWriteFunc		(SSLContextRef		ctx,
+							 SSLWritevFunc		writevFunc);
+
+/*
+ * Read-ahead mode, off by default. When enabled, each read asks the
+ * SSLReadFunc for as much as fits in a buffer of a few records, and
+ * complete records already in that buffer are decrypted without calling
+ * it again. Records are decrypted straight into the SSLRead buffer when
+ * it is big enough.
+ *
+ * Only use this with an SSLReadFunc that returns what is available
+ * (a short read) instead of waiting for the full requested length. Since
+ * data may be buffered that the transport no longer reports as readable,
+ * keep calling SSLRead until errSSLWouldBlock before waiting for the
+ * connection. Only available with the internal record layer, and can not
+ * be changed when a session is active.
+ */
+OSStatus SSLSetReadAheadEnabled(SSLContextRef ctx, bool enabled);
+
+OSStatus SSLGetReadAheadEnabled(SSLContextRef ctx, bool *enabled);
+
 #if TARGET_OS_IPHONE
 
 /* Following are SPIs on iOS */
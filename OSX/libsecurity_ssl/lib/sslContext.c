@@ -413,8 +413,16 @@ void SSLContextDestroy(CFTypeRef arg)
     tls_handshake_destroy(ctx->hdsk);
 
     /* Only destroy if we were using the internal record layer */
-    if(ctx->recFuncs==&SSLRecordLayerInternal)
+    if(ctx->recFuncs==&SSLRecordLayerInternal) {
+        /* receivedDataBuffer may be lent by the record layer, give it back first */
+        if(ctx->receivedDataBuffer.data) {
+            SSLRecord rec = { SSL_RecordTypeAppData, ctx->receivedDataBuffer };
+            SSLFreeRecord(rec, ctx);
+            ctx->receivedDataBuffer.data = NULL;
+            ctx->receivedDataBuffer.length = 0;
+        }
         SSLDestroyInternalRecordLayer(ctx->recCtx);
+    }
 
     SSLFreeBuffer(&ctx->sessionTicket);
     SSLFreeBuffer(&ctx->sessionID);
@@ -617,6 +625,28 @@ SSLSetIOFuncs				(SSLContextRef		ctx,
     return 0;
 }
 
+OSStatus
+SSLSetIOVecWriteFunc		(SSLContextRef		ctx,
+							 SSLWritevFunc		writevFunc)
+{
+	if(ctx == NULL) {
+		return errSecParam;
+	}
+    if(ctx->recFuncs!=&SSLRecordLayerInternal) {
+        /* Can Only do this with the internal record layer */
+        check(0);
+        return errSecBadReq;
+    }
+	if(sslIsSessionActive(ctx)) {
+		/* can't do this with an active session */
+		return errSecBadReq;
+	}
+
+    ctx->ioCtx.writev=writevFunc;
+
+    return 0;
+}
+
 void
 SSLSetNPNFunc(SSLContextRef      context,
 			  SSLNPNFunc         npnFunc,
@@ -2043,6 +2073,34 @@ OSStatus SSLGetDHEEnabled(SSLContextRef ctx, bool *enabled)
     return noErr;
 }
 
+OSStatus SSLSetReadAheadEnabled(SSLContextRef ctx, bool enabled)
+{
+    if(ctx == NULL) {
+        return errSecParam;
+    }
+    if(ctx->recFuncs!=&SSLRecordLayerInternal) {
+        /* Can Only do this with the internal record layer */
+        check(0);
+        return errSecBadReq;
+    }
+    if(sslIsSessionActive(ctx)) {
+        /* can't do this with an active session */
+        return errSecBadReq;
+    }
+
+    ctx->readAheadEnabled = enabled;
+    return ctx->recFuncs->setOption(ctx->recCtx, kSSLRecordOptionReadAhead, enabled);
+}
+
+OSStatus SSLGetReadAheadEnabled(SSLContextRef ctx, bool *enabled)
+{
+    if(ctx == NULL || enabled == NULL) {
+        return errSecParam;
+    }
+    *enabled = ctx->readAheadEnabled;
+    return noErr;
+}
+
 OSStatus SSLSetMinimumDHGroupSize(SSLContextRef ctx, unsigned nbits)
 {
     return tls_handshake_set_min_dh_group_size(ctx->hdsk, nbits);
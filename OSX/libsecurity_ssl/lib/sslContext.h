@@ -62,6 +62,7 @@ extern "C" {
 typedef struct
 {   SSLReadFunc         read;
     SSLWriteFunc        write;
+    SSLWritevFunc       writev;         /* optional */
     SSLConnectionRef   	ioRef;
 } IOContext;
 
@@ -244,6 +245,9 @@ struct SSLContext
     /* Enable DHE or not */
     bool            dheEnabled;
 
+    /* Read-ahead in the internal record layer, see SSLSetReadAheadEnabled */
+    bool            readAheadEnabled;
+
     /* For early failure reporting */
     bool    serverHelloReceived;
 };
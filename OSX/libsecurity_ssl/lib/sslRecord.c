@@ -117,6 +117,19 @@ SSLReadRecord(SSLRecord *rec, SSLContext *ctx)
     return errorTranslate(ctx->recFuncs->read(ctx->recCtx, rec));
 }
 
+/* SSLReadRecordInto
+ *  Same as SSLReadRecord, but the record content may end up in data
+ *  when it fits. Still to be freed using SSLFreeRecord.
+ */
+OSStatus
+SSLReadRecordInto(SSLRecord *rec, uint8_t *data, size_t length, SSLContext *ctx)
+{
+    if(ctx->recFuncs!=&SSLRecordLayerInternal)
+        return SSLReadRecord(rec, ctx);
+
+    return errorTranslate(SSLRecordReadIntoInternal(ctx->recCtx, rec, data, length));
+}
+
 OSStatus SSLServiceWriteQueue(SSLContext *ctx)
 {
     return errorTranslate(ctx->recFuncs->serviceWriteQueue(ctx->recCtx));
@@ -52,6 +52,12 @@ OSStatus SSLReadRecord(
 	SSLRecord 	*rec,
 	SSLContext 	*ctx);
 
+OSStatus SSLReadRecordInto(
+	SSLRecord 	*rec,
+	uint8_t 	*data,
+	size_t 		length,
+	SSLContext 	*ctx);
+
 OSStatus SSLServiceWriteQueue(
     SSLContext  *ctx);
 
@@ -224,7 +224,12 @@ readRetry:
     if (ctx->receivedDataBuffer.data != 0 &&
         ctx->receivedDataPos >= ctx->receivedDataBuffer.length)
     {
-        SSLFreeBuffer(&ctx->receivedDataBuffer);
+        /* This may be lent by the record layer, give it back */
+        rec.contentType = SSL_RecordTypeAppData;
+        rec.contents = ctx->receivedDataBuffer;
+        if ((err = SSLFreeRecord(rec, ctx))) {
+            goto exit;
+        }
         ctx->receivedDataBuffer.data = 0;
         ctx->receivedDataPos = 0;
     }
@@ -235,15 +240,16 @@ readRetry:
     if (remaining > 0 && ctx->state != SSL_HdskStateGracefulClose)
     {
         assert(ctx->receivedDataBuffer.data == 0);
-        if ((err = SSLReadRecord(&rec, ctx)) != 0) {
+        if ((err = SSLReadRecordInto(&rec, charPtr, remaining, ctx)) != 0) {
             goto exit;
         }
         if (rec.contentType == SSL_RecordTypeAppData ||
             rec.contentType == SSL_RecordTypeV2_0)
         {
             if (rec.contents.length <= remaining)
-            {   /* Copy all we got in the user's buffer */
-                memcpy(charPtr, rec.contents.data, rec.contents.length);
+            {   /* Copy all we got in the user's buffer, unless it was decrypted there */
+                if (rec.contents.data != charPtr)
+                    memcpy(charPtr, rec.contents.data, rec.contents.length);
                 *processed += rec.contents.length;
                 {
                     if ((err = SSLFreeRecord(rec, ctx))) {
@@ -79,6 +79,7 @@ enum
 typedef enum
 {
     kSSLRecordOptionSendOneByteRecord = 0,
+    kSSLRecordOptionReadAhead = 1,
 } SSLRecordOption;
 
 /*
@@ -47,6 +47,8 @@ struct SSLRecordInternalContext;
 typedef struct WaitingRecord
 {   struct WaitingRecord    *next;
     size_t                  sent;
+    /* Size of data[]; records are reused for anything that fits. */
+    size_t                  capacity;
     /*
      * These two fields replace a dynamically allocated SSLBuffer;
      * the payload to write is contained in the variable-length
@@ -69,6 +71,21 @@ struct SSLRecordInternalContext
     size_t              amountRead;
 
     WaitingRecord       *recordWriteQueue;
+    WaitingRecord       *recordWriteQueueTail;
+
+    /* A sent full size record kept for reuse until the session is destroyed. */
+    WaitingRecord       *recordSpare;
+
+    /* Read-ahead mode (kSSLRecordOptionReadAhead) */
+    bool                readAhead;
+    SSLBuffer           readAheadBuffer;
+    size_t              readAheadStart;     /* first byte not yet handed out */
+    size_t              readAheadEnd;       /* end of the bytes read so far */
+    SSLBuffer           plaintextBuffer;    /* reused for decrypted records */
+    uint8_t             *readDest;          /* SSLRead buffer, see SSLRecordReadIntoInternal */
+    size_t              readDestLength;
+    /* Contents of the last record handed out when not owned by the record, or NULL */
+    uint8_t             *lentPlaintext;
 };
 
 #ifdef	__cplusplus
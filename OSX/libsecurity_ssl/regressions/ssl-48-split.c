@@ -28,6 +28,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <mach/mach_time.h>
@@ -48,6 +49,7 @@ typedef struct {
     int comm;
     CFArrayRef certs;
     int write_counter;
+    int writev_counter;
     tls_stream_parser_t parser;
     size_t write_size;
 } ssl_test_handle;
@@ -105,6 +107,34 @@ static OSStatus SocketWrite(SSLConnectionRef h, const void *data, size_t *length
     return errSecSuccess;
 }
 
+/* Only used by the server, so everything written goes through the parser. */
+static OSStatus SocketWritev(SSLConnectionRef h, const struct iovec *iov, int iovcnt, size_t *length)
+{
+    ssl_test_handle *handle =(ssl_test_handle *)h;
+    int conn = handle->comm;
+    ssize_t ret;
+
+    handle->writev_counter++;
+
+    do {
+        ret = writev(conn, iov, iovcnt);
+    } while ((ret < 0) && (errno == EAGAIN || errno == EINTR));
+    if (ret <= 0)
+        return -36;
+
+    size_t left = ret;
+    for (int i = 0; i < iovcnt && left; i++) {
+        tls_buffer buffer;
+        buffer.data = iov[i].iov_base;
+        buffer.length = iov[i].iov_len < left ? iov[i].iov_len : left;
+        tls_stream_parser_parse(handle->parser, buffer);
+        left -= buffer.length;
+    }
+
+    *length = ret;
+    return errSecSuccess;
+}
+
 static OSStatus SocketRead(SSLConnectionRef h, void *data, size_t *length)
 {
     const ssl_test_handle *handle=h;
@@ -133,6 +163,26 @@ static OSStatus SocketRead(SSLConnectionRef h, void *data, size_t *length)
     return errSecSuccess;
 }
 
+/* Return whatever is available, as required in read-ahead mode */
+static OSStatus SocketReadSome(SSLConnectionRef h, void *data, size_t *length)
+{
+    const ssl_test_handle *handle=h;
+    int conn = handle->comm;
+    ssize_t ret;
+
+    do {
+        ret = read((int)conn, data, *length);
+    } while ((ret < 0) && (errno == EAGAIN || errno == EINTR));
+
+    if (ret <= 0) {
+        *length = 0;
+        return -36;
+    }
+
+    *length = ret;
+    return errSecSuccess;
+}
+
 static int process(tls_stream_parser_ctx_t ctx, tls_buffer record)
 {
     ssl_test_handle *handle = (ssl_test_handle *)ctx;
@@ -234,6 +284,7 @@ ssl_test_handle_create(bool server, int comm, CFArrayRef certs)
     handle->certs = certs;
     handle->st = ctx;
     handle->write_counter = 0;
+    handle->writev_counter = 0;
     handle->parser = tls_stream_parser_create(handle, process);
 
     return handle;
@@ -285,12 +336,14 @@ tests(void)
     CFArrayRef server_certs = server_chain();
     ok(server_certs, "got server certs");
 
-    int i,j,k,s;
+    int i,j,k,s,w,r;
 
     for(i=0; i<nciphers; i++)
     for(j=0; j<nversions; j++)
     for(k=0; k<nwsizes; k++)
     for(s=0; s<3; s++)
+    for(w=0; w<2; w++)
+    for(r=0; r<2; r++)
     {
         int sp[2];
         if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp)) exit(errno);
@@ -317,7 +370,16 @@ tests(void)
             // s=2: expliciti disable
             require_noerr(SSLSetSessionOption(server->st, kSSLSessionOptionSendOneByteRecord, (s==1)?true:false), out);
         }
-        // printf("**** Test Case: i=%d, j=%d, k=%d (%zd), s=%d ****\n", i, j, k, wsizes[k][0], s);
+        if(w) {
+            // w=1: server flushes queued records with gather writes
+            require_noerr(SSLSetIOVecWriteFunc(server->st, (SSLWritevFunc)SocketWritev), out);
+        }
+        if(r) {
+            // r=1: client reads ahead, taking whatever the socket has
+            require_noerr(SSLSetIOFuncs(client->st, (SSLReadFunc)SocketReadSome, (SSLWriteFunc)SocketWrite), out);
+            require_noerr(SSLSetReadAheadEnabled(client->st, true), out);
+        }
+        // printf("**** Test Case: i=%d, j=%d, k=%d (%zd), s=%d, w=%d, r=%d ****\n", i, j, k, wsizes[k][0], s, w, r);
 
         pthread_create(&client_thread, NULL, securetransport_ssl_thread, client);
         pthread_create(&server_thread, NULL, securetransport_ssl_thread, server);
@@ -334,6 +396,7 @@ tests(void)
         int expected_count = (int)(expected_split ? wsizes[k][2]: wsizes[k][1]);
 
         is(server->write_counter, expected_count, "wrong number of data records");
+        is(server->writev_counter > 0, w != 0, "server used gather writes only when asked to");
 
         // fprintf(stderr, "Server write counter = %d, expected %d\n", server->write_counter, expected_count);
 
@@ -348,7 +411,7 @@ out:
 int ssl_48_split(int argc, char *const *argv)
 {
 
-    plan_tests(1 + nciphers*nversions*nwsizes*3 * 3);
+    plan_tests(1 + nciphers*nversions*nwsizes*3*2*2 * 4);
 
 
     tests();
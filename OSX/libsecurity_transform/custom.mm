@@ -32,6 +32,7 @@
 #import "SecSignVerifyTransform.h"
 #import "SecNullTransform.h"
 #import "SecExternalSourceTransform.h"
+#import "SecCollectTransform.h"
 #import <Security/SecItem.h>
 #import "misc.h"
 #import "Utilities.h"
@@ -1361,6 +1362,322 @@ static SecTransformInstanceBlock nopInstance(CFStringRef name, SecTransformRef n
     CFRelease(resolved_url);
 }
 
+static CFDataRef DigestStream(CFReadStreamRef stream, CFTypeRef chunkSize, CFErrorRef *error)
+{
+	SecTransformRef digest = SecDigestTransformCreate(kSecDigestSHA2, 256, error);
+	if (NULL == digest)
+	{
+		return NULL;
+	}
+	
+	if (chunkSize)
+	{
+		SecTransformSetAttribute(digest, kSecTransformStreamChunkSizeAttributeName, chunkSize, error);
+	}
+	SecTransformSetAttribute(digest, kSecTransformInputAttributeName, stream, error);
+	CFDataRef result = (CFDataRef)SecTransformExecute(digest, error);
+	CFRelease(digest);
+	
+	return result;
+}
+
+-(void)testStreamSourceChunkSizes
+{
+	NSError *err = NULL;
+	NSData *d = [NSData dataWithContentsOfFile:@"/usr/share/dict/words" options:NSDataReadingMapped error: &err];
+	STAssertNil(err, @"dataWithContentsOfFile %@", err);
+	
+	CFReadStreamRef referenceStream = CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[d bytes], [d length], kCFAllocatorNull);
+	CFDataRef reference = DigestStream(referenceStream, NULL, (CFErrorRef *)&err);
+	STAssertNil(err, @"Unexpected error %@ digesting with the default chunk size", err);
+	STAssertNotNil((id)reference, @"No digest with the default chunk size");
+	CFRelease(referenceStream);
+	
+	// sizes outside of 64K..1M get clamped, and non-numbers are ignored
+	NSArray *chunkSizes = [NSArray arrayWithObjects:[NSNumber numberWithInt:1], [NSNumber numberWithInt:64 * 1024], [NSNumber numberWithInt:100 * 1000],
+						   [NSNumber numberWithInt:1024 * 1024], [NSNumber numberWithInt:16 * 1024 * 1024], @"big", nil];
+	for (id chunkSize in chunkSizes)
+	{
+		CFReadStreamRef stream = CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[d bytes], [d length], kCFAllocatorNull);
+		CFDataRef result = DigestStream(stream, (CFTypeRef)chunkSize, (CFErrorRef *)&err);
+		STAssertNil(err, @"Unexpected error %@ with chunk size %@", err, chunkSize);
+		STAssertEqualObjects((id)result, (id)reference, @"Digest mismatch with chunk size %@", chunkSize);
+		if (result)
+		{
+			CFRelease(result);
+		}
+		CFRelease(stream);
+	}
+	
+	if (reference)
+	{
+		CFRelease(reference);
+	}
+}
+
+-(void)testStreamSourceThroughput
+{
+	// This reports MB/s for digest and encrypt chains fed from a stream so changes to
+	// StreamSource (chunk size, credits) can be compared, and checks that no chain has more
+	// chunks outstanding than StreamSource's credits plus whatever overdraft it allowed after
+	// a stall.  Whether a stall happens at all depends on scheduling, so the bound is taken
+	// from the overdraft the library reports rather than assumed to be zero.
+	const NSUInteger kLength = 64 * 1024 * 1024;
+	NSMutableData *d = [NSMutableData dataWithLength:kLength];
+	
+	const char *aes_kbytes = "0123456789012345";
+	NSDictionary *parm = [NSDictionary dictionaryWithObjectsAndKeys:
+						  (id)kSecAttrKeyClassSymmetric, kSecAttrKeyClass,
+						  (id)kSecAttrKeyTypeAES, kSecAttrKeyType,
+						  (id)kCFBooleanFalse, kSecAttrIsPermanent,
+						  NULL];
+	CFErrorRef err = NULL;
+	SecKeyRef k = SecKeyCreateFromData((CFDictionaryRef)parm, (CFDataRef)[NSData dataWithBytes:aes_kbytes length:strlen(aes_kbytes)], &err);
+	STAssertNotNil((id)k, @"SecKeyCreateFromData err=%@", err);
+	if (NULL == k)
+	{
+		return;
+	}
+	
+	NSArray *chunkSizes = [NSArray arrayWithObjects:[NSNumber numberWithInt:64 * 1024], [NSNumber numberWithInt:256 * 1024], [NSNumber numberWithInt:1024 * 1024], nil];
+	for (NSNumber *chunkSize in chunkSizes)
+	{
+		for (int encrypt = 0; encrypt < 2; ++encrypt)
+		{
+			CFReadStreamRef stream = CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[d bytes], [d length], kCFAllocatorNull);
+			SecGroupTransformRef group = SecTransformCreateGroupTransform();
+			SecTransformRef digest = SecDigestTransformCreate(kSecDigestSHA2, 256, &err);
+			SecTransformRef head = digest;
+			SecTransformRef et = NULL;
+			
+			if (encrypt)
+			{
+				et = SecEncryptTransformCreate(k, &err);
+				SecTransformConnectTransforms(et, kSecTransformOutputAttributeName, digest, kSecTransformInputAttributeName, group, &err);
+				head = et;
+			}
+			
+			SecTransformSetAttribute(head, kSecTransformStreamChunkSizeAttributeName, (CFNumberRef)chunkSize, &err);
+			SecTransformSetAttribute(head, kSecTransformInputAttributeName, stream, &err);
+			
+			SecTransformStreamSourcePeakChunks(NULL);
+			CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+			CFTypeRef result = SecTransformExecute(encrypt ? group : digest, &err);
+			CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+			CFIndex overdraft = 0;
+			CFIndex peak = SecTransformStreamSourcePeakChunks(&overdraft);
+			
+			STAssertNil((id)err, @"Unexpected error %@", err);
+			STAssertNotNil((id)result, @"No result");
+			STAssertTrue(peak > 0 && peak <= kSecTransformStreamChunkCredits + overdraft, @"%ld chunks outstanding, expected at most %ld credits + %ld overdraft", (long) peak, (long) kSecTransformStreamChunkCredits, (long) overdraft);
+			NSLog(@"%@ chain, %@ byte chunks: %.1f MB/s (%ld chunk overdraft)", encrypt ? @"encrypt+digest" : @"digest", chunkSize, (kLength / (1024.0 * 1024.0)) / elapsed, (long) overdraft);
+			
+			if (result)
+			{
+				CFRelease(result);
+			}
+			if (et)
+			{
+				CFRelease(et);
+			}
+			CFRelease(digest);
+			CFRelease(group);
+			CFRelease(stream);
+		}
+	}
+	
+	CFRelease(k);
+}
+
+-(void)testStreamSourceAccumulates
+{
+	// A transform that may hold on to every chunk it is given never returns a credit, so
+	// StreamSource has to go past its credits (a bounded number at a time) to finish.
+	const NSUInteger kLength = 16 * 1024 * 1024;
+	NSMutableData *d = [NSMutableData dataWithLength:kLength];
+	CFErrorRef err = NULL;
+	
+	CFReadStreamRef stream = CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[d bytes], [d length], kCFAllocatorNull);
+	SecTransformRef collect = SecCreateCollectTransform(&err);
+	STAssertNotNil((id)collect, @"SecCreateCollectTransform err=%@", err);
+	SecTransformSetAttribute(collect, kSecTransformInputAttributeName, stream, &err);
+	
+	CFDataRef result = (CFDataRef)SecTransformExecute(collect, &err);
+	
+	STAssertNil((id)err, @"Unexpected error %@", err);
+	STAssertEqualObjects((id)result, d, @"Collected data doesn't match the stream");
+	
+	if (result)
+	{
+		CFRelease(result);
+	}
+	CFRelease(collect);
+	CFRelease(stream);
+}
+
+static CFDataRef AESStream(SecKeyRef key, Boolean encrypt, CFStringRef mode, CFStringRef padding, CFDataRef iv, NSData *data, CFErrorRef *error)
+{
+	SecTransformRef cryptor = encrypt ? SecEncryptTransformCreate(key, error) : SecDecryptTransformCreate(key, error);
+	if (NULL == cryptor)
+	{
+		return NULL;
+	}
+	
+	SecTransformSetAttribute(cryptor, kSecEncryptionMode, mode, error);
+	SecTransformSetAttribute(cryptor, kSecPaddingKey, padding, error);
+	if (iv)
+	{
+		SecTransformSetAttribute(cryptor, kSecIVKey, iv, error);
+	}
+	// an odd chunk size, so the CSP's update calls split the input in the middle of AES blocks
+	// (sizes below 64K are clamped to 64K, which would keep every chunk block aligned)
+	SecTransformSetAttribute(cryptor, kSecTransformStreamChunkSizeAttributeName, (CFNumberRef)[NSNumber numberWithInt:64 * 1024 + 7], error);
+	CFReadStreamRef stream = CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[data bytes], [data length], kCFAllocatorNull);
+	SecTransformSetAttribute(cryptor, kSecTransformInputAttributeName, stream, error);
+	CFDataRef result = (CFDataRef)SecTransformExecute(cryptor, error);
+	CFRelease(stream);
+	CFRelease(cryptor);
+	
+	return result;
+}
+
+static SecKeyRef AESTestKey(const uint8_t *bytes, size_t length)
+{
+	NSDictionary *parm = [NSDictionary dictionaryWithObjectsAndKeys:
+						  (id)kSecAttrKeyClassSymmetric, kSecAttrKeyClass,
+						  (id)kSecAttrKeyTypeAES, kSecAttrKeyType,
+						  (id)kCFBooleanFalse, kSecAttrIsPermanent,
+						  NULL];
+	return SecKeyCreateFromData((CFDictionaryRef)parm, (CFDataRef)[NSData dataWithBytes:bytes length:length], NULL);
+}
+
+-(void)testAESModesMatchCommonCrypto
+{
+	const uint8_t rawKey[kCCKeySizeAES256] = { 63, 17, 27, 99, 185, 231, 1, 191, 217, 74, 141, 16, 12, 99, 253, 41,
+											   3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3 };
+	const uint8_t rawIV[kCCBlockSizeAES128] = { 2, 7, 1, 8, 2, 8, 1, 8, 2, 8, 4, 5, 9, 0, 4, 5 };
+	CFDataRef iv = CFDataCreate(NULL, rawIV, sizeof(rawIV));
+	
+	NSMutableData *source = [NSMutableData dataWithLength:1024 * 1024 + 5];
+	uint8_t *bytes = (uint8_t *)[source mutableBytes];
+	for (NSUInteger i = 0; i < [source length]; ++i)
+	{
+		bytes[i] = (uint8_t)(i * 131 + (i >> 8));
+	}
+	
+	size_t keySizes[] = { kCCKeySizeAES128, kCCKeySizeAES256 };
+	for (int k = 0; k < 2; ++k)
+	{
+		SecKeyRef key = AESTestKey(rawKey, keySizes[k]);
+		STAssertNotNil((id)key, @"Couldn't make a %zu byte AES key", keySizes[k]);
+		
+		for (int cbc = 0; cbc < 2; ++cbc)
+		{
+			for (int pad = 0; pad < 2; ++pad)
+			{
+				NSData *plain = pad ? source : [source subdataWithRange:NSMakeRange(0, [source length] & ~(NSUInteger)(kCCBlockSizeAES128 - 1))];
+				CCOptions options = (cbc ? 0 : kCCOptionECBMode) | (pad ? kCCOptionPKCS7Padding : 0);
+				NSMutableData *reference = [NSMutableData dataWithLength:[plain length] + kCCBlockSizeAES128];
+				size_t moved = 0;
+				CCCryptorStatus status = CCCrypt(kCCEncrypt, kCCAlgorithmAES128, options, rawKey, keySizes[k], cbc ? rawIV : NULL,
+												 [plain bytes], [plain length], [reference mutableBytes], [reference length], &moved);
+				STAssertEquals(status, (CCCryptorStatus)kCCSuccess, @"CCCrypt failed");
+				[reference setLength:moved];
+				
+				CFErrorRef error = NULL;
+				CFStringRef mode = cbc ? kSecModeCBCKey : kSecModeECBKey;
+				CFStringRef padding = pad ? kSecPaddingPKCS7Key : kSecPaddingNoneKey;
+				CFDataRef encrypted = AESStream(key, true, mode, padding, cbc ? iv : NULL, plain, &error);
+				STAssertNil((id)error, @"Unexpected encrypt error %@ (%@, %@)", error, mode, padding);
+				STAssertEqualObjects((id)encrypted, reference, @"Ciphertext differs from CommonCrypto's (%@, %@, %zu byte key)", mode, padding, keySizes[k]);
+				
+				CFDataRef decrypted = AESStream(key, false, mode, padding, cbc ? iv : NULL, reference, &error);
+				STAssertNil((id)error, @"Unexpected decrypt error %@ (%@, %@)", error, mode, padding);
+				STAssertEqualObjects((id)decrypted, plain, @"Round trip failed (%@, %@, %zu byte key)", mode, padding, keySizes[k]);
+				
+				if (encrypted)
+				{
+					CFRelease(encrypted);
+				}
+				if (decrypted)
+				{
+					CFRelease(decrypted);
+				}
+			}
+		}
+		if (key)
+		{
+			CFRelease(key);
+		}
+	}
+	CFRelease(iv);
+}
+
+-(void)testAESModesThroughput
+{
+	// Not a pass/fail test, this reports MB/s through the CSP's AES for each mode and direction.
+	const NSUInteger kLength = 64 * 1024 * 1024;
+	NSData *plain = [NSMutableData dataWithLength:kLength];
+	const uint8_t rawKey[kCCKeySizeAES128] = { 63, 17, 27, 99, 185, 231, 1, 191, 217, 74, 141, 16, 12, 99, 253, 41 };
+	const uint8_t rawIV[kCCBlockSizeAES128] = { 0 };
+	CFDataRef iv = CFDataCreate(NULL, rawIV, sizeof(rawIV));
+	SecKeyRef key = AESTestKey(rawKey, sizeof(rawKey));
+	STAssertNotNil((id)key, @"Couldn't make an AES key");
+	if (NULL == key)
+	{
+		CFRelease(iv);
+		return;
+	}
+	
+	CFStringRef modes[] = { kSecModeECBKey, kSecModeCBCKey };
+	for (int m = 0; m < 2; ++m)
+	{
+		CFDataRef input = NULL;
+		for (int encrypt = 1; encrypt >= 0; --encrypt)
+		{
+			SecTransformRef cryptor = encrypt ? SecEncryptTransformCreate(key, NULL) : SecDecryptTransformCreate(key, NULL);
+			SecTransformSetAttribute(cryptor, kSecEncryptionMode, modes[m], NULL);
+			SecTransformSetAttribute(cryptor, kSecPaddingKey, kSecPaddingNoneKey, NULL);
+			if (modes[m] == kSecModeCBCKey)
+			{
+				SecTransformSetAttribute(cryptor, kSecIVKey, iv, NULL);
+			}
+			CFReadStreamRef stream = encrypt
+				? CFReadStreamCreateWithBytesNoCopy(NULL, (const UInt8*)[plain bytes], [plain length], kCFAllocatorNull)
+				: CFReadStreamCreateWithBytesNoCopy(NULL, CFDataGetBytePtr(input), CFDataGetLength(input), kCFAllocatorNull);
+			SecTransformSetAttribute(cryptor, kSecTransformInputAttributeName, stream, NULL);
+			
+			CFErrorRef error = NULL;
+			CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+			CFDataRef result = (CFDataRef)SecTransformExecute(cryptor, &error);
+			CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+			
+			STAssertNil((id)error, @"Unexpected error %@", error);
+			STAssertNotNil((id)result, @"No result");
+			NSLog(@"AES-128 %@ %@: %.1f MB/s", modes[m], encrypt ? @"encrypt" : @"decrypt", (kLength / (1024.0 * 1024.0)) / elapsed);
+			if (!encrypt)
+			{
+				STAssertEqualObjects((id)result, plain, @"Round trip failed for %@", modes[m]);
+			}
+			
+			CFRelease(stream);
+			CFRelease(cryptor);
+			if (input)
+			{
+				CFRelease(input);
+			}
+			input = result;
+		}
+		if (input)
+		{
+			CFRelease(input);
+		}
+	}
+	
+	CFRelease(key);
+	CFRelease(iv);
+}
+
 -(void)testMGF
 {
     UInt8 raw_seed[] = {0xaa, 0xfd, 0x12, 0xf6, 0x59, 0xca, 0xe6, 0x34, 0x89, 0xb4, 0x79, 0xe5, 0x07, 0x6d, 0xde, 0xc2, 0xf0, 0x6c, 0xb5, 0x8f};
@@ -3835,6 +4152,65 @@ static SecTransformInstanceBlock LineLengthCheck(CFStringRef name, SecTransformR
 	dispatch_group_wait(dg, DISPATCH_TIME_FOREVER);
 }
 
+-(void)testFusedChains
+{
+	// encode -> decode -> digest chains run fused on one queue, make sure they get the same
+	// answer (and the same errors) as the digest alone
+	NSError *err = NULL;
+	NSData *d = [NSData dataWithContentsOfFile:@"/usr/share/dict/web2a" options:NSDataReadingMapped error: &err];
+	STAssertNil(err, @"dataWithContentsOfFile %@", err);
+	
+	SecTransformRef digest = SecDigestTransformCreate(kSecDigestSHA2, 256, (CFErrorRef *)&err);
+	SecTransformSetAttribute(digest, kSecTransformInputAttributeName, (CFDataRef)d, (CFErrorRef *)&err);
+	CFDataRef expected = (CFDataRef)SecTransformExecute(digest, (CFErrorRef *)&err);
+	STAssertNil(err, @"Unexpected error %@ from the lone digest", err);
+	CFRelease(digest);
+	
+	CFStringRef types[] = {kSecZLibEncoding, kSecBase64Encoding, kSecBase32Encoding, NULL};
+	for(int i = 0; types[i]; i++) {
+		SecGroupTransformRef group = SecTransformCreateGroupTransform();
+		SecTransformRef et = SecEncodeTransformCreate(types[i], (CFErrorRef *)&err);
+		SecTransformRef dt = SecDecodeTransformCreate(types[i], (CFErrorRef *)&err);
+		digest = SecDigestTransformCreate(kSecDigestSHA2, 256, (CFErrorRef *)&err);
+		
+		SecTransformConnectTransforms(et, kSecTransformOutputAttributeName, dt, kSecTransformInputAttributeName, group, (CFErrorRef *)&err);
+		SecTransformConnectTransforms(dt, kSecTransformOutputAttributeName, digest, kSecTransformInputAttributeName, group, (CFErrorRef *)&err);
+		
+		NSInputStream *is = [NSInputStream inputStreamWithData:d];
+		SecTransformSetAttribute(et, kSecTransformInputAttributeName, (CFTypeRef)is, (CFErrorRef *)&err);
+		
+		CFDataRef result = (CFDataRef)SecTransformExecute(group, (CFErrorRef *)&err);
+		STAssertNil(err, @"Unexpected error %@ from the %@ chain", err, types[i]);
+		STAssertEqualObjects((id)result, (id)expected, @"Digest mismatch through the %@ chain", types[i]);
+		
+		if (result) {
+			CFRelease(result);
+		}
+		CFRelease(et);
+		CFRelease(dt);
+		CFRelease(digest);
+		CFRelease(group);
+	}
+	
+	// a decode error in the middle of a fused chain still comes back from SecTransformExecute
+	SecGroupTransformRef group = SecTransformCreateGroupTransform();
+	SecTransformRef dt = SecDecodeTransformCreate(kSecZLibEncoding, (CFErrorRef *)&err);
+	digest = SecDigestTransformCreate(kSecDigestSHA2, 256, (CFErrorRef *)&err);
+	SecTransformConnectTransforms(dt, kSecTransformOutputAttributeName, digest, kSecTransformInputAttributeName, group, (CFErrorRef *)&err);
+	SecTransformSetAttribute(dt, kSecTransformInputAttributeName, (CFDataRef)[@"not zlib compressed at all" dataUsingEncoding:NSUTF8StringEncoding], (CFErrorRef *)&err);
+	CFTypeRef result = SecTransformExecute(group, (CFErrorRef *)&err);
+	STAssertNil((id)result, @"Expected no result from a bad zlib stream");
+	STAssertNotNil(err, @"Expected an error from a bad zlib stream");
+	err = NULL;
+	CFRelease(dt);
+	CFRelease(digest);
+	CFRelease(group);
+	
+	if (expected) {
+		CFRelease(expected);
+	}
+}
+
 -(void)testZLib {
 	SecTransformRef et = SecEncodeTransformCreate(kSecZLibEncoding, NULL);
 	SecTransformRef dt = SecDecodeTransformCreate(kSecZLibEncoding, NULL);
@@ -425,6 +425,13 @@ DigestTransform::~DigestTransform()
 
 
 
+bool DigestTransform::CanFuse()
+{
+	return true;
+}
+
+
+
 void DigestTransform::AttributeChanged(CFStringRef name, CFTypeRef value)
 {
 	if (CFStringCompare(name, kSecTransformInputAttributeName, 0) == kCFCompareEqualTo)
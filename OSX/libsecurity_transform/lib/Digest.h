@@ -193,6 +193,7 @@ public:
 	CFErrorRef Setup(CFTypeRef digestType, CFIndex length);
 	
 	virtual void AttributeChanged(CFStringRef name, CFTypeRef value);
+	virtual bool CanFuse();
 
 	static TransformFactory* MakeTransformFactory();
 	
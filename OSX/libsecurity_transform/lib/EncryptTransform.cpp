@@ -309,6 +309,16 @@ Boolean EncryptDecryptBase::TransformCanExecute()
 	return key != NULL;
 }
 
+/* --------------------------------------------------------------------------
+ method: 		CanFuse
+ description: 	Encrypt and decrypt only touch their own state, so they can
+ 				share a queue with the rest of a straight chain
+ -------------------------------------------------------------------------- */
+bool EncryptDecryptBase::CanFuse()
+{
+	return true;
+}
+
 void EncryptDecryptBase::SendCSSMError(CSSM_RETURN retCode)
 {
 	// make a CFErrorRef for the error message
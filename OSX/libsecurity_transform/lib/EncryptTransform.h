@@ -64,6 +64,7 @@ protected:
 	virtual CFErrorRef 		TransformStartingExecution();
 	CFErrorRef				SerializedTransformStartingExecution();
 	virtual void 			AttributeChanged(SecTransformAttributeRef ah, CFTypeRef value);
+	virtual bool			CanFuse();
 	
 	CFDataRef				apply_oaep_padding(CFDataRef value);
 	CFDataRef				remove_oaep_padding(CFDataRef value);
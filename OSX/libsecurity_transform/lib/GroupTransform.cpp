@@ -441,6 +441,48 @@ void GroupTransform::RecurseForAllNodes(dispatch_group_t group, CFErrorRef *err_
     dispatch_group_leave(group);
 }
 
+// Find straight runs of transforms that can be fused (see Transform::CanFuse) and make each
+// run share the queue of its first transform.   Every chunk then flows down the run on one
+// queue without a dispatch per stage.   Called once all connections are made, just before
+// execution starts.
+void GroupTransform::FuseLinearChains()
+{
+	// maps each fusible transform to the fusible transform feeding it
+	CFMutableDictionaryRef upstream = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+	
+	ForAllNodes(false, false, ^(Transform *t) {
+		Transform *next = t->FusibleSuccessor();
+		if (next)
+		{
+			CFDictionarySetValue(upstream, next, t);
+		}
+		return (CFErrorRef)NULL;
+	});
+	
+	CFIndex i, count = CFDictionaryGetCount(upstream);
+	const void **fused = (const void **)alloca(count * sizeof(void*));
+	CFDictionaryGetKeysAndValues(upstream, fused, NULL);
+	
+	for(i = 0; i < count; ++i)
+	{
+		// walk back to the start of the run, a cycle has no start and is left alone (a queue can't target itself)
+		const void *head = fused[i], *prev = NULL;
+		CFIndex steps = 0;
+		while (steps <= count && CFDictionaryGetValueIfPresent(upstream, head, &prev))
+		{
+			head = prev;
+			steps++;
+		}
+		
+		if (steps <= count)
+		{
+			((Transform*)fused[i])->FuseOnto((Transform*)head);
+		}
+	}
+	
+	CFRelease(upstream);
+}
+
 // Return a dot (GraphViz) description of the group.
 // For debugging use.   Exact content and style may
 // change.   Currently all transforms and attributes
@@ -50,6 +50,8 @@ public:
 	
     CFErrorRef ForAllNodes(bool parallel, bool opExecutesOnGroups, Transform::TransformOperation op);
 	void ForAllNodesAsync(bool opExecutesOnGroups, dispatch_group_t group, Transform::TransformAsyncOperation op);
+	
+	void FuseLinearChains();
 
     CFStringRef DotForDebugging();
 };
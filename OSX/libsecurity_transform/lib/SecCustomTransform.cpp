@@ -514,6 +514,7 @@ public:
 	virtual void AttributeChanged(CFStringRef name, CFTypeRef value);
 	virtual void AttributeChanged(SecTransformAttributeRef ah, CFTypeRef value);
 	virtual CFErrorRef TransformStartingExecution();
+	virtual bool CanFuse();
 	virtual CFDictionaryRef GetCustomExternalData();
 	virtual void SetCustomExternalData(CFDictionaryRef customData);
 	
@@ -1010,6 +1011,13 @@ CFErrorRef CustomTransform::TransformStartingExecution()
 	return (CFErrorRef)result;
 }
 
+bool CustomTransform::CanFuse()
+{
+	// Only our own encoders and decoders (see EncodeDecodeTransforms.c), there is no telling
+	// what a third party's blocks expect of the queue they run on
+	return CFEqual(mTypeName, CFSTR("com.apple.security.Encoder")) || CFEqual(mTypeName, CFSTR("com.apple.security.Decoder"));
+}
+
 
 CFDictionaryRef CustomTransform::GetCustomExternalData()
 {
@@ -20,6 +20,7 @@ const CFStringRef kSecTransformTransformName = CFSTR("NAME");
 //const CFStringRef kSecTransformErrorTransform = CFSTR("TRANSFORM");
 const CFStringRef kSecTransformErrorDomain = CFSTR("com.apple.security.transforms.error");
 const CFStringRef kSecTransformAbortAttributeName = CFSTR("ABORT");
+const CFStringRef kSecTransformStreamChunkSizeAttributeName = CFSTR("STREAM_CHUNK_SIZE");
 
 CFErrorRef SecTransformConnectTransformsInternal(SecGroupTransformRef groupRef,
 							        SecTransformRef sourceTransformRef,
@@ -24,6 +24,25 @@ bool SecGroupTransformHasMember(SecGroupTransformRef groupTransform, SecTransfor
 CF_EXPORT
 CFStringRef SecTransformDotForDebugging(SecTransformRef transformRef);
 
+// Set this (a CFNumber) on a transform before its execution begins to choose the
+// size of the chunks read from a CFReadStreamRef attached to it.  Values are
+// clamped to 64K..1M, and 64K is used when it is unset.
+CF_EXPORT
+const CFStringRef kSecTransformStreamChunkSizeAttributeName;
+
+// A transform reading from a CFReadStreamRef has at most this many chunks outstanding (read
+// but not yet released downstream) while downstream keeps up.  Each time it waits too long
+// for one to come back it may go past that by an overdraft, kSecTransformStreamChunkCredits
+// chunks the first time and twice the previous overdraft each time after that, until a
+// chunk is released again.
+enum { kSecTransformStreamChunkCredits = 4 };
+
+// For the unit tests, which link this library directly: the most chunks read from a
+// CFReadStreamRef that were outstanding at once since the previous call, and in
+// *peakOverdraft (if not NULL) the largest overdraft allowed; both are reset.
+__attribute__((visibility("hidden")))
+CFIndex SecTransformStreamSourcePeakChunks(CFIndex* peakOverdraft);
+
 
     
 #ifdef __cplusplus
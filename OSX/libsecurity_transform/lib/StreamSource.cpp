@@ -1,17 +1,267 @@
 #include "StreamSource.h"
+#include "SecTransformInternal.h"
 #include <string>
+#include <vector>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
 #include "misc.h"
 
 using namespace std;
 
 CFStringRef gStreamSourceName = CFSTR("StreamSource");
 
-const CFIndex kMaximumSize = 2048;
+const CFIndex kMinimumChunkSize = 64 * 1024;
+const CFIndex kMaximumChunkSize = 1024 * 1024;
+
+// The number of chunks a StreamSource may have outstanding (read but not yet released by
+// the transforms downstream) before it stops reading.   Remember the destination attribute
+// holds on to the last value it was given, so this must be at least 2.
+const long kChunkCredits = kSecTransformStreamChunkCredits;
+
+// How long to wait for a credit before deciding downstream is holding on to its chunks.
+const int64_t kStallTimeout = 250 * NSEC_PER_MSEC;
+
+// the most chunks any pool has had outstanding at once, and the largest overdraft any pool
+// has allowed, see SecTransformStreamSourcePeakChunks
+static volatile int32_t gPeakChunks = 0;
+static volatile int32_t gPeakAllowance = 0;
+
+static void RaisePeak(volatile int32_t *peak, int32_t value)
+{
+	int32_t current;
+	while (value > (current = *peak) && !OSAtomicCompareAndSwap32Barrier(current, value, peak))
+	{
+	}
+}
+
+static int32_t TakePeak(volatile int32_t *peak)
+{
+	int32_t current;
+	do
+	{
+		current = *peak;
+	} while (!OSAtomicCompareAndSwap32Barrier(current, 0, peak));
+	
+	return current;
+}
+
+
+
+// Hands out chunk sized buffers and takes them back when the CFData wrapped around them
+// is released, which is also how a credit is returned.   A CFData can't be resurrected once
+// it is released, so it is the storage under it that gets recycled.   The pool is owned by
+// the CFAllocator used as the CFData's deallocator, so it lives until the last chunk is gone
+// even if that is after the StreamSource itself.
+class StreamBufferPool
+{
+protected:
+	CFIndex mChunkSize;
+	dispatch_semaphore_t mCredits;
+	pthread_mutex_t mLock;
+	vector<UInt8*> mFree;
+	CFIndex mOutstanding;
+	CFIndex mOverdraft;
+	CFIndex mAllowance;
+	int32_t mRefCount;
+
+	~StreamBufferPool();
+
+	static const void *RetainCallback(const void *info);
+	static void ReleaseCallback(const void *info);
+	static void DeallocateCallback(void *ptr, void *info);
+
+public:
+	StreamBufferPool(CFIndex chunkSize);
+
+	static CFAllocatorRef Make(CFIndex chunkSize);
+	static StreamBufferPool* FromAllocator(CFAllocatorRef allocator);
+
+	UInt8* Checkout(Transform* destination);
+	void Recycle(UInt8* buffer);
+	CFIndex ChunkSize() const {return mChunkSize;}
+};
+
+
+
+StreamBufferPool::StreamBufferPool(CFIndex chunkSize)
+	: mChunkSize(chunkSize),
+	mCredits(dispatch_semaphore_create(kChunkCredits)),
+	mOutstanding(0),
+	mOverdraft(0),
+	mAllowance(0),
+	mRefCount(0)
+{
+	pthread_mutex_init(&mLock, NULL);
+}
+
+
+
+StreamBufferPool::~StreamBufferPool()
+{
+	for (vector<UInt8*>::iterator it = mFree.begin(); it != mFree.end(); ++it)
+	{
+		free(*it);
+	}
+	
+	pthread_mutex_destroy(&mLock);
+	dispatch_release(mCredits);
+}
+
+
+
+const void *StreamBufferPool::RetainCallback(const void *info)
+{
+	StreamBufferPool* pool = (StreamBufferPool*) info;
+	OSAtomicIncrement32Barrier(&pool->mRefCount);
+	return info;
+}
+
+
+
+void StreamBufferPool::ReleaseCallback(const void *info)
+{
+	StreamBufferPool* pool = (StreamBufferPool*) info;
+	if (OSAtomicDecrement32Barrier(&pool->mRefCount) == 0)
+	{
+		delete pool;
+	}
+}
+
+
+
+void StreamBufferPool::DeallocateCallback(void *ptr, void *info)
+{
+	((StreamBufferPool*) info)->Recycle((UInt8*) ptr);
+}
+
+
+
+CFAllocatorRef StreamBufferPool::Make(CFIndex chunkSize)
+{
+	StreamBufferPool* pool = new StreamBufferPool(chunkSize);
+	
+	// allocate is left NULL on purpose, this allocator is only ever used to give back bytes
+	CFAllocatorContext context = {0, pool, RetainCallback, ReleaseCallback, NULL, NULL, NULL, DeallocateCallback, NULL};
+	CFAllocatorRef allocator = CFAllocatorCreate(NULL, &context);
+	if (allocator == NULL)
+	{
+		delete pool;
+		return NULL;
+	}
+	
+	return allocator;
+}
+
+
+
+StreamBufferPool* StreamBufferPool::FromAllocator(CFAllocatorRef allocator)
+{
+	CFAllocatorContext context;
+	context.version = 0;
+	CFAllocatorGetContext(allocator, &context);
+	return (StreamBufferPool*) context.info;
+}
+
+
+
+UInt8* StreamBufferPool::Checkout(Transform* destination)
+{
+	// Wait for downstream to hand a chunk back.   If it is hanging on to everything we have
+	// given it (say a transform that accumulates its input) waiting won't help, so each time
+	// a wait times out allow a few more chunks that weren't paid for with a credit, twice as
+	// many as the last time.   The allowance is withdrawn as soon as a credit comes back, so a
+	// chain that is merely slow gets its backpressure back.
+	bool credited = (dispatch_semaphore_wait(mCredits, DISPATCH_TIME_NOW) == 0);
+	bool overdrawn = false;
+	
+	if (!credited)
+	{
+		pthread_mutex_lock(&mLock);
+		if (mOverdraft < mAllowance)
+		{
+			mOverdraft++;
+			overdrawn = true;
+		}
+		pthread_mutex_unlock(&mLock);
+		
+		if (!overdrawn)
+		{
+			credited = (dispatch_semaphore_wait(mCredits, dispatch_time(DISPATCH_TIME_NOW, kStallTimeout)) == 0);
+		}
+	}
+	
+	UInt8* buffer = NULL;
+	int32_t allowance = 0;
+	
+	pthread_mutex_lock(&mLock);
+	if (!credited && !overdrawn)
+	{
+		allowance = (int32_t) (mAllowance = mAllowance ? mAllowance * 2 : kChunkCredits);
+		mOverdraft++;
+		destination->Debug("StreamSource for %@ is out of credits, allowing %ld more chunks\n", destination->GetName(), (long) mAllowance);
+	}
+	else if (credited && !mFree.empty())
+	{
+		buffer = mFree.back();
+		mFree.pop_back();
+	}
+	
+	int32_t outstanding = (int32_t) ++mOutstanding;
+	pthread_mutex_unlock(&mLock);
+	
+	RaisePeak(&gPeakChunks, outstanding);
+	RaisePeak(&gPeakAllowance, allowance);
+	
+	if (buffer == NULL)
+	{
+		buffer = (UInt8*) malloc(mChunkSize);
+	}
+	
+	return buffer;
+}
+
+
+
+void StreamBufferPool::Recycle(UInt8* buffer)
+{
+	pthread_mutex_lock(&mLock);
+	mOutstanding--;
+	if (mOverdraft > 0)
+	{
+		// this buffer was never paid for with a credit, so there isn't one to give back
+		mOverdraft--;
+		pthread_mutex_unlock(&mLock);
+		free(buffer);
+		return;
+	}
+	
+	// downstream is letting go of chunks again, so stop handing out unpaid ones
+	mAllowance = 0;
+	mFree.push_back(buffer);
+	pthread_mutex_unlock(&mLock);
+	
+	dispatch_semaphore_signal(mCredits);
+}
+
+
+
+CFIndex SecTransformStreamSourcePeakChunks(CFIndex* peakOverdraft)
+{
+	if (peakOverdraft)
+	{
+		*peakOverdraft = TakePeak(&gPeakAllowance);
+	}
+	
+	return TakePeak(&gPeakChunks);
+}
+
+
 
 StreamSource::StreamSource(CFReadStreamRef input, Transform* transform, CFStringRef name)
 	: Source(gStreamSourceName, transform, name),
 	mReadStream(input),
-	mReading(dispatch_group_create())
+	mReading(dispatch_group_create()),
+	mChunkSize(kMinimumChunkSize)
 {
 	dispatch_group_enter(mReading);
 	CFRetain(mReadStream);
@@ -21,18 +271,40 @@ void StreamSource::BackgroundActivate()
 {
 	CFIndex result = 0;
 	
+	CFAllocatorRef chunkDeallocator = StreamBufferPool::Make(mChunkSize);
+	if (chunkDeallocator == NULL)
+	{
+		mDestination->SetAttribute(mDestinationName, GetNoMemoryError());
+		return;
+	}
+	
+	StreamBufferPool* pool = StreamBufferPool::FromAllocator(chunkDeallocator);
+	
 	do
 	{
-		// make a buffer big enough to handle the object
-		// NOTE: allocating this on the stack and letting CFDataCreate copy it is _faster_ then malloc and CFDataCreateWithBytes(..., kCFAllactorMalloc) by a fair margin.   At least for 2K chunks.   Retest if changing the size.
-		UInt8 buffer[kMaximumSize];
+		// Read straight into a pooled buffer and hand it downstream without copying it; the
+		// buffer comes back to the pool (along with its credit) when the data is released.
+		UInt8* buffer = pool->Checkout(mDestination);
+		if (buffer == NULL)
+		{
+			mDestination->SetAttribute(mDestinationName, GetNoMemoryError());
+			CFRelease(chunkDeallocator);
+			return;
+		}
 		
-		result = CFReadStreamRead(mReadStream, buffer, kMaximumSize);
+		result = CFReadStreamRead(mReadStream, buffer, mChunkSize);
 		
 		if (result > 0) // was data returned?
 		{
 			// make the data and send it to the transform
-			CFDataRef data = CFDataCreate(NULL, buffer, result);
+			CFDataRef data = CFDataCreateWithBytesNoCopy(NULL, buffer, result, chunkDeallocator);
+			if (data == NULL)
+			{
+				pool->Recycle(buffer);
+				mDestination->SetAttribute(mDestinationName, GetNoMemoryError());
+				CFRelease(chunkDeallocator);
+				return;
+			}
 
 			CFErrorRef error = mDestination->SetAttribute(mDestinationName, data);
 			
@@ -40,11 +312,19 @@ void StreamSource::BackgroundActivate()
 
 			if (error != NULL) // we have a problem, there was probably an abort on the chain
 			{
+				CFRelease(chunkDeallocator);
 				return; // quiesce the source
 			}
 		}
+		else
+		{
+			pool->Recycle(buffer);
+		}
 	} while (result > 0);
 	
+	// the pool stays around until downstream lets go of the last chunk
+	CFRelease(chunkDeallocator);
+	
 	if (result < 0)
 	{
 		// we got an error!
@@ -66,6 +346,14 @@ void StreamSource::BackgroundActivate()
 
 void StreamSource::DoActivate()
 {
+	CFTypeRef chunkSize = mDestination->GetAttribute(kSecTransformStreamChunkSizeAttributeName);
+	if (chunkSize != NULL && CFGetTypeID(chunkSize) == CFNumberGetTypeID())
+	{
+		CFIndex requested = 0;
+		CFNumberGetValue((CFNumberRef) chunkSize, kCFNumberCFIndexType, &requested);
+		mChunkSize = requested < kMinimumChunkSize ? kMinimumChunkSize : (requested > kMaximumChunkSize ? kMaximumChunkSize : requested);
+	}
+	
 	CFRetain(mDestination->GetCFObject());
 	dispatch_group_async(mReading, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{ 
 		this->BackgroundActivate();
@@ -116,7 +404,7 @@ string StreamSource::DebugDescription()
 	string result = Source::DebugDescription() + ": Stream ";
 	
 	char buffer[256];
-	snprintf(buffer, sizeof(buffer), "(mReadStream = %p)", mReadStream);
+	snprintf(buffer, sizeof(buffer), "(mReadStream = %p, mChunkSize = %ld)", mReadStream, (long) mChunkSize);
 	
 	result += buffer;
 	
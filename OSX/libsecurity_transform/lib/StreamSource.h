@@ -18,6 +18,7 @@ protected:
 	virtual void Finalize();
 	CFReadStreamRef mReadStream;
 	dispatch_group_t mReading;
+	CFIndex mChunkSize;
 
 	void BackgroundActivate();
 	
@@ -22,6 +22,10 @@ static CFTypeID internalID = _kCFRuntimeNotATypeID;
 // a transforms master, activation, or any attribute queue to the Transform*
 static unsigned char dispatchQueueToTransformKey;
 
+// Use &fusedChainKey as a key to dispatch_get_specific to find the head of the fused chain
+// (if any) whose queue we are running on
+static unsigned char fusedChainKey;
+
 static char RandomChar()
 {
 	return arc4random() % 26 + 'A'; // good enough
@@ -215,6 +219,7 @@ SecTransformAttributeRef Transform::getAH(SecTransformStringOrAttributeRef attri
 		
 		ta->pushback_state = transform_attribute::pb_empty;
 		ta->pushback_value = NULL;
+		ta->queued_sets = 0;
 		ta->value = NULL;
 		ta->connections = NULL;
 		ta->transform = this;
@@ -324,6 +329,7 @@ Transform::Transform(CFStringRef transformType, CFStringRef CFobjectType) :
 	mAttributes = NULL;
 	mPushedback = NULL;
 	mProcessingPushbacks = FALSE;
+	mFusedHead = NULL;
 	
 	if (internalID == _kCFRuntimeNotATypeID) {
 		(void)SecTransformNoData();
@@ -893,7 +899,10 @@ CFErrorRef Transform::SetAttributeNoCallback(SecTransformStringOrAttributeRef ke
 			{
 				if (tt->mIsActive)
 				{
-					tt->SetAttribute(ah, value);
+					if (!tt->TryFusedDo(ah, value))
+					{
+						tt->SetAttribute(ah, value);
+					}
 				}
 				else
 				{
@@ -979,6 +988,7 @@ CFErrorRef Transform::SetAttribute(CFTypeRef key, CFTypeRef value)
 	transform_attribute *ta = ah2ta(ah);
 
 	dispatch_block_t set = ^{
+		OSAtomicDecrement32Barrier(&ta->queued_sets);
 		Do(ah, value);
 
 		dispatch_semaphore_signal(ta->semaphore);
@@ -992,6 +1002,7 @@ CFErrorRef Transform::SetAttribute(CFTypeRef key, CFTypeRef value)
 	
 	// when the transform is active, set attributes asynchronously.  Otherwise, we are doing
 	// initialization and must wait for the operation to complete.
+	OSAtomicIncrement32Barrier(&ta->queued_sets);
 	if (mIsActive)
 	{
 		dispatch_async(ta->q, set);
@@ -1117,6 +1128,72 @@ void Transform::try_pushbacks() {
 	}
 }
 
+bool Transform::CanFuse()
+{
+	return false;
+}
+
+// The transform our OUTPUT feeds if the two of us can be fused, NULL otherwise.   Only a lone
+// OUTPUT -> INPUT connection qualifies, and an INPUT only ever has one incoming connection.
+Transform *Transform::FusibleSuccessor()
+{
+	if (!CanFuse())
+	{
+		return NULL;
+	}
+	
+	transform_attribute *ta = getTA(kSecTransformOutputAttributeName, false);
+	if (ta == NULL || ta->connections == NULL || CFArrayGetCount(ta->connections) != 1)
+	{
+		return NULL;
+	}
+	
+	transform_attribute *dst = ah2ta(CFArrayGetValueAtIndex(ta->connections, 0));
+	Transform *next = dst->transform;
+	if (next == NULL || next == this || !next->CanFuse() || !CFEqual(dst->name, kSecTransformInputAttributeName))
+	{
+		return NULL;
+	}
+	
+	return next;
+}
+
+// Run all of our work on head's queue.   Must be called before execution starts.
+void Transform::FuseOnto(Transform *head)
+{
+	(void)transforms_assume_zero(mIsActive);
+	
+	if (head->mFusedHead == NULL)
+	{
+		head->mFusedHead = head;
+		dispatch_queue_set_specific(head->mDispatchQueue, &fusedChainKey, head, NULL);
+	}
+	
+	mFusedHead = head;
+	dispatch_set_target_queue(mDispatchQueue, head->mDispatchQueue);
+}
+
+// A value crossing a connection inside a fused chain is already on the right (shared) queue, so
+// when nothing is queued ahead of it (and no pushback is pending) it can be processed right away
+// rather than taking a trip through the attribute queue.   Returns false if the caller needs to
+// use SetAttribute instead.
+bool Transform::TryFusedDo(SecTransformAttributeRef ah, CFTypeRef value)
+{
+	transform_attribute *ta = ah2ta(ah);
+	if (mFusedHead == NULL || dispatch_get_specific(&fusedChainKey) != mFusedHead)
+	{
+		return false;
+	}
+	
+	if (mAbortError || ta->pushback_state != transform_attribute::pb_empty || ta->queued_sets != 0)
+	{
+		return false;
+	}
+	
+	Do(ah, value);
+	return true;
+}
+
 void Transform::Debug(const char *cfmt, ...) {
 	CFTypeRef d = ah2ta(DebugAH)->value;
 	if (d) {
@@ -1182,7 +1259,8 @@ void Transform::Do(SecTransformAttributeRef ah, CFTypeRef value)
 	{
 		return;
 	}
-	(void)transforms_assume(dispatch_get_current_queue() == ((ta->pushback_state == transform_attribute::pb_repush) ? mDispatchQueue : ta->q));
+	(void)transforms_assume(dispatch_get_current_queue() == ((ta->pushback_state == transform_attribute::pb_repush) ? mDispatchQueue : ta->q)
+							|| (mFusedHead && dispatch_get_specific(&fusedChainKey) == mFusedHead));
 	
 	if (mIsFinalizing)
 	{
@@ -1317,6 +1395,9 @@ CFTypeRef Transform::Execute(dispatch_queue_t deliveryQueue, SecMessageBlock del
         return NULL;
 	}
 	
+	// All connections (including the monitor's) are in place now
+	rootGroup->FuseLinearChains();
+	
 	dispatch_group_t initialized = dispatch_group_create();
 	rootGroup->ForAllNodesAsync(true, initialized, ^(Transform*t) {
         t->Initialize();
@@ -56,6 +56,8 @@ struct transform_attribute {
 	// (for pushback support; also need pushback state & value)
 	dispatch_queue_t q;
 	dispatch_semaphore_t semaphore;
+	// Number of sets queued on q that haven't started yet (a fused set may only skip the queue when this is zero)
+	int32_t queued_sets;
 	
 	// This attribute needs a value set, or to have something connected to it before running the transform
 	unsigned int required:1;
@@ -102,6 +104,8 @@ protected:
 	GroupTransform *mGroup;
 	CFErrorRef mAbortError;
 	CFStringRef mTypeName;
+	// First transform of the fused chain this transform runs in (see GroupTransform::FuseLinearChains), or NULL
+	Transform *mFusedHead;
 
 	SecTransformAttributeRef AbortAH, DebugAH;
 
@@ -131,6 +135,13 @@ protected:
 	
 	void try_pushbacks();
 
+	// subclasses that only touch their own state from AttributeChanged can return true to let
+	// GroupTransform::FuseLinearChains run them on the queue of the transform feeding them
+	virtual bool CanFuse();
+	Transform *FusibleSuccessor();
+	void FuseOnto(Transform *head);
+	bool TryFusedDo(SecTransformAttributeRef ah, CFTypeRef value);
+
 	void Initialize();
 
 	void ActivateInputs();
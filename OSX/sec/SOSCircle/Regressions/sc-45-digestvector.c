@@ -26,10 +26,11 @@
 
 #include <Security/SecureObjectSync/SOSDigestVector.h>
 
+#include <Security/SecRandom.h>
 #include <utilities/SecCFRelease.h>
 #include <stdlib.h>
 
-static int kTestTestCount = 15;
+static int kTestTestCount = 19;
 
 static void testNullDigestVector(void)
 {
@@ -150,10 +151,60 @@ static void testIntersectUnionDigestVector(void)
     SOSDigestVectorFree(&dvpatched);
 }
 
+static bool dvIsStrictlySorted(const struct SOSDigestVector *dv)
+{
+    for (size_t ix = 1; ix < dv->count; ++ix) {
+        if (memcmp(dv->digest[ix - 1], dv->digest[ix], SOSDigestSize) >= 0)
+            return false;
+    }
+    return true;
+}
+
+// Sort and diff two manifests of count random digests which differ in
+// roughly 1% of their entries, and report how long that took.
+static void testLargeDigestVector(size_t count)
+{
+    struct SOSDigestVector dv1 = SOSDigestVectorInit;
+    struct SOSDigestVector dv2 = SOSDigestVectorInit;
+    struct SOSDigestVector dvdels = SOSDigestVectorInit;
+    struct SOSDigestVector dvadds = SOSDigestVectorInit;
+    size_t changed = 0;
+
+    uint8_t digest[SOSDigestSize];
+    for (size_t ix = 0; ix < count; ++ix) {
+        SecRandomCopyBytes(kSecRandomDefault, sizeof(digest), digest);
+        SOSDigestVectorAppend(&dv1, digest);
+        if (ix % 100 == 0) {
+            SecRandomCopyBytes(kSecRandomDefault, sizeof(digest), digest);
+            changed++;
+        }
+        SOSDigestVectorAppend(&dv2, digest);
+    }
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    SOSDigestVectorSort(&dv1);
+    SOSDigestVectorSort(&dv2);
+    CFAbsoluteTime sorted = CFAbsoluteTimeGetCurrent();
+    SOSDigestVectorDiffSorted(&dv1, &dv2, &dvdels, &dvadds);
+    CFAbsoluteTime diffed = CFAbsoluteTimeGetCurrent();
+
+    ok(dvIsStrictlySorted(&dv1) && dvIsStrictlySorted(&dv2), "%zu digests sorted", count);
+    ok(dvdels.count == changed && dvadds.count == changed, "diff of %zu digests found %zu/%zu changes, expected %zu",
+       count, dvdels.count, dvadds.count, changed);
+    diag("%zu digests: sort x2 %.3fs, diff %.3fs", count, sorted - start, diffed - sorted);
+
+    SOSDigestVectorFree(&dv1);
+    SOSDigestVectorFree(&dv2);
+    SOSDigestVectorFree(&dvdels);
+    SOSDigestVectorFree(&dvadds);
+}
+
 static void tests(void)
 {
     testNullDigestVector();
     testIntersectUnionDigestVector();
+    testLargeDigestVector(100000);
+    testLargeDigestVector(1000000);
 }
 
 int sc_45_digestvector(int argc, char *const *argv)
@@ -690,10 +690,15 @@ CFMutableDictionaryRef derStateToDictionaryCopy(CFDataRef state, CFErrorRef *err
     if (state) {
         const uint8_t *der = CFDataGetBytePtr(state);
         const uint8_t *der_end = der + CFDataGetLength(state);
-        ok = der = der_decode_dictionary(kCFAllocatorDefault, kCFPropertyListMutableContainers, (CFDictionaryRef *)&stateDict, error, der, der_end);
+        CFPropertyListRef plist = NULL;
+        // Manifests and coders are big CFData leaves, borrow them from state rather than copying.
+        ok = der = der_decode_plist_borrowing(state, kCFPropertyListMutableContainers, &plist, error, der, der_end);
         if (der && der != der_end) {
             ok = SOSErrorCreate(kSOSErrorDecodeFailure, error, NULL, CFSTR("trailing %td bytes at end of state"), der_end - der);
+        } else if (ok && !isDictionary(plist)) {
+            ok = SOSErrorCreate(kSOSErrorDecodeFailure, error, NULL, CFSTR("state is not a dictionary: %@"), plist);
         }
+        stateDict = (CFMutableDictionaryRef)plist;
         if (!ok) {
             CFReleaseNull(stateDict);
         }
@@ -709,14 +714,28 @@ static bool SOSEngineLoadCoders(SOSEngineRef engine, SOSTransactionRef txn, CFEr
     // Read the serialized engine state from the datasource (aka keychain) and populate the in-memory engine
     bool ok = true;
     CFDataRef derCoders = NULL;
-    CFMutableDictionaryRef codersDict = NULL;
+    CFIndex peerCount = engine->peerMap ? CFDictionaryGetCount(engine->peerMap) : 0;
+    const void *peerIDs[peerCount ? peerCount : 1];
+    CFTypeRef coderRefs[peerCount ? peerCount : 1];
     derCoders = SOSDataSourceCopyStateWithKey(engine->dataSource, kSOSEngineCoders, kSOSEngineProtectionDomainClassA, txn, error);
     require_quiet(derCoders, xit);
-    codersDict = derStateToDictionaryCopy(derCoders, error);
-    require_quiet(codersDict, xit);
-    CFDictionaryForEach(engine->peerMap, ^(const void *peerID, const void *peerState) {
+    // Only decode the coders of peers we still have, skip the rest of the dictionary.
+    if (peerCount)
+        CFDictionaryGetKeysAndValues(engine->peerMap, peerIDs, NULL);
+    const uint8_t *der = CFDataGetBytePtr(derCoders);
+    const uint8_t *der_end = der + CFDataGetLength(derCoders);
+    der = der_decode_dictionary_values(kCFAllocatorDefault, kCFPropertyListImmutable, peerCount, peerIDs, coderRefs, error, der, der_end);
+    require_quiet(der, xit);
+    if (der != der_end) {
+        for (CFIndex ix = 0; ix < peerCount; ++ix)
+            CFReleaseNull(coderRefs[ix]);
+        SOSErrorCreate(kSOSErrorDecodeFailure, error, NULL, CFSTR("trailing %td bytes at end of coders"), der_end - der);
+        goto xit;
+    }
+    for (CFIndex ix = 0; ix < peerCount; ++ix) {
+        const void *peerID = peerIDs[ix];
         if (peerID) {
-            CFTypeRef coderRef = CFDictionaryGetValue(codersDict, peerID);
+            CFTypeRef coderRef = coderRefs[ix];
             if (coderRef) {
                 CFDataRef coderData = asData(coderRef, NULL);
                 if (coderData) {
@@ -738,18 +757,17 @@ static bool SOSEngineLoadCoders(SOSEngineRef engine, SOSTransactionRef txn, CFEr
                 }
             }
             else{
-                secnotice("coder", "didn't find coder for peer: %@ engine dictionary: %@", peerID, codersDict);
+                secnotice("coder", "didn't find coder for peer: %@", peerID);
                 SOSCCEnsurePeerRegistration();
             }
-
+            CFReleaseNull(coderRef);
         }
-    });
+    }
 
     engine->haveLoadedCoders = true;
 
 xit:
     CFReleaseNull(derCoders);
-    CFReleaseNull(codersDict);
     return ok;
 }
 #if !TARGET_IPHONE_SIMULATOR
@@ -1822,6 +1840,8 @@ bool SOSEngineHandleMessage_locked(SOSEngineRef engine, CFStringRef peerID, SOSM
     SOSManifestRef confirmed = NULL;
     SOSManifestRef base = NULL;
     SOSManifestRef confirmedRemovals = NULL, confirmedAdditions = NULL;
+    SOSManifestRef sketchAdditions = NULL;
+    bool sketchFailed = false;
     __block struct SOSDigestVector receivedObjects = SOSDigestVectorInit;
     __block struct SOSDigestVector unwantedObjects = SOSDigestVectorInit;
 
@@ -1842,6 +1862,46 @@ bool SOSEngineHandleMessage_locked(SOSEngineRef engine, CFStringRef peerID, SOSM
     });
     require_quiet(ok, exit);
 
+    // Peers that set kSOSMessageAcceptsManifestSketches get a sketch rather
+    // than our whole manifest when we have no confirmed manifest for them.
+    SOSPeerSetSendManifestSketches(peer, (SOSMessageGetFlags(message) & ((SOSMessageFlags)1 << kSOSMessageAcceptsManifestSketches)) != 0);
+    // Size that sketch from the difference our peer's estimator predicts;
+    // without an estimate, or if no sketch would beat it, send the manifest.
+    size_t sketchCells = 0;
+    CFDataRef estimator = SOSMessageGetDifferenceEstimator(message);
+    if (estimator && SOSPeerSendManifestSketches(peer)) {
+        CFErrorRef estimateError = NULL;
+        size_t differences = 0;
+        SOSManifestRef estimateLocal = SOSEngineCopyLocalPeerManifest_locked(engine, peer, &estimateError);
+        if (estimateLocal && SOSManifestEstimateDifference(estimateLocal, estimator, &differences, &estimateError))
+            sketchCells = SOSManifestSketchCellsForDifference(estimateLocal, differences);
+        else
+            secnoticeq("engine", "%@:%@ failed to estimate manifest difference: %@", engine->myID, peerID, estimateError);
+        CFReleaseSafe(estimateLocal);
+        CFReleaseSafe(estimateError);
+    }
+    SOSPeerSetManifestSketchCells(peer, sketchCells);
+    CFDataRef sketch = SOSMessageGetManifestSketch(message);
+    if (sketch) {
+        CFErrorRef sketchError = NULL;
+        SOSManifestRef sketchLocal = SOSEngineCopyLocalPeerManifest_locked(engine, peer, &sketchError);
+        if (sketchLocal)
+            sketchAdditions = SOSManifestCreateWithSketch(sketchLocal, sketch, &sketchError);
+        if (sketchAdditions && !CFEqualSafe(SOSManifestGetDigest(sketchAdditions, NULL), SOSMessageGetProposedDigest(message))) {
+            SOSErrorCreate(kSOSErrorProcessingFailure, &sketchError, NULL, CFSTR("manifest from sketch doesn't match proposed digest"));
+            CFReleaseNull(sketchAdditions);
+        }
+        if (!sketchAdditions) {
+            // Ask our peer for full manifests until we are in sync again.
+            secnoticeq("engine", "%@:%@ failed to decode manifest sketch: %@", engine->myID, peerID, sketchError);
+            sketchFailed = true;
+            SOSPeerSetAcceptsManifestSketches(peer, false);
+            SOSPeerSetMustSendMessage(peer, true);
+        }
+        CFReleaseSafe(sketchLocal);
+        CFReleaseSafe(sketchError);
+    }
+
     // Merge Objects from the message into our DataSource.
     // Should we move the transaction to the SOSAccount level?
     // TODO: Filter incoming objects
@@ -1889,7 +1949,7 @@ bool SOSEngineHandleMessage_locked(SOSEngineRef engine, CFStringRef peerID, SOSM
     }), exit);
     struct SOSDigestVector dvunion = SOSDigestVectorInit;
     SOSDigestVectorSort(&receivedObjects);
-    SOSDigestVectorUnionSorted(SOSManifestGetDigestVector(SOSMessageGetAdditions(message)), &receivedObjects, &dvunion);
+    SOSDigestVectorUnionSorted(SOSManifestGetDigestVector(sketchAdditions ? sketchAdditions : SOSMessageGetAdditions(message)), &receivedObjects, &dvunion);
     allAdditions = SOSManifestCreateWithDigestVector(&dvunion, error);
     SOSDigestVectorFree(&receivedObjects);
     SOSDigestVectorFree(&dvunion);
@@ -1936,7 +1996,10 @@ bool SOSEngineHandleMessage_locked(SOSEngineRef engine, CFStringRef peerID, SOSM
 
     base = SOSPeerCopyManifestForDigest(peer, baseDigest);
     confirmed = SOSPeerCopyManifestForDigest(peer, SOSMessageGetSenderDigest(message));
-    if (!confirmed) {
+    // The additions a sketch stood in for are unknown if it didn't decode, so
+    // allAdditions only holds the objects we received; don't confirm anything
+    // from it and wait for the full manifest we asked for instead.
+    if (!confirmed && !sketchFailed) {
         if (SOSManifestGetCount(SOSMessageGetRemovals(message)) || SOSManifestGetCount(allAdditions)) {
             if (base || !baseDigest) {
                 confirmed = SOSManifestCreateWithPatch(base, SOSMessageGetRemovals(message), allAdditions, error);
@@ -1994,6 +2057,7 @@ exit:
     CFReleaseSafe(localManifest);
     CFReleaseSafe(peerDesc);
     CFReleaseSafe(allAdditions);
+    CFReleaseSafe(sketchAdditions);
     CFReleaseSafe(unwanted);
     CFReleaseSafe(confirmedRemovals);
     CFReleaseSafe(confirmedAdditions);
@@ -2224,9 +2288,13 @@ static void SOSEngineCompletedSyncWithPeer(SOSEngineRef engine, SOSPeerRef peer)
     }
 
     SOSPeerSetHasBeenInSync(peer, true);
+    SOSPeerSetAcceptsManifestSketches(peer, true);
 }
 
 
+// Below this many entries a full manifest is about as small as a sketch.
+static const size_t kSOSEngineManifestSketchMinCount = 1024;
+
 CFDataRef SOSEngineCreateMessage_locked(SOSEngineRef engine, SOSTransactionRef txn, SOSPeerRef peer,
                                         CFErrorRef *error, SOSEnginePeerMessageSentBlock *sent) {
     SOSManifestRef local = SOSEngineCopyLocalPeerManifest_locked(engine, peer, error);
@@ -2438,6 +2506,28 @@ CFDataRef SOSEngineCreateMessage_locked(SOSEngineRef engine, SOSTransactionRef t
         CFReleaseNull(message);
     }
 
+    // Without a confirmed manifest the deltas above are all of proposed, so
+    // send a sketch instead if our peer can rebuild proposed from one and
+    // told us how far apart our manifests are.
+    size_t sketchCells = SOSPeerGetManifestSketchCells(peer);
+    if (message && !confirmed && SOSPeerSendManifestSketches(peer) && sketchCells
+        && SOSManifestGetCount(proposed) >= kSOSEngineManifestSketchMinCount) {
+        CFErrorRef sketchError = NULL;
+        if (!SOSMessageSetManifestSketch(message, proposed, sketchCells, &sketchError))
+            secnoticeq("engine", "%@:%@: sending full manifest, no sketch: %@", engine->myID, SOSPeerGetID(peer), sketchError);
+        CFReleaseSafe(sketchError);
+    }
+    if (message && SOSPeerAcceptsManifestSketches(peer)) {
+        SOSMessageSetFlags(message, SOSMessageGetFlags(message) | ((SOSMessageFlags)1 << kSOSMessageAcceptsManifestSketches));
+        // Our peer needs an estimate of our difference to size its sketch.
+        if (!confirmed && SOSManifestGetCount(local) >= kSOSEngineManifestSketchMinCount) {
+            CFErrorRef estimateError = NULL;
+            if (!SOSMessageSetDifferenceEstimator(message, local, &estimateError))
+                secnoticeq("engine", "%@:%@: no difference estimator: %@", engine->myID, SOSPeerGetID(peer), estimateError);
+            CFReleaseSafe(estimateError);
+        }
+    }
+
     CFReleaseNull(objectsSent);
 
     if (message) {
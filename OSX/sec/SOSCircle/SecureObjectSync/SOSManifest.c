@@ -31,6 +31,7 @@
 #include <utilities/SecCFError.h>
 #include <utilities/SecCFWrappers.h>
 #include <utilities/SecCFCCWrappers.h>
+#include <libkern/OSByteOrder.h>
 
 CFStringRef kSOSManifestErrorDomain = CFSTR("com.apple.security.sos.manifest.error");
 
@@ -232,6 +233,337 @@ CFDataRef SOSManifestGetDigest(SOSManifestRef m, CFErrorRef *error) {
     return m->digest;
 }
 
+//
+// MARK: Manifest sketches
+//
+
+// A sketch is an invertible Bloom lookup table over manifest digests.  Every
+// digest is xored into one cell in each of kSOSManifestSketchHashCount equally
+// sized subtables.  Digests are already uniformly distributed, so the cell
+// indexes come straight from their leading words.
+//
+// Wire format: UInt32 cell count followed by that many
+// { SInt32 count, digest keySum, UInt32 checkSum } cells, all big endian.
+
+#define kSOSManifestSketchHashCount     3
+#define kSOSManifestSketchMinCells      (kSOSManifestSketchHashCount * 32)
+#define kSOSManifestSketchMaxCells      (kSOSManifestSketchHashCount * 128 * 1024)
+#define kSOSManifestSketchCellSize(KS)  (4 + (KS) + 4)
+
+// A difference estimator is kSOSManifestStrataCount small sketches over
+// 12 byte digest prefixes.  Stratum i holds the digests whose word at
+// kSOSManifestStrataWord has i trailing zero bits, so it samples 1 in 2^(i+1)
+// entries.  Wire format: UInt32 stratum count followed by that many sketches
+// of kSOSManifestStrataCells cells each, encoded as above minus the count.
+
+#define kSOSManifestStrataCount         16
+#define kSOSManifestStrataCells         (kSOSManifestSketchHashCount * 8)
+#define kSOSManifestStrataKeySize       12
+#define kSOSManifestStrataWord          12
+
+struct SOSManifestSketchCell {
+    int32_t count;
+    uint8_t keySum[SOSDigestSize];
+    uint32_t checkSum;
+};
+
+struct SOSManifestSketch {
+    size_t cells;
+    size_t keySize;
+    struct SOSManifestSketchCell *cell;
+};
+
+// Must not be linear in the digest bits, otherwise the xor of two digests
+// would pass for a pure cell.
+static uint32_t SOSManifestSketchCheck(const uint8_t *digest, size_t keySize) {
+    uint32_t h = 2166136261U;
+    for (size_t ix = 0; ix < keySize; ++ix) {
+        h ^= digest[ix];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static size_t SOSManifestSketchIndex(const struct SOSManifestSketch *sk, const uint8_t *digest, size_t hash) {
+    size_t subtableSize = sk->cells / kSOSManifestSketchHashCount;
+    return hash * subtableSize + OSReadBigInt32(digest, 4 * hash) % subtableSize;
+}
+
+static void SOSManifestSketchToggle(struct SOSManifestSketch *sk, const uint8_t *digest, int32_t delta) {
+    uint32_t check = SOSManifestSketchCheck(digest, sk->keySize);
+    for (size_t hash = 0; hash < kSOSManifestSketchHashCount; ++hash) {
+        struct SOSManifestSketchCell *cell = &sk->cell[SOSManifestSketchIndex(sk, digest, hash)];
+        cell->count += delta;
+        for (size_t ix = 0; ix < sk->keySize; ++ix)
+            cell->keySum[ix] ^= digest[ix];
+        cell->checkSum ^= check;
+    }
+}
+
+// A cell is pure if it holds exactly one digest, which must also hash back to it.
+static bool SOSManifestSketchCellIsPure(const struct SOSManifestSketch *sk, size_t ix) {
+    const struct SOSManifestSketchCell *cell = &sk->cell[ix];
+    if (cell->count != 1 && cell->count != -1)
+        return false;
+    if (cell->checkSum != SOSManifestSketchCheck(cell->keySum, sk->keySize))
+        return false;
+    size_t hash = ix / (sk->cells / kSOSManifestSketchHashCount);
+    return SOSManifestSketchIndex(sk, cell->keySum, hash) == ix;
+}
+
+static bool SOSManifestSketchIsEmpty(const struct SOSManifestSketch *sk) {
+    static const uint8_t zero[SOSDigestSize] = {};
+    for (size_t ix = 0; ix < sk->cells; ++ix) {
+        const struct SOSManifestSketchCell *cell = &sk->cell[ix];
+        if (cell->count || cell->checkSum || memcmp(cell->keySum, zero, sk->keySize))
+            return false;
+    }
+    return true;
+}
+
+static bool SOSManifestSketchInit(struct SOSManifestSketch *sk, size_t cells, size_t keySize, CFErrorRef *error) {
+    sk->cells = cells;
+    sk->keySize = keySize;
+    sk->cell = calloc(cells, sizeof(*sk->cell));
+    if (!sk->cell)
+        return SecCFCreateErrorWithFormat(kSOSManifestCreateError, kSOSManifestErrorDomain, NULL, error, NULL, CFSTR("Failed to allocate %zu sketch cells"), cells);
+    return true;
+}
+
+static uint8_t *SOSManifestSketchEncode(const struct SOSManifestSketch *sk, uint8_t *der) {
+    for (size_t ix = 0; ix < sk->cells; ++ix, der += kSOSManifestSketchCellSize(sk->keySize)) {
+        OSWriteBigInt32(der, 0, (uint32_t)sk->cell[ix].count);
+        memcpy(der + 4, sk->cell[ix].keySum, sk->keySize);
+        OSWriteBigInt32(der, 4 + sk->keySize, sk->cell[ix].checkSum);
+    }
+    return der;
+}
+
+static const uint8_t *SOSManifestSketchDecode(struct SOSManifestSketch *sk, const uint8_t *der) {
+    for (size_t ix = 0; ix < sk->cells; ++ix, der += kSOSManifestSketchCellSize(sk->keySize)) {
+        sk->cell[ix].count = (int32_t)OSReadBigInt32(der, 0);
+        memcpy(sk->cell[ix].keySum, der + 4, sk->keySize);
+        sk->cell[ix].checkSum = OSReadBigInt32(der, 4 + sk->keySize);
+    }
+    return der;
+}
+
+// Peel pure cells until none are left, handing each recovered digest to
+// block.  Pure cells wait on a worklist; peeling a digest only changes the
+// cells it hashes to, so only those are checked again, which keeps this
+// linear in the number of cells.  A sketch can never yield more differences
+// than it has cells, which bounds the work on garbage input.  Returns false
+// if the sketch held more differences than it could give up.
+static bool SOSManifestSketchPeel(struct SOSManifestSketch *sk, size_t *peeled, void (^block)(const uint8_t *digest, int32_t count)) {
+    *peeled = 0;
+    size_t *work = malloc(sk->cells * sizeof(*work));
+    bool *queued = calloc(sk->cells, sizeof(*queued));
+    if (!work || !queued) {
+        free(work);
+        free(queued);
+        return false;
+    }
+    size_t pending = 0;
+    for (size_t ix = 0; ix < sk->cells; ++ix) {
+        if (SOSManifestSketchCellIsPure(sk, ix)) {
+            work[pending++] = ix;
+            queued[ix] = true;
+        }
+    }
+    while (pending && *peeled <= sk->cells) {
+        size_t ix = work[--pending];
+        queued[ix] = false;
+        // Peeling a neighbour may have emptied or polluted this cell since.
+        if (!SOSManifestSketchCellIsPure(sk, ix))
+            continue;
+        uint8_t digest[SOSDigestSize];
+        int32_t count = sk->cell[ix].count;
+        memcpy(digest, sk->cell[ix].keySum, sk->keySize);
+        if (block)
+            block(digest, count);
+        SOSManifestSketchToggle(sk, digest, -count);
+        ++*peeled;
+        for (size_t hash = 0; hash < kSOSManifestSketchHashCount; ++hash) {
+            size_t next = SOSManifestSketchIndex(sk, digest, hash);
+            if (!queued[next] && SOSManifestSketchCellIsPure(sk, next)) {
+                work[pending++] = next;
+                queued[next] = true;
+            }
+        }
+    }
+    free(work);
+    free(queued);
+    return SOSManifestSketchIsEmpty(sk);
+}
+
+size_t SOSManifestSketchCellsForDifference(SOSManifestRef m, size_t differences) {
+    // Twice the estimate absorbs most of the estimator's error; a sketch that
+    // still fails to decode makes our peer ask for full manifests.
+    size_t cells = kSOSManifestSketchMinCells;
+    if (differences < (kSOSManifestSketchMaxCells - cells) / 2)
+        cells += 2 * differences;
+    else
+        cells = kSOSManifestSketchMaxCells;
+    cells -= cells % kSOSManifestSketchHashCount;
+    if (4 + cells * kSOSManifestSketchCellSize(SOSDigestSize) >= SOSManifestGetSize(m))
+        return 0;
+    return cells;
+}
+
+CFDataRef SOSManifestCopySketch(SOSManifestRef m, size_t cells, CFErrorRef *error) {
+    if (cells < kSOSManifestSketchHashCount || cells > kSOSManifestSketchMaxCells || cells % kSOSManifestSketchHashCount) {
+        SecCFCreateErrorWithFormat(kSOSManifestCreateError, kSOSManifestErrorDomain, NULL, error, NULL, CFSTR("Invalid sketch size %zu"), cells);
+        return NULL;
+    }
+    struct SOSManifestSketch sk;
+    if (!SOSManifestSketchInit(&sk, cells, SOSDigestSize, error))
+        return NULL;
+
+    const uint8_t *p, *q;
+    for (p = SOSManifestGetBytePtr(m), q = p + SOSManifestGetSize(m); p + SOSDigestSize <= q; p += SOSDigestSize)
+        SOSManifestSketchToggle(&sk, p, 1);
+
+    CFMutableDataRef sketch = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    CFDataSetLength(sketch, (CFIndex)(4 + cells * kSOSManifestSketchCellSize(SOSDigestSize)));
+    uint8_t *der = CFDataGetMutableBytePtr(sketch);
+    OSWriteBigInt32(der, 0, (uint32_t)cells);
+    SOSManifestSketchEncode(&sk, der + 4);
+    free(sk.cell);
+    return sketch;
+}
+
+SOSManifestRef SOSManifestCreateWithSketch(SOSManifestRef local, CFDataRef sketch, CFErrorRef *error) {
+    size_t len = (size_t)CFDataGetLength(sketch);
+    const uint8_t *der = CFDataGetBytePtr(sketch);
+    size_t cells = len >= 4 ? OSReadBigInt32(der, 0) : 0;
+    if (cells < kSOSManifestSketchHashCount || cells > kSOSManifestSketchMaxCells || cells % kSOSManifestSketchHashCount
+        || len != 4 + cells * kSOSManifestSketchCellSize(SOSDigestSize)) {
+        SecCFCreateErrorWithFormat(kSOSManifestSketchDecodeError, kSOSManifestErrorDomain, NULL, error, NULL, CFSTR("Malformed sketch of %zu bytes"), len);
+        return NULL;
+    }
+    struct SOSManifestSketch sk;
+    if (!SOSManifestSketchInit(&sk, cells, SOSDigestSize, error))
+        return NULL;
+    SOSManifestSketchDecode(&sk, der + 4);
+
+    // Subtract local, leaving only the symmetric difference in the sketch.
+    const uint8_t *p, *q;
+    for (p = SOSManifestGetBytePtr(local), q = p + SOSManifestGetSize(local); p + SOSDigestSize <= q; p += SOSDigestSize)
+        SOSManifestSketchToggle(&sk, p, -1);
+
+    __block struct SOSDigestVector removals = SOSDigestVectorInit, additions = SOSDigestVectorInit;
+    size_t peeled;
+    SOSManifestRef result = NULL;
+    if (!SOSManifestSketchPeel(&sk, &peeled, ^(const uint8_t *digest, int32_t count) {
+        SOSDigestVectorAppend(count > 0 ? &additions : &removals, digest);
+    })) {
+        SecCFCreateErrorWithFormat(kSOSManifestSketchDecodeError, kSOSManifestErrorDomain, NULL, error, NULL, CFSTR("Sketch of %zu cells has more than %zu differences"), cells, peeled);
+    } else {
+        struct SOSDigestVector dv = SOSDigestVectorInit;
+        SOSDigestVectorSort(&removals);
+        SOSDigestVectorSort(&additions);
+        if (SOSDigestVectorPatchSorted(SOSManifestGetDigestVector(local), &removals, &additions, &dv, error))
+            result = SOSManifestCreateWithDigestVector(&dv, error);
+        SOSDigestVectorFree(&dv);
+    }
+    SOSDigestVectorFree(&removals);
+    SOSDigestVectorFree(&additions);
+    free(sk.cell);
+    return result;
+}
+
+static size_t SOSManifestStratum(const uint8_t *digest) {
+    uint32_t word = OSReadBigInt32(digest, kSOSManifestStrataWord);
+    size_t stratum = word ? (size_t)__builtin_ctz(word) : kSOSManifestStrataCount - 1;
+    return stratum < kSOSManifestStrataCount ? stratum : kSOSManifestStrataCount - 1;
+}
+
+static bool SOSManifestStrataInit(struct SOSManifestSketch strata[kSOSManifestStrataCount], SOSManifestRef m, int32_t delta, CFErrorRef *error) {
+    size_t ix;
+    for (ix = 0; ix < kSOSManifestStrataCount; ++ix) {
+        if (!SOSManifestSketchInit(&strata[ix], kSOSManifestStrataCells, kSOSManifestStrataKeySize, error))
+            break;
+    }
+    if (ix < kSOSManifestStrataCount) {
+        while (ix-- > 0)
+            free(strata[ix].cell);
+        return false;
+    }
+    const uint8_t *p, *q;
+    for (p = SOSManifestGetBytePtr(m), q = p + SOSManifestGetSize(m); p + SOSDigestSize <= q; p += SOSDigestSize)
+        SOSManifestSketchToggle(&strata[SOSManifestStratum(p)], p, delta);
+    return true;
+}
+
+static void SOSManifestStrataFree(struct SOSManifestSketch strata[kSOSManifestStrataCount]) {
+    for (size_t ix = 0; ix < kSOSManifestStrataCount; ++ix)
+        free(strata[ix].cell);
+}
+
+#define kSOSManifestStrataSize (4 + kSOSManifestStrataCount * kSOSManifestStrataCells * kSOSManifestSketchCellSize(kSOSManifestStrataKeySize))
+
+CFDataRef SOSManifestCopyDifferenceEstimator(SOSManifestRef m, CFErrorRef *error) {
+    struct SOSManifestSketch strata[kSOSManifestStrataCount];
+    if (!SOSManifestStrataInit(strata, m, 1, error))
+        return NULL;
+
+    CFMutableDataRef estimator = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    CFDataSetLength(estimator, (CFIndex)kSOSManifestStrataSize);
+    uint8_t *der = CFDataGetMutableBytePtr(estimator);
+    OSWriteBigInt32(der, 0, kSOSManifestStrataCount);
+    der += 4;
+    for (size_t ix = 0; ix < kSOSManifestStrataCount; ++ix)
+        der = SOSManifestSketchEncode(&strata[ix], der);
+    SOSManifestStrataFree(strata);
+    return estimator;
+}
+
+bool SOSManifestEstimateDifference(SOSManifestRef local, CFDataRef estimator, size_t *differences, CFErrorRef *error) {
+    size_t len = (size_t)CFDataGetLength(estimator);
+    const uint8_t *der = CFDataGetBytePtr(estimator);
+    if (len != kSOSManifestStrataSize || OSReadBigInt32(der, 0) != kSOSManifestStrataCount)
+        return SecCFCreateErrorWithFormat(kSOSManifestSketchDecodeError, kSOSManifestErrorDomain, NULL, error, NULL, CFSTR("Malformed difference estimator of %zu bytes"), len);
+
+    struct SOSManifestSketch strata[kSOSManifestStrataCount];
+    if (!SOSManifestStrataInit(strata, local, -1, error))
+        return false;
+
+    // Toggle the remote strata into ours, leaving the difference per stratum.
+    struct SOSManifestSketch remote = { .cells = kSOSManifestStrataCells, .keySize = kSOSManifestStrataKeySize };
+    struct SOSManifestSketchCell cells[kSOSManifestStrataCells];
+    remote.cell = cells;
+    der += 4;
+    for (size_t ix = 0; ix < kSOSManifestStrataCount; ++ix) {
+        der = SOSManifestSketchDecode(&remote, der);
+        for (size_t cx = 0; cx < kSOSManifestStrataCells; ++cx) {
+            strata[ix].cell[cx].count += cells[cx].count;
+            for (size_t kx = 0; kx < kSOSManifestStrataKeySize; ++kx)
+                strata[ix].cell[cx].keySum[kx] ^= cells[cx].keySum[kx];
+            strata[ix].cell[cx].checkSum ^= cells[cx].checkSum;
+        }
+    }
+
+    // Decode from the sparsest stratum down; the first one that won't decode
+    // scales up the count of everything sparser than it.  A stratum only
+    // fails to decode with at least half as many differences as cells, so
+    // never scale up less than that.
+    size_t count = 0;
+    size_t ix = kSOSManifestStrataCount;
+    while (ix-- > 0) {
+        size_t peeled;
+        if (!SOSManifestSketchPeel(&strata[ix], &peeled, NULL)) {
+            if (count < kSOSManifestStrataCells / 2)
+                count = kSOSManifestStrataCells / 2;
+            count <<= ix + 1;
+            break;
+        }
+        count += peeled;
+    }
+    SOSManifestStrataFree(strata);
+    *differences = count;
+    return true;
+}
+
 static CFStringRef SOSManifestCopyFormatDescription(CFTypeRef cf, CFDictionaryRef formatOptions) {
     SOSManifestRef mf = (SOSManifestRef)cf;
     CFMutableStringRef desc = CFStringCreateMutable(0, 0);
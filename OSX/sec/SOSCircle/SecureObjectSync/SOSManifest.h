@@ -40,6 +40,7 @@ __BEGIN_DECLS
 enum {
     kSOSManifestUnsortedError = 1,
     kSOSManifestCreateError = 2,
+    kSOSManifestSketchDecodeError = 3,
 };
 
 extern CFStringRef kSOSManifestErrorDomain;
@@ -96,6 +97,32 @@ void SOSManifestForEach(SOSManifestRef m, void(^block)(CFDataRef e, bool *stop))
 
 CFDataRef SOSManifestGetDigest(SOSManifestRef m, CFErrorRef *error);
 
+/* Manifest sketches. */
+
+// Number of sketch cells needed to send m to a peer whose manifest differs
+// from it in about differences entries, or 0 if such a sketch would be no
+// smaller than m itself.
+size_t SOSManifestSketchCellsForDifference(SOSManifestRef m, size_t differences);
+
+// Encode m as an invertible Bloom lookup table with cells cells.  The result
+// is independent of m's size, so a peer whose manifest differs from m in only
+// a few entries can recover m without us sending every digest.
+CFDataRef SOSManifestCopySketch(SOSManifestRef m, size_t cells, CFErrorRef *error);
+
+// Rebuild the manifest a sketch was made from by subtracting local from it
+// and peeling off the symmetric difference.  Fails with
+// kSOSManifestSketchDecodeError if the manifests differ in more entries than
+// the sketch can hold.
+SOSManifestRef SOSManifestCreateWithSketch(SOSManifestRef local, CFDataRef sketch, CFErrorRef *error);
+
+// A fixed size (about 8KB) summary of m from which a peer can estimate how
+// many entries its manifest differs from m in, to size a sketch for us.
+CFDataRef SOSManifestCopyDifferenceEstimator(SOSManifestRef m, CFErrorRef *error);
+
+// Estimate the size of the symmetric difference between local and the
+// manifest estimator was made from.
+bool SOSManifestEstimateDifference(SOSManifestRef local, CFDataRef estimator, size_t *differences, CFErrorRef *error);
+
 __END_DECLS
 
 #endif /* !_SEC_SOSMANIFEST_H_ */
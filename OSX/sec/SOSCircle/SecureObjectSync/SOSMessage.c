@@ -136,6 +136,8 @@ SOSMessageHeader ::= SEQUENCE {
             -- clearGetObjects was set during this delta update, do not
             -- set it again (STICKY until either peer clears delta) -- }
         skipHello                           (6)  -- Respond with at least a manifest
+        acceptsManifestSketches             (7)  -- Sender can rebuild a manifest from a
+            -- SOSManifestSketch extension in place of full deltas
     senderDigest    SOSManifestDigest,
         -- The senders manifest digest at the time of sending this message.
     baseDigest      [0] IMPLICIT SOSManifestDigest,
@@ -170,6 +172,21 @@ SOSExtension ::= SEQUENCE {
     critical    BOOLEAN DEFAULT FALSE,
     extnValue   OCTET STRING }
 
+-- extnID 1.2.840.113635.100.14.1, sent instead of deltas to peers that
+-- set acceptsManifestSketches.  The receiver subtracts its own manifest and
+-- must end up with proposedDigest, or it stops setting acceptsManifestSketches.
+SOSManifestSketch ::= OCTET STRING
+    -- UInt32 cellCount followed by cellCount cells of
+    -- { SInt32 count, SOSDigest keySum, UInt32 checkSum } all big endian
+
+-- extnID 1.2.840.113635.100.14.2, sent by peers that set
+-- acceptsManifestSketches while they have no confirmed manifest from us.
+-- Sketches sent back are sized by the difference it estimates; without one
+-- the full deltas are sent instead.
+SOSManifestDifferenceEstimator ::= OCTET STRING
+    -- UInt32 strataCount followed by strataCount sketches of 24 cells each,
+    -- keyed on the first 12 bytes of each SOSDigest, without a cellCount
+
 SOSManifest ::= OCTET STRING
     -- DER encoding is sorted and ready to merge.
     -- All SOSDigest entries in a SOSManifest /must/ be the same size
@@ -260,6 +277,7 @@ struct __OpaqueSOSMessage {
     SOSManifestRef additions;
 
     CFMutableArrayRef objects;
+    CFMutableArrayRef extensions;   // Array of [ oid, isCritical, extension ] triples
 
     SOSMessageFlags flags;
     uint64_t sequenceNumber;
@@ -282,6 +300,7 @@ static Boolean SOSMessageCompare(CFTypeRef cf1, CFTypeRef cf2) {
     if (!CFEqualSafe(M->proposedDigest, P->proposedDigest)) return false;
     if (!CFEqualSafe(M->removals, P->removals)) return false;
     if (!CFEqualSafe(M->additions, P->additions)) return false;
+    if (!CFEqualSafe(M->extensions, P->extensions)) return false;
 
     // TODO Compare Objects if present.
 
@@ -297,6 +316,7 @@ static void SOSMessageDestroy(CFTypeRef cf) {
     CFReleaseNull(message->additions);
     CFReleaseNull(message->removals);
     CFReleaseNull(message->objects);
+    CFReleaseNull(message->extensions);
 }
 
 // TODO: Remove this layer violation!
@@ -430,8 +450,55 @@ void SOSMessageSetFlags(SOSMessageRef message, SOSMessageFlags flags) {
 
 // Add an extension to this message
 void SOSMessageAddExtension(SOSMessageRef message, CFDataRef oid, bool isCritical, CFDataRef extension) {
-    // TODO: Implement
-    secerror("not implemented yet!");
+    if (!message->extensions)
+        message->extensions = CFArrayCreateMutableForCFTypes(CFGetAllocator(message));
+    CFArrayRef triple = CFArrayCreateForCFTypes(CFGetAllocator(message), oid, isCritical ? kCFBooleanTrue : kCFBooleanFalse, extension, NULL);
+    CFArrayAppendValue(message->extensions, triple);
+    CFReleaseSafe(triple);
+}
+
+// DER body of OID 1.2.840.113635.100.14.1
+static const uint8_t kSOSManifestSketchOIDBytes[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x63, 0x64, 0x0E, 0x01 };
+
+// DER body of OID 1.2.840.113635.100.14.2
+static const uint8_t kSOSManifestDifferenceEstimatorOIDBytes[] = { 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x63, 0x64, 0x0E, 0x02 };
+
+static CFDataRef SOSManifestSketchOID(void) {
+    static CFDataRef oid = NULL;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        oid = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, kSOSManifestSketchOIDBytes, sizeof(kSOSManifestSketchOIDBytes), kCFAllocatorNull);
+    });
+    return oid;
+}
+
+static CFDataRef SOSManifestDifferenceEstimatorOID(void) {
+    static CFDataRef oid = NULL;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        oid = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, kSOSManifestDifferenceEstimatorOIDBytes, sizeof(kSOSManifestDifferenceEstimatorOIDBytes), kCFAllocatorNull);
+    });
+    return oid;
+}
+
+bool SOSMessageSetManifestSketch(SOSMessageRef message, SOSManifestRef proposed, size_t cells, CFErrorRef *error) {
+    CFDataRef sketch = SOSManifestCopySketch(proposed, cells, error);
+    if (!sketch)
+        return false;
+    CFReleaseNull(message->removals);
+    CFReleaseNull(message->additions);
+    SOSMessageAddExtension(message, SOSManifestSketchOID(), false, sketch);
+    CFReleaseSafe(sketch);
+    return true;
+}
+
+bool SOSMessageSetDifferenceEstimator(SOSMessageRef message, SOSManifestRef local, CFErrorRef *error) {
+    CFDataRef estimator = SOSManifestCopyDifferenceEstimator(local, error);
+    if (!estimator)
+        return false;
+    SOSMessageAddExtension(message, SOSManifestDifferenceEstimatorOID(), false, estimator);
+    CFReleaseSafe(estimator);
+    return true;
 }
 
 static bool SecMessageIsObjectValid(CFDataRef object, CFErrorRef *error) {
@@ -550,14 +617,46 @@ static uint8_t *der_encode_deltas(SOSMessageRef message, CFErrorRef *error, cons
     }
 }
 
+static size_t der_sizeof_extension(CFArrayRef triple) {
+    CFDataRef oid = CFArrayGetValueAtIndex(triple, 0);
+    bool isCritical = CFBooleanGetValue(CFArrayGetValueAtIndex(triple, 1));
+    CFDataRef extension = CFArrayGetValueAtIndex(triple, 2);
+    return ccder_sizeof(CCDER_CONSTRUCTED_SEQUENCE,
+                        der_sizeof_implicit_data(CCDER_OBJECT_IDENTIFIER, oid) +
+                        (isCritical ? ccder_sizeof(CCDER_BOOLEAN, 1) : 0) +
+                        der_sizeof_implicit_data(CCDER_OCTET_STRING, extension));
+}
+
+static uint8_t *der_encode_extension(CFArrayRef triple, const uint8_t *der, uint8_t *der_end) {
+    static const uint8_t trueByte = 0xFF;
+    CFDataRef oid = CFArrayGetValueAtIndex(triple, 0);
+    bool isCritical = CFBooleanGetValue(CFArrayGetValueAtIndex(triple, 1));
+    CFDataRef extension = CFArrayGetValueAtIndex(triple, 2);
+    uint8_t *body_end = der_end;
+    der_end = der_encode_implicit_data(CCDER_OCTET_STRING, extension, der, der_end);
+    if (isCritical)
+        der_end = ccder_encode_tl(CCDER_BOOLEAN, 1, der, ccder_encode_body(1, &trueByte, der, der_end));
+    return ccder_encode_constructed_tl(CCDER_CONSTRUCTED_SEQUENCE, body_end, der,
+           der_encode_implicit_data(CCDER_OBJECT_IDENTIFIER, oid, der, der_end));
+}
+
 static size_t der_sizeof_extensions(SOSMessageRef message) {
-    // We don't support any yet.
-    return 0;
+    if (!message->extensions || message->version == 0) return 0;
+    size_t body_size = 0;
+    CFArrayRef triple;
+    CFArrayForEachC(message->extensions, triple) {
+        body_size += der_sizeof_extension(triple);
+    }
+    return ccder_sizeof(1 | CCDER_CONTEXT_SPECIFIC | CCDER_CONSTRUCTED, body_size);
 }
 
 static uint8_t *der_encode_extensions(SOSMessageRef message, CFErrorRef *error, const uint8_t *der, uint8_t *der_end) {
-    // We don't support any yet.
-    return der_end;
+    if (!message->extensions || message->version == 0) return der_end;
+    const uint8_t *original_der_end = der_end;
+    for (CFIndex position = CFArrayGetCount(message->extensions) - 1; der_end && position >= 0; --position) {
+        der_end = der_encode_extension(CFArrayGetValueAtIndex(message->extensions, position), der, der_end);
+    }
+    return ccder_encode_constructed_tl(1 | CCDER_CONTEXT_SPECIFIC | CCDER_CONSTRUCTED, original_der_end, der, der_end);
 }
 
 static size_t der_sizeof_objects(SOSMessageRef message) {
@@ -904,12 +1003,41 @@ static const uint8_t *der_decode_optional_deltas(SOSMessageRef message, const ui
     return seq_end ? seq_end : der;
 }
 
+static const uint8_t *der_decode_extension(SOSMessageRef message, CFErrorRef *error, const uint8_t *der, const uint8_t *der_end) {
+    const uint8_t *extension_end;
+    CFDataRef oid = NULL, extension = NULL;
+    bool isCritical = false;
+    der = ccder_decode_constructed_tl(CCDER_CONSTRUCTED_SEQUENCE, &extension_end, der, der_end);
+    if (!der) return NULL;
+    der = der_decode_implicit_data(CCDER_OBJECT_IDENTIFIER, &oid, der, extension_end);
+    if (der) {
+        size_t len = 0;
+        const uint8_t *body = ccder_decode_tl(CCDER_BOOLEAN, &len, der, extension_end);
+        if (body && len == 1) {
+            isCritical = *body != 0;
+            der = body + len;
+        }
+    }
+    der = der_decode_implicit_data(CCDER_OCTET_STRING, &extension, der, extension_end);
+    if (der && der != extension_end) {
+        SOSErrorCreate(kSOSErrorDecodeFailure, error, NULL, CFSTR("%td trailing bytes after SOSExtension"), extension_end - der);
+        der = NULL;
+    }
+    if (der)
+        SOSMessageAddExtension(message, oid, isCritical, extension);
+    CFReleaseSafe(oid);
+    CFReleaseSafe(extension);
+    return der;
+}
+
 static const uint8_t *der_decode_extensions(SOSMessageRef message, CFErrorRef *error, const uint8_t *der, const uint8_t *der_end) {
     const uint8_t *extensions_end;
     der = ccder_decode_constructed_tl(1 | CCDER_CONTEXT_SPECIFIC | CCDER_CONSTRUCTED, &extensions_end, der, der_end);
-    if (!der) return NULL;
-    // Skip over extensions for now.
-    return extensions_end;
+    while (der && der < extensions_end)
+        der = der_decode_extension(message, error, der, extensions_end);
+    if (!der)
+        CFReleaseNull(message->extensions);
+    return der;
 }
 
 static const uint8_t *der_decode_optional_extensions(SOSMessageRef message, CFErrorRef *error, const uint8_t *der, const uint8_t *der_end) {
@@ -1135,7 +1263,37 @@ SOSManifestRef SOSMessageGetAdditions(SOSMessageRef message) {
 // Iterate though the extensions in a decoded SOSMessage.  If criticalOnly is
 // true all non critical extensions are skipped.
 void SOSMessageWithExtensions(SOSMessageRef message, bool criticalOnly, void(^withExtension)(CFDataRef oid, bool isCritical, CFDataRef extension, bool *stop)) {
-    // TODO
+    if (!message->extensions)
+        return;
+    bool stop = false;
+    CFArrayRef triple;
+    CFArrayForEachC(message->extensions, triple) {
+        bool isCritical = CFBooleanGetValue(CFArrayGetValueAtIndex(triple, 1));
+        if (criticalOnly && !isCritical)
+            continue;
+        withExtension(CFArrayGetValueAtIndex(triple, 0), isCritical, CFArrayGetValueAtIndex(triple, 2), &stop);
+        if (stop)
+            break;
+    }
+}
+
+static CFDataRef SOSMessageGetExtension(SOSMessageRef message, CFDataRef extnID) {
+    __block CFDataRef value = NULL;
+    SOSMessageWithExtensions(message, false, ^(CFDataRef oid, bool isCritical, CFDataRef extension, bool *stop) {
+        if (CFEqual(oid, extnID)) {
+            value = extension;
+            *stop = true;
+        }
+    });
+    return value;
+}
+
+CFDataRef SOSMessageGetManifestSketch(SOSMessageRef message) {
+    return SOSMessageGetExtension(message, SOSManifestSketchOID());
+}
+
+CFDataRef SOSMessageGetDifferenceEstimator(SOSMessageRef message) {
+    return SOSMessageGetExtension(message, SOSManifestDifferenceEstimatorOID());
 }
 
 size_t SOSMessageCountObjects(SOSMessageRef message) {
@@ -45,6 +45,7 @@ enum SOSMessageFlags {
     kSOSMessageClearGetObjects                  = (4),
     kSOSMessageDidClearGetObjectsSinceLastDelta = (5),
     kSOSMessageSkipHello                        = (6),
+    kSOSMessageAcceptsManifestSketches          = (7),
 };
 typedef uint64_t SOSMessageFlags;
 
@@ -86,6 +87,15 @@ bool SOSMessageSetManifests(SOSMessageRef message, SOSManifestRef sender,
 // Add an extension to this message
 void SOSMessageAddExtension(SOSMessageRef message, CFDataRef oid, bool isCritical, CFDataRef extension);
 
+// Replace the manifest deltas in this message with a sketch of proposed with
+// cells cells.  Only send this to peers whose messages have
+// kSOSMessageAcceptsManifestSketches set.
+bool SOSMessageSetManifestSketch(SOSMessageRef message, SOSManifestRef proposed, size_t cells, CFErrorRef *error);
+
+// Attach a difference estimator for local, from which our peer sizes the
+// sketches it sends us.
+bool SOSMessageSetDifferenceEstimator(SOSMessageRef message, SOSManifestRef local, CFErrorRef *error);
+
 bool SOSMessageAppendObject(SOSMessageRef message, CFDataRef object, CFErrorRef *error);
 
 void SOSMessageSetFlags(SOSMessageRef message, SOSMessageFlags flags);
@@ -117,6 +127,12 @@ SOSManifestRef SOSMessageGetRemovals(SOSMessageRef message);
 
 SOSManifestRef SOSMessageGetAdditions(SOSMessageRef message);
 
+// Returns the sketch of the proposed manifest sent instead of deltas, if any.
+CFDataRef SOSMessageGetManifestSketch(SOSMessageRef message);
+
+// Returns the difference estimator for the sender's manifest, if any.
+CFDataRef SOSMessageGetDifferenceEstimator(SOSMessageRef message);
+
 // Iterate though the extensions in a decoded SOSMessage.  If criticalOnly is
 // true all non critical extensions are skipped.
 void SOSMessageWithExtensions(SOSMessageRef message, bool criticalOnly,
@@ -71,6 +71,8 @@ CFStringRef kSOSPeerDataLabel = CFSTR("iCloud Peer Data Meta-data");
 static CFStringRef kSOSPeerSendObjectsKey = CFSTR("send-objects"); // bool
 static CFStringRef kSOSPeerMustSendMessageKey = CFSTR("must-send"); // bool
 static CFStringRef kSOSPeerHasBeenInSyncKey = CFSTR("has-been-in-sync"); // bool
+static CFStringRef kSOSPeerSendManifestSketchesKey = CFSTR("send-sketches"); // bool
+static CFStringRef kSOSPeerRefuseManifestSketchesKey = CFSTR("refuse-sketches"); // bool
 static CFStringRef kSOSPeerPendingObjectsKey = CFSTR("pending-objects"); // digest
 static CFStringRef kSOSPeerUnwantedManifestKey = CFSTR("unwanted-manifest"); // digest
 static CFStringRef kSOSPeerConfirmedManifestKey = CFSTR("confirmed-manifest");  //digest
@@ -322,6 +324,9 @@ struct __OpaqueSOSPeer {
     bool sendObjects;
 
     bool hasBeenInSync;
+    bool sendManifestSketches;      // Peer told us it can rebuild our manifest from a sketch
+    bool refuseManifestSketches;    // We failed to decode a sketch from this peer
+    size_t manifestSketchCells;     // Sketch size for the difference our peer last estimated, 0 for none (not persisted)
 
     SOSManifestRef pendingObjects;
     SOSManifestRef unwantedManifest;
@@ -523,6 +528,8 @@ bool SOSPeerSetState(SOSPeerRef p, SOSEngineRef engine, CFDictionaryRef state, C
         p->mustSendMessage = SOSPeerGetPersistedBoolean(state, kSOSPeerMustSendMessageKey);
         p->sendObjects = SOSPeerGetPersistedBoolean(state, kSOSPeerSendObjectsKey);
         p->hasBeenInSync = SOSPeerGetPersistedBoolean(state, kSOSPeerHasBeenInSyncKey);
+        p->sendManifestSketches = SOSPeerGetPersistedBoolean(state, kSOSPeerSendManifestSketchesKey);
+        p->refuseManifestSketches = SOSPeerGetPersistedBoolean(state, kSOSPeerRefuseManifestSketchesKey);
         CFRetainAssign(p->views, SOSPeerGetPersistedViewNameSet(p, state, kSOSPeerViewsKey));
         SOSPeerSetKeyBag(p, SOSPeerGetPersistedData(state, kSOSPeerKeyBagKey));
         CFAssignRetained(p->pendingObjects, SOSEngineCopyPersistedManifest(engine, state, kSOSPeerPendingObjectsKey));
@@ -611,6 +618,8 @@ CFDictionaryRef SOSPeerCopyState(SOSPeerRef peer, CFErrorRef *error) {
     SOSPeerPersistBool(state, kSOSPeerMustSendMessageKey, peer->mustSendMessage);
     SOSPeerPersistBool(state, kSOSPeerSendObjectsKey, peer->sendObjects);
     SOSPeerPersistBool(state, kSOSPeerHasBeenInSyncKey, peer->hasBeenInSync);
+    SOSPeerPersistBool(state, kSOSPeerSendManifestSketchesKey, peer->sendManifestSketches);
+    SOSPeerPersistBool(state, kSOSPeerRefuseManifestSketchesKey, peer->refuseManifestSketches);
     SOSPeerPersistOptionalValue(state, kSOSPeerViewsKey, peer->views);
 
     CFDataRef keybag = SOSPeerGetKeyBag(peer);
@@ -773,6 +782,30 @@ void SOSPeerSetHasBeenInSync(SOSPeerRef peer, bool hasBeenInSync) {
     peer->hasBeenInSync = hasBeenInSync;
 }
 
+bool SOSPeerSendManifestSketches(SOSPeerRef peer) {
+    return peer->sendManifestSketches;
+}
+
+void SOSPeerSetSendManifestSketches(SOSPeerRef peer, bool sendManifestSketches) {
+    peer->sendManifestSketches = sendManifestSketches;
+}
+
+bool SOSPeerAcceptsManifestSketches(SOSPeerRef peer) {
+    return !peer->refuseManifestSketches;
+}
+
+void SOSPeerSetAcceptsManifestSketches(SOSPeerRef peer, bool acceptsManifestSketches) {
+    peer->refuseManifestSketches = !acceptsManifestSketches;
+}
+
+size_t SOSPeerGetManifestSketchCells(SOSPeerRef peer) {
+    return peer->manifestSketchCells;
+}
+
+void SOSPeerSetManifestSketchCells(SOSPeerRef peer, size_t cells) {
+    peer->manifestSketchCells = cells;
+}
+
 // MARK: Manifests
 
 SOSManifestRef SOSPeerGetProposedManifest(SOSPeerRef peer) {
@@ -102,6 +102,19 @@ void SOSPeerSetSendObjects(SOSPeerRef peer, bool sendObjects);
 bool SOSPeerHasBeenInSync(SOSPeerRef peer);
 void SOSPeerSetHasBeenInSync(SOSPeerRef peer, bool hasBeenInSync);
 
+// True if the peer advertised it can rebuild our manifest from a sketch.
+bool SOSPeerSendManifestSketches(SOSPeerRef peer);
+void SOSPeerSetSendManifestSketches(SOSPeerRef peer, bool sendManifestSketches);
+
+// False once a sketch from this peer failed to decode, until we are in sync again.
+bool SOSPeerAcceptsManifestSketches(SOSPeerRef peer);
+void SOSPeerSetAcceptsManifestSketches(SOSPeerRef peer, bool acceptsManifestSketches);
+
+// Cells for the next sketch we send this peer, sized from the difference
+// estimator in its last message; 0 means send full manifests.
+size_t SOSPeerGetManifestSketchCells(SOSPeerRef peer);
+void SOSPeerSetManifestSketchCells(SOSPeerRef peer, size_t cells);
+
 SOSManifestRef SOSPeerGetProposedManifest(SOSPeerRef peer);
 SOSManifestRef SOSPeerGetConfirmedManifest(SOSPeerRef peer);
 void SOSPeerSetConfirmedManifest(SOSPeerRef peer, SOSManifestRef confirmed);
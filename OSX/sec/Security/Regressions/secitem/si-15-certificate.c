@@ -6,10 +6,14 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <Security/SecCertificate.h>
 #include <Security/SecCertificatePriv.h>
+#include <Security/SecCertificateInternal.h>
 #include <Security/SecPolicy.h>
 #include <Security/SecTrust.h>
 #include <utilities/SecCFRelease.h>
+#include <utilities/SecCFWrappers.h>
+#include <utilities/array_size.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "shared_regressions.h"
@@ -786,6 +790,219 @@ static uint8_t two_common_names[1427]={
     0x99,0x58,0xFC,
 };
 
+/* subject:/C=US/O=U.S. Government/OU=FPKI/CN=Federal Bridge CA 2013 */
+/* issuer :/C=US/O=U.S. Government/OU=FPKI/CN=Federal Common Policy CA */
+static unsigned char _federal_bridge_ca[1641]={
+0x30,0x82,0x06,0x65,0x30,0x82,0x05,0x4D,0xA0,0x03,0x02,0x01,0x02,0x02,0x02,0x2C,
+0xA0,0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,0x0B,0x05,0x00,
+0x30,0x59,0x31,0x0B,0x30,0x09,0x06,0x03,0x55,0x04,0x06,0x13,0x02,0x55,0x53,0x31,
+0x18,0x30,0x16,0x06,0x03,0x55,0x04,0x0A,0x13,0x0F,0x55,0x2E,0x53,0x2E,0x20,0x47,
+0x6F,0x76,0x65,0x72,0x6E,0x6D,0x65,0x6E,0x74,0x31,0x0D,0x30,0x0B,0x06,0x03,0x55,
+0x04,0x0B,0x13,0x04,0x46,0x50,0x4B,0x49,0x31,0x21,0x30,0x1F,0x06,0x03,0x55,0x04,
+0x03,0x13,0x18,0x46,0x65,0x64,0x65,0x72,0x61,0x6C,0x20,0x43,0x6F,0x6D,0x6D,0x6F,
+0x6E,0x20,0x50,0x6F,0x6C,0x69,0x63,0x79,0x20,0x43,0x41,0x30,0x1E,0x17,0x0D,0x31,
+0x35,0x30,0x36,0x32,0x34,0x31,0x35,0x34,0x35,0x30,0x37,0x5A,0x17,0x0D,0x31,0x38,
+0x30,0x36,0x32,0x34,0x31,0x35,0x34,0x35,0x30,0x37,0x5A,0x30,0x57,0x31,0x0B,0x30,
+0x09,0x06,0x03,0x55,0x04,0x06,0x13,0x02,0x55,0x53,0x31,0x18,0x30,0x16,0x06,0x03,
+0x55,0x04,0x0A,0x13,0x0F,0x55,0x2E,0x53,0x2E,0x20,0x47,0x6F,0x76,0x65,0x72,0x6E,
+0x6D,0x65,0x6E,0x74,0x31,0x0D,0x30,0x0B,0x06,0x03,0x55,0x04,0x0B,0x13,0x04,0x46,
+0x50,0x4B,0x49,0x31,0x1F,0x30,0x1D,0x06,0x03,0x55,0x04,0x03,0x13,0x16,0x46,0x65,
+0x64,0x65,0x72,0x61,0x6C,0x20,0x42,0x72,0x69,0x64,0x67,0x65,0x20,0x43,0x41,0x20,
+0x32,0x30,0x31,0x33,0x30,0x82,0x01,0x22,0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,
+0xF7,0x0D,0x01,0x01,0x01,0x05,0x00,0x03,0x82,0x01,0x0F,0x00,0x30,0x82,0x01,0x0A,
+0x02,0x82,0x01,0x01,0x00,0x9C,0xE8,0x17,0x25,0xC2,0x59,0xEF,0x34,0xA5,0xC5,0x44,
+0x3B,0x00,0x35,0xEC,0x31,0x40,0xA5,0x7A,0x02,0xD2,0x3E,0x19,0x14,0x9B,0x25,0x89,
+0xCD,0x4A,0x8C,0x3B,0xE6,0x5E,0x6A,0xDA,0x1C,0x6B,0xDD,0x0C,0x03,0x2A,0x45,0x84,
+0x29,0x9D,0x4F,0x2E,0xFF,0xB0,0xA0,0x6C,0x02,0xC6,0x5A,0xA7,0x78,0x67,0xA5,0x77,
+0xBB,0xC6,0x98,0xF8,0xB1,0x7E,0xE2,0x94,0xBB,0xFA,0x11,0x4F,0x63,0x38,0x1C,0x1E,
+0x7C,0x08,0x0C,0x9E,0xF6,0x2A,0x15,0x63,0x22,0x62,0x14,0x12,0xE7,0x9F,0xD4,0xEA,
+0x50,0x2E,0xD4,0x7E,0x3E,0x64,0x25,0xE4,0x2E,0x1C,0x1B,0xB8,0xED,0x5F,0x65,0xB4,
+0xF3,0x00,0x15,0x4F,0x0D,0x24,0x92,0x2C,0x71,0x50,0x22,0x3C,0xEB,0x11,0x69,0xB3,
+0x2C,0x38,0xF3,0xE0,0x73,0xA1,0x98,0x26,0x75,0xA6,0x2D,0x56,0xA9,0x05,0xAF,0x9B,
+0xC9,0x38,0x8C,0x66,0xC0,0xC8,0x08,0x3B,0x43,0x3C,0x83,0xDD,0x2A,0x52,0xAB,0x08,
+0x21,0x7E,0xCD,0x4F,0xEF,0x45,0x69,0x70,0x0C,0x7C,0xB5,0xFE,0x1B,0x51,0x4E,0x09,
+0x28,0x2C,0x07,0x2B,0x4A,0x79,0x8C,0x41,0x45,0xC4,0x53,0x0B,0xCD,0xE5,0xD4,0xA6,
+0xBB,0x93,0x33,0xD8,0x37,0x96,0xC3,0xB0,0x2B,0x5B,0xC5,0xC5,0xE6,0x49,0x5C,0x41,
+0x5B,0x75,0xA3,0x02,0xDB,0x15,0x9E,0x73,0xD0,0xA6,0xCC,0xE4,0xC8,0x9A,0x1A,0xC7,
+0x01,0x07,0x93,0xB0,0xDF,0xEB,0xB8,0xFD,0x7F,0xDC,0xAB,0x18,0x94,0x92,0x8B,0x8D,
+0xF4,0x0C,0x29,0x09,0x50,0x4F,0x5B,0x71,0xE1,0xDA,0x50,0x5E,0xA3,0xBF,0xDF,0xDC,
+0xA4,0x8A,0xF0,0x07,0x4B,0x02,0x03,0x01,0x00,0x01,0xA3,0x82,0x03,0x37,0x30,0x82,
+0x03,0x33,0x30,0x0F,0x06,0x03,0x55,0x1D,0x13,0x01,0x01,0xFF,0x04,0x05,0x30,0x03,
+0x01,0x01,0xFF,0x30,0x4F,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,0x07,0x01,0x01,0x04,
+0x43,0x30,0x41,0x30,0x3F,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,0x07,0x30,0x02,0x86,
+0x33,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x68,0x74,0x74,0x70,0x2E,0x66,0x70,0x6B,
+0x69,0x2E,0x67,0x6F,0x76,0x2F,0x66,0x63,0x70,0x63,0x61,0x2F,0x63,0x61,0x43,0x65,
+0x72,0x74,0x73,0x49,0x73,0x73,0x75,0x65,0x64,0x54,0x6F,0x66,0x63,0x70,0x63,0x61,
+0x2E,0x70,0x37,0x63,0x30,0x81,0x8D,0x06,0x03,0x55,0x1D,0x21,0x04,0x81,0x85,0x30,
+0x81,0x82,0x30,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x06,
+0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x03,0x30,0x18,0x06,0x0A,
+0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x07,0x06,0x0A,0x60,0x86,0x48,0x01,
+0x65,0x03,0x02,0x01,0x03,0x0C,0x30,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,
+0x02,0x01,0x03,0x08,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x25,
+0x30,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x10,0x06,0x0A,
+0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x04,0x30,0x18,0x06,0x0A,0x60,0x86,
+0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x24,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,
+0x02,0x01,0x03,0x26,0x30,0x82,0x01,0x41,0x06,0x03,0x55,0x1D,0x20,0x04,0x82,0x01,
+0x38,0x30,0x82,0x01,0x34,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,
+0x01,0x03,0x01,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,
+0x02,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x03,0x30,
+0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x0C,0x30,0x0C,0x06,
+0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x0E,0x30,0x0C,0x06,0x0A,0x60,
+0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x0F,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,
+0x01,0x65,0x03,0x02,0x01,0x03,0x25,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,
+0x03,0x02,0x01,0x03,0x26,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,
+0x01,0x03,0x04,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,
+0x12,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x13,0x30,
+0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x14,0x30,0x0C,0x06,
+0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x06,0x30,0x0C,0x06,0x0A,0x60,
+0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x07,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,
+0x01,0x65,0x03,0x02,0x01,0x03,0x08,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,
+0x03,0x02,0x01,0x03,0x24,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,
+0x01,0x03,0x0D,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,
+0x10,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x11,0x30,
+0x0C,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x28,0x30,0x0C,0x06,
+0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x29,0x30,0x0C,0x06,0x0A,0x60,
+0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x27,0x30,0x53,0x06,0x08,0x2B,0x06,0x01,
+0x05,0x05,0x07,0x01,0x0B,0x04,0x47,0x30,0x45,0x30,0x43,0x06,0x08,0x2B,0x06,0x01,
+0x05,0x05,0x07,0x30,0x05,0x86,0x37,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x68,0x74,
+0x74,0x70,0x2E,0x66,0x70,0x6B,0x69,0x2E,0x67,0x6F,0x76,0x2F,0x62,0x72,0x69,0x64,
+0x67,0x65,0x2F,0x63,0x61,0x43,0x65,0x72,0x74,0x73,0x49,0x73,0x73,0x75,0x65,0x64,
+0x42,0x79,0x66,0x62,0x63,0x61,0x32,0x30,0x31,0x33,0x2E,0x70,0x37,0x63,0x30,0x0F,
+0x06,0x03,0x55,0x1D,0x24,0x01,0x01,0xFF,0x04,0x05,0x30,0x03,0x81,0x01,0x02,0x30,
+0x0D,0x06,0x03,0x55,0x1D,0x36,0x01,0x01,0xFF,0x04,0x03,0x02,0x01,0x00,0x30,0x0E,
+0x06,0x03,0x55,0x1D,0x0F,0x01,0x01,0xFF,0x04,0x04,0x03,0x02,0x01,0x06,0x30,0x1F,
+0x06,0x03,0x55,0x1D,0x23,0x04,0x18,0x30,0x16,0x80,0x14,0xAD,0x0C,0x7A,0x75,0x5C,
+0xE5,0xF3,0x98,0xC4,0x79,0x98,0x0E,0xAC,0x28,0xFD,0x97,0xF4,0xE7,0x02,0xFC,0x30,
+0x35,0x06,0x03,0x55,0x1D,0x1F,0x04,0x2E,0x30,0x2C,0x30,0x2A,0xA0,0x28,0xA0,0x26,
+0x86,0x24,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x68,0x74,0x74,0x70,0x2E,0x66,0x70,
+0x6B,0x69,0x2E,0x67,0x6F,0x76,0x2F,0x66,0x63,0x70,0x63,0x61,0x2F,0x66,0x63,0x70,
+0x63,0x61,0x2E,0x63,0x72,0x6C,0x30,0x1D,0x06,0x03,0x55,0x1D,0x0E,0x04,0x16,0x04,
+0x14,0xBB,0xCE,0x74,0x71,0x83,0x34,0x4E,0x59,0x32,0x45,0x15,0x5F,0x40,0x60,0x60,
+0xDC,0x2B,0xB0,0xB4,0xE4,0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,
+0x01,0x0B,0x05,0x00,0x03,0x82,0x01,0x01,0x00,0xC0,0x1E,0x6D,0x27,0xF0,0x79,0x47,
+0x52,0x46,0x84,0xC8,0x88,0x5D,0x2E,0x9C,0xA6,0x76,0xFD,0xFC,0xF9,0x85,0xD2,0x79,
+0x3C,0x06,0x21,0xFB,0xCC,0xFD,0x27,0x39,0xBC,0xA3,0x1A,0x91,0x64,0x57,0xA8,0x5E,
+0x80,0x71,0xB0,0x43,0x66,0x9D,0x2A,0xF8,0x11,0x47,0xBA,0x0C,0x7E,0x58,0x5F,0xB7,
+0x51,0x8F,0x23,0xB9,0xDD,0x13,0xEF,0x18,0xF2,0x89,0xF4,0x51,0x37,0x59,0x81,0x4A,
+0xC4,0x70,0xAD,0x47,0xEC,0x8B,0x1A,0x53,0x71,0xE7,0x2F,0x49,0x66,0xC6,0xEF,0x84,
+0x1B,0x2C,0xF3,0x43,0x5D,0x3C,0x11,0x7B,0x41,0x20,0x5B,0x8E,0x5A,0x72,0xD5,0x01,
+0x84,0xF6,0x32,0xF5,0x01,0xF1,0x3A,0xC8,0x7E,0x8F,0xF4,0xFA,0xD0,0xC5,0x78,0xD6,
+0xBF,0xA3,0x84,0x1C,0x18,0x66,0xC8,0x4D,0xBC,0x33,0xFD,0xDF,0x4D,0xCE,0x78,0xB2,
+0x52,0x1B,0x46,0x88,0x72,0x67,0x4D,0x6D,0x72,0x5B,0xBB,0xE1,0x57,0x2D,0xCF,0x3E,
+0x0A,0x4D,0x07,0x37,0x70,0x94,0xB2,0x23,0xBB,0xDA,0xD5,0xBE,0x6F,0x87,0x52,0xF6,
+0x57,0x53,0xA8,0x6B,0x33,0x3B,0x60,0xD9,0xB0,0x84,0x0E,0xB0,0x4A,0x59,0x4F,0x6B,
+0xAC,0xB7,0x4C,0x95,0xBE,0x37,0xB1,0xD3,0x39,0x83,0xC8,0xB3,0x8D,0xEB,0xDC,0x38,
+0x65,0xCF,0x16,0x33,0x66,0xAE,0x72,0x92,0x8F,0x0D,0x68,0xE4,0xD2,0x5D,0x72,0x73,
+0x30,0x08,0xA5,0x4C,0x74,0x5A,0xDC,0x1F,0x9B,0x4B,0x71,0x60,0x9C,0xD3,0x5E,0x50,
+0xBF,0x2E,0x6D,0xCE,0xB2,0x5B,0xE6,0xC6,0xED,0xC9,0x7C,0x8B,0x01,0xD1,0xDB,0xB1,
+0xCD,0xA7,0xA1,0x62,0x6E,0xD4,0x67,0x5E,0x31,
+};
+
+/* subject:/C=US/O=U.S. Government/OU=DoD/OU=PKI/CN=DoD Interoperability Root CA 1 */
+/* issuer :/C=US/O=U.S. Government/OU=FPKI/CN=SHA-1 Federal Root CA */
+static unsigned char _dod_interop_root_ca[1588]={
+0x30,0x82,0x06,0x30,0x30,0x82,0x05,0x18,0xA0,0x03,0x02,0x01,0x02,0x02,0x02,0x15,
+0x95,0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,0x05,0x05,0x00,
+0x30,0x56,0x31,0x0B,0x30,0x09,0x06,0x03,0x55,0x04,0x06,0x13,0x02,0x55,0x53,0x31,
+0x18,0x30,0x16,0x06,0x03,0x55,0x04,0x0A,0x13,0x0F,0x55,0x2E,0x53,0x2E,0x20,0x47,
+0x6F,0x76,0x65,0x72,0x6E,0x6D,0x65,0x6E,0x74,0x31,0x0D,0x30,0x0B,0x06,0x03,0x55,
+0x04,0x0B,0x13,0x04,0x46,0x50,0x4B,0x49,0x31,0x1E,0x30,0x1C,0x06,0x03,0x55,0x04,
+0x03,0x13,0x15,0x53,0x48,0x41,0x2D,0x31,0x20,0x46,0x65,0x64,0x65,0x72,0x61,0x6C,
+0x20,0x52,0x6F,0x6F,0x74,0x20,0x43,0x41,0x30,0x1E,0x17,0x0D,0x31,0x33,0x31,0x32,
+0x30,0x33,0x31,0x36,0x30,0x34,0x33,0x32,0x5A,0x17,0x0D,0x31,0x36,0x31,0x32,0x30,
+0x33,0x31,0x36,0x30,0x32,0x34,0x38,0x5A,0x30,0x6C,0x31,0x0B,0x30,0x09,0x06,0x03,
+0x55,0x04,0x06,0x13,0x02,0x55,0x53,0x31,0x18,0x30,0x16,0x06,0x03,0x55,0x04,0x0A,
+0x13,0x0F,0x55,0x2E,0x53,0x2E,0x20,0x47,0x6F,0x76,0x65,0x72,0x6E,0x6D,0x65,0x6E,
+0x74,0x31,0x0C,0x30,0x0A,0x06,0x03,0x55,0x04,0x0B,0x13,0x03,0x44,0x6F,0x44,0x31,
+0x0C,0x30,0x0A,0x06,0x03,0x55,0x04,0x0B,0x13,0x03,0x50,0x4B,0x49,0x31,0x27,0x30,
+0x25,0x06,0x03,0x55,0x04,0x03,0x13,0x1E,0x44,0x6F,0x44,0x20,0x49,0x6E,0x74,0x65,
+0x72,0x6F,0x70,0x65,0x72,0x61,0x62,0x69,0x6C,0x69,0x74,0x79,0x20,0x52,0x6F,0x6F,
+0x74,0x20,0x43,0x41,0x20,0x31,0x30,0x82,0x01,0x22,0x30,0x0D,0x06,0x09,0x2A,0x86,
+0x48,0x86,0xF7,0x0D,0x01,0x01,0x01,0x05,0x00,0x03,0x82,0x01,0x0F,0x00,0x30,0x82,
+0x01,0x0A,0x02,0x82,0x01,0x01,0x00,0x9C,0x7D,0xB2,0xF6,0xCD,0x5A,0x1A,0x5B,0xB7,
+0x30,0xF5,0x32,0x2F,0x0B,0x9E,0x9A,0xC3,0x1C,0xA8,0x42,0x32,0x6B,0x6C,0x59,0x57,
+0x70,0x42,0x3C,0x4A,0xA9,0xA9,0xB1,0xDD,0x42,0xE0,0x59,0xBE,0x78,0x96,0xC0,0xFF,
+0x7B,0xB9,0x23,0xBF,0x5E,0x49,0x32,0xF1,0x1B,0x69,0x73,0xEB,0xC6,0x72,0x47,0xD7,
+0x7F,0x29,0xBF,0x6D,0xD6,0x93,0xE7,0xB4,0x61,0xE4,0xA4,0x7C,0x1C,0xF0,0x56,0xCD,
+0xD0,0xB3,0x99,0x24,0xC4,0xC1,0x7D,0xD5,0xEE,0xD2,0x83,0x8D,0x68,0x68,0x8C,0x8E,
+0x98,0xE5,0x5D,0x29,0x38,0xC8,0xA6,0xB3,0xE7,0xED,0x21,0x2B,0x58,0xBA,0x83,0x5B,
+0xBC,0xF4,0x03,0x90,0x3F,0x60,0xEE,0x2B,0x2F,0x96,0xD4,0x2E,0x37,0x8F,0xAB,0x2C,
+0xB4,0x1B,0xA2,0x80,0x0D,0x35,0x89,0x47,0x63,0x44,0x46,0xC4,0xAA,0x45,0x43,0x7B,
+0xC1,0x3C,0xD2,0x21,0x43,0x8A,0x02,0x76,0x13,0x6D,0x7B,0x57,0x19,0xBF,0xA7,0x38,
+0x79,0x9B,0x5F,0xFA,0x6F,0xDF,0xFA,0x61,0x8C,0x07,0xD9,0x4D,0xF2,0x26,0xEF,0xF2,
+0x90,0x35,0x1F,0xD7,0xFD,0x74,0x72,0x90,0x29,0x36,0xF1,0x6E,0x74,0xC4,0xDC,0xF7,
+0xB5,0x1B,0xD7,0x85,0x78,0x21,0xAF,0x20,0xC9,0x7A,0xA5,0x7D,0x0E,0x74,0xE1,0x8F,
+0x24,0x6C,0x43,0xD3,0x09,0xF4,0x83,0xA5,0x39,0x12,0x2E,0x4F,0xD4,0x94,0xFA,0xB3,
+0x5F,0x07,0xDB,0x17,0x83,0x27,0x9E,0x07,0xA6,0xCA,0x07,0xDE,0xAF,0x4A,0x13,0xEE,
+0x37,0x2E,0x37,0xAC,0x91,0xE8,0x2D,0x6C,0x82,0x52,0xBD,0x02,0x08,0xAE,0x1F,0x09,
+0xBC,0x0A,0x23,0xA0,0x59,0xFC,0xDD,0x02,0x03,0x01,0x00,0x01,0xA3,0x82,0x02,0xF0,
+0x30,0x82,0x02,0xEC,0x30,0x0F,0x06,0x03,0x55,0x1D,0x13,0x01,0x01,0xFF,0x04,0x05,
+0x30,0x03,0x01,0x01,0xFF,0x30,0x55,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,0x07,0x01,
+0x01,0x04,0x49,0x30,0x47,0x30,0x45,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,0x07,0x30,
+0x02,0x86,0x39,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x68,0x74,0x74,0x70,0x2E,0x66,
+0x70,0x6B,0x69,0x2E,0x67,0x6F,0x76,0x2F,0x73,0x68,0x61,0x31,0x66,0x72,0x63,0x61,
+0x2F,0x63,0x61,0x43,0x65,0x72,0x74,0x73,0x49,0x73,0x73,0x75,0x65,0x64,0x54,0x6F,
+0x73,0x68,0x61,0x31,0x66,0x72,0x63,0x61,0x2E,0x70,0x37,0x63,0x30,0x81,0xBE,0x06,
+0x03,0x55,0x1D,0x21,0x04,0x81,0xB6,0x30,0x81,0xB3,0x30,0x17,0x06,0x0A,0x60,0x86,
+0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x17,0x06,0x09,0x60,0x86,0x48,0x01,0x65,0x02,
+0x01,0x0B,0x12,0x30,0x17,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,
+0x18,0x06,0x09,0x60,0x86,0x48,0x01,0x65,0x02,0x01,0x0B,0x13,0x30,0x17,0x06,0x0A,
+0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x19,0x06,0x09,0x60,0x86,0x48,0x01,
+0x65,0x02,0x01,0x0B,0x11,0x30,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,
+0x01,0x03,0x19,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x0C,0x01,0x30,
+0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x17,0x06,0x0A,0x60,
+0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x0C,0x01,0x30,0x18,0x06,0x0A,0x60,0x86,0x48,
+0x01,0x65,0x03,0x02,0x01,0x03,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,
+0x01,0x0C,0x02,0x30,0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,
+0x18,0x06,0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x0C,0x03,0x30,0x81,0xA2,
+0x06,0x03,0x55,0x1D,0x1E,0x01,0x01,0xFF,0x04,0x81,0x97,0x30,0x81,0x94,0xA0,0x81,
+0x91,0x30,0x39,0xA4,0x37,0x30,0x35,0x31,0x0B,0x30,0x09,0x06,0x03,0x55,0x04,0x06,
+0x13,0x02,0x55,0x53,0x31,0x18,0x30,0x16,0x06,0x03,0x55,0x04,0x0A,0x13,0x0F,0x55,
+0x2E,0x53,0x2E,0x20,0x47,0x6F,0x76,0x65,0x72,0x6E,0x6D,0x65,0x6E,0x74,0x31,0x0C,
+0x30,0x0A,0x06,0x03,0x55,0x04,0x0B,0x13,0x03,0x44,0x6F,0x44,0x30,0x19,0xA4,0x17,
+0x30,0x15,0x31,0x13,0x30,0x11,0x06,0x0A,0x09,0x92,0x26,0x89,0x93,0xF2,0x2C,0x64,
+0x01,0x19,0x16,0x03,0x6D,0x69,0x6C,0x30,0x39,0xA4,0x37,0x30,0x35,0x31,0x0B,0x30,
+0x09,0x06,0x03,0x55,0x04,0x06,0x13,0x02,0x55,0x53,0x31,0x18,0x30,0x16,0x06,0x03,
+0x55,0x04,0x0A,0x13,0x0F,0x55,0x2E,0x53,0x2E,0x20,0x47,0x6F,0x76,0x65,0x72,0x6E,
+0x6D,0x65,0x6E,0x74,0x31,0x0C,0x30,0x0A,0x06,0x03,0x55,0x04,0x0B,0x13,0x03,0x45,
+0x43,0x41,0x30,0x33,0x06,0x03,0x55,0x1D,0x20,0x04,0x2C,0x30,0x2A,0x30,0x0C,0x06,
+0x0A,0x60,0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x17,0x30,0x0C,0x06,0x0A,0x60,
+0x86,0x48,0x01,0x65,0x03,0x02,0x01,0x03,0x18,0x30,0x0C,0x06,0x0A,0x60,0x86,0x48,
+0x01,0x65,0x03,0x02,0x01,0x03,0x19,0x30,0x5A,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,
+0x07,0x01,0x0B,0x04,0x4E,0x30,0x4C,0x30,0x4A,0x06,0x08,0x2B,0x06,0x01,0x05,0x05,
+0x07,0x30,0x05,0x86,0x3E,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x63,0x72,0x6C,0x2E,
+0x64,0x69,0x73,0x61,0x2E,0x6D,0x69,0x6C,0x2F,0x69,0x73,0x73,0x75,0x65,0x64,0x62,
+0x79,0x2F,0x44,0x4F,0x44,0x49,0x4E,0x54,0x45,0x52,0x4F,0x50,0x45,0x52,0x41,0x42,
+0x49,0x4C,0x49,0x54,0x59,0x52,0x4F,0x4F,0x54,0x43,0x41,0x31,0x5F,0x49,0x42,0x2E,
+0x70,0x37,0x63,0x30,0x0E,0x06,0x03,0x55,0x1D,0x0F,0x01,0x01,0xFF,0x04,0x04,0x03,
+0x02,0x01,0x06,0x30,0x1F,0x06,0x03,0x55,0x1D,0x23,0x04,0x18,0x30,0x16,0x80,0x14,
+0x86,0x9A,0x5C,0x62,0xFF,0x73,0x93,0xD5,0xE1,0x8A,0x7F,0x4A,0xC6,0x88,0x2E,0x9F,
+0x6E,0xA0,0xAE,0x12,0x30,0x3B,0x06,0x03,0x55,0x1D,0x1F,0x04,0x34,0x30,0x32,0x30,
+0x30,0xA0,0x2E,0xA0,0x2C,0x86,0x2A,0x68,0x74,0x74,0x70,0x3A,0x2F,0x2F,0x68,0x74,
+0x74,0x70,0x2E,0x66,0x70,0x6B,0x69,0x2E,0x67,0x6F,0x76,0x2F,0x73,0x68,0x61,0x31,
+0x66,0x72,0x63,0x61,0x2F,0x73,0x68,0x61,0x31,0x66,0x72,0x63,0x61,0x2E,0x63,0x72,
+0x6C,0x30,0x1D,0x06,0x03,0x55,0x1D,0x0E,0x04,0x16,0x04,0x14,0x76,0x86,0x1E,0xDF,
+0xED,0x00,0xC9,0x7E,0x14,0x31,0x7C,0x5B,0x94,0x82,0x21,0x49,0x57,0xBE,0x70,0x07,
+0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,0x05,0x05,0x00,0x03,
+0x82,0x01,0x01,0x00,0x35,0xC2,0xF1,0x40,0x23,0x9D,0xD1,0x61,0xB5,0xB7,0xC4,0xD7,
+0xD8,0x38,0x62,0xF2,0xF1,0x20,0x29,0xBA,0xDD,0x87,0x84,0xA6,0xCB,0x87,0x4A,0x3D,
+0x97,0x7D,0x78,0x2C,0xD6,0x24,0xBA,0xCE,0x81,0x2C,0xE4,0xC9,0xC4,0x43,0xC0,0xB8,
+0x6E,0x93,0xF4,0xED,0xE4,0x2E,0x3E,0x0A,0x82,0x0C,0x62,0x90,0xDE,0xE6,0xF7,0xAB,
+0x03,0xD1,0xB3,0x07,0xC1,0xCB,0xA9,0x55,0x9E,0x5F,0x29,0x48,0x0A,0x18,0xF1,0xFA,
+0x17,0x7C,0x34,0x88,0xE9,0xB3,0xC2,0x09,0x4D,0xD4,0x17,0xEB,0x00,0xA5,0xBA,0x62,
+0x61,0xAC,0x37,0x5A,0x15,0xC4,0x0F,0x5B,0x0A,0x00,0xCA,0x95,0xDD,0xCC,0xB4,0x5E,
+0xC2,0x81,0xB2,0x20,0x39,0x6A,0x84,0xA3,0xBD,0x53,0x48,0xE9,0x2D,0x02,0x93,0x5A,
+0x6D,0xE0,0x71,0xF7,0xA5,0x77,0xA3,0xAB,0x22,0x1F,0x11,0x0A,0x05,0x0F,0x3C,0x5C,
+0x33,0x72,0xE8,0xD6,0xFB,0x2A,0x8C,0x57,0x6F,0x5D,0x43,0x52,0x59,0xA5,0x5F,0x52,
+0x4C,0x99,0x4B,0x88,0x5C,0x6A,0x35,0x4B,0x72,0x5A,0x55,0x6D,0xC4,0xF9,0x73,0x6A,
+0x37,0x18,0x0A,0x1C,0x24,0x1B,0x47,0xCE,0x94,0x4F,0x8A,0x3A,0x95,0xE0,0x54,0x26,
+0x93,0x2E,0x05,0x98,0x10,0x34,0xCB,0xAC,0x84,0x96,0xD2,0xE6,0xED,0xCD,0xE6,0x06,
+0x0A,0xE0,0x8D,0x47,0x7A,0xEE,0x81,0xAA,0xDA,0x5D,0xD5,0xE9,0x45,0xFF,0xC7,0xE6,
+0x99,0x87,0x12,0xF8,0x24,0xFE,0x71,0xED,0x9B,0x69,0x43,0xD9,0x78,0xDD,0x85,0x73,
+0xEE,0xA7,0xC4,0xE2,0xEA,0xAE,0x49,0xB8,0x0A,0xE5,0x39,0x9D,0x0F,0xF4,0x4F,0xF6,
+0x2B,0xB1,0x31,0xD2,
+};
+
 /* Test basic add delete update copy matching stuff. */
 static void tests(void)
 {
@@ -894,12 +1111,157 @@ errOut:
     CFReleaseSafe(cert);
 }
 
+static const struct {
+    const uint8_t *der;
+    size_t length;
+} corpus[] = {
+    { _c0, sizeof(_c0) },
+    { _c1, sizeof(_c1) },
+    { _c2, sizeof(_c2) },
+    { _phased_c3, sizeof(_phased_c3) },
+    { _elektron_v1_cert_der, sizeof(_elektron_v1_cert_der) },
+    { _wapi_as_der, sizeof(_wapi_as_der) },
+    { two_common_names, sizeof(two_common_names) },
+    { _federal_bridge_ca, sizeof(_federal_bridge_ca) },
+    { _dod_interop_root_ca, sizeof(_dod_interop_root_ca) },
+};
+
+static bool items_agree(const DERItem *a, const DERItem *b) {
+    return a->length == b->length && (a->length == 0 || !memcmp(a->data, b->data, a->length));
+}
+
+static bool arrays_agree(CFArrayRef a, CFArrayRef b) {
+    bool agree = CFEqualSafe(a, b);
+    CFReleaseSafe(a);
+    CFReleaseSafe(b);
+    return agree;
+}
+
+/* Every accessor backed by a lazily decoded extension. */
+static bool extensions_agree(SecCertificateRef lazy, SecCertificateRef eager) {
+    const SecCEBasicConstraints *lbc = SecCertificateGetBasicConstraints(lazy);
+    const SecCEBasicConstraints *ebc = SecCertificateGetBasicConstraints(eager);
+    if ((lbc == NULL) != (ebc == NULL) ||
+        (lbc && (lbc->critical != ebc->critical || lbc->isCA != ebc->isCA ||
+                 lbc->pathLenConstraintPresent != ebc->pathLenConstraintPresent ||
+                 lbc->pathLenConstraint != ebc->pathLenConstraint))) {
+        return false;
+    }
+
+    const SecCECertificatePolicies *lcp = SecCertificateGetCertificatePolicies(lazy);
+    const SecCECertificatePolicies *ecp = SecCertificateGetCertificatePolicies(eager);
+    if ((lcp == NULL) != (ecp == NULL) ||
+        (lcp && (lcp->critical != ecp->critical || lcp->numPolicies != ecp->numPolicies))) {
+        return false;
+    }
+    for (uint32_t ix = 0; lcp && ix < lcp->numPolicies; ++ix) {
+        if (!items_agree(&lcp->policies[ix].policyIdentifier, &ecp->policies[ix].policyIdentifier) ||
+            !items_agree(&lcp->policies[ix].policyQualifiers, &ecp->policies[ix].policyQualifiers)) {
+            return false;
+        }
+    }
+
+    const SecCEPolicyMappings *lpm = SecCertificateGetPolicyMappings(lazy);
+    const SecCEPolicyMappings *epm = SecCertificateGetPolicyMappings(eager);
+    if ((lpm == NULL) != (epm == NULL) ||
+        (lpm && (lpm->critical != epm->critical || lpm->numMappings != epm->numMappings))) {
+        return false;
+    }
+    for (uint32_t ix = 0; lpm && ix < lpm->numMappings; ++ix) {
+        if (!items_agree(&lpm->mappings[ix].issuerDomainPolicy, &epm->mappings[ix].issuerDomainPolicy) ||
+            !items_agree(&lpm->mappings[ix].subjectDomainPolicy, &epm->mappings[ix].subjectDomainPolicy)) {
+            return false;
+        }
+    }
+
+    const SecCEPolicyConstraints *lpc = SecCertificateGetPolicyConstraints(lazy);
+    const SecCEPolicyConstraints *epc = SecCertificateGetPolicyConstraints(eager);
+    if ((lpc == NULL) != (epc == NULL) ||
+        (lpc && (lpc->critical != epc->critical ||
+                 lpc->requireExplicitPolicyPresent != epc->requireExplicitPolicyPresent ||
+                 lpc->requireExplicitPolicy != epc->requireExplicitPolicy ||
+                 lpc->inhibitPolicyMappingPresent != epc->inhibitPolicyMappingPresent ||
+                 lpc->inhibitPolicyMapping != epc->inhibitPolicyMapping))) {
+        return false;
+    }
+
+    const SecCEInhibitAnyPolicy *lia = SecCertificateGetInhibitAnyPolicySkipCerts(lazy);
+    const SecCEInhibitAnyPolicy *eia = SecCertificateGetInhibitAnyPolicySkipCerts(eager);
+    if ((lia == NULL) != (eia == NULL) ||
+        (lia && (lia->critical != eia->critical || lia->skipCerts != eia->skipCerts))) {
+        return false;
+    }
+
+    const DERItem *lsan = SecCertificateGetSubjectAltName(lazy);
+    const DERItem *esan = SecCertificateGetSubjectAltName(eager);
+    if ((lsan == NULL) != (esan == NULL) || (lsan && !items_agree(lsan, esan))) {
+        return false;
+    }
+
+    return SecCertificateHasCriticalSubjectAltName(lazy) == SecCertificateHasCriticalSubjectAltName(eager) &&
+        arrays_agree(SecCertificateCopyDNSNames(lazy), SecCertificateCopyDNSNames(eager)) &&
+        arrays_agree(SecCertificateCopyIPAddresses(lazy), SecCertificateCopyIPAddresses(eager)) &&
+        arrays_agree(SecCertificateCopyRFC822Names(lazy), SecCertificateCopyRFC822Names(eager)) &&
+        arrays_agree(SecCertificateCopyNTPrincipalNames(lazy), SecCertificateCopyNTPrincipalNames(eager)) &&
+        SecCertificateGetKeyUsage(lazy) == SecCertificateGetKeyUsage(eager) &&
+        CFEqualSafe(SecCertificateGetPermittedSubtrees(lazy), SecCertificateGetPermittedSubtrees(eager)) &&
+        CFEqualSafe(SecCertificateGetExcludedSubtrees(lazy), SecCertificateGetExcludedSubtrees(eager)) &&
+        CFEqualSafe(SecCertificateGetAuthorityKeyID(lazy), SecCertificateGetAuthorityKeyID(eager)) &&
+        CFEqualSafe(SecCertificateGetSubjectKeyID(lazy), SecCertificateGetSubjectKeyID(eager)) &&
+        CFEqualSafe(SecCertificateGetCRLDistributionPoints(lazy), SecCertificateGetCRLDistributionPoints(eager)) &&
+        CFEqualSafe(SecCertificateGetOCSPResponders(lazy), SecCertificateGetOCSPResponders(eager)) &&
+        CFEqualSafe(SecCertificateGetCAIssuers(lazy), SecCertificateGetCAIssuers(eager));
+}
+
+/* Create 100000 certificates from the corpus, asking each only for its
+   subject like most callers do. */
+static CFAbsoluteTime time_creation(bool lazy) {
+    SecCertificateSetLazyExtensionParsing(lazy);
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int ix = 0; ix < 100000; ++ix) {
+        size_t cx = ix % array_size(corpus);
+        SecCertificateRef cert = SecCertificateCreateWithBytes(NULL, corpus[cx].der, corpus[cx].length);
+        SecCertificateGetNormalizedSubjectContent(cert);
+        CFReleaseSafe(cert);
+    }
+    return CFAbsoluteTimeGetCurrent() - start;
+}
+
+static void test_lazy_extensions(void) {
+    for (size_t cx = 0; cx < array_size(corpus); ++cx) {
+        SecCertificateSetLazyExtensionParsing(true);
+        SecCertificateRef lazy = SecCertificateCreateWithBytes(NULL, corpus[cx].der, corpus[cx].length);
+        SecCertificateSetLazyExtensionParsing(false);
+        SecCertificateRef eager = SecCertificateCreateWithBytes(NULL, corpus[cx].der, corpus[cx].length);
+        ok(lazy && eager && extensions_agree(lazy, eager), "lazily and eagerly parsed extensions agree for corpus[%zu]", cx);
+        CFReleaseSafe(lazy);
+        CFReleaseSafe(eager);
+    }
+    SecCertificateSetLazyExtensionParsing(true);
+
+    /* Make sure the corpus exercises the less common extensions at all. */
+    SecCertificateRef bridge = SecCertificateCreateWithBytes(NULL, _federal_bridge_ca, sizeof(_federal_bridge_ca));
+    ok(bridge && SecCertificateGetPolicyMappings(bridge) && SecCertificateGetPolicyConstraints(bridge) &&
+       SecCertificateGetInhibitAnyPolicySkipCerts(bridge) && SecCertificateGetCAIssuers(bridge),
+       "lazily parsed policy mappings, policy constraints, inhibit any policy and CA issuers");
+    CFReleaseSafe(bridge);
+
+    SecCertificateRef dod = SecCertificateCreateWithBytes(NULL, _dod_interop_root_ca, sizeof(_dod_interop_root_ca));
+    ok(dod && SecCertificateGetPermittedSubtrees(dod), "lazily parsed name constraints");
+    CFReleaseSafe(dod);
+
+    CFAbsoluteTime eagerTime = time_creation(false);
+    CFAbsoluteTime lazyTime = time_creation(true);
+    diag("100000 certificates: eager %.3fs lazy %.3fs", eagerTime, lazyTime);
+}
+
 int si_15_certificate(int argc, char *const *argv)
 {
-	plan_tests(24);
+	plan_tests(35);
 
 	tests();
     test_common_name();
+    test_lazy_extensions();
 
 	return 0;
 }
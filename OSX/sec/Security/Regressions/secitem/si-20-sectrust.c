@@ -16,6 +16,7 @@
 
 #if TARGET_OS_IPHONE
 #include <Security/SecInternal.h>
+#include <Security/SecCertificateInternal.h>
 #include <ipc/securityd_client.h>
 #endif
 
@@ -585,12 +586,32 @@ errOut:
     CFReleaseNull(date);
 }
 
+static void test_signature_cache() {
+    SecCertificateRef cert0 = NULL, cert1 = NULL;
+    uint64_t hits = 0, misses = 0;
+
+    require(cert0 = SecCertificateCreateWithBytes(NULL, _c0, sizeof(_c0)), errOut);
+    require(cert1 = SecCertificateCreateWithBytes(NULL, _c1, sizeof(_c1)), errOut);
+
+    SecCertificateFlushSignatureCache();
+    ok_status(SecCertificateIsSignedByCertificate(cert0, cert1), "cert0 signed by cert1");
+    ok_status(SecCertificateIsSignedByCertificate(cert0, cert1), "cert0 signed by cert1 again");
+    SecCertificateGetSignatureCacheStatistics(&hits, &misses);
+    ok(hits >= 1, "second verify hit the cache (%llu hits, %llu misses)", hits, misses);
+    is_status(SecCertificateIsSignedByCertificate(cert1, cert0), errSecNotSigner, "cert1 not signed by cert0");
+    is_status(SecCertificateIsSignedByCertificate(cert1, cert0), errSecNotSigner, "failures are not cached");
+
+errOut:
+    CFReleaseNull(cert0);
+    CFReleaseNull(cert1);
+}
+
 int si_20_sectrust(int argc, char *const *argv)
 {
 #if TARGET_OS_IPHONE
-	plan_tests(101+9+(8*13)+9+1);
+	plan_tests(101+9+(8*13)+9+1+5);
 #else
-    plan_tests(97+9+(8*13)+9+1);
+    plan_tests(97+9+(8*13)+9+1+5);
 #endif
 
 	basic_tests();
@@ -601,6 +622,7 @@ int si_20_sectrust(int argc, char *const *argv)
     ec_key_size_tests();
     test_input_certificates();
     test_async_trust();
+    test_signature_cache();
 
 	return 0;
 }
@@ -532,6 +532,24 @@ static void test_multiple_constraints(void) {
 
 }
 
+#define kNumberChangedSettingsTests (3+3*4)
+static void test_changed_settings(void) {
+    /* trustd remembers evaluation results; the same evaluation repeated after
+     * a trust settings change must see the new settings, not a cached result */
+    setTS(cert0, NULL);
+    check_trust(sslChain, basicPolicy, verify_date, kSecTrustResultUnspecified);
+
+    NSDictionary *deny = @{ (__bridge NSString*)kSecTrustSettingsResult: @(kSecTrustSettingsResultDeny)};
+    setTS(cert0, (__bridge CFDictionaryRef)deny);
+    check_trust(sslChain, basicPolicy, verify_date, kSecTrustResultDeny);
+
+    removeTS(cert0);
+#if !TARGET_OS_IPHONE
+    usleep(20000);
+#endif
+    check_trust(sslChain, basicPolicy, verify_date, kSecTrustResultRecoverableTrustFailure);
+}
+
 int si_28_sectrustsettings(int argc, char *const *argv)
 {
     plan_tests(kNumberNoConstraintsTests +
@@ -540,7 +558,8 @@ int si_28_sectrustsettings(int argc, char *const *argv)
                kNumberApplicationsConstraintsTests +
                kNumberKeyUsageConstraintsTests +
                kNumberAllowedErrorsTests +
-               kNumberMultipleConstraintsTests);
+               kNumberMultipleConstraintsTests +
+               kNumberChangedSettingsTests);
 
 #if !TARGET_OS_IPHONE
     if (getuid() != 0) {
@@ -558,6 +577,7 @@ int si_28_sectrustsettings(int argc, char *const *argv)
         test_key_usage_constraints();
         test_allowed_errors();
         test_multiple_constraints();
+        test_changed_settings();
         cleanup_globals();
     }
 
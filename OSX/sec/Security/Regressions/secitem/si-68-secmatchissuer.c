@@ -39,10 +39,14 @@
 #include <Security/SecItem.h>
 #include <Security/SecInternal.h>
 #include <utilities/array_size.h>
+#include <utilities/SecCFWrappers.h>
 
 #include "Security_regressions.h"
 #include <test/testcert.h>
 
+/* More issuer names than sqlite will bind in one IN list (999). */
+#define kLargeClosureCount 1000
+
 /*
 static OSStatus add_item_to_keychain(CFTypeRef item, CFDataRef * persistent_ref)
 {
@@ -122,6 +126,9 @@ static void tests(void)
     CFStringRef root_authority_name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Root CA"), uuidString);
     CFStringRef intermediate_authority_name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Intermediate CA"), uuidString);
     CFStringRef leaf_name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Client"), uuidString);
+    CFStringRef other_authority_name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Other CA"), uuidString);
+    CFStringRef outsider_name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Outsider"), uuidString);
+    CFStringRef large_org = CFStringCreateCopy(kCFAllocatorDefault, uuidString);
     CFRelease(uuidString);
     CFRelease(UUID);
 
@@ -149,6 +156,15 @@ static void tests(void)
     ok_status(add_item(leaf_identity), "add leaf");
     //CFShow(leaf_cert);
 
+    // a certificate from an unrelated hierarchy, which must never match
+    SecIdentityRef other_identity =
+        test_cert_create_root_certificate(other_authority_name, public_key, private_key);
+    CFRelease(other_authority_name);
+    SecCertificateRef outsider_cert = test_cert_issue_certificate(other_identity, public_key,
+          outsider_name, 4343, kSecKeyUsageDigitalSignature);
+    CFRelease(outsider_name);
+    ok_status(add_item(outsider_cert), "add outsider");
+
     // this is already canonical - see if we can get the raw one
     CFDataRef issuer = SecCertificateGetNormalizedIssuerContent(intermediate_cert);
     ok(CFDataGetLength(issuer) < 128, "max 127 bytes of content - or else you'll need to properly encode issuer sequence");
@@ -188,6 +204,74 @@ static void tests(void)
         CFReleaseSafe(cfLimit);
     }
 
+    {
+        const void *keys[] = { kSecClass, kSecReturnRef, kSecMatchLimit, kSecMatchIssuers };
+        const void *vals[] = { kSecClassCertificate, kCFBooleanTrue, kSecMatchLimitOne, all_distinguished_names };
+        CFDictionaryRef first_certificate_query = CFDictionaryCreate(kCFAllocatorDefault, keys, vals, array_size(keys), NULL, NULL);
+        CFTypeRef first_matching_certificate = NULL;
+        ok_status(SecItemCopyMatching(first_certificate_query, &first_matching_certificate), "find first certificate matching");
+        CFReleaseNull(first_certificate_query);
+        ok(first_matching_certificate && (SecCertificateGetTypeID() == CFGetTypeID(first_matching_certificate)), "return 1");
+        CFReleaseNull(first_matching_certificate);
+    }
+
+    {
+        const void *keys[] = { kSecClass, kSecReturnRef, kSecMatchLimit, kSecMatchIssuers };
+        const void *vals[] = { kSecClassCertificate, kCFBooleanTrue, kSecMatchLimitAll, all_distinguished_names };
+        CFDictionaryRef all_certificates_query = CFDictionaryCreate(kCFAllocatorDefault, keys, vals, array_size(keys), NULL, NULL);
+        CFTypeRef all_matching_certificates = NULL;
+        ok_status(SecItemCopyMatching(all_certificates_query, &all_matching_certificates), "find all certificates matching");
+        CFReleaseNull(all_certificates_query);
+        ok(isArray(all_matching_certificates) &&
+           !CFArrayContainsValue(all_matching_certificates, CFRangeMake(0, CFArrayGetCount(all_matching_certificates)), outsider_cert),
+           "certificate outside the issuer chain is excluded");
+        CFReleaseNull(all_matching_certificates);
+    }
+
+// MARK: issuer closure larger than an sqlite IN list
+
+    CFMutableArrayRef large_items = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    OSStatus large_status = errSecSuccess;
+    for (int ix = 0; ix < kLargeClosureCount && large_status == errSecSuccess; ix++) {
+        CFStringRef name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Intermediate CA %d"), large_org, ix);
+        SecCertificateRef ica = test_cert_issue_certificate(ca_identity, public_key, name, 10000 + ix, kSecKeyUsageKeyCertSign);
+        CFRelease(name);
+        SecIdentityRef ica_identity = SecIdentityCreate(kCFAllocatorDefault, ica, private_key);
+        name = CFStringCreateWithFormat(kCFAllocatorDefault, 0, CFSTR("O=%@,CN=Client %d"), large_org, ix);
+        SecCertificateRef client = test_cert_issue_certificate(ica_identity, public_key, name, 20000 + ix, kSecKeyUsageDigitalSignature);
+        CFRelease(name);
+        large_status = add_item(ica);
+        if (large_status == errSecSuccess)
+            large_status = add_item(client);
+        CFArrayAppendValue(large_items, ica);
+        CFArrayAppendValue(large_items, client);
+        CFRelease(client);
+        CFRelease(ica_identity);
+        CFRelease(ica);
+    }
+    ok_status(large_status, "add %d intermediates, each with a leaf", kLargeClosureCount);
+
+    {
+        const void *keys[] = { kSecClass, kSecReturnRef, kSecMatchLimit, kSecMatchIssuers };
+        const void *vals[] = { kSecClassCertificate, kCFBooleanTrue, kSecMatchLimitAll, all_distinguished_names };
+        CFDictionaryRef all_certificates_query = CFDictionaryCreate(kCFAllocatorDefault, keys, vals, array_size(keys), NULL, NULL);
+        CFTypeRef all_matching_certificates = NULL;
+        ok_status(SecItemCopyMatching(all_certificates_query, &all_matching_certificates), "find all certificates under a large closure");
+        CFReleaseNull(all_certificates_query);
+        is(isArray(all_matching_certificates) ? CFArrayGetCount(all_matching_certificates) : 0,
+           2 + 2 * kLargeClosureCount, "return every certificate in the large hierarchy");
+        CFReleaseNull(all_matching_certificates);
+    }
+
+    for (CFIndex ix = 0; ix < CFArrayGetCount(large_items); ix++)
+        remove_item(CFArrayGetValueAtIndex(large_items, ix));
+    CFRelease(large_items);
+    CFRelease(large_org);
+
+    remove_item(outsider_cert);
+    CFRelease(outsider_cert);
+    CFRelease(other_identity);
+
     remove_item(leaf_identity);
     CFRelease(leaf_identity);
     CFRelease(leaf_cert);
@@ -206,7 +290,7 @@ static void tests(void)
 
 int si_68_secmatchissuer(int argc, char *const *argv)
 {
-	plan_tests(10);
+	plan_tests(18);
     
 	tests();
     
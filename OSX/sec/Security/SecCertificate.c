@@ -63,6 +63,7 @@
 #include <utilities/array_size.h>
 #include <stdlib.h>
 #include <libkern/OSByteOrder.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <Security/SecInternal.h>
 #include <Security/SecFrameworkStrings.h>
@@ -110,6 +111,10 @@ struct __SecCertificate {
 
     bool                _foundUnknownCriticalExtension;
 
+    /* kSecCEParsed bits of the well known extensions decoded so far.  Only
+       read with acquire and written under gSecExtensionParseLock. */
+    uint32_t            _parsedExtensions;
+
     /* Well known certificate extensions. */
     SecCEBasicConstraints       _basicConstraints;
     SecCEPolicyConstraints      _policyConstraints;
@@ -1517,6 +1522,80 @@ CFDataRef SecDistinguishedNameCopyNormalizedContent(CFDataRef distinguished_name
     return NULL;
 }
 
+/* Well known extensions are decoded the first time one of their accessors
+   is called rather than in SecCertificateParse, since most certificates are
+   only ever asked for their names and key. */
+enum {
+    kSecCEParsedSubjectKeyIdentifier    = 1 << 0,
+    kSecCEParsedKeyUsage                = 1 << 1,
+    kSecCEParsedSubjectAltName          = 1 << 2,
+    kSecCEParsedBasicConstraints        = 1 << 3,
+    kSecCEParsedNameConstraints         = 1 << 4,
+    kSecCEParsedCertificatePolicies     = 1 << 5,
+    kSecCEParsedPolicyMappings          = 1 << 6,
+    kSecCEParsedAuthorityKeyIdentifier  = 1 << 7,
+    kSecCEParsedPolicyConstraints       = 1 << 8,
+    kSecCEParsedInhibitAnyPolicy        = 1 << 9,
+    /* CRL distribution points, AIA and the WWDR OCSP fallback. */
+    kSecCEParsedRevocationInfo          = 1 << 10,
+    kSecCEParsedAll                     = (1 << 11) - 1,
+};
+
+static const struct {
+    uint32_t flag;
+    const DERItem *oid;
+} sLazyExtensions[] = {
+    { kSecCEParsedSubjectKeyIdentifier, &oidSubjectKeyIdentifier },
+    { kSecCEParsedKeyUsage, &oidKeyUsage },
+    { kSecCEParsedSubjectAltName, &oidSubjectAltName },
+    { kSecCEParsedBasicConstraints, &oidBasicConstraints },
+    { kSecCEParsedNameConstraints, &oidNameConstraints },
+    { kSecCEParsedCertificatePolicies, &oidCertificatePolicies },
+    { kSecCEParsedPolicyMappings, &oidPolicyMappings },
+    { kSecCEParsedAuthorityKeyIdentifier, &oidAuthorityKeyIdentifier },
+    { kSecCEParsedPolicyConstraints, &oidPolicyConstraints },
+    { kSecCEParsedInhibitAnyPolicy, &oidInhibitAnyPolicy },
+    { kSecCEParsedRevocationInfo, &oidCrlDistributionPoints },
+    { kSecCEParsedRevocationInfo, &oidAuthorityInfoAccess },
+};
+
+static pthread_mutex_t gSecExtensionParseLock = PTHREAD_MUTEX_INITIALIZER;
+static bool gSecLazyExtensionParsing = true;
+
+void SecCertificateSetLazyExtensionParsing(bool lazy) {
+    gSecLazyExtensionParsing = lazy;
+}
+
+/* Make sure the extensions named by flags have been decoded. */
+static void SecCertificateParseExtensions(SecCertificateRef certificate,
+    uint32_t flags) {
+    if ((__atomic_load_n(&certificate->_parsedExtensions, __ATOMIC_ACQUIRE) & flags) == flags) {
+        return;
+    }
+
+    pthread_mutex_lock(&gSecExtensionParseLock);
+    uint32_t missing = flags & ~certificate->_parsedExtensions;
+    for (size_t lx = 0; lx < array_size(sLazyExtensions); ++lx) {
+        if (!(missing & sLazyExtensions[lx].flag)) {
+            continue;
+        }
+        SecCertificateExtensionParser parser =
+            (SecCertificateExtensionParser)CFDictionaryGetValue(
+            sExtensionParsers, sLazyExtensions[lx].oid);
+        for (CFIndex ix = 0; ix < certificate->_extensionCount; ++ix) {
+            if (DEROidCompare(&certificate->_extensions[ix].extnID, sLazyExtensions[lx].oid)) {
+                parser(certificate, &certificate->_extensions[ix]);
+            }
+        }
+    }
+    if (missing & kSecCEParsedRevocationInfo) {
+        checkForMissingRevocationInfo(certificate);
+    }
+    __atomic_store_n(&certificate->_parsedExtensions,
+        certificate->_parsedExtensions | missing, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&gSecExtensionParseLock);
+}
+
 /* AUDIT[securityd]:
    certificate->_der is a caller provided data of any length (might be 0).
 
@@ -1723,8 +1802,11 @@ static bool SecCertificateParse(SecCertificateRef certificate)
 				(SecCertificateExtensionParser)CFDictionaryGetValue(
 				sExtensionParsers, &certificate->_extensions[ix].extnID);
 			if (parser) {
-				/* Invoke the parser. */
-				parser(certificate, &certificate->_extensions[ix]);
+				/* Invoke the parser, unless SecCertificateParseExtensions
+				   will do that on first use. */
+				if (!gSecLazyExtensionParsing) {
+					parser(certificate, &certificate->_extensions[ix]);
+				}
 			} else if (certificate->_extensions[ix].critical) {
 				if (isAppleExtensionOID(&extn.extnID)) {
 					continue;
@@ -1736,7 +1818,10 @@ static bool SecCertificateParse(SecCertificateRef certificate)
 			}
 		}
 	}
-	checkForMissingRevocationInfo(certificate);
+	if (!gSecLazyExtensionParsing) {
+		checkForMissingRevocationInfo(certificate);
+		certificate->_parsedExtensions = kSecCEParsedAll;
+	}
 
 	return true;
 
@@ -4115,7 +4200,84 @@ OSStatus SecCertificateIsSignedBy(SecCertificateRef certificate,
     return errSecSuccess;
 }
 
+/* Memo of certificate/issuer pairs whose signature verified.  A slot holds
+   SHA-256 of the whole certificate (tbs, signature algorithm and signature)
+   followed by SHA-256 of the issuer's SubjectPublicKeyInfo, and is simply
+   overwritten when another pair hashes to it. */
+#define kSecSignatureCacheSlots 1024
+#define kSecSignatureCacheKeySize (2 * CC_SHA256_DIGEST_LENGTH)
+
+static pthread_mutex_t gSecSignatureCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t gSecSignatureCache[kSecSignatureCacheSlots][kSecSignatureCacheKeySize];
+static uint64_t gSecSignatureCacheHits;
+static uint64_t gSecSignatureCacheMisses;
+
+static bool SecSignatureCacheKeyCreate(SecCertificateRef certificate,
+    SecCertificateRef issuer, uint8_t key[kSecSignatureCacheKeySize]) {
+    if (!certificate->_der.data || !issuer->_subjectPublicKeyInfo.data)
+        return false;
+    CC_SHA256(certificate->_der.data, (CC_LONG)certificate->_der.length, key);
+    CC_SHA256(issuer->_subjectPublicKeyInfo.data,
+        (CC_LONG)issuer->_subjectPublicKeyInfo.length, key + CC_SHA256_DIGEST_LENGTH);
+    return true;
+}
+
+static size_t SecSignatureCacheSlot(const uint8_t key[kSecSignatureCacheKeySize]) {
+    return (OSReadBigInt32(key, 0) ^ OSReadBigInt32(key, CC_SHA256_DIGEST_LENGTH)) % kSecSignatureCacheSlots;
+}
+
+OSStatus SecCertificateIsSignedByCertificate(SecCertificateRef certificate,
+    SecCertificateRef issuer) {
+    uint8_t key[kSecSignatureCacheKeySize];
+    bool haveKey = SecSignatureCacheKeyCreate(certificate, issuer, key);
+    if (haveKey) {
+        size_t slot = SecSignatureCacheSlot(key);
+        pthread_mutex_lock(&gSecSignatureCacheLock);
+        bool hit = !memcmp(gSecSignatureCache[slot], key, sizeof(key));
+        if (hit)
+            gSecSignatureCacheHits++;
+        else
+            gSecSignatureCacheMisses++;
+        pthread_mutex_unlock(&gSecSignatureCacheLock);
+        if (hit)
+            return errSecSuccess;
+    }
+
+#if TARGET_OS_OSX
+    SecKeyRef issuerKey = SecCertificateCopyPublicKey_ios(issuer);
+#else
+    SecKeyRef issuerKey = SecCertificateCopyPublicKey(issuer);
+#endif
+    if (!issuerKey)
+        return errSecInvalidKeyRef;
+    OSStatus status = SecCertificateIsSignedBy(certificate, issuerKey);
+    CFRelease(issuerKey);
+
+    if (haveKey && status == errSecSuccess) {
+        size_t slot = SecSignatureCacheSlot(key);
+        pthread_mutex_lock(&gSecSignatureCacheLock);
+        memcpy(gSecSignatureCache[slot], key, sizeof(key));
+        pthread_mutex_unlock(&gSecSignatureCacheLock);
+    }
+    return status;
+}
+
+void SecCertificateGetSignatureCacheStatistics(uint64_t *hits, uint64_t *misses) {
+    pthread_mutex_lock(&gSecSignatureCacheLock);
+    if (hits) *hits = gSecSignatureCacheHits;
+    if (misses) *misses = gSecSignatureCacheMisses;
+    pthread_mutex_unlock(&gSecSignatureCacheLock);
+}
+
+void SecCertificateFlushSignatureCache(void) {
+    pthread_mutex_lock(&gSecSignatureCacheLock);
+    memset(gSecSignatureCache, 0, sizeof(gSecSignatureCache));
+    gSecSignatureCacheHits = gSecSignatureCacheMisses = 0;
+    pthread_mutex_unlock(&gSecSignatureCacheLock);
+}
+
 const DERItem * SecCertificateGetSubjectAltName(SecCertificateRef certificate) {
+    SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
     if (!certificate->_subjectAltName) {
         return NULL;
     }
@@ -4140,6 +4302,7 @@ static OSStatus appendIPAddressesFromGeneralNames(void *context,
 
 CFArrayRef SecCertificateCopyIPAddresses(SecCertificateRef certificate) {
 	/* These can only exist in the subject alt name. */
+	SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
 	if (!certificate->_subjectAltName)
 		return NULL;
 
@@ -4281,6 +4444,7 @@ CFArrayRef SecCertificateCopyDNSNames(SecCertificateRef certificate) {
 	CFMutableArrayRef dnsNames = CFArrayCreateMutable(kCFAllocatorDefault,
 		0, &kCFTypeArrayCallBacks);
 	OSStatus status = errSecSuccess;
+	SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
 	if (certificate->_subjectAltName) {
 		status = SecCertificateParseGeneralNames(&certificate->_subjectAltName->extnValue,
 			dnsNames, appendDNSNamesFromGeneralNames);
@@ -4347,6 +4511,7 @@ CFArrayRef SecCertificateCopyRFC822Names(SecCertificateRef certificate) {
 	CFMutableArrayRef rfc822Names = CFArrayCreateMutable(kCFAllocatorDefault,
 		0, &kCFTypeArrayCallBacks);
 	OSStatus status = errSecSuccess;
+	SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
 	if (certificate->_subjectAltName) {
 		status = SecCertificateParseGeneralNames(&certificate->_subjectAltName->extnValue,
 			rfc822Names, appendRFC822NamesFromGeneralNames);
@@ -4506,6 +4671,7 @@ CFArrayRef SecCertificateCopyCountry(SecCertificateRef certificate) {
 
 const SecCEBasicConstraints *
 SecCertificateGetBasicConstraints(SecCertificateRef certificate) {
+	SecCertificateParseExtensions(certificate, kSecCEParsedBasicConstraints);
 	if (certificate->_basicConstraints.present)
 		return &certificate->_basicConstraints;
 	else
@@ -4513,15 +4679,18 @@ SecCertificateGetBasicConstraints(SecCertificateRef certificate) {
 }
 
 CFArrayRef SecCertificateGetPermittedSubtrees(SecCertificateRef certificate) {
+    SecCertificateParseExtensions(certificate, kSecCEParsedNameConstraints);
     return (certificate->_permittedSubtrees);
 }
 
 CFArrayRef SecCertificateGetExcludedSubtrees(SecCertificateRef certificate) {
+    SecCertificateParseExtensions(certificate, kSecCEParsedNameConstraints);
     return (certificate->_excludedSubtrees);
 }
 
 const SecCEPolicyConstraints *
 SecCertificateGetPolicyConstraints(SecCertificateRef certificate) {
+	SecCertificateParseExtensions(certificate, kSecCEParsedPolicyConstraints);
 	if (certificate->_policyConstraints.present)
 		return &certificate->_policyConstraints;
 	else
@@ -4530,6 +4699,7 @@ SecCertificateGetPolicyConstraints(SecCertificateRef certificate) {
 
 const SecCEPolicyMappings *
 SecCertificateGetPolicyMappings(SecCertificateRef certificate) {
+    SecCertificateParseExtensions(certificate, kSecCEParsedPolicyMappings);
     if (certificate->_policyMappings.present) {
         return &certificate->_policyMappings;
     } else {
@@ -4539,6 +4709,7 @@ SecCertificateGetPolicyMappings(SecCertificateRef certificate) {
 
 const SecCECertificatePolicies *
 SecCertificateGetCertificatePolicies(SecCertificateRef certificate) {
+	SecCertificateParseExtensions(certificate, kSecCEParsedCertificatePolicies);
 	if (certificate->_certificatePolicies.present)
 		return &certificate->_certificatePolicies;
 	else
@@ -4547,6 +4718,7 @@ SecCertificateGetCertificatePolicies(SecCertificateRef certificate) {
 
 const SecCEInhibitAnyPolicy *
 SecCertificateGetInhibitAnyPolicySkipCerts(SecCertificateRef certificate) {
+    SecCertificateParseExtensions(certificate, kSecCEParsedInhibitAnyPolicy);
     if (certificate->_inhibitAnyPolicySkipCerts.present) {
         return &certificate->_inhibitAnyPolicySkipCerts;
     } else {
@@ -4582,6 +4754,7 @@ CFArrayRef SecCertificateCopyNTPrincipalNames(SecCertificateRef certificate) {
 	CFMutableArrayRef ntPrincipalNames = CFArrayCreateMutable(kCFAllocatorDefault,
 		0, &kCFTypeArrayCallBacks);
 	OSStatus status = errSecSuccess;
+	SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
 	if (certificate->_subjectAltName) {
 		status = SecCertificateParseGeneralNames(&certificate->_subjectAltName->extnValue,
 			ntPrincipalNames, appendNTPrincipalNamesFromGeneralNames);
@@ -4957,6 +5130,7 @@ CFDataRef SecCertificateGetAuthorityKeyID(SecCertificateRef certificate) {
 	if (!certificate) {
 		return NULL;
 	}
+	SecCertificateParseExtensions(certificate, kSecCEParsedAuthorityKeyIdentifier);
 	if (!certificate->_authorityKeyID &&
 		certificate->_authorityKeyIdentifier.length) {
 		certificate->_authorityKeyID = CFDataCreate(kCFAllocatorDefault,
@@ -4971,6 +5145,7 @@ CFDataRef SecCertificateGetSubjectKeyID(SecCertificateRef certificate) {
 	if (!certificate) {
 		return NULL;
 	}
+	SecCertificateParseExtensions(certificate, kSecCEParsedSubjectKeyIdentifier);
 	if (!certificate->_subjectKeyID &&
 		certificate->_subjectKeyIdentifier.length) {
 		certificate->_subjectKeyID = CFDataCreate(kCFAllocatorDefault,
@@ -4985,6 +5160,7 @@ CFArrayRef SecCertificateGetCRLDistributionPoints(SecCertificateRef certificate)
     if (!certificate) {
         return NULL;
     }
+    SecCertificateParseExtensions(certificate, kSecCEParsedRevocationInfo);
     return certificate->_crlDistributionPoints;
 }
 
@@ -4992,6 +5168,7 @@ CFArrayRef SecCertificateGetOCSPResponders(SecCertificateRef certificate) {
     if (!certificate) {
         return NULL;
     }
+    SecCertificateParseExtensions(certificate, kSecCEParsedRevocationInfo);
     return certificate->_ocspResponders;
 }
 
@@ -4999,6 +5176,7 @@ CFArrayRef SecCertificateGetCAIssuers(SecCertificateRef certificate) {
     if (!certificate) {
         return NULL;
     }
+    SecCertificateParseExtensions(certificate, kSecCEParsedRevocationInfo);
     return certificate->_caIssuers;
 }
 
@@ -5006,6 +5184,7 @@ bool SecCertificateHasCriticalSubjectAltName(SecCertificateRef certificate) {
     if (!certificate) {
         return false;
     }
+    SecCertificateParseExtensions(certificate, kSecCEParsedSubjectAltName);
     return certificate->_subjectAltName &&
         certificate->_subjectAltName->critical;
 }
@@ -5162,6 +5341,7 @@ SecKeyUsage SecCertificateGetKeyUsage(SecCertificateRef certificate) {
     if (!certificate) {
         return kSecKeyUsageUnspecified;
     }
+    SecCertificateParseExtensions(certificate, kSecCEParsedKeyUsage);
     return certificate->_keyUsage;
 }
 
@@ -131,6 +131,22 @@ const DERItem *SecCertificateGetPublicKeyData(SecCertificateRef certificate);
 OSStatus SecCertificateIsSignedBy(SecCertificateRef certificate,
     SecKeyRef issuerKey);
 
+/* Verify that certificate was signed by the public key of issuer.  Pairs that
+   verified are remembered in a small process wide cache, so path building
+   doesn't redo the same public key operations.  Returns errSecInvalidKeyRef
+   if issuer's public key can't be decoded. */
+OSStatus SecCertificateIsSignedByCertificate(SecCertificateRef certificate,
+    SecCertificateRef issuer);
+
+/* Hit and miss counters for SecCertificateIsSignedByCertificate. */
+void SecCertificateGetSignatureCacheStatistics(uint64_t *hits, uint64_t *misses);
+void SecCertificateFlushSignatureCache(void);
+
+/* By default well known extensions are only decoded when first asked for.
+   Passing false makes certificates created afterwards decode them all up
+   front, as SecCertificateParse used to. */
+void SecCertificateSetLazyExtensionParsing(bool lazy);
+
 void appendProperty(CFMutableArrayRef properties, CFStringRef propertyType,
     CFStringRef label, CFStringRef localizedLabel, CFTypeRef value);
 
@@ -349,12 +349,7 @@ SecCertificatePathRef SecCertificatePathCopyAddingLeaf(SecCertificatePathRef pat
 	bool isSelfSigned;
 
     /* First make sure the new leaf is signed by path's current leaf. */
-    SecKeyRef issuerKey = SecCertificatePathCopyPublicKeyAtIndex(path, 0);
-    if (!issuerKey)
-        return NULL;
-    OSStatus status = SecCertificateIsSignedBy(leaf, issuerKey);
-    CFRelease(issuerKey);
-    if (status)
+    if (SecCertificateIsSignedByCertificate(leaf, path->certificates[0]))
         return NULL;
 
     count = path->count + 1;
@@ -583,15 +578,11 @@ SecPathVerifyStatus SecCertificatePathVerify(
 	for (;
 		certificatePath->lastVerifiedSigner < certificatePath->count - 1;
 		++certificatePath->lastVerifiedSigner) {
-		SecKeyRef issuerKey =
-			SecCertificatePathCopyPublicKeyAtIndex(certificatePath,
-				certificatePath->lastVerifiedSigner + 1);
-		if (!issuerKey)
-			return kSecPathVerifiesUnknown;
-		OSStatus status = SecCertificateIsSignedBy(
+		OSStatus status = SecCertificateIsSignedByCertificate(
 			certificatePath->certificates[certificatePath->lastVerifiedSigner],
-			issuerKey);
-		CFRelease(issuerKey);
+			certificatePath->certificates[certificatePath->lastVerifiedSigner + 1]);
+		if (status == errSecInvalidKeyRef)
+			return kSecPathVerifiesUnknown;
 		if (status) {
 			return kSecPathVerifyFailed;
 		}
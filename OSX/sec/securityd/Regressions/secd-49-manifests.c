@@ -32,9 +32,10 @@
 #include <utilities/der_plist.h>
 #include <Security/SecureObjectSync/SOSDigestVector.h>
 #include <securityd/SecDbItem.h>
+#include <corecrypto/ccdigest.h>
 #include <stdlib.h>
 
-static int kTestTestCount = 68;
+static int kTestTestCount = 83;
 
 
 #define okmfcomplement(r, b, n, ...)  test_okmfcomplement(r, b, n, test_create_description(__VA_ARGS__), test_directive, test_reason, __FILE__, __LINE__, NULL)
@@ -335,6 +336,71 @@ static void testComplement(mf_t *mf) {
     okmfcomplement(mf->empty, mf->bab, mf->ab);
 }
 
+static SOSManifestRef createManifestWithRange(uint32_t first, uint32_t count) {
+    struct SOSDigestVector dv = SOSDigestVectorInit;
+    for (uint32_t ix = first; ix < first + count; ++ix) {
+        uint8_t digest[SOSDigestSize];
+        ccdigest(ccsha1_di(), sizeof(ix), &ix, digest);
+        SOSDigestVectorAppend(&dv, digest);
+    }
+    SOSManifestRef mf = SOSManifestCreateWithDigestVector(&dv, NULL);
+    SOSDigestVectorFree(&dv);
+    return mf;
+}
+
+static void testSketch(void) {
+    CFErrorRef error = NULL;
+    SOSManifestRef remote = createManifestWithRange(0, 5000);
+    SOSManifestRef local = createManifestWithRange(20, 5030);
+    SOSManifestRef empty = SOSManifestCreateWithBytes(NULL, 0, NULL);
+    SOSManifestRef rebuilt = NULL;
+    CFDataRef estimator = NULL;
+    CFDataRef sketch = NULL;
+    size_t differences = 0;
+    size_t cells = 0;
+
+    ok(estimator = SOSManifestCopyDifferenceEstimator(local, &error), "estimator create: %@", error);
+    CFReleaseNull(error);
+    ok(SOSManifestEstimateDifference(remote, estimator, &differences, &error), "estimate difference: %@", error);
+    CFReleaseNull(error);
+    ok(differences >= 25 && differences <= 200, "estimated %zu for 50 differences", differences);
+    ok(cells = SOSManifestSketchCellsForDifference(remote, differences), "%zu cells for %zu differences", cells, differences);
+
+    ok(sketch = SOSManifestCopySketch(remote, cells, &error), "sketch create: %@", error);
+    CFReleaseNull(error);
+    ok((size_t)CFDataGetLength(sketch) < SOSManifestGetSize(remote) / 4, "sketch of %zu bytes for %zu byte manifest", (size_t)CFDataGetLength(sketch), SOSManifestGetSize(remote));
+
+    ok(rebuilt = SOSManifestCreateWithSketch(local, sketch, &error), "rebuild from 50 differences: %@", error);
+    CFReleaseNull(error);
+    ok(CFEqualSafe(rebuilt, remote), "rebuilt %@ == remote %@", rebuilt, remote);
+    CFReleaseNull(rebuilt);
+
+    ok(rebuilt = SOSManifestCreateWithSketch(remote, sketch, &error), "rebuild from identical manifest: %@", error);
+    CFReleaseNull(error);
+    ok(CFEqualSafe(rebuilt, remote), "rebuilt %@ == remote %@", rebuilt, remote);
+    CFReleaseNull(rebuilt);
+
+    rebuilt = SOSManifestCreateWithSketch(empty, sketch, &error);
+    ok(!rebuilt && error && CFErrorGetCode(error) == kSOSManifestSketchDecodeError, "5000 differences don't fit in sketch: %@", error);
+    CFReleaseNull(error);
+    CFReleaseNull(rebuilt);
+
+    // Too far apart for any sketch to beat the manifest itself.
+    CFReleaseNull(estimator);
+    ok(estimator = SOSManifestCopyDifferenceEstimator(empty, &error), "empty estimator create: %@", error);
+    CFReleaseNull(error);
+    ok(SOSManifestEstimateDifference(remote, estimator, &differences, &error), "estimate difference: %@", error);
+    CFReleaseNull(error);
+    ok(differences >= 2500, "estimated %zu for 5000 differences", differences);
+    is(SOSManifestSketchCellsForDifference(remote, differences), (size_t)0, "send full manifest for %zu differences", differences);
+
+    CFReleaseNull(sketch);
+    CFReleaseNull(estimator);
+    CFReleaseNull(empty);
+    CFReleaseNull(local);
+    CFReleaseNull(remote);
+}
+
 static void tests(void)
 {
     mf_t mf;
@@ -346,6 +412,7 @@ static void tests(void)
     testUnion(&mf);
     testIntersect(&mf);
     testComplement(&mf);
+    testSketch();
 
     teardownMF(&mf);
 }
@@ -32,7 +32,7 @@
 #include <Security/SecureObjectSync/SOSDigestVector.h>
 #include <securityd/SecDbItem.h>
 
-static int kTestTestCount = 68;
+static int kTestTestCount = 73;
 
 static void testNullMessage(uint64_t msgid)
 {
@@ -147,6 +147,47 @@ __unused static void testDeltaManifestMessage(const char *test_directive, const
     CFReleaseNull(sender);
 }
 
+static void testSketchMessage(uint64_t msgid)
+{
+    SOSMessageRef sentMessage = NULL;
+    SOSMessageRef rcvdMessage = NULL;
+    SOSManifestRef proposed = NULL;
+    CFErrorRef error = NULL;
+    CFDataRef data = NULL;
+
+    struct SOSDigestVector dv = SOSDigestVectorInit;
+    SOSDigestVectorAppend(&dv, (const uint8_t *)"sha1 hash that is 20 bytes long or so and stuff");
+    SOSDigestVectorAppend(&dv, (const uint8_t *)"so much more is good to see here is another one for me");
+    SOSDigestVectorSort(&dv);
+    proposed = SOSManifestCreateWithBytes((const uint8_t *)dv.digest, dv.count * SOSDigestSize, &error);
+    SOSDigestVectorFree(&dv);
+    CFReleaseNull(error);
+
+    sentMessage = SOSMessageCreateWithManifests(kCFAllocatorDefault, proposed, NULL, proposed, true, &error);
+    CFReleaseNull(error);
+    ok(SOSMessageSetManifestSketch(sentMessage, proposed, 96, &error), "set sketch: %@", error);
+    CFReleaseNull(error);
+    ok(SOSMessageSetDifferenceEstimator(sentMessage, proposed, &error), "set estimator: %@", error);
+    CFReleaseNull(error);
+    SOSMessageSetFlags(sentMessage, (SOSMessageFlags)1 << kSOSMessageAcceptsManifestSketches);
+    ok(data = SOSMessageCreateData(sentMessage, msgid, &error), "sentMessage data create: %@", error);
+    CFReleaseNull(error);
+
+    // Decode
+    ok(rcvdMessage = SOSMessageCreateWithData(kCFAllocatorDefault, data, &error), "rcvdMessage create: %@", error);
+    CFReleaseNull(error);
+    ok(sentMessage && rcvdMessage && CFEqual(sentMessage, rcvdMessage)
+       && CFEqualSafe(SOSMessageGetManifestSketch(sentMessage), SOSMessageGetManifestSketch(rcvdMessage))
+       && CFEqualSafe(SOSMessageGetDifferenceEstimator(sentMessage), SOSMessageGetDifferenceEstimator(rcvdMessage))
+       && SOSMessageGetDifferenceEstimator(rcvdMessage)
+       && !SOSMessageGetAdditions(rcvdMessage), "sent %@ == rcvd %@", sentMessage, rcvdMessage);
+
+    CFReleaseNull(data);
+    CFReleaseNull(sentMessage);
+    CFReleaseNull(rcvdMessage);
+    CFReleaseNull(proposed);
+}
+
 static CFDataRef testCopyAddedObject(SOSMessageRef message, CFPropertyListRef plist)
 {
     CFErrorRef error = NULL;
@@ -238,6 +279,7 @@ static void tests(void)
     testNullMessage(++msgid); // v2
     testFlaggedMessage(test_directive, test_reason, ++msgid, 0x865);
     testFlaggedMessage(test_directive, test_reason, ++msgid, 0xdeadbeef);
+    testSketchMessage(++msgid);
     TODO: {
         todo("V2 doesn't work");
         testDeltaManifestMessage(test_directive, test_reason, 0);
@@ -93,6 +93,26 @@ static CFArrayRef subject_to_anchors(CFDataRef nic)
     return result;
 }
 
+static CFDataRef CopyCertDataFromOffset(const char *anchorTable, CFNumberRef offset)
+{
+    uint32_t offset_value = 0;
+    if (!CFNumberGetValue(offset, kCFNumberSInt32Type, &offset_value))
+    {
+        return NULL;
+    }
+
+    char* pDataPtr = (char *)(anchorTable + offset_value);
+    //int32_t record_length = *((int32_t * )pDataPtr);
+    //record_length = record_length;
+    pDataPtr += sizeof(uint32_t);
+
+    int32_t cert_data_length = *((int32_t * )pDataPtr);
+    pDataPtr += sizeof(uint32_t);
+
+    return CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)pDataPtr,
+                                       cert_data_length, kCFAllocatorNull);
+}
+
 static CFArrayRef CopyCertDataFromIndices(CFArrayRef offsets)
 {
     CFMutableArrayRef result = NULL;
@@ -117,57 +137,88 @@ static CFArrayRef CopyCertDataFromIndices(CFArrayRef offsets)
     for (CFIndex idx = 0; idx < num_offsets; idx++)
     {
         CFNumberRef offset = (CFNumberRef)CFArrayGetValueAtIndex(offsets, idx);
-        uint32_t offset_value = 0;
-        if (CFNumberGetValue(offset, kCFNumberSInt32Type, &offset_value))
+        CFDataRef cert_data = CopyCertDataFromOffset(anchorTable, offset);
+        if (NULL != cert_data)
         {
-            char* pDataPtr = (char *)(anchorTable + offset_value);
-            //int32_t record_length = *((int32_t * )pDataPtr);
-            //record_length = record_length;
-            pDataPtr += sizeof(uint32_t);
-
-            int32_t cert_data_length = *((int32_t * )pDataPtr);
-            pDataPtr += sizeof(uint32_t);
-
-            CFDataRef cert_data = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)pDataPtr,
-                                                              cert_data_length, kCFAllocatorNull);
-            if (NULL != cert_data)
-            {
-                CFArrayAppendValue(result, cert_data);
-                CFReleaseSafe(cert_data);
-            }
+            CFArrayAppendValue(result, cert_data);
+            CFReleaseSafe(cert_data);
         }
     }
     CFReleaseSafe(otapkiref);
     return result;
 }
 
+/* Parsed system anchors keyed by their offset in the anchor table.  The cache
+   belongs to one OTAPKI asset; it is replaced as a whole, under the queue,
+   as soon as a lookup sees a different current asset. */
+static dispatch_once_t kSecSystemAnchorCacheOnce;
+static dispatch_queue_t kSecSystemAnchorCacheQueue;
+static SecOTAPKIRef kSecSystemAnchorCacheOTAPKIRef;
+static CFMutableDictionaryRef kSecSystemAnchorCache;
+
 static CFArrayRef CopyCertsFromIndices(CFArrayRef offsets)
 {
-    CFMutableArrayRef result = NULL;
+    __block CFMutableArrayRef result = NULL;
 
-    CFArrayRef cert_data_array = CopyCertDataFromIndices(offsets);
+    SecOTAPKIRef otapkiref = SecOTAPKICopyCurrentOTAPKIRef();
+    if (NULL == otapkiref)
+    {
+        return result;
+    }
 
-    if (NULL != cert_data_array)
+    const char* anchorTable = SecOTAPKIGetAnchorTable(otapkiref);
+    if (NULL == anchorTable)
     {
+        CFReleaseSafe(otapkiref);
+        return result;
+    }
+
+    dispatch_once(&kSecSystemAnchorCacheOnce, ^{
+        kSecSystemAnchorCacheQueue = dispatch_queue_create("com.apple.security.systemanchorcache", DISPATCH_QUEUE_SERIAL);
+    });
+
+    dispatch_sync(kSecSystemAnchorCacheQueue, ^{
+        if (kSecSystemAnchorCacheOTAPKIRef != otapkiref)
+        {
+            CFRetainAssign(kSecSystemAnchorCacheOTAPKIRef, otapkiref);
+            CFReleaseNull(kSecSystemAnchorCache);
+        }
+        if (NULL == kSecSystemAnchorCache)
+        {
+            kSecSystemAnchorCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+                                                              &kCFTypeDictionaryKeyCallBacks,
+                                                              &kCFTypeDictionaryValueCallBacks);
+        }
+
         result = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
-        CFIndex num_cert_datas = CFArrayGetCount(cert_data_array);
-        for (CFIndex idx = 0; idx < num_cert_datas; idx++)
+        CFIndex num_offsets = CFArrayGetCount(offsets);
+        for (CFIndex idx = 0; idx < num_offsets; idx++)
         {
-            CFDataRef cert_data = (CFDataRef)CFArrayGetValueAtIndex(cert_data_array, idx);
-            if (NULL != cert_data)
+            CFNumberRef offset = (CFNumberRef)CFArrayGetValueAtIndex(offsets, idx);
+            SecCertificateRef cert = (SecCertificateRef)CFDictionaryGetValue(kSecSystemAnchorCache, offset);
+            if (NULL == cert)
             {
-                SecCertificateRef cert = SecCertificateCreateWithData(kCFAllocatorDefault, cert_data);
+                CFDataRef cert_data = CopyCertDataFromOffset(anchorTable, offset);
+                if (NULL != cert_data)
+                {
+                    cert = SecCertificateCreateWithData(kCFAllocatorDefault, cert_data);
+                    CFRelease(cert_data);
+                }
                 if (NULL != cert)
                 {
-                    CFArrayAppendValue(result, cert);
+                    CFDictionarySetValue(kSecSystemAnchorCache, offset, cert);
                     CFRelease(cert);
                 }
             }
+            if (NULL != cert)
+            {
+                CFArrayAppendValue(result, cert);
+            }
         }
-        CFRelease(cert_data_array);
-    }
-    return result;
+    });
 
+    CFReleaseSafe(otapkiref);
+    return result;
 }
 //#endif // SECITEM_SHIM_OSX
 
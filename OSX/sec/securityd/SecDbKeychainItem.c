@@ -821,6 +821,8 @@ CFMutableDictionaryRef s3dl_item_v3_decode(CFDataRef plain, CFErrorRef *error) {
     CFPropertyListRef item = NULL;
     const uint8_t *der_beg = CFDataGetBytePtr(plain);
     const uint8_t *der_end = der_beg + CFDataGetLength(plain);
+    // Copy rather than borrow: plain is decrypted secret data, and borrowing would keep all of it
+    // (v_Data included) alive for as long as any attribute value is.
     const uint8_t *der = der_decode_plist(0, kCFPropertyListMutableContainers, &item, error, der_beg, der_end);
     if (!der && error && CFEqualSafe(CFErrorGetDomain(*error), sSecDERErrorDomain) && CFErrorGetCode(*error) == kSecDERErrorUnknownEncoding) {
         CFReleaseNull(*error);
@@ -837,6 +837,7 @@ bool query_destroy(Query *q, CFErrorRef *error) {
     CFReleaseSafe(q->q_musrView);
     CFReleaseSafe(q->q_primary_key_digest);
     CFReleaseSafe(q->q_match_issuer);
+    CFReleaseSafe(q->q_match_issuer_closure);
     CFReleaseSafe(q->q_access_control);
     CFReleaseSafe(q->q_use_cred_handle);
     CFReleaseSafe(q->q_caller_access_groups);
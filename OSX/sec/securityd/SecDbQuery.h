@@ -120,6 +120,9 @@ typedef struct Query
     CFDataRef q_primary_key_digest;
 
     CFArrayRef q_match_issuer;
+    // q_match_issuer plus every intermediate subject below it in the
+    // keychain, matched against the issr column directly in SQL.
+    CFArrayRef q_match_issuer_closure;
 
     /* Caller acces groups for AKS */
     CFArrayRef q_caller_access_groups;
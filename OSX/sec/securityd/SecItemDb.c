@@ -43,6 +43,7 @@
 #include <utilities/SecIOFormat.h>
 #include <SecAccessControlPriv.h>
 #include <uuid/uuid.h>
+#include <dispatch/dispatch.h>
 
 #define kSecBackupKeybagUUIDKey CFSTR("keybag-uuid")
 
@@ -309,17 +310,61 @@ s3dl_copy_data_from_col(sqlite3_stmt *stmt, int col, CFErrorRef *error) {
                                        kCFAllocatorNull);
 }
 
-static bool
-s3dl_item_from_col(sqlite3_stmt *stmt, Query *q, int col, CFArrayRef accessGroups,
-                   CFMutableDictionaryRef *item, SecAccessControlRef *access_control, CFErrorRef *error) {
-    CFDataRef edata = NULL;
-    bool ok = false;
-    require(edata = s3dl_copy_data_from_col(stmt, col, error), out);
-    ok = s3dl_item_from_data(edata, q, accessGroups, item, access_control, error);
+/* A row whose encrypted columns have been pulled out of the statement, so
+ it can be decrypted after sqlite has stepped past it.  Slot 0 is the data
+ column, slot 1 the key data column of an identity row. */
+struct s3dl_row {
+    sqlite_int64 rowid;
+    CFDataRef edata[2];
+    CFMutableDictionaryRef item[2];
+    SecAccessControlRef access_control[2];
+    CFErrorRef error[2];
+    bool ok[2];
+};
 
-out:
-    CFReleaseSafe(edata);
-    return ok;
+typedef void (*s3dl_handle_decrypted_row)(struct s3dl_row *row, void *context);
+
+static size_t s3dl_row_slots(const Query *q) {
+    return q->q_class == &identity_class ? 2 : 1;
+}
+
+/* Load rowid and encrypted data from stmt.  Unless copy is set the blobs
+ are only valid until the statement is stepped again. */
+static void s3dl_row_load(struct s3dl_row *row, sqlite3_stmt *stmt, size_t slots, bool copy) {
+    static const int cols[] = { 1, 3 };
+    row->rowid = sqlite3_column_int64(stmt, 0);
+    for (size_t slot = 0; slot < slots; ++slot) {
+        if (copy)
+            row->edata[slot] = CFDataCreate(0, sqlite3_column_blob(stmt, cols[slot]),
+                                            sqlite3_column_bytes(stmt, cols[slot]));
+        else
+            row->edata[slot] = s3dl_copy_data_from_col(stmt, cols[slot], NULL);
+    }
+}
+
+/* Only reads from q, so it's safe to call for several rows concurrently. */
+static void s3dl_row_decrypt(struct s3dl_row *row, size_t slot, Query *q, CFArrayRef accessGroups) {
+    if (row->edata[slot])
+        row->ok[slot] = s3dl_item_from_data(row->edata[slot], q, accessGroups, &row->item[slot],
+                                            &row->access_control[slot], &row->error[slot]);
+}
+
+/* Hand the error for slot over to *error, unless an error is already
+ pending there, which is what SecError() would have done. */
+static void s3dl_row_take_error(struct s3dl_row *row, size_t slot, CFErrorRef *error) {
+    if (*error == NULL) {
+        *error = row->error[slot];
+        row->error[slot] = NULL;
+    }
+}
+
+static void s3dl_row_release(struct s3dl_row *row) {
+    for (size_t slot = 0; slot < array_size(row->edata); ++slot) {
+        CFReleaseNull(row->edata[slot]);
+        CFReleaseNull(row->item[slot]);
+        CFReleaseNull(row->access_control[slot]);
+        CFReleaseNull(row->error[slot]);
+    }
 }
 
 struct s3dl_query_ctx {
@@ -328,6 +373,9 @@ struct s3dl_query_ctx {
     SecDbConnectionRef dbt;
     CFTypeRef result;
     int found;
+    /* When set, unlimited queries decrypt rows in batches and hand them
+     here in statement order, instead of calling handle_row. */
+    s3dl_handle_decrypted_row decrypted_row;
 };
 
 /* Return whatever the caller requested based on the value of q->q_return_type.
@@ -388,26 +436,26 @@ static void s3dl_merge_into_dict(const void *key, const void *value, void *conte
     CFDictionarySetValue(context, key, value);
 }
 
-static void s3dl_query_row(sqlite3_stmt *stmt, void *context) {
+static void s3dl_query_decrypted_row(struct s3dl_row *row, void *context) {
     struct s3dl_query_ctx *c = context;
     Query *q = c->q;
 
-    sqlite_int64 rowid = sqlite3_column_int64(stmt, 0);
-    CFMutableDictionaryRef item = NULL;
-    bool ok = s3dl_item_from_col(stmt, q, 1, c->accessGroups, &item, NULL, &q->q_error);
-    if (!ok) {
+    sqlite_int64 rowid = row->rowid;
+    CFMutableDictionaryRef item = row->item[0];
+    row->item[0] = NULL;
+    if (!row->ok[0]) {
+        s3dl_row_take_error(row, 0, &q->q_error);
         OSStatus status = SecErrorGetOSStatus(q->q_error);
         // errSecDecode means the item is corrupted, stash it for delete.
         if (status == errSecDecode) {
             secwarning("ignoring corrupt %@,rowid=%" PRId64 " %@", q->q_class->name, rowid, q->q_error);
             {
-                CFDataRef edata = s3dl_copy_data_from_col(stmt, 1, NULL);
+                CFDataRef edata = row->edata[0];
                 CFMutableStringRef edatastring =  CFStringCreateMutable(kCFAllocatorDefault, 0);
                 if(edatastring) {
                     CFStringAppendEncryptedData(edatastring, edata);
                     secnotice("item", "corrupted edata=%@", edatastring);
                 }
-                CFReleaseSafe(edata);
                 CFReleaseSafe(edatastring);
             }
             CFReleaseNull(q->q_error);
@@ -417,6 +465,7 @@ static void s3dl_query_row(sqlite3_stmt *stmt, void *context) {
             secerror("decode %@,rowid=%" PRId64 " failed (%" PRIdOSStatus "): %@", q->q_class->name, rowid, status, q->q_error);
         }
         // q->q_error will be released appropriately by a call to query_error
+        CFReleaseSafe(item);
         return;
     }
 
@@ -426,10 +475,14 @@ static void s3dl_query_row(sqlite3_stmt *stmt, void *context) {
     if (q->q_class == &identity_class) {
         // TODO: Use col 2 for key rowid and use both rowids in persistent ref.
 
-        CFMutableDictionaryRef key;
+        CFMutableDictionaryRef key = row->item[1];
+        row->item[1] = NULL;
         /* TODO : if there is a errSecDecode error here, we should cleanup */
-        if (!s3dl_item_from_col(stmt, q, 3, c->accessGroups, &key, NULL, &q->q_error) || !key)
+        if (!row->ok[1] || !key) {
+            s3dl_row_take_error(row, 1, &q->q_error);
+            CFReleaseSafe(key);
             goto out;
+        }
 
         CFDataRef certData = CFDictionaryGetValue(item, kSecValueData);
         if (certData) {
@@ -469,6 +522,20 @@ out:
     CFReleaseSafe(item);
 }
 
+static void s3dl_query_row(sqlite3_stmt *stmt, void *context) {
+    struct s3dl_query_ctx *c = context;
+    struct s3dl_row row = { 0 };
+    size_t slots = s3dl_row_slots(c->q);
+
+    s3dl_row_load(&row, stmt, slots, false);
+    s3dl_row_decrypt(&row, 0, c->q, c->accessGroups);
+    /* Don't bother with the key if the certificate didn't decrypt. */
+    if (slots > 1 && row.ok[0] && row.item[0])
+        s3dl_row_decrypt(&row, 1, c->q, c->accessGroups);
+    s3dl_query_decrypted_row(&row, context);
+    s3dl_row_release(&row);
+}
+
 static void
 SecDbAppendWhereROWID(CFMutableStringRef sql,
                       CFStringRef col, sqlite_int64 row_id,
@@ -531,29 +598,29 @@ SecDbAppendWhereMusr(CFMutableStringRef sql,
                      const Query *q,
                      bool *needWhere)
 {
-    SecDbAppendWhereOrAnd(sql, needWhere);
-
 #if TARGET_OS_IPHONE
     if (isQueryOverBothUserAndSystem(q->q_musrView, NULL)) {
+        SecDbAppendWhereOrAnd(sql, needWhere);
         CFStringAppend(sql, CFSTR("(musr = ? OR musr = ?)"));
     } else
 #endif
     if (isQueryOverAllMUSRViews(q->q_musrView)) {
             /* query over all items, regardless of view */
     } else if (isQueryOverSingleUserView(q->q_musrView)) {
+        SecDbAppendWhereOrAnd(sql, needWhere);
         CFStringAppend(sql, CFSTR("musr = ?"));
     } else {
+        SecDbAppendWhereOrAnd(sql, needWhere);
         CFStringAppend(sql, CFSTR("musr = ?"));
     }
 }
 
 static void SecDbAppendWhereClause(CFMutableStringRef sql, const Query *q,
-                                   CFArrayRef accessGroups) {
-    bool needWhere = true;
-    SecDbAppendWhereROWID(sql, CFSTR("ROWID"), q->q_row_id, &needWhere);
-    SecDbAppendWhereAttrs(sql, q, &needWhere);
-    SecDbAppendWhereMusr(sql, q, &needWhere);
-    SecDbAppendWhereAccessGroups(sql, CFSTR("agrp"), accessGroups, &needWhere);
+                                   CFArrayRef accessGroups, bool *needWhere) {
+    SecDbAppendWhereROWID(sql, CFSTR("ROWID"), q->q_row_id, needWhere);
+    SecDbAppendWhereAttrs(sql, q, needWhere);
+    SecDbAppendWhereMusr(sql, q, needWhere);
+    SecDbAppendWhereAccessGroups(sql, CFSTR("agrp"), accessGroups, needWhere);
 }
 
 static void SecDbAppendLimit(CFMutableStringRef sql, CFIndex limit) {
@@ -563,6 +630,7 @@ static void SecDbAppendLimit(CFMutableStringRef sql, CFIndex limit) {
 
 static CF_RETURNS_RETAINED CFStringRef s3dl_select_sql(Query *q, CFArrayRef accessGroups) {
     CFMutableStringRef sql = CFStringCreateMutable(NULL, 0);
+    bool needWhere = true;
 	if (q->q_class == &identity_class) {
         CFStringAppendFormat(sql, NULL, CFSTR("SELECT crowid, %@"
                                               ", rowid,data FROM "
@@ -578,17 +646,20 @@ static CF_RETURNS_RETAINED CFStringRef s3dl_select_sql(Query *q, CFArrayRef acce
          as long as we do an extra sqlBindAccessGroups first. */
         SecDbAppendWhereROWID(sql, CFSTR("crowid"), q->q_row_id, 0);
         CFStringAppend(sql, CFSTR(")"));
-        bool needWhere = true;
         SecDbAppendWhereAttrs(sql, q, &needWhere);
         SecDbAppendWhereMusr(sql, q, &needWhere);
         SecDbAppendWhereAccessGroups(sql, CFSTR("agrp"), accessGroups, &needWhere);
 	} else {
         CFStringAppend(sql, CFSTR("SELECT rowid, data FROM "));
 		CFStringAppend(sql, q->q_class->name);
-        SecDbAppendWhereClause(sql, q, accessGroups);
+        SecDbAppendWhereClause(sql, q, accessGroups, &needWhere);
+    }
+    if (q->q_match_issuer_closure) {
+        SecDbAppendWhereOrAndIn(sql, CFSTR("issr"), &needWhere, CFArrayGetCount(q->q_match_issuer_closure));
     }
-    //do not append limit for all queries which needs filtering
-    if (q->q_match_issuer == NULL && q->q_match_policy == NULL && q->q_match_valid_on_date == NULL && q->q_match_trusted_only == NULL) {
+    //do not append limit for all queries which needs filtering, the row
+    //loop stops as soon as enough rows passed match_item() instead
+    if ((q->q_match_issuer == NULL || q->q_match_issuer_closure) && q->q_match_policy == NULL && q->q_match_valid_on_date == NULL && q->q_match_trusted_only == NULL) {
         SecDbAppendLimit(sql, q->q_limit);
     }
 
@@ -662,10 +733,129 @@ static bool sqlBindWhereClause(sqlite3_stmt *stmt, const Query *q,
         result = sqlBindAccessGroups(stmt, accessGroups, &param, error);
     }
 
+    /* Bind the issuer closure appended after the where clause. */
+    if (result && q->q_match_issuer_closure) {
+        CFIndex count = CFArrayGetCount(q->q_match_issuer_closure);
+        for (ix = 0; ix < count; ++ix) {
+            result = SecDbBindObject(stmt, param++, CFArrayGetValueAtIndex(q->q_match_issuer_closure, ix), error);
+            if (!result)
+                break;
+        }
+    }
+
     *pParam = param;
     return result;
 }
 
+/* Same bound as the recursion in items_matching_issuer_parent(). */
+#define kSecMatchIssuerMaxDepth 10
+
+/* Largest issuer closure bound into "issr IN (...)".  This keeps the IN list,
+ plus the attribute, musr and access group parameters of the query, well under
+ SQLITE_MAX_VARIABLE_NUMBER (999).  Larger closures fall back to matching
+ issuers per row in match_item(). */
+#define kSecMatchIssuerMaxClosure 256
+
+/* Expand q->q_match_issuer into every issuer name whose chain reaches one
+ of the requested issuers through certificates in the keychain.  The walk
+ reads the plaintext subj and issr columns of the cert table, so the
+ result can be matched against issr in the SELECT itself and rows from
+ unrelated issuers are never fetched or decrypted.
+
+ Only certificates that issue other certificates in the keychain can be
+ links, so leaves never enter the closure.  A link must also pass the
+ filters a plain certificate query by the caller would apply: the same
+ sync, musr and access group clauses, and it must decrypt, so certs in
+ locked classes or hidden by their ACL don't extend the chain.  That is
+ what the recursive lookup in items_matching_issuer_parent() enforced. */
+static bool s3dl_expand_match_issuer(SecDbConnectionRef dbt, Query *q,
+                                     CFArrayRef accessGroups, CFErrorRef *error) {
+    if (!q->q_match_issuer || q->q_match_issuer_closure)
+        return true;
+    if (q->q_class != &cert_class && q->q_class != &identity_class)
+        return true;
+    if (CFArrayGetCount(q->q_match_issuer) > kSecMatchIssuerMaxClosure)
+        return true;
+
+    const void *keys[] = { kSecClass };
+    const void *vals[] = { kSecClassCertificate };
+    CFDictionaryRef linkQuery = CFDictionaryCreate(kCFAllocatorDefault, keys, vals, array_size(keys), NULL, NULL);
+    Query *linkq = linkQuery ? query_create_with_limit(linkQuery, q->q_musrView, kSecMatchUnlimited, error) : NULL;
+    CFReleaseSafe(linkQuery);
+    if (!linkq)
+        return false;
+    query_set_caller_access_groups(linkq, q->q_caller_access_groups);
+
+    __block bool ok = true;
+    __block bool overflow = false;
+    CFMutableArrayRef closure = CFArrayCreateMutableCopy(kCFAllocatorDefault, 0, q->q_match_issuer);
+    CFMutableSetRef seen = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+    for (CFIndex ix = 0; ix < CFArrayGetCount(closure); ++ix)
+        CFSetAddValue(seen, CFArrayGetValueAtIndex(closure, ix));
+    CFIndex start = 0;
+    for (int depth = 0; ok && !overflow && depth < kSecMatchIssuerMaxDepth; ++depth) {
+        CFIndex end = CFArrayGetCount(closure);
+        if (start == end)
+            break;
+
+        CFMutableStringRef sql = CFStringCreateMutable(kCFAllocatorDefault, 0);
+        CFStringAppend(sql, CFSTR("SELECT subj, data FROM cert"));
+        bool needWhere = true;
+        SecDbAppendWhereClause(sql, linkq, accessGroups, &needWhere);
+        SecDbAppendWhereOrAndIn(sql, CFSTR("issr"), &needWhere, end - start);
+        SecDbAppendWhereOrAnd(sql, &needWhere);
+        CFStringAppend(sql, CFSTR("subj IN (SELECT issr FROM cert)"));
+
+        ok = SecDbWithSQL(dbt, sql, error, ^bool(sqlite3_stmt *stmt) {
+            int param = 1;
+            bool sql_ok = sqlBindWhereClause(stmt, linkq, accessGroups, &param, error);
+            for (CFIndex ix = start; sql_ok && ix < end; ++ix)
+                sql_ok = SecDbBindObject(stmt, param++, CFArrayGetValueAtIndex(closure, ix), error);
+            if (sql_ok) {
+                sql_ok = SecDbForEach(dbt, stmt, error, ^bool(int row_index) {
+                    if (sqlite3_column_type(stmt, 0) != SQLITE_BLOB)
+                        return true;
+                    CFDataRef subject = CFDataCreate(kCFAllocatorDefault, sqlite3_column_blob(stmt, 0),
+                                                     sqlite3_column_bytes(stmt, 0));
+                    if (subject && !CFSetContainsValue(seen, subject)) {
+                        CFDataRef edata = s3dl_copy_data_from_col(stmt, 1, NULL);
+                        CFMutableDictionaryRef item = NULL;
+                        CFErrorRef localError = NULL;
+                        if (edata && s3dl_item_from_data(edata, linkq, accessGroups, &item, NULL, &localError)) {
+                            CFSetAddValue(seen, subject);
+                            CFArrayAppendValue(closure, subject);
+                        }
+                        CFReleaseSafe(item);
+                        CFReleaseSafe(localError);
+                        CFReleaseSafe(edata);
+                    }
+                    CFReleaseSafe(subject);
+                    if (CFArrayGetCount(closure) > kSecMatchIssuerMaxClosure) {
+                        overflow = true;
+                        return false;
+                    }
+                    return true;
+                });
+                if (overflow)
+                    sql_ok = true;
+            }
+            return sql_ok;
+        });
+        CFRelease(sql);
+        start = end;
+    }
+
+    if (ok && overflow)
+        secinfo("item", "issuer closure has more than %d names; matching issuers per row", kSecMatchIssuerMaxClosure);
+    if (ok && !overflow)
+        q->q_match_issuer_closure = closure;
+    else
+        CFReleaseSafe(closure);
+    CFReleaseSafe(seen);
+    query_destroy(linkq, NULL);
+    return ok;
+}
+
 bool SecDbItemQuery(SecDbQueryRef query, CFArrayRef accessGroups, SecDbConnectionRef dbconn, CFErrorRef *error,
                     void (^handle_row)(SecDbItemRef item, bool *stop)) {
     __block bool ok = true;
@@ -679,6 +869,9 @@ bool SecDbItemQuery(SecDbQueryRef query, CFArrayRef accessGroups, SecDbConnectio
         return attr->kind == kSecDbRowIdAttr || attr->kind == kSecDbEncryptedDataAttr;
     };
 
+    if (!s3dl_expand_match_issuer(dbconn, query, accessGroups, error))
+        return false;
+
     CFStringRef sql = s3dl_select_sql(query, accessGroups);
     ok = sql;
     if (sql) {
@@ -716,6 +909,70 @@ bool SecDbItemQuery(SecDbQueryRef query, CFArrayRef accessGroups, SecDbConnectio
     return ok;
 }
 
+/* Return true once the query has found enough rows, or has hit an error
+ that should end it. */
+static bool
+s3dl_query_done(struct s3dl_query_ctx *c)
+{
+    Query *q = c->q;
+    bool needs_auth = q->q_error && CFErrorGetCode(q->q_error) == errSecAuthNeeded;
+    if (q->q_skip_acl_items && needs_auth)
+        // Skip items needing authentication if we are told to do so.
+        CFReleaseNull(q->q_error);
+
+    bool stop = q->q_limit != kSecMatchUnlimited && c->found >= q->q_limit;
+    return stop || (q->q_error && !needs_auth);
+}
+
+/* Number of rows stepped out of sqlite before their blobs are decrypted
+ concurrently.  Each item has its own wrapped key, so unwrapping is per row
+ either way; the batch just lets the unwraps and the AES/decode work run on
+ more than the connection's thread. */
+#define kSecItemDecryptBatchSize 64
+
+/* Like the SecDbForEach loop in s3dl_query(), but for c->decrypted_row.
+ Rows are still handed over one at a time in statement order, so results
+ and stop conditions are identical to the serial loop. */
+static bool
+s3dl_query_batched(struct s3dl_query_ctx *c, void *context,
+                   sqlite3_stmt *stmt, CFErrorRef *error)
+{
+    Query *q = c->q;
+    CFArrayRef accessGroups = c->accessGroups;
+    const size_t slots = s3dl_row_slots(q);
+    struct s3dl_row *rows = calloc(kSecItemDecryptBatchSize, sizeof(*rows));
+    if (!rows)
+        return SecError(errSecAllocate, error, CFSTR("s3dl_query: failed to allocate decrypt batch"));
+
+    __block size_t count = 0;
+    __block bool stop = false;
+    void (^flush)(void) = ^{
+        dispatch_apply(count * slots, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t ix) {
+            s3dl_row_decrypt(&rows[ix / slots], ix % slots, q, accessGroups);
+        });
+        for (size_t ix = 0; ix < count; ++ix) {
+            if (!stop) {
+                c->decrypted_row(&rows[ix], context);
+                stop = s3dl_query_done(c);
+            }
+            s3dl_row_release(&rows[ix]);
+        }
+        count = 0;
+    };
+
+    bool ok = SecDbForEach(c->dbt, stmt, error, ^bool (int row_index) {
+        s3dl_row_load(&rows[count++], stmt, slots, true);
+        if (count == kSecItemDecryptBatchSize)
+            flush();
+        return !stop;
+    });
+    if (count)
+        flush();
+
+    free(rows);
+    return ok;
+}
+
 static bool
 s3dl_query(s3dl_handle_row handle_row,
            void *context, CFErrorRef *error)
@@ -735,6 +992,8 @@ s3dl_query(s3dl_handle_row handle_row,
     } else {
         c->result = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
     }
+    if (!s3dl_expand_match_issuer(dbt, q, accessGroups, error))
+        return false;
     CFStringRef sql = s3dl_select_sql(q, accessGroups);
     bool ok = SecDbWithSQL(dbt, sql, error, ^(sqlite3_stmt *stmt) {
         bool sql_ok = true;
@@ -746,18 +1005,14 @@ s3dl_query(s3dl_handle_row handle_row,
         }
         if (sql_ok)
             sql_ok = sqlBindWhereClause(stmt, q, accessGroups, &param, error);
-        if (sql_ok) {
+        /* Batch only unlimited queries; a caller supplied credential handle
+         means ACL evaluation, which stays on this thread. */
+        if (sql_ok && c->decrypted_row && q->q_limit == kSecMatchUnlimited && !q->q_use_cred_handle) {
+            s3dl_query_batched(c, context, stmt, error);
+        } else if (sql_ok) {
             SecDbForEach(dbt, stmt, error, ^bool (int row_index) {
                 handle_row(stmt, context);
-
-                bool needs_auth = q->q_error && CFErrorGetCode(q->q_error) == errSecAuthNeeded;
-                if (q->q_skip_acl_items && needs_auth)
-                    // Skip items needing authentication if we are told to do so.
-                    CFReleaseNull(q->q_error);
-
-                bool stop = q->q_limit != kSecMatchUnlimited && c->found >= q->q_limit;
-                stop = stop || (q->q_error && !needs_auth);
-                return !stop;
+                return !s3dl_query_done(c);
             });
         }
         return sql_ok;
@@ -785,6 +1040,7 @@ s3dl_copy_matching(SecDbConnectionRef dbt, Query *q, CFTypeRef *result,
 {
     struct s3dl_query_ctx ctx = {
         .q = q, .accessGroups = accessGroups, .dbt = dbt,
+        .decrypted_row = s3dl_query_decrypted_row,
     };
     if (q->q_row_id && query_attr_count(q))
         return SecError(errSecItemIllegalQuery, error,
@@ -976,7 +1232,7 @@ s3dl_query_delete(SecDbConnectionRef dbt, Query *q, CFArrayRef accessGroups, CFE
     ok &= SecDbItemSelect(q, dbt, error, NULL, ^bool(const SecDbAttr *attr) {
         return false;
     },^bool(CFMutableStringRef sql, bool *needWhere) {
-        SecDbAppendWhereClause(sql, q, accessGroups);
+        SecDbAppendWhereClause(sql, q, accessGroups, needWhere);
         return true;
     },^bool(sqlite3_stmt * stmt, int col) {
         return sqlBindWhereClause(stmt, q, accessGroups, &col, error);
@@ -1197,7 +1453,7 @@ static bool DeleteAllFromTableForMUSRView(SecDbConnectionRef dbt,
 
 fail:
     if (stmt) {
-        ok = SecDbFinalize(stmt, error);
+        ok = SecDbReleaseCachedStmt(dbt, sql2, stmt, error);
     }
     if (!ok)
         secwarning("DeleteAllFromTableForMUSRView failed for %@ for musr: %@: %@", sql2, musr, error ? *error : NULL);
@@ -1231,18 +1487,20 @@ struct s3dl_export_row_ctx {
     bool multiUser;
 };
 
-static void s3dl_export_row(sqlite3_stmt *stmt, void *context) {
+static void s3dl_export_decrypted_row(struct s3dl_row *row, void *context) {
     struct s3dl_export_row_ctx *c = context;
     Query *q = c->qc.q;
-    SecAccessControlRef access_control = NULL;
+    SecAccessControlRef access_control = row->access_control[0];
     CFErrorRef localError = NULL;
 
     /* Skip akpu items when backing up, those are intentionally lost across restores. The same applies to SEP-based keys */
     bool skip_akpu_or_token = c->filter == kSecBackupableItemFilter;
 
-    sqlite_int64 rowid = sqlite3_column_int64(stmt, 0);
-    CFMutableDictionaryRef item = NULL;
-    bool ok = s3dl_item_from_col(stmt, q, 1, c->qc.accessGroups, &item, &access_control, &localError);
+    sqlite_int64 rowid = row->rowid;
+    CFMutableDictionaryRef item = row->item[0];
+    bool ok = row->ok[0];
+    if (!ok)
+        s3dl_row_take_error(row, 0, &localError);
 
     bool is_akpu = access_control ? CFEqualSafe(SecAccessControlGetProtection(access_control),
                                                 kSecAttrAccessibleWhenPasscodeSetThisDeviceOnly) : false;
@@ -1289,7 +1547,6 @@ static void s3dl_export_row(sqlite3_stmt *stmt, void *context) {
                 CFReleaseSafe(pref);
             }
         }
-        CFRelease(item);
     } else {
         OSStatus status = SecErrorGetOSStatus(localError);
 
@@ -1309,7 +1566,16 @@ static void s3dl_export_row(sqlite3_stmt *stmt, void *context) {
             }
         }
     }
-    CFReleaseSafe(access_control);
+}
+
+static void s3dl_export_row(sqlite3_stmt *stmt, void *context) {
+    struct s3dl_export_row_ctx *c = context;
+    struct s3dl_row row = { 0 };
+
+    s3dl_row_load(&row, stmt, 1, false);
+    s3dl_row_decrypt(&row, 0, c->qc.q, c->qc.accessGroups);
+    s3dl_export_decrypted_row(&row, context);
+    s3dl_row_release(&row);
 }
 
 static CFStringRef
@@ -1386,7 +1652,7 @@ SecServerCopyKeychainPlist(SecDbConnectionRef dbt,
          ++class_ix) {
         q.q_class = SecDbClasses[class_ix];
         struct s3dl_export_row_ctx ctx = {
-            .qc = { .q = &q, .dbt = dbt },
+            .qc = { .q = &q, .dbt = dbt, .decrypted_row = s3dl_export_decrypted_row },
             .dest_keybag = dest_keybag, .filter = filter,
             .multiUser = inMultiUser,
         };
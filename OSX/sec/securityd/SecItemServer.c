@@ -1125,7 +1125,9 @@ bool match_item(SecDbConnectionRef dbt, Query *q, CFArrayRef accessGroups, CFDic
 {
     bool ok = false;
     SecCertificateRef certRef = NULL;
-    if (q->q_match_issuer) {
+    /* When the issuer closure was pushed into the SELECT, rows with other
+     issuers were never returned, so there's nothing left to walk. */
+    if (q->q_match_issuer && !q->q_match_issuer_closure) {
         CFDataRef issuer = CFDictionaryGetValue(item, kSecAttrIssuer);
         if (!items_matching_issuer_parent(dbt, accessGroups, q->q_musrView, issuer, q->q_match_issuer, 10 /*max depth*/))
             return ok;
@@ -2966,24 +2966,15 @@ static bool SecOCSPResponseEvaluateSigner(SecORVCRef rvc, CFArrayRef signers, CF
     /* verify the public key of the issuer signed the OCSP signer */
     if (evaluated) {
         SecCertificateRef issuer = NULL, signer = NULL;
-        SecKeyRef issuerPubKey = NULL;
 
         issuer = (SecCertificateRef)CFArrayGetValueAtIndex(issuers, 0);
         signer = (SecCertificateRef)CFArrayGetValueAtIndex(signers, 0);
 
-        if (issuer) {
-#if TARGET_OS_IPHONE
-            issuerPubKey = SecCertificateCopyPublicKey(issuer);
-#else
-            issuerPubKey = SecCertificateCopyPublicKey_ios(issuer);
-#endif
-        }
-        if (signer && issuerPubKey && (errSecSuccess == SecCertificateIsSignedBy(signer, issuerPubKey))) {
+        if (signer && issuer && (errSecSuccess == SecCertificateIsSignedByCertificate(signer, issuer))) {
             trusted = true;
         } else {
             secnotice("ocsp", "ocsp signer cert not signed by issuer");
         }
-        CFReleaseNull(issuerPubKey);
     }
 
     return trusted;
@@ -28,6 +28,7 @@
 
 #include <securityd/SecRevocationDb.h>
 #include <securityd/asynchttp.h>
+#include <securityd/SecTrustServer.h>
 #include <Security/SecCertificateInternal.h>
 #include <Security/SecCMS.h>
 #include <Security/SecFramework.h>
@@ -96,6 +97,9 @@ typedef CF_OPTIONS(CFOptionFlags, SecValidInfoFlags) {
 #define kSecRevocationBasePath          "/Library/Keychains/crls"
 #define kSecRevocationDbFileName        "valid.sqlite3"
 
+/* maximum number of decoded N-to-1 filters kept in memory */
+#define kSecRevocationDbMaxCachedFilters 64
+
 bool SecRevocationDbVerifyUpdate(CFDictionaryRef update);
 CFIndex SecRevocationDbIngestUpdate(CFDictionaryRef update);
 void SecRevocationDbApplyUpdate(CFDictionaryRef update, CFIndex version);
@@ -845,6 +849,7 @@ static SecDbRef SecRevocationDbCreate(CFStringRef path) {
              'check_again' (double) // CFAbsoluteTime of next check (optional; this value is currently stored in prefs)
              'db_version' (integer) // version of database schema
              'db_hash' (blob)       // SHA-256 database hash
+             'generation' (integer) // bumped in every transaction that writes the groups table
              --> entries in admin table are unique by text key
 
              issuers table holds map of issuing CA hashes to group identifiers:
@@ -929,13 +934,29 @@ static SecDbRef SecRevocationDbCreate(CFStringRef path) {
     return result;
 }
 
+/* An N-to-1 filter decoded from its group record, ready to be probed. */
+typedef struct __SecRevocationDbFilter *SecRevocationDbFilterRef;
+struct __SecRevocationDbFilter {
+    int64_t groupId;
+    int64_t generation;     /* database generation the group data was read at */
+    uint8_t *bits;
+    CFIndex bitsLength;
+    uint32_t *params;
+    CFIndex paramCount;
+};
+
 typedef struct __SecRevocationDb *SecRevocationDbRef;
 struct __SecRevocationDb {
     SecDbRef db;
     dispatch_queue_t update_queue;
     bool fullUpdateInProgress;
+    dispatch_queue_t filter_queue;  /* protects the filter cache */
+    SecRevocationDbFilterRef filters[kSecRevocationDbMaxCachedFilters]; /* most recently used first */
+    CFIndex filterCount;
 };
 
+static void _SecRevocationDbPurgeFilters(SecRevocationDbRef this);
+
 static dispatch_once_t kSecRevocationDbOnce;
 static SecRevocationDbRef kSecRevocationDb = NULL;
 
@@ -947,10 +968,13 @@ static SecRevocationDbRef SecRevocationDbInit(CFStringRef db_name) {
     this->db = NULL;
     this->update_queue = NULL;
     this->fullUpdateInProgress = false;
+    this->filter_queue = NULL;
+    this->filterCount = 0;
 
     require(this->db = SecRevocationDbCreate(db_name), errOut);
     attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_BACKGROUND, 0);
     require(this->update_queue = dispatch_queue_create(NULL, attr), errOut);
+    require(this->filter_queue = dispatch_queue_create("com.apple.trustd.valid.filters", DISPATCH_QUEUE_SERIAL), errOut);
 
     return this;
 
@@ -960,6 +984,9 @@ errOut:
         if (this->update_queue) {
             dispatch_release(this->update_queue);
         }
+        if (this->filter_queue) {
+            dispatch_release(this->filter_queue);
+        }
         CFReleaseSafe(this->db);
         free(this);
     }
@@ -1008,7 +1035,8 @@ static void SecRevocationDbWith(void(^dbJob)(SecRevocationDbRef db)) {
 "WHERE key='db_hash'")
 #define selectNextUpdateSQL CFSTR("SELECT value FROM admin " \
 "WHERE key='check_again'")
-#define selectGroupRecordSQL CFSTR("SELECT flags,format,data FROM " \
+#define selectGroupRecordSQL CFSTR("SELECT flags,format,data," \
+"(SELECT ival FROM admin WHERE key='generation') FROM " \
 "groups WHERE groupid=?")
 #define selectSerialRecordSQL CFSTR("SELECT rowid FROM serials " \
 "WHERE serial=? AND groupid=?")
@@ -1025,10 +1053,13 @@ static void SecRevocationDbWith(void(^dbJob)(SecRevocationDbRef db)) {
 #define insertSha256RecordSQL CFSTR("INSERT OR REPLACE INTO hashes " \
 "(rowid,sha256,groupid) VALUES (?,?,?)")
 #define deleteGroupRecordSQL CFSTR("DELETE FROM groups WHERE groupid=?")
+#define updateGenerationSQL CFSTR("INSERT OR REPLACE INTO admin " \
+"(key,ival,value) VALUES ('generation'," \
+"COALESCE((SELECT ival FROM admin WHERE key='generation'),0)+1,NULL)")
 
 #define deleteAllEntriesSQL CFSTR("DELETE from hashes; " \
 "DELETE from serials; DELETE from issuers; DELETE from groups; " \
-"DELETE from admin; DELETE from sqlite_sequence; VACUUM")
+"DELETE from admin WHERE key<>'generation'; DELETE from sqlite_sequence; VACUUM")
 
 static int64_t _SecRevocationDbGetVersion(SecRevocationDbRef this, CFErrorRef *error) {
     /* look up version entry in admin table; returns -1 on error */
@@ -1182,6 +1213,15 @@ static void _SecRevocationDbSetNextUpdateTime(SecRevocationDbRef this, CFAbsolut
     CFReleaseSafe(localError);
 }
 
+static bool _SecRevocationDbUpdateGeneration(SecDbConnectionRef dbconn, CFErrorRef *error) {
+    /* Called inside every transaction that writes the groups table, so a
+       decoded filter tagged with the generation it was read at is known to
+       be current without reading its group data again. */
+    return SecDbWithSQL(dbconn, updateGenerationSQL, error, ^bool(sqlite3_stmt *updateGeneration) {
+        return SecDbStep(dbconn, updateGeneration, error, NULL);
+    });
+}
+
 static bool _SecRevocationDbRemoveAllEntries(SecRevocationDbRef this) {
     /* remove all entries from all tables in the database */
     __block bool ok = true;
@@ -1193,11 +1233,14 @@ static bool _SecRevocationDbRemoveAllEntries(SecRevocationDbRef this) {
                 ok = SecDbStep(dbconn, deleteAll, &localError, NULL);
                 return ok;
             });
+            if (ok) ok = _SecRevocationDbUpdateGeneration(dbconn, &localError);
         });
     });
     /* one more thing: update the schema version */
     _SecRevocationDbSetSchemaVersion(this, kSecRevocationDbSchemaVersion);
 
+    _SecRevocationDbPurgeFilters(this);
+
     CFReleaseSafe(localError);
     return ok;
 }
@@ -1420,6 +1463,7 @@ static int64_t _SecRevocationDbUpdateGroup(SecRevocationDbRef this, int64_t grou
                 CFReleaseSafe(xmlData);
                 return ok;
             });
+            if (ok) ok = _SecRevocationDbUpdateGeneration(dbconn, &localError);
         });
     });
 
@@ -1480,6 +1524,7 @@ static bool _SecRevocationDbApplyGroupDelete(SecRevocationDbRef this, CFDataRef
                 }
                 return ok;
             });
+            if (ok) ok = _SecRevocationDbUpdateGeneration(dbconn, &localError);
         });
     });
 
@@ -1574,6 +1619,9 @@ static void _SecRevocationDbApplyUpdate(SecRevocationDbRef this, CFDictionaryRef
     }
     CFRelease(localUpdate);
 
+    /* group data may have changed; drop any decoded filters */
+    _SecRevocationDbPurgeFilters(this);
+
     /* set version */
     _SecRevocationDbSetVersion(this, version);
 
@@ -1647,17 +1695,25 @@ errOut:
     return result;
 }
 
-static bool _SecRevocationDbSerialInFilter(SecRevocationDbRef this,
-                                           CFDataRef serialData,
-                                           CFDataRef xmlData) {
+static void SecRevocationDbFilterRelease(SecRevocationDbFilterRef filter) {
+    if (filter) {
+        free(filter->bits);
+        free(filter->params);
+        free(filter);
+    }
+}
+
+static SecRevocationDbFilterRef SecRevocationDbFilterCreate(int64_t groupId,
+                                                            int64_t generation,
+                                                            const uint8_t *blob,
+                                                            CFIndex blobLength) {
     /* N-To-1 filter implementation.
-       The 'xmlData' parameter is a flattened XML dictionary,
-       containing 'xor' and 'params' keys. First order of
-       business is to reconstitute the blob into components.
+       The group data is a (possibly compressed) flattened XML dictionary,
+       containing 'xor' and 'params' keys. Reconstitute the blob into
+       components once, so probing a filter needs no further parsing.
     */
-    bool result = false;
-    CFRetainSafe(xmlData);
-    CFDataRef propListData = xmlData;
+    SecRevocationDbFilterRef filter = NULL;
+    CFDataRef propListData = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, blob, blobLength, kCFAllocatorNull);
     /* Expand data blob if needed */
     CFDataRef inflatedData = copyInflatedData(propListData);
     if (inflatedData) {
@@ -1666,22 +1722,22 @@ static bool _SecRevocationDbSerialInFilter(SecRevocationDbRef this,
     }
     CFDataRef xor = NULL;
     CFArrayRef params = NULL;
-    CFPropertyListRef nto1 = CFPropertyListCreateWithData(kCFAllocatorDefault, propListData, 0, NULL, NULL);
-    if (nto1) {
+    CFPropertyListRef nto1 = (propListData) ? CFPropertyListCreateWithData(kCFAllocatorDefault, propListData, 0, NULL, NULL) : NULL;
+    if (isDictionary(nto1)) {
         xor = (CFDataRef)CFDictionaryGetValue((CFDictionaryRef)nto1, CFSTR("xor"));
         params = (CFArrayRef)CFDictionaryGetValue((CFDictionaryRef)nto1, CFSTR("params"));
     }
-    uint8_t *hash = (xor) ? (uint8_t*)CFDataGetBytePtr(xor) : NULL;
-    CFIndex hashLen = (hash) ? CFDataGetLength(xor) : 0;
-    uint8_t *serial = (serialData) ? (uint8_t*)CFDataGetBytePtr(serialData) : NULL;
-    CFIndex serialLen = (serial) ? CFDataGetLength(serialData) : 0;
+    require(isData(xor) && CFDataGetLength(xor) > 0 && isArray(params), errOut);
 
-    require(hash && serial && params, errOut);
+    require(filter = (SecRevocationDbFilterRef)calloc(1, sizeof(*filter)), errOut);
+    filter->groupId = groupId;
+    filter->generation = generation;
+    filter->bitsLength = CFDataGetLength(xor);
+    require(filter->bits = (uint8_t *)malloc(filter->bitsLength), errOut);
+    memcpy(filter->bits, CFDataGetBytePtr(xor), filter->bitsLength);
 
-    const uint32_t FNV_OFFSET_BASIS = 2166136261;
-    const uint32_t FNV_PRIME = 16777619;
-    bool notInHash = false;
     CFIndex ix, count = CFArrayGetCount(params);
+    require(filter->params = (uint32_t *)calloc(count ? count : 1, sizeof(uint32_t)), errOut);
     for (ix = 0; ix < count; ix++) {
         int32_t param;
         CFNumberRef cfnum = (CFNumberRef)CFArrayGetValueAtIndex(params, ix);
@@ -1690,26 +1746,121 @@ static bool _SecRevocationDbSerialInFilter(SecRevocationDbRef this,
             secinfo("validupdate", "error processing filter params at index %ld", (long)ix);
             continue;
         }
+        filter->params[filter->paramCount++] = (uint32_t)param;
+    }
+
+    CFReleaseSafe(nto1);
+    CFReleaseSafe(propListData);
+    return filter;
+
+errOut:
+    SecRevocationDbFilterRelease(filter);
+    CFReleaseSafe(nto1);
+    CFReleaseSafe(propListData);
+    return NULL;
+}
+
+static bool SecRevocationDbFilterContainsSerial(SecRevocationDbFilterRef filter,
+                                                CFDataRef serialData) {
+    const uint8_t *serial = (serialData) ? CFDataGetBytePtr(serialData) : NULL;
+    CFIndex serialLen = (serial) ? CFDataGetLength(serialData) : 0;
+    if (!filter || !serial) {
+        return false;
+    }
+
+    const uint32_t FNV_OFFSET_BASIS = 2166136261;
+    const uint32_t FNV_PRIME = 16777619;
+    const uint8_t *hash = filter->bits;
+    CFIndex hashLen = filter->bitsLength;
+    CFIndex ix;
+    for (ix = 0; ix < filter->paramCount; ix++) {
         /* process one param */
-        uint32_t hval = FNV_OFFSET_BASIS ^ param;
+        uint32_t hval = FNV_OFFSET_BASIS ^ filter->params[ix];
         CFIndex i = serialLen;
         while (i > 0) {
             hval = ((hval ^ (serial[--i])) * FNV_PRIME) & 0xFFFFFFFF;
         }
         hval = hval % (hashLen * 8);
         if ((hash[hval/8] & (1 << (hval % 8))) == 0) {
-            notInHash = true; /* definitely not in hash */
-            break;
+            return false; /* definitely not in hash */
         }
     }
-    if (!notInHash) {
-        /* probabilistically might be in hash if we get here. */
-        result = true;
+    /* probabilistically might be in hash if we get here. */
+    return true;
+}
+
+static void _SecRevocationDbPurgeFilters(SecRevocationDbRef this) {
+    dispatch_sync(this->filter_queue, ^{
+        CFIndex ix;
+        for (ix = 0; ix < this->filterCount; ix++) {
+            SecRevocationDbFilterRelease(this->filters[ix]);
+            this->filters[ix] = NULL;
+        }
+        this->filterCount = 0;
+    });
+}
+
+/* Insert filter at the head of the cache, replacing any existing filter for
+   the same group and evicting the least recently used filter if full. */
+static void _SecRevocationDbCacheFilter(SecRevocationDbRef this, SecRevocationDbFilterRef filter) {
+    dispatch_sync(this->filter_queue, ^{
+        CFIndex ix, count = this->filterCount;
+        for (ix = 0; ix < count; ix++) {
+            if (this->filters[ix]->groupId == filter->groupId) {
+                break;
+            }
+        }
+        if (ix == count && count == kSecRevocationDbMaxCachedFilters) {
+            ix = count - 1;
+        }
+        if (ix < count) {
+            SecRevocationDbFilterRelease(this->filters[ix]);
+        } else {
+            this->filterCount++;
+        }
+        memmove(&this->filters[1], &this->filters[0], ix * sizeof(this->filters[0]));
+        this->filters[0] = filter;
+    });
+}
+
+static bool _SecRevocationDbSerialInFilter(SecRevocationDbRef this,
+                                           CFDataRef serialData,
+                                           int64_t groupId,
+                                           int64_t generation,
+                                           sqlite3_stmt *selectGroup) {
+    /* Every write to the groups table bumps the database generation, so a
+       filter decoded at the current generation is never stale, even if the
+       group was rewritten by another process. Only on a miss is the group
+       data (column 2 of selectGroup) read and decoded. */
+    __block bool found = false;
+    __block bool result = false;
+    dispatch_sync(this->filter_queue, ^{
+        CFIndex ix;
+        for (ix = 0; ix < this->filterCount; ix++) {
+            SecRevocationDbFilterRef filter = this->filters[ix];
+            if (filter->groupId == groupId) {
+                if (filter->generation == generation) {
+                    found = true;
+                    result = SecRevocationDbFilterContainsSerial(filter, serialData);
+                    memmove(&this->filters[1], &this->filters[0], ix * sizeof(this->filters[0]));
+                    this->filters[0] = filter;
+                }
+                break;
+            }
+        }
+    });
+    if (found) {
+        return result;
     }
 
-errOut:
-    CFReleaseSafe(nto1);
-    CFReleaseSafe(propListData);
+    const uint8_t *blob = (const uint8_t *)sqlite3_column_blob(selectGroup, 2);
+    CFIndex blobLength = (CFIndex)sqlite3_column_bytes(selectGroup, 2);
+    SecRevocationDbFilterRef filter = (blob) ? SecRevocationDbFilterCreate(groupId, generation, blob, blobLength) : NULL;
+    if (!filter) {
+        return false;
+    }
+    result = SecRevocationDbFilterContainsSerial(filter, serialData);
+    _SecRevocationDbCacheFilter(this, filter);
     return result;
 }
 
@@ -1721,7 +1872,7 @@ static SecValidInfoRef _SecRevocationDbValidInfoForCertificate(SecRevocationDbRe
     __block bool ok = true;
     __block int flags = 0;
     __block SecValidInfoFormat format = kSecValidInfoFormatUnknown;
-    __block CFDataRef data = NULL;
+    __block bool filterMatched = false;
 
     bool matched = false;
     int64_t groupId = 0;
@@ -1745,10 +1896,13 @@ static SecValidInfoRef _SecRevocationDbValidInfoForCertificate(SecRevocationDbRe
             ok &= SecDbStep(dbconn, selectGroup, &localError, ^(bool *stop) {
                 flags = (int)sqlite3_column_int(selectGroup, 0);
                 format = (SecValidInfoFormat)sqlite3_column_int(selectGroup, 1);
-                uint8_t *p = (uint8_t *)sqlite3_column_blob(selectGroup, 2);
-                if (p != NULL && format == kSecValidInfoFormatNto1) {
-                    CFIndex length = (CFIndex)sqlite3_column_bytes(selectGroup, 2);
-                    data = CFDataCreate(kCFAllocatorDefault, p, length);
+                if (format == kSecValidInfoFormatNto1) {
+                    /* Perform a Bloom filter match against the serial while the
+                       group data is still available from the statement. The
+                       generation comes from the same row, so both are read
+                       from one snapshot of the database. */
+                    int64_t generation = sqlite3_column_int64(selectGroup, 3);
+                    filterMatched = _SecRevocationDbSerialInFilter(this, serial, groupId, generation, selectGroup);
                 }
             });
             return ok;
@@ -1770,7 +1924,7 @@ static SecValidInfoRef _SecRevocationDbValidInfoForCertificate(SecRevocationDbRe
         /* Perform a Bloom filter match against the serial. If matched is false,
            then the cert is definitely not in the list. But if matched is true,
            we don't know for certain, so we would need to check OCSP. */
-        matched = _SecRevocationDbSerialInFilter(this, serial, data);
+        matched = filterMatched;
     }
 
     if (matched) {
@@ -1796,7 +1950,6 @@ static SecValidInfoRef _SecRevocationDbValidInfoForCertificate(SecRevocationDbRe
 
 errOut:
     (void) CFErrorPropagate(localError, error);
-    CFReleaseSafe(data);
     CFReleaseSafe(certHash);
     CFReleaseSafe(serial);
     return result;
@@ -1833,6 +1986,7 @@ void SecRevocationDbApplyUpdate(CFDictionaryRef update, CFIndex version) {
     SecRevocationDbWith(^(SecRevocationDbRef db) {
         _SecRevocationDbApplyUpdate(db, update, version);
     });
+    SecTrustServerFlushResultCache();
 }
 
 /* Set the schema version for the revocation database.
@@ -1886,6 +2040,7 @@ void SecRevocationDbRemoveAllEntries(void) {
     SecRevocationDbWith(^(SecRevocationDbRef db) {
         _SecRevocationDbRemoveAllEntries(db);
     });
+    SecTrustServerFlushResultCache();
 }
 
 /* === Public API === */
@@ -43,6 +43,7 @@
 #include <Security/SecPolicyInternal.h>
 #include <Security/SecTrustSettingsPriv.h>
 #include <Security/SecTask.h>
+#include <Security/SecItemInternal.h>
 #include <CoreFoundation/CFRuntime.h>
 #include <CoreFoundation/CFSet.h>
 #include <CoreFoundation/CFString.h>
@@ -55,11 +56,13 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <sys/codesign.h>
+#include <notify.h>
 #include <Security/SecBase.h>
 #include "SecRSAKey.h"
 #include <libDER/oids.h>
 #include <utilities/debugging.h>
 #include <utilities/SecCFWrappers.h>
+#include <utilities/der_plist.h>
 #include <Security/SecInternal.h>
 #include <ipc/securityd_client.h>
 #include <CommonCrypto/CommonDigest.h>
@@ -69,6 +72,7 @@
 
 #if TARGET_OS_OSX
 #include <Security/SecTaskPriv.h>
+#include <../trustd/SecTrustOSXEntryPoints.h>
 #endif
 
 #define MAX_CHAIN_LENGTH  15
@@ -1032,6 +1036,300 @@ CFDataRef SecPathBuilderCopyClientAuditToken(SecPathBuilderRef builder) {
 
 typedef void (^SecTrustServerEvaluationCompleted)(SecTrustResultType tr, CFArrayRef details, CFDictionaryRef info, SecCertificatePathRef chain, CFErrorRef error);
 
+// MARK: -
+// MARK: SecTrustResultCache
+/********************************************************
+ ***************** SecTrustResultCache ******************
+ ********************************************************/
+
+/* Completed evaluations keyed by a digest of everything that went into them,
+   with the verify time rounded down to kSecTrustResultCacheTimeBucket.  Most
+   clients verify at the current time, so an entry stops matching once its
+   bucket is over; it lives no longer than one bucket and never past the
+   revocation validity reported in its info.  Any change to trust settings,
+   keychain certificates, the revocation db or the OTAPKI asset flushes the
+   whole cache. */
+#define kSecTrustResultCacheTimeBucket  60.0
+#define kSecTrustResultCacheMaxEntries  256
+
+typedef struct SecTrustResultCacheEntry {
+    SecTrustResultType result;
+    CFArrayRef details;
+    CFDictionaryRef info;
+    SecCertificatePathRef chain;
+    CFAbsoluteTime expires;
+} *SecTrustResultCacheEntryRef;
+
+static dispatch_once_t kSecTrustResultCacheOnce;
+static dispatch_queue_t kSecTrustResultCacheQueue;
+static CFMutableDictionaryRef kSecTrustResultCache;
+static SecOTAPKIRef kSecTrustResultCacheOTAPKIRef;
+/* Bumped by every flush, so evaluations that started before a flush don't
+   add their (possibly stale) results after it. */
+static uint64_t kSecTrustResultCacheGeneration;
+#if TARGET_OS_OSX
+static uint64_t kSecTrustResultCacheLegacyGeneration;
+#endif
+
+static void SecTrustResultCacheEntryRelease(CFAllocatorRef allocator __unused, const void *value) {
+    SecTrustResultCacheEntryRef entry = (SecTrustResultCacheEntryRef)value;
+    CFReleaseSafe(entry->details);
+    CFReleaseSafe(entry->info);
+    CFReleaseSafe(entry->chain);
+    free(entry);
+}
+
+static const CFDictionaryValueCallBacks kSecTrustResultCacheEntryCallBacks = {
+    0, NULL, SecTrustResultCacheEntryRelease, NULL, NULL
+};
+
+static void SecTrustResultCacheFlush_locked(void) {
+    CFDictionaryRemoveAllValues(kSecTrustResultCache);
+    kSecTrustResultCacheGeneration++;
+}
+
+static void SecTrustResultCacheInit(void) {
+    dispatch_once(&kSecTrustResultCacheOnce, ^{
+        kSecTrustResultCacheQueue = dispatch_queue_create("com.apple.security.trustresultcache", DISPATCH_QUEUE_SERIAL);
+        kSecTrustResultCache = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+            &kCFTypeDictionaryKeyCallBacks, &kSecTrustResultCacheEntryCallBacks);
+        /* Trust settings and keychain certificates may also change in other
+           processes.  Legacy ones on OS X are checked for separately, see
+           SecTrustResultCacheCheckLegacySources_locked. */
+        int out_token = 0;
+        notify_register_dispatch(kSecServerCertificateTrustNotification, &out_token,
+                                 kSecTrustResultCacheQueue, ^(int token __unused) {
+                                     SecTrustResultCacheFlush_locked();
+                                 });
+        notify_register_dispatch(kSecServerKeychainChangedNotification, &out_token,
+                                 kSecTrustResultCacheQueue, ^(int token __unused) {
+                                     SecTrustResultCacheFlush_locked();
+                                 });
+    });
+}
+
+/* Legacy keychains and trust settings on OS X only announce changes through
+   keychain events, which the legacy sources runloop counts for us.  Returns
+   false, and nothing may be cached, while those events aren't being received;
+   otherwise flushes the cache if any arrived since it was filled. */
+static bool SecTrustResultCacheCheckLegacySources_locked(void) {
+#if TARGET_OS_OSX
+    uint64_t generation;
+    if (!SecTrustLegacySourcesGetEventGeneration(&generation)) {
+        return false;
+    }
+    if (kSecTrustResultCacheLegacyGeneration != generation) {
+        kSecTrustResultCacheLegacyGeneration = generation;
+        SecTrustResultCacheFlush_locked();
+    }
+#endif
+    return true;
+}
+
+/* Flush the cache if the OTAPKI asset changed since it was filled. */
+static void SecTrustResultCacheCheckOTAPKI_locked(SecOTAPKIRef otapkiref) {
+    if (kSecTrustResultCacheOTAPKIRef != otapkiref) {
+        CFRetainAssign(kSecTrustResultCacheOTAPKIRef, otapkiref);
+        SecTrustResultCacheFlush_locked();
+    }
+}
+
+void SecTrustServerFlushResultCache(void) {
+    SecTrustResultCacheInit();
+    dispatch_sync(kSecTrustResultCacheQueue, ^{
+        secdebug("trust", "flushing %ld cached results", CFDictionaryGetCount(kSecTrustResultCache));
+        SecTrustResultCacheFlush_locked();
+    });
+}
+
+static void SecTrustResultCacheDigestCertificates(CC_SHA256_CTX *ctx, CFArrayRef certificates) {
+    CFIndex ix, count = isArray(certificates) ? CFArrayGetCount(certificates) : 0;
+    CC_SHA256_Update(ctx, &count, sizeof(count));
+    for (ix = 0; ix < count; ++ix) {
+        SecCertificateRef cert = (SecCertificateRef)CFArrayGetValueAtIndex(certificates, ix);
+        CFIndex length = SecCertificateGetLength(cert);
+        CC_SHA256_Update(ctx, &length, sizeof(length));
+        CC_SHA256_Update(ctx, SecCertificateGetBytePtr(cert), (CC_LONG)length);
+    }
+}
+
+/* Returns NULL if any input can't be serialized, in which case the
+   evaluation isn't cached. */
+static CFDataRef SecTrustResultCacheCopyKey(CFDataRef clientAuditToken,
+    CFArrayRef certificates, CFArrayRef anchors, bool anchorsOnly,
+    bool keychainsAllowed, CFArrayRef policies, CFArrayRef responses,
+    CFArrayRef SCTs, CFArrayRef trustedLogs, CFAbsoluteTime verifyTime,
+    CFArrayRef accessGroups) {
+    CFDataRef key = NULL;
+    CFArrayRef serializedPolicies = NULL;
+    CFArrayRef plist = NULL;
+    CFDataRef der = NULL;
+    CFNumberRef bucket = NULL;
+
+    for (CFIndex ix = 0; ix < CFArrayGetCount(certificates); ++ix) {
+        require_quiet(SecCertificateGetTypeID() == CFGetTypeID(CFArrayGetValueAtIndex(certificates, ix)), errOut);
+    }
+    if (anchors) {
+        require_quiet(isArray(anchors), errOut);
+        for (CFIndex ix = 0; ix < CFArrayGetCount(anchors); ++ix) {
+            require_quiet(SecCertificateGetTypeID() == CFGetTypeID(CFArrayGetValueAtIndex(anchors, ix)), errOut);
+        }
+    }
+    require_quiet(serializedPolicies = SecPolicyArrayCreateSerialized(policies), errOut);
+
+    int64_t bucketValue = (int64_t)floor(verifyTime / kSecTrustResultCacheTimeBucket);
+    bucket = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &bucketValue);
+    /* Some policy checks depend on who's asking, so results are per client. */
+    const void *values[] = {
+        clientAuditToken ? (CFTypeRef)clientAuditToken : kCFNull,
+        anchorsOnly ? kCFBooleanTrue : kCFBooleanFalse,
+        keychainsAllowed ? kCFBooleanTrue : kCFBooleanFalse,
+        serializedPolicies,
+        responses ? (CFTypeRef)responses : kCFNull,
+        SCTs ? (CFTypeRef)SCTs : kCFNull,
+        trustedLogs ? (CFTypeRef)trustedLogs : kCFNull,
+        accessGroups ? (CFTypeRef)accessGroups : kCFNull,
+        bucket,
+    };
+    plist = CFArrayCreate(kCFAllocatorDefault, values, sizeof(values) / sizeof(*values), &kCFTypeArrayCallBacks);
+    require_quiet(der = CFPropertyListCreateDERData(kCFAllocatorDefault, plist, NULL), errOut);
+
+    CC_SHA256_CTX ctx;
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Init(&ctx);
+    SecTrustResultCacheDigestCertificates(&ctx, certificates);
+    SecTrustResultCacheDigestCertificates(&ctx, anchors);
+    CC_SHA256_Update(&ctx, CFDataGetBytePtr(der), (CC_LONG)CFDataGetLength(der));
+    CC_SHA256_Final(digest, &ctx);
+    key = CFDataCreate(kCFAllocatorDefault, digest, sizeof(digest));
+
+errOut:
+    CFReleaseSafe(serializedPolicies);
+    CFReleaseSafe(plist);
+    CFReleaseSafe(der);
+    CFReleaseSafe(bucket);
+    return key;
+}
+
+/* Calls evaluated and returns true on a hit.  Otherwise returns false and
+   sets *generation for a later SecTrustResultCacheAdd. */
+static bool SecTrustResultCacheLookup(CFDataRef key, uint64_t *generation,
+    SecTrustServerEvaluationCompleted evaluated) {
+    __block bool hit = false;
+    __block struct SecTrustResultCacheEntry copy = {};
+
+    SecOTAPKIRef otapkiref = SecOTAPKICopyCurrentOTAPKIRef();
+    SecTrustResultCacheInit();
+    dispatch_sync(kSecTrustResultCacheQueue, ^{
+        SecTrustResultCacheCheckOTAPKI_locked(otapkiref);
+        bool usable = SecTrustResultCacheCheckLegacySources_locked();
+        *generation = kSecTrustResultCacheGeneration;
+        if (!usable) {
+            return;
+        }
+        SecTrustResultCacheEntryRef entry = (SecTrustResultCacheEntryRef)CFDictionaryGetValue(kSecTrustResultCache, key);
+        if (!entry) {
+            return;
+        }
+        if (entry->expires <= CFAbsoluteTimeGetCurrent()) {
+            CFDictionaryRemoveValue(kSecTrustResultCache, key);
+            return;
+        }
+        copy.result = entry->result;
+        copy.details = CFRetainSafe(entry->details);
+        copy.info = CFRetainSafe(entry->info);
+        copy.chain = CFRetainSafe(entry->chain);
+        hit = true;
+    });
+    CFReleaseSafe(otapkiref);
+
+    if (!hit) {
+        return false;
+    }
+    secinfo("trust", "cached: %@ details: %@ result: %d",
+        copy.chain, copy.details, copy.result);
+    evaluated(copy.result, copy.details, copy.info, copy.chain, NULL);
+    CFReleaseSafe(copy.details);
+    CFReleaseSafe(copy.info);
+    CFReleaseSafe(copy.chain);
+    return true;
+}
+
+/* True if a certificate's validity starts or ends inside the verify time
+   bucket, so two evaluations sharing a key could disagree. */
+static bool SecTrustResultCacheValidityChangesInBucket(SecCertificateRef cert,
+    CFAbsoluteTime bucketStart) {
+    CFAbsoluteTime bucketEnd = bucketStart + kSecTrustResultCacheTimeBucket;
+    CFAbsoluteTime notBefore = SecCertificateNotValidBefore(cert);
+    CFAbsoluteTime notAfter = SecCertificateNotValidAfter(cert);
+    return (bucketStart < notBefore && notBefore <= bucketEnd) ||
+           (bucketStart <= notAfter && notAfter < bucketEnd);
+}
+
+static void SecTrustResultCacheAdd(CFDataRef key, uint64_t generation,
+    CFArrayRef certificates, CFAbsoluteTime verifyTime, SecTrustResultType result,
+    CFArrayRef details, CFDictionaryRef info, SecCertificatePathRef chain) {
+    /* Recoverable failures may come from a missing intermediate or a network
+       fetch that didn't complete; only cache outcomes the inputs decide. */
+    if (result != kSecTrustResultUnspecified && result != kSecTrustResultDeny) {
+        return;
+    }
+    if (info && CFEqualSafe(CFDictionaryGetValue(info, kSecTrustInfoRevocationKey), kCFBooleanFalse)) {
+        return;
+    }
+
+    CFAbsoluteTime bucketStart = floor(verifyTime / kSecTrustResultCacheTimeBucket) * kSecTrustResultCacheTimeBucket;
+    CFIndex ix, count = CFArrayGetCount(certificates);
+    for (ix = 0; ix < count; ++ix) {
+        if (SecTrustResultCacheValidityChangesInBucket((SecCertificateRef)CFArrayGetValueAtIndex(certificates, ix), bucketStart)) {
+            return;
+        }
+    }
+    count = chain ? SecCertificatePathGetCount(chain) : 0;
+    for (ix = 0; ix < count; ++ix) {
+        if (SecTrustResultCacheValidityChangesInBucket(SecCertificatePathGetCertificateAtIndex(chain, ix), bucketStart)) {
+            return;
+        }
+    }
+
+    CFAbsoluteTime expires = CFAbsoluteTimeGetCurrent() + kSecTrustResultCacheTimeBucket;
+    CFDateRef validUntil = info ? CFDictionaryGetValue(info, kSecTrustInfoRevocationValidUntilKey) : NULL;
+    if (isDate(validUntil) && CFDateGetAbsoluteTime(validUntil) < expires) {
+        expires = CFDateGetAbsoluteTime(validUntil);
+    }
+
+    SecTrustResultCacheEntryRef entry = malloc(sizeof(*entry));
+    entry->result = result;
+    entry->details = CFRetainSafe(details);
+    entry->info = CFRetainSafe(info);
+    entry->chain = CFRetainSafe(chain);
+    entry->expires = expires;
+
+    dispatch_sync(kSecTrustResultCacheQueue, ^{
+        if (!SecTrustResultCacheCheckLegacySources_locked() ||
+            generation != kSecTrustResultCacheGeneration) {
+            SecTrustResultCacheEntryRelease(NULL, entry);
+            return;
+        }
+        if (CFDictionaryGetCount(kSecTrustResultCache) >= kSecTrustResultCacheMaxEntries) {
+            /* Drop expired entries first; if that isn't enough start over. */
+            CFIndex n = CFDictionaryGetCount(kSecTrustResultCache);
+            const void *keys[n], *values[n];
+            CFDictionaryGetKeysAndValues(kSecTrustResultCache, keys, values);
+            CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+            for (CFIndex i = 0; i < n; ++i) {
+                if (((SecTrustResultCacheEntryRef)values[i])->expires <= now) {
+                    CFDictionaryRemoveValue(kSecTrustResultCache, keys[i]);
+                }
+            }
+            if (CFDictionaryGetCount(kSecTrustResultCache) >= kSecTrustResultCacheMaxEntries) {
+                CFDictionaryRemoveAllValues(kSecTrustResultCache);
+            }
+        }
+        CFDictionarySetValue(kSecTrustResultCache, key, entry);
+    });
+}
+
 static void
 SecTrustServerEvaluateCompleted(const void *userData,
                                 SecCertificatePathRef chain, CFArrayRef details, CFDictionaryRef info,
@@ -1050,7 +1348,31 @@ SecTrustServerEvaluateBlock(CFDataRef clientAuditToken, CFArrayRef certificates,
         CFReleaseSafe(certError);
         return;
     }
-    SecTrustServerEvaluationCompleted userData = Block_copy(evaluated);
+
+    uint64_t generation = 0;
+    CFDataRef cacheKey = SecTrustResultCacheCopyKey(clientAuditToken,
+        certificates, anchors, anchorsOnly, keychainsAllowed, policies,
+        responses, SCTs, trustedLogs, verifyTime, accessGroups);
+    if (cacheKey && SecTrustResultCacheLookup(cacheKey, &generation, evaluated)) {
+        CFRelease(cacheKey);
+        return;
+    }
+
+    SecTrustServerEvaluationCompleted userData;
+    if (cacheKey) {
+        CFRetainSafe(certificates);
+        userData = Block_copy(^(SecTrustResultType tr, CFArrayRef details, CFDictionaryRef info, SecCertificatePathRef chain, CFErrorRef error) {
+            if (!error) {
+                SecTrustResultCacheAdd(cacheKey, generation, certificates,
+                    verifyTime, tr, details, info, chain);
+            }
+            CFRelease(cacheKey);
+            CFRelease(certificates);
+            evaluated(tr, details, info, chain, error);
+        });
+    } else {
+        userData = Block_copy(evaluated);
+    }
     /* Call the actual evaluator function. */
     SecPathBuilderRef builder = SecPathBuilderCreate(clientAuditToken,
                                                      certificates, anchors,
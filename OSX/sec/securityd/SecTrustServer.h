@@ -84,6 +84,10 @@ void SecTrustServerEvaluateBlock(CFDataRef clientAuditToken, CFArrayRef certific
 /* Synchronously invoke SecTrustServerEvaluateBlock. */
 SecTrustResultType SecTrustServerEvaluate(CFArrayRef certificates, CFArrayRef anchors, bool anchorsOnly, bool keychainsAllowed, CFArrayRef policies, CFArrayRef responses, CFArrayRef SCTs, CFArrayRef trustedLogs, CFAbsoluteTime verifyTime, __unused CFArrayRef accessGroups, CFArrayRef *details, CFDictionaryRef *info, SecCertificatePathRef *chain, CFErrorRef *error);
 
+/* Discard all cached evaluation results.  Call after anything that can change
+   the outcome of an evaluation for the same inputs. */
+void SecTrustServerFlushResultCache(void);
+
 void InitializeAnchorTable(void);
 
 /* Return the current best chain */
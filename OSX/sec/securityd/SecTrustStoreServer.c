@@ -47,6 +47,7 @@
 #include <Security/SecInternal.h>
 #include <ipc/securityd_client.h>
 #include <securityd/SecTrustStoreServer.h>
+#include <securityd/SecTrustServer.h>
 #include "utilities/sqlutils.h"
 #include "utilities/SecDb.h"
 #include <utilities/SecCFError.h>
@@ -361,6 +362,9 @@ bool _SecTrustStoreSetTrustSettings(SecTrustStoreRef ts,
         CFReleaseSafe(xmlData);
         CFReleaseSafe(array);
     });
+    if (ok) {
+        SecTrustServerFlushResultCache();
+    }
 errOutNotLocked:
 	return ok;
 }
@@ -387,6 +391,7 @@ bool SecTrustStoreRemoveCertificateWithDigest(SecTrustStoreRef ts,
             verify_noerr(sqlite3_finalize(deleteStmt));
         }
     });
+    SecTrustServerFlushResultCache();
 errOutNotLocked:
 	return true;
 }
@@ -412,6 +417,7 @@ bool _SecTrustStoreRemoveAll(SecTrustStoreRef ts, CFErrorRef *error)
         sqlite3_prepare(ts->s3h, containsSQL, sizeof(containsSQL),
                         &ts->contains, NULL);
     });
+    SecTrustServerFlushResultCache();
 errOutNotLocked:
 	return removed_all;
 }
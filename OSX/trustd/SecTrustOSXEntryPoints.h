@@ -36,6 +36,10 @@ __BEGIN_DECLS
 
 void SecTrustLegacySourcesEventRunloopCreate(void);
 
+/* Returns false until the runloop is receiving legacy keychain and trust
+ * settings events, then sets *generation to a count that changes on each one. */
+bool SecTrustLegacySourcesGetEventGeneration(uint64_t *generation);
+
 OSStatus SecTrustLegacyCRLStatus(SecCertificateRef cert, CFArrayRef chain, CFURLRef currCRLDP);
 
 typedef struct async_ocspd_s {
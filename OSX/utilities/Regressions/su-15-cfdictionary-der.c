@@ -28,8 +28,10 @@
 #include "utilities/der_plist_internal.h"
 
 #include "utilities/SecCFRelease.h"
+#include "utilities/SecCFWrappers.h"
 #include "utilities/array_size.h"
 
+#include <corecrypto/ccder.h>
 #include <CoreFoundation/CoreFoundation.h>
 
 
@@ -105,6 +107,186 @@ static void test_dictionary(CFDictionaryRef testValue, size_t expected_size, con
 }
 
 
+//
+// Reference encoder: one CFData per element, sorted with CFDataCompare. This
+// is how dictionaries and sets used to be encoded, the in place sort in
+// der_sort_set_elements has to produce exactly the same bytes.
+//
+static uint8_t* reference_encode(CFPropertyListRef pl, const uint8_t *der, uint8_t *der_end);
+
+static CFDataRef reference_copy_element(CFTypeRef key, CFTypeRef value)
+{
+    size_t size = der_sizeof_plist(key, NULL) + (value ? der_sizeof_plist(value, NULL) : 0) + 16;
+    CFMutableDataRef buffer = CFDataCreateMutable(NULL, size);
+    CFDataSetLength(buffer, size);
+
+    uint8_t *begin = CFDataGetMutableBytePtr(buffer);
+    uint8_t *end = begin + size;
+    uint8_t *encoded = value ? ccder_encode_constructed_tl(CCDER_CONSTRUCTED_SEQUENCE, end, begin,
+                                                           reference_encode(key, begin,
+                                                           reference_encode(value, begin, end)))
+                             : reference_encode(key, begin, end);
+
+    CFDataRef element = encoded ? CFDataCreate(NULL, encoded, end - encoded) : NULL;
+    CFReleaseNull(buffer);
+    return element;
+}
+
+static void reference_add_key_value(const void *key, const void *value, void *context)
+{
+    CFDataRef element = reference_copy_element(key, value);
+    if (element)
+        CFArrayAppendValue((CFMutableArrayRef) context, element);
+    CFReleaseNull(element);
+}
+
+static void reference_add_value(const void *value, void *context)
+{
+    reference_add_key_value(value, NULL, context);
+}
+
+static CFComparisonResult reference_compare(const void *val1, const void *val2, void *context __unused)
+{
+    return CFDataCompare((CFDataRef) val1, (CFDataRef) val2);
+}
+
+static uint8_t* reference_encode(CFPropertyListRef pl, const uint8_t *der, uint8_t *der_end)
+{
+    CFTypeID type = CFGetTypeID(pl);
+    ccder_tag tag;
+
+    if (type == CFDictionaryGetTypeID())
+        tag = CCDER_CONSTRUCTED_SET;
+    else if (type == CFSetGetTypeID())
+        tag = CCDER_CONSTRUCTED_CFSET;
+    else if (type == CFArrayGetTypeID())
+        tag = CCDER_CONSTRUCTED_SEQUENCE;
+    else
+        return der_encode_plist(pl, NULL, der, der_end);
+
+    CFMutableArrayRef elements = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+
+    if (type == CFDictionaryGetTypeID()) {
+        CFDictionaryApplyFunction(pl, reference_add_key_value, elements);
+    } else if (type == CFSetGetTypeID()) {
+        CFSetApplyFunction(pl, reference_add_value, elements);
+    } else {
+        CFArrayApplyFunction(pl, CFRangeMake(0, CFArrayGetCount(pl)), reference_add_value, elements);
+    }
+
+    if (tag != CCDER_CONSTRUCTED_SEQUENCE)
+        CFArraySortValues(elements, CFRangeMake(0, CFArrayGetCount(elements)), reference_compare, NULL);
+
+    uint8_t* original_der_end = der_end;
+
+    for(CFIndex position = CFArrayGetCount(elements); position > 0;) {
+        --position;
+        CFDataRef data = CFArrayGetValueAtIndex(elements, position);
+        der_end = ccder_encode_body(CFDataGetLength(data), CFDataGetBytePtr(data), der, der_end);
+    }
+
+    CFReleaseNull(elements);
+
+    return ccder_encode_constructed_tl(tag, original_der_end, der, der_end);
+}
+
+static void test_matches_reference(CFPropertyListRef plist, const char *name)
+{
+    CFDataRef encoded = CFPropertyListCreateDERData(NULL, plist, NULL);
+
+    size_t size = der_sizeof_plist(plist, NULL);
+    CFMutableDataRef expected = CFDataCreateMutable(NULL, size);
+    CFDataSetLength(expected, size);
+    uint8_t *expected_begin = CFDataGetMutableBytePtr(expected);
+    uint8_t *expected_end = expected_begin + size;
+
+    ok(encoded != NULL &&
+       reference_encode(plist, expected_begin, expected_end) == expected_begin &&
+       CFEqual(encoded, expected), "%s: encoding differs from reference", name);
+
+    CFReleaseNull(encoded);
+    CFReleaseNull(expected);
+}
+
+// Dictionaries and sets with lots of elements that only differ late or in length.
+static CFDictionaryRef create_nested_dictionary(int depth, int width)
+{
+    CFMutableDictionaryRef dictionary = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    CFMutableSetRef set = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+    CFMutableArrayRef array = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+
+    for (int i = 0; i < width; ++i) {
+        CFStringRef key = CFStringCreateWithFormat(NULL, NULL, CFSTR("key%s%d"), &"aaaaa"[5 - i % 5], i);
+        CFStringRef prefix = CFStringCreateWithFormat(NULL, NULL, CFSTR("%s"), &"zzzzzz"[6 - i % 6]);
+        long long numberValue = (i & 1) ? -(1LL << i) : (long long) i * 977;
+        CFNumberRef number = CFNumberCreate(NULL, kCFNumberLongLongType, &numberValue);
+        uint8_t bytes[] = { 0xFF, (uint8_t) i, 0x00 };
+        CFDataRef data = CFDataCreate(NULL, bytes, 1 + i % 3);
+
+        CFDictionaryAddValue(dictionary, key, (i % 3 == 0) ? (CFTypeRef) number : (CFTypeRef) prefix);
+        CFDictionaryAddValue(dictionary, number, data);
+        CFDictionaryAddValue(dictionary, data, (i & 1) ? kCFBooleanTrue : kCFBooleanFalse);
+        CFSetAddValue(set, prefix);
+        CFSetAddValue(set, number);
+        CFArrayAppendValue(array, key);
+
+        CFReleaseNull(key);
+        CFReleaseNull(prefix);
+        CFReleaseNull(number);
+        CFReleaseNull(data);
+    }
+
+    CFDateRef date = CFDateCreate(NULL, 500000000.0 + depth);
+    CFDictionaryAddValue(dictionary, CFSTR("date"), date);
+    CFDictionaryAddValue(dictionary, CFSTR("null"), kCFNull);
+    CFDictionaryAddValue(dictionary, CFSTR("set"), set);
+    CFReleaseNull(date);
+
+    if (depth > 0) {
+        CFDictionaryRef child = create_nested_dictionary(depth - 1, width);
+        CFDictionaryAddValue(dictionary, CFSTR("child"), child);
+        CFArrayAppendValue(array, child);
+        CFReleaseNull(child);
+    }
+    CFDictionaryAddValue(dictionary, CFSTR("array"), array);
+
+    CFReleaseNull(set);
+    CFReleaseNull(array);
+    return dictionary;
+}
+
+static const int nested_shapes[][2] = {
+    { 0, 0 }, { 0, 1 }, { 0, 2 }, { 1, 7 }, { 2, 16 }, { 3, 40 },
+};
+
+#define kReferenceTestCount (array_size(test_cases) + 1 + array_size(nested_shapes))
+
+#define kLookupTestCount 3
+static void test_dictionary_values(CFDictionaryRef dictionary)
+{
+    CFDataRef encoded = CFPropertyListCreateDERData(NULL, dictionary, NULL);
+    const uint8_t *der = CFDataGetBytePtr(encoded);
+    const uint8_t *der_end = der + CFDataGetLength(encoded);
+
+    CFTypeRef keys[] = { CFSTR("child"), CFSTR("no such key"), CFSTR("null"), };
+    CFTypeRef values[array_size(keys)];
+
+    ok(der_decode_dictionary_values(NULL, kCFPropertyListImmutable, array_size(keys), keys, values,
+                                    NULL, der, der_end) == der_end, "didn't decode whole buffer");
+    ok(CFEqualSafe(values[0], CFDictionaryGetValue(dictionary, keys[0])) && values[1] == NULL &&
+       CFEqualSafe(values[2], kCFNull), "wrong values");
+
+    for (size_t i = 0; i < array_size(values); ++i)
+        CFReleaseNull(values[i]);
+
+    // Borrowed leaves have to outlive the encoded data they came from.
+    CFPropertyListRef borrowed = NULL;
+    der_decode_plist_borrowing(encoded, kCFPropertyListImmutable, &borrowed, NULL, der, der_end);
+    CFReleaseNull(encoded);
+    ok(CFEqualSafe(borrowed, dictionary), "borrowed decode didn't make equal value");
+    CFReleaseNull(borrowed);
+}
+
 #define kTestsPerTestCase (1 + kTestsPerDictionaryTest)
 static void one_test(const struct test_case * thisCase)
 {
@@ -122,6 +304,7 @@ static void one_test(const struct test_case * thisCase)
                                                    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
 
     test_dictionary(testValue, thisCase->encoded_size, thisCase->encoded);
+    test_matches_reference(testValue, "test case");
     
     CFReleaseNull(testValue);
 }
@@ -166,12 +349,23 @@ static void tests(void)
     
     uint8_t expected_result[] = { 0x31, 0x3D, 0x30, 0x07, 0x01, 0x01, 0x00, 0x02, 0x02, 0x09, 0x09, 0x30, 0x07, 0x02, 0x02, 0x09, 0x09, 0x01, 0x01, 0x01, 0x30, 0x0C, 0x0C, 0x07, 0x4F, 0x68, 0x20, 0x79, 0x65, 0x61, 0x68, 0x01, 0x01, 0x01, 0x30, 0x1B, 0x04, 0x03, 0xFC, 0xFF, 0xFA, 0x30, 0x14, 0x01, 0x01, 0x00, 0x04, 0x05, 0x10, 0xFF, 0x00, 0x12, 0xA5, 0x0C, 0x08, 0x49, 0x6E, 0x20, 0x41, 0x72, 0x72, 0x61, 0x79, };
     test_dictionary(dictionary, array_size(expected_result), expected_result);
+    test_matches_reference(dictionary, "big dictionary");
     CFReleaseSafe(dictionary);
+
+    for (int shape = 0; shape < array_size(nested_shapes); ++shape) {
+        CFDictionaryRef nested = create_nested_dictionary(nested_shapes[shape][0], nested_shapes[shape][1]);
+        test_matches_reference(nested, "nested dictionary");
+        CFReleaseNull(nested);
+    }
+
+    CFDictionaryRef nested = create_nested_dictionary(2, 10);
+    test_dictionary_values(nested);
+    CFReleaseNull(nested);
 }
 
 int su_15_cfdictionary_der(int argc, char *const *argv)
 {
-    plan_tests(kTestCount);
+    plan_tests(kTestCount + kReferenceTestCount + kLookupTestCount);
     tests();
 
     return 0;
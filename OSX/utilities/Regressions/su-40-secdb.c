@@ -30,7 +30,7 @@
 #include "utilities_regressions.h"
 #include <time.h>
 
-#define kTestCount 31
+#define kTestCount 37
 
 static int count_func(SecDbRef db, const char *name, CFIndex *max_conn_count, bool (*perform)(SecDbRef db, CFErrorRef *error, void (^perform)(SecDbConnectionRef dbconn))) {
     __block int count = 0;
@@ -164,6 +164,24 @@ static void tests(void)
 
         }), "SecDbPrepare: %@", error);
 
+        uint64_t hits = 0, misses = 0;
+        SecDbGetStmtCacheStats(dbconn, &hits, &misses);
+        cmp_ok(hits, >, 0, "statement cache hits: %llu misses: %llu", hits, misses);
+
+        CFStringRef bound = CFSTR("SELECT ?;");
+        ok(SecDbPrepare(dbconn, bound, &error, ^void (sqlite3_stmt *stmt) {
+            ok_status(sqlite3_bind_int(stmt, 1, 42), "bind_int[1]");
+        }), "SecDbPrepare: %@", error);
+        CFReleaseNull(error);
+        ok(SecDbPrepare(dbconn, bound, &error, ^void (sqlite3_stmt *stmt) {
+            ok(SecDbStep(dbconn, stmt, &error, ^(bool *stop) {
+                is(sqlite3_column_type(stmt, 0), SQLITE_NULL, "cached statement bindings cleared");
+                *stop = true;
+            }), "SecDbStep: %@", error);
+            CFReleaseNull(error);
+        }), "SecDbPrepare: %@", error);
+        CFReleaseNull(error);
+
         ok(SecDbExec(dbconn, CFSTR("DROP TABLE tablea;"), &error),
            "exec: %@", error);
     }), "SecDbPerformWrite: %@", error);
@@ -56,10 +56,22 @@ struct __OpaqueSecDbStatement {
     sqlite3_stmt *stmt;
 };
 
+// A prepared statement parked in a connection's statement cache.
+struct SecDbCachedStmt {
+    CFStringRef sql;
+    CFHashCode hash;
+    sqlite3_stmt *stmt;
+};
+
 struct __OpaqueSecDbConnection {
     CFRuntimeBase _base;
 
-    //CFMutableDictionaryRef statements;
+    // Prepared statement cache, most recently used first.  Statements handed
+    // out by SecDbCopyStmt are removed from the cache until they are released.
+    struct SecDbCachedStmt statements[kSecDbMaxCachedStmts];
+    CFIndex statementCount;
+    uint64_t statementCacheHits;
+    uint64_t statementCacheMisses;
 
     SecDbRef db;     // NONRETAINED, since db or block retains us
     bool readOnly;
@@ -161,6 +173,7 @@ bool SecDbErrorWithStmt(int sql_code, sqlite3_stmt *stmt, CFErrorRef *error, CFS
 
 static bool SecDbOpenHandle(SecDbConnectionRef dbconn, bool *created, CFErrorRef *error);
 static bool SecDbHandleCorrupt(SecDbConnectionRef dbconn, int rc, CFErrorRef *error);
+static void SecDbFlushStmtCache(SecDbConnectionRef dbconn);
 
 #pragma mark -
 #pragma mark SecDbRef
@@ -718,6 +731,7 @@ static bool SecDbTruncate(SecDbConnectionRef dbconn, CFErrorRef *error)
     }
     __block bool ok = SecDbFileControl(dbconn, SQLITE_TRUNCATE_DATABASE, &flags, error);
     if (!ok) {
+        SecDbFlushStmtCache(dbconn);
         sqlite3_close(dbconn->handle);
         dbconn->handle = NULL;
         CFStringPerformWithCString(dbconn->db->db_path, ^(const char *path) {
@@ -762,6 +776,7 @@ static bool SecDbHandleCorrupt(SecDbConnectionRef dbconn, int rc, CFErrorRef *er
             if (error)
                 CFReleaseNull(*error);
 
+            SecDbFlushStmtCache(dbconn);
             didRename = (!dbconn->handle || SecDbError(sqlite3_close(dbconn->handle), error, CFSTR("close"))) &&
                 SecCheckErrno(rename(db_path, buf), error, CFSTR("rename %s %s"), db_path, buf) &&
                 SecDbOpenHandle(dbconn, NULL, error);
@@ -923,6 +938,9 @@ SecDbConnectionCreate(SecDbRef db, bool readOnly, CFErrorRef *error)
     dbconn->hasIOFailure = false;
     dbconn->corruptionError = NULL;
     dbconn->handle = NULL;
+    dbconn->statementCount = 0;
+    dbconn->statementCacheHits = 0;
+    dbconn->statementCacheMisses = 0;
     dbconn->changes = CFArrayCreateMutableForCFTypes(kCFAllocatorDefault);
 
 done:
@@ -1090,6 +1108,7 @@ static void
 SecDbConnectionDestroy(CFTypeRef value)
 {
     SecDbConnectionRef dbconn = (SecDbConnectionRef)value;
+    SecDbFlushStmtCache(dbconn);
     if (dbconn->handle) {
         sqlite3_close(dbconn->handle);
     }
@@ -1284,10 +1303,74 @@ static sqlite3_stmt *SecDbCopyStatementWithTailRange(SecDbConnectionRef dbconn,
     return stmt;
 }
 
+// MARK: -
+// MARK: Statement cache
+
+/* Remove and return the cached statement for sql, or NULL if there is none. */
+static sqlite3_stmt *SecDbCheckoutCachedStmt(SecDbConnectionRef dbconn, CFStringRef sql) {
+    CFHashCode hash = CFHash(sql);
+    for (CFIndex ix = 0; ix < dbconn->statementCount; ++ix) {
+        struct SecDbCachedStmt *entry = &dbconn->statements[ix];
+        if (entry->hash == hash && CFEqual(entry->sql, sql)) {
+            sqlite3_stmt *stmt = entry->stmt;
+            CFReleaseNull(entry->sql);
+            memmove(entry, entry + 1, (dbconn->statementCount - ix - 1) * sizeof(*entry));
+            dbconn->statementCount--;
+            return stmt;
+        }
+    }
+    return NULL;
+}
+
+/* Park stmt at the front of the cache, evicting the least recently used entry if the cache is full. */
+static void SecDbCheckinCachedStmt(SecDbConnectionRef dbconn, CFStringRef sql, sqlite3_stmt *stmt) {
+    if (dbconn->statementCount == kSecDbMaxCachedStmts) {
+        struct SecDbCachedStmt *lru = &dbconn->statements[--dbconn->statementCount];
+        sqlite3_finalize(lru->stmt);
+        CFReleaseNull(lru->sql);
+    }
+    memmove(&dbconn->statements[1], &dbconn->statements[0], dbconn->statementCount * sizeof(dbconn->statements[0]));
+    dbconn->statements[0].sql = CFStringCreateCopy(kCFAllocatorDefault, sql);
+    dbconn->statements[0].hash = CFHash(sql);
+    dbconn->statements[0].stmt = stmt;
+    dbconn->statementCount++;
+}
+
+/* Finalize every cached statement; must be called before the sqlite3 handle is closed. */
+static void SecDbFlushStmtCache(SecDbConnectionRef dbconn) {
+    for (CFIndex ix = 0; ix < dbconn->statementCount; ++ix) {
+        sqlite3_finalize(dbconn->statements[ix].stmt);
+        CFReleaseNull(dbconn->statements[ix].sql);
+    }
+    dbconn->statementCount = 0;
+}
+
+/* Return true iff stmt was prepared from all of sql, with no unused tail. */
+static bool SecDbStmtConsumesSQL(sqlite3_stmt *stmt, CFStringRef sql) {
+    __block bool whole = false;
+    const char *stmtSql = sqlite3_sql(stmt);
+    if (stmtSql) CFStringPerformWithCStringAndLength(sql, ^(const char *sqlStr, size_t sqlLen) {
+        whole = strlen(stmtSql) == sqlLen && memcmp(stmtSql, sqlStr, sqlLen) == 0;
+    });
+    return whole;
+}
+
+void SecDbGetStmtCacheStats(SecDbConnectionRef dbconn, uint64_t *hits, uint64_t *misses) {
+    if (hits) *hits = dbconn->statementCacheHits;
+    if (misses) *misses = dbconn->statementCacheMisses;
+}
+
 sqlite3_stmt *SecDbCopyStmt(SecDbConnectionRef dbconn, CFStringRef sql, CFStringRef *tail, CFErrorRef *error) {
-    // TODO: Add caching and cache lookup of statements
+    // Only statements prepared from their entire sql are ever cached, so a hit never has a tail.
+    sqlite3_stmt *stmt = sql ? SecDbCheckoutCachedStmt(dbconn, sql) : NULL;
+    if (stmt) {
+        dbconn->statementCacheHits++;
+        return stmt;
+    }
+    dbconn->statementCacheMisses++;
+
     CFRange sqlTail = {};
-    sqlite3_stmt *stmt = SecDbCopyStatementWithTailRange(dbconn, sql, &sqlTail, error);
+    stmt = SecDbCopyStatementWithTailRange(dbconn, sql, &sqlTail, error);
     if (sqlTail.length > 0) {
         CFStringRef excess = CFStringCreateWithSubstring(CFGetAllocator(sql), sql, sqlTail);
         if (tail) {
@@ -1304,13 +1387,25 @@ sqlite3_stmt *SecDbCopyStmt(SecDbConnectionRef dbconn, CFStringRef sql, CFString
     return stmt;
 }
 
-/*
- TODO: Could do a hack here with a custom kCFAllocatorNULL allocator for a second CFRuntimeBase inside a SecDbStatement,
- TODO: Better yet make a full blow SecDbStatement instance whenever SecDbCopyStmt is called.  Then, when the statement is released, in the Dispose method, we Reset and ClearBindings the sqlite3_stmt * and hand it back to the SecDb with the original CFStringRef for the sql (or hash thereof) as an argument. */
+/* Hand a statement obtained from SecDbCopyStmt back to the connection.  Statements that were prepared
+ from the whole of sql and that reset cleanly are kept (with their bindings cleared) for the next
+ SecDbCopyStmt of the same sql; anything else is finalized.  Like SecDbFinalize, this returns the error
+ of the most recent step of stmt, if any. */
 bool SecDbReleaseCachedStmt(SecDbConnectionRef dbconn, CFStringRef sql, sqlite3_stmt *stmt, CFErrorRef *error) {
-    if (stmt) {
+    if (!stmt)
+        return true;
+
+    if (!sql || !dbconn->handle || sqlite3_db_handle(stmt) != dbconn->handle || !SecDbStmtConsumesSQL(stmt, sql))
         return SecDbFinalize(stmt, error);
+
+    int s3e = sqlite3_reset(stmt);
+    if (s3e != SQLITE_OK) {
+        bool ok = SecDbErrorWithStmt(s3e, stmt, error, CFSTR("reset"));
+        sqlite3_finalize(stmt);
+        return ok;
     }
+    sqlite3_clear_bindings(stmt);
+    SecDbCheckinCachedStmt(dbconn, sql, stmt);
     return true;
 }
 
@@ -75,7 +75,10 @@ const uint8_t* der_decode_data(CFAllocatorRef allocator, CFOptionFlags mutabilit
         return NULL;
     }
     
-    *data = CFDataCreate(allocator, payload, payload_size);
+    if (mutability & kSecDERDecodeBorrowData)
+        *data = CFDataCreateWithBytesNoCopy(allocator, payload, payload_size, kCFAllocatorNull);
+    else
+        *data = CFDataCreate(allocator, payload, payload_size);
 
     if (NULL == *data) {
         SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("Failed to create data"), NULL, error);
@@ -23,6 +23,8 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "utilities/SecCFRelease.h"
 #include "utilities/der_plist.h"
@@ -111,6 +113,86 @@ exit:
     return payload;
 }
 
+// Returns the end of the DER element at der, without decoding it.
+static const uint8_t* der_skip_element(const uint8_t* der, const uint8_t *der_end)
+{
+    ccder_tag tag;
+    size_t length = 0;
+    const uint8_t *body = ccder_decode_len(&length, ccder_decode_tag(&tag, der, der_end), der_end);
+
+    if (NULL == body || (size_t) (der_end - body) < length)
+        return NULL;
+
+    return body + length;
+}
+
+const uint8_t* der_decode_dictionary_values(CFAllocatorRef allocator, CFOptionFlags mutability,
+                                            CFIndex count, const CFTypeRef *keys, CFTypeRef *values,
+                                            CFErrorRef *error,
+                                            const uint8_t* der, const uint8_t *der_end)
+{
+    for (CFIndex index = 0; index < count; ++index)
+        values[index] = NULL;
+
+    if (NULL == der)
+        return NULL;
+
+    const uint8_t *payload_end = 0;
+    const uint8_t *payload = ccder_decode_constructed_tl(CCDER_CONSTRUCTED_SET, &payload_end, der, der_end);
+
+    if (NULL == payload) {
+        SecCFDERCreateError(kSecDERErrorUnknownEncoding, CFSTR("Unknown data encoding, expected CCDER_CONSTRUCTED_SET"), NULL, error);
+        return NULL;
+    }
+
+    // Entries are matched on their encoded key, so encode the keys we want once.
+    CFDataRef *encoded_keys = calloc(count ? count : 1, sizeof(CFDataRef));
+    if (NULL == encoded_keys) {
+        SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("Failed to allocate keys"), NULL, error);
+        return NULL;
+    }
+
+    for (CFIndex index = 0; payload && index < count; ++index) {
+        encoded_keys[index] = CFPropertyListCreateDERData(kCFAllocatorDefault, keys[index], error);
+        if (NULL == encoded_keys[index])
+            payload = NULL;
+    }
+
+    while (payload != NULL && payload < payload_end) {
+        const uint8_t *sequence_end = 0;
+        const uint8_t *key = ccder_decode_constructed_tl(CCDER_CONSTRUCTED_SEQUENCE, &sequence_end, payload, payload_end);
+        const uint8_t *key_end = der_skip_element(key, sequence_end);
+
+        if (NULL == key_end) {
+            SecCFDERCreateError(kSecDERErrorUnknownEncoding, CFSTR("Unknown data encoding, expected CCDER_CONSTRUCTED_SEQUENCE"), NULL, error);
+            payload = NULL;
+            break;
+        }
+
+        for (CFIndex index = 0; index < count; ++index) {
+            if (values[index] == NULL &&
+                CFDataGetLength(encoded_keys[index]) == key_end - key &&
+                memcmp(CFDataGetBytePtr(encoded_keys[index]), key, key_end - key) == 0) {
+                if (NULL == der_decode_plist(allocator, mutability, &values[index], error, key_end, sequence_end))
+                    payload = NULL;
+                break;
+            }
+        }
+
+        if (payload)
+            payload = sequence_end;
+    }
+
+    for (CFIndex index = 0; index < count; ++index) {
+        CFReleaseNull(encoded_keys[index]);
+        if (payload != payload_end)
+            CFReleaseNull(values[index]);
+    }
+    free(encoded_keys);
+
+    return payload;
+}
+
 struct size_context {
     bool   success;
     size_t size;
@@ -169,76 +251,59 @@ static uint8_t* der_encode_key_value(CFPropertyListRef key, CFPropertyListRef va
 }
 
 struct encode_context {
-    bool         success;
-    CFErrorRef * error;
-    CFMutableArrayRef list;
-    CFAllocatorRef allocator;
+    bool              success;
+    CFErrorRef *      error;
+    const uint8_t *   der;
+    uint8_t *         der_end;
+    struct der_span * spans;
+    size_t            count;
 };
 
-static void add_sequence_to_array(const void *key_void, const void *value_void, void *context_void)
+// Encode each key/value sequence right in front of the previous one, we sort them afterwards.
+static void add_sequence_to_spans(const void *key_void, const void *value_void, void *context_void)
 {
     struct encode_context *context = (struct encode_context *) context_void;
     if (context->success) {
         CFTypeRef key = (CFTypeRef) key_void;
         CFTypeRef value = (CFTypeRef) value_void;
 
-        size_t der_size = der_sizeof_key_value(key, value, context->error);
-        if (der_size == 0) {
-            context-> success = false;
-        } else {
-            CFMutableDataRef encoded_kv = CFDataCreateMutable(context->allocator, der_size);
-            CFDataSetLength(encoded_kv, der_size);
-
-            uint8_t* const encode_begin = CFDataGetMutableBytePtr(encoded_kv);
-            uint8_t* encode_end = encode_begin + der_size;
-
-            encode_end = der_encode_key_value(key, value, context->error, encode_begin, encode_end);
-
-            if (encode_end != NULL) {
-                CFDataDeleteBytes(encoded_kv, CFRangeMake(0, (encode_end - encode_begin)));
-                CFArrayAppendValue(context->list, encoded_kv);
-            } else {
-                context-> success = false;
-            }
+        uint8_t *encode_begin = der_encode_key_value(key, value, context->error, context->der, context->der_end);
 
-            CFReleaseNull(encoded_kv);
+        if (encode_begin != NULL) {
+            context->spans[context->count].der = encode_begin;
+            context->spans[context->count].length = context->der_end - encode_begin;
+            context->count++;
+            context->der_end = encode_begin;
+        } else {
+            context->success = false;
         }
     }
 }
 
-static CFComparisonResult cfdata_compare_contents(const void *val1, const void *val2, void *context __unused)
-{
-    return CFDataCompare((CFDataRef) val1, (CFDataRef) val2);
-}
-
-
 uint8_t* der_encode_dictionary(CFDictionaryRef dictionary, CFErrorRef *error,
                                const uint8_t *der, uint8_t *der_end)
 {
-    CFMutableArrayRef elements = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
-    
-    struct encode_context context = { .success = true, .error = error, .list = elements };
-    CFDictionaryApplyFunction(dictionary, add_sequence_to_array, &context);
-    
-    if (!context.success) {
-        CFReleaseNull(elements);
-        return NULL;
+    CFIndex count = CFDictionaryGetCount(dictionary);
+    struct der_span *spans = NULL;
+
+    if (count > 0) {
+        spans = malloc(count * sizeof(*spans));
+        if (spans == NULL) {
+            SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("Failed to allocate dictionary elements"), NULL, error);
+            return NULL;
+        }
     }
-    
-    CFRange allOfThem = CFRangeMake(0, CFArrayGetCount(elements));
 
-    CFArraySortValues(elements, allOfThem, cfdata_compare_contents, NULL);
+    struct encode_context context = { .success = true, .error = error, .der = der, .der_end = der_end, .spans = spans };
+    CFDictionaryApplyFunction(dictionary, add_sequence_to_spans, &context);
 
-    uint8_t* original_der_end = der_end;
+    if (context.success)
+        context.success = der_sort_set_elements(context.count, spans, error, context.der_end, der_end);
 
-    for(CFIndex position = CFArrayGetCount(elements); position > 0;) {
-        --position;
-        CFDataRef data = CFArrayGetValueAtIndex(elements, position);
-        der_end = ccder_encode_body(CFDataGetLength(data), CFDataGetBytePtr(data), der, der_end);
-    }
+    free(spans);
 
-    CFReleaseNull(elements);
-
-    return ccder_encode_constructed_tl(CCDER_CONSTRUCTED_SET, original_der_end, der, der_end);
+    if (!context.success)
+        return NULL;
 
+    return ccder_encode_constructed_tl(CCDER_CONSTRUCTED_SET, der_end, der, context.der_end);
 }
@@ -152,6 +152,65 @@ uint8_t* der_encode_plist(CFPropertyListRef pl, CFErrorRef *error,
     }
 }
 
+//
+// Borrowing decode: objects are allocated through an allocator that forwards
+// to the default one, but whose context retains the backing data. Since every
+// CF object retains its allocator, the backing data lives as long as they do.
+//
+
+static const void *der_borrowing_retain(const void *info) {
+    return CFRetain(info);
+}
+
+static void der_borrowing_release(const void *info) {
+    CFRelease(info);
+}
+
+static CFStringRef der_borrowing_copy_description(const void *info) {
+    return CFSTR("DER decoding allocator keeping the encoded data alive");
+}
+
+static void *der_borrowing_allocate(CFIndex size, CFOptionFlags hint, void *info) {
+    return CFAllocatorAllocate(kCFAllocatorDefault, size, hint);
+}
+
+static void *der_borrowing_reallocate(void *ptr, CFIndex size, CFOptionFlags hint, void *info) {
+    return CFAllocatorReallocate(kCFAllocatorDefault, ptr, size, hint);
+}
+
+static void der_borrowing_deallocate(void *ptr, void *info) {
+    CFAllocatorDeallocate(kCFAllocatorDefault, ptr);
+}
+
+static CFIndex der_borrowing_preferred_size(CFIndex size, CFOptionFlags hint, void *info) {
+    return CFAllocatorGetPreferredSizeForSize(kCFAllocatorDefault, size, hint);
+}
+
+const uint8_t* der_decode_plist_borrowing(CFDataRef backing, CFOptionFlags mutability,
+                                          CFPropertyListRef* pl, CFErrorRef *error,
+                                          const uint8_t* der, const uint8_t *der_end)
+{
+    CFAllocatorContext context = { 0, (void *) backing,
+        der_borrowing_retain,
+        der_borrowing_release,
+        der_borrowing_copy_description,
+        der_borrowing_allocate,
+        der_borrowing_reallocate,
+        der_borrowing_deallocate,
+        der_borrowing_preferred_size };
+
+    assert(der == NULL || (CFDataGetBytePtr(backing) <= der && der_end <= CFDataGetBytePtr(backing) + CFDataGetLength(backing)));
+
+    CFAllocatorRef allocator = CFAllocatorCreate(NULL, &context);
+    if (!allocator)
+        return der_decode_plist(kCFAllocatorDefault, mutability & ~kSecDERDecodeBorrowData, pl, error, der, der_end);
+
+    der = der_decode_plist(allocator, mutability | kSecDERDecodeBorrowData, pl, error, der, der_end);
+    CFReleaseNull(allocator);
+
+    return der;
+}
+
 // Similar to CFPropertyListCreateData
 
 CFDataRef CFPropertyListCreateDERData(CFAllocatorRef allocator, CFPropertyListRef plist, CFErrorRef *error) {
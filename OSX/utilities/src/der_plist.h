@@ -47,6 +47,16 @@ enum {
     kCFPropertyListDERFormat_v1_0 = 400
 };
 
+// Decode option, or'ed into the mutability argument of the der_decode_ functions.
+// CFData leaves (and ASCII strings) reference the DER bytes instead of copying
+// them, so these bytes have to stay around, unchanged, for as long as the decoded
+// objects do. der_decode_plist_borrowing takes care of that.
+// Only borrow from buffers that aren't secret: any one decoded value keeps all of
+// them in memory, so decrypted keychain items are always copied.
+enum {
+    kSecDERDecodeBorrowData = 1 << 16
+};
+
 
 // PropertyList <-> DER Functions
 
@@ -59,6 +69,21 @@ const uint8_t* der_decode_plist(CFAllocatorRef pl, CFOptionFlags mutability,
                                 CFPropertyListRef* cf, CFErrorRef *error,
                                 const uint8_t* der, const uint8_t *der_end);
 
+// Like der_decode_plist with kSecDERDecodeBorrowData, der..der_end being part of
+// backing. Every decoded object keeps backing alive (through the allocator they
+// are created with), so it can be released as soon as this returns.
+const uint8_t* der_decode_plist_borrowing(CFDataRef backing, CFOptionFlags mutability,
+                                          CFPropertyListRef* cf, CFErrorRef *error,
+                                          const uint8_t* der, const uint8_t *der_end);
+
+// Look up keys in a DER encoded dictionary without decoding it all: only the
+// matching values are decoded, every other entry is skipped. values[i] is the
+// value for keys[i] (retained), or NULL when there is no such key.
+const uint8_t* der_decode_dictionary_values(CFAllocatorRef allocator, CFOptionFlags mutability,
+                                            CFIndex count, const CFTypeRef *keys, CFTypeRef *values,
+                                            CFErrorRef *error,
+                                            const uint8_t* der, const uint8_t *der_end);
+
 CFDataRef CFPropertyListCreateDERData(CFAllocatorRef allocator, CFPropertyListRef plist, CFErrorRef *error);
 
 CFPropertyListRef CFPropertyListCreateWithDERData(CFAllocatorRef allocator, CFDataRef data, CFOptionFlags options, CFPropertyListFormat *format, CFErrorRef *error);
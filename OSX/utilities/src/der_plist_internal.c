@@ -22,13 +22,65 @@
  */
 
 
+#include "utilities/der_plist.h"
 #include "utilities/der_plist_internal.h"
 #include "utilities/SecCFError.h"
 #include "utilities/SecCFRelease.h"
 #include <CoreFoundation/CoreFoundation.h>
+#include <stdlib.h>
+#include <string.h>
 
 CFStringRef sSecDERErrorDomain = CFSTR("com.apple.security.cfder.error");
 
 bool SecCFDERCreateError(CFIndex errorCode, CFStringRef descriptionString, CFErrorRef previousError, CFErrorRef *newError) {
     return SecCFCreateError(errorCode, sSecDERErrorDomain, descriptionString, previousError, newError);
 }
+
+static int der_span_compare(const void *left_void, const void *right_void)
+{
+    const struct der_span *left = left_void;
+    const struct der_span *right = right_void;
+    const size_t shortest = (left->length <= right->length) ? left->length : right->length;
+
+    int comparison = memcmp(left->der, right->der, shortest);
+
+    if (comparison == 0)
+        comparison = (left->length > right->length) - (left->length < right->length);
+
+    return comparison;
+}
+
+bool der_sort_set_elements(size_t count, struct der_span *spans, CFErrorRef *error,
+                           uint8_t *der, const uint8_t *der_end)
+{
+    if (count < 2)
+        return true;
+
+    qsort(spans, count, sizeof(*spans), der_span_compare);
+
+    // Leave them be if they were in order already.
+    const uint8_t *next = der;
+    size_t position = 0;
+    while (position < count && spans[position].der == next) {
+        next += spans[position].length;
+        ++position;
+    }
+    if (position == count)
+        return true;
+
+    const size_t size = der_end - der;
+    uint8_t *sorted = malloc(size);
+    if (sorted == NULL)
+        return SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("Failed to allocate sort buffer"), NULL, error);
+
+    uint8_t *sorted_end = sorted;
+    for (position = 0; position < count; ++position) {
+        memcpy(sorted_end, spans[position].der, spans[position].length);
+        sorted_end += spans[position].length;
+    }
+
+    memcpy(der, sorted, size);
+    free(sorted);
+
+    return true;
+}
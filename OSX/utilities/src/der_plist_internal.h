@@ -31,6 +31,19 @@
 bool SecCFDERCreateError(CFIndex errorCode, CFStringRef descriptionString, CFErrorRef previousError, CFErrorRef *newError);
 
 
+// Canonical ordering for DER SETs (CFDictionary and CFSet).
+// The count elements are encoded back to back in [der, der_end), spans
+// describes them in any order. Sorts spans by contents (memcmp, then
+// shorter first) and moves the elements into that order in place.
+struct der_span {
+    const uint8_t *der;
+    size_t         length;
+};
+
+bool der_sort_set_elements(size_t count, struct der_span *spans, CFErrorRef *error,
+                           uint8_t *der, const uint8_t *der_end);
+
+
 // CFArray <-> DER
 size_t der_sizeof_array(CFArrayRef array, CFErrorRef *error);
 
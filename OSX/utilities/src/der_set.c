@@ -23,6 +23,7 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "der_set.h"
 
 #include "utilities/SecCFRelease.h"
@@ -115,72 +116,56 @@ size_t der_sizeof_set(CFSetRef dict, CFErrorRef *error)
 }
 
 struct encode_context {
-    bool         success;
-    CFErrorRef * error;
-    CFMutableArrayRef list;
-    CFAllocatorRef allocator;
+    bool              success;
+    CFErrorRef *      error;
+    const uint8_t *   der;
+    uint8_t *         der_end;
+    struct der_span * spans;
+    size_t            count;
 };
 
-static void add_sequence_to_array(const void *value_void, void *context_void)
+// Encode each value right in front of the previous one, we sort them afterwards.
+static void add_value_to_spans(const void *value_void, void *context_void)
 {
     struct encode_context *context = (struct encode_context *) context_void;
     if (context->success) {
-        size_t der_size = der_sizeof_plist(value_void, context->error);
-        if (der_size == 0) {
-            context-> success = false;
+        uint8_t *encode_begin = der_encode_plist(value_void, context->error, context->der, context->der_end);
+
+        if (encode_begin != NULL) {
+            context->spans[context->count].der = encode_begin;
+            context->spans[context->count].length = context->der_end - encode_begin;
+            context->count++;
+            context->der_end = encode_begin;
         } else {
-            CFMutableDataRef value = CFDataCreateMutable(context->allocator, der_size);
-            CFDataSetLength(value, der_size);
-            
-            uint8_t* const encode_begin = CFDataGetMutableBytePtr(value);
-            uint8_t *encode_end = encode_begin + der_size;
-            
-            encode_end = der_encode_plist(value_void, context->error, encode_begin, encode_end);
-            
-            if (encode_end != NULL) {
-                CFDataDeleteBytes(value, CFRangeMake(0, (encode_end - encode_begin)));
-                CFArrayAppendValue(context->list, value);
-            } else {
-                context-> success = false;
-            }
-            CFReleaseNull(value);
+            context->success = false;
         }
     }
 }
 
-static CFComparisonResult cfdata_compare_contents(const void *val1, const void *val2, void *context __unused)
-{
-    return CFDataCompare((CFDataRef) val1, (CFDataRef) val2);
-}
-
-
 uint8_t* der_encode_set(CFSetRef set, CFErrorRef *error,
                                const uint8_t *der, uint8_t *der_end)
 {
-    CFMutableArrayRef elements = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
-    
-    struct encode_context context = { .success = true, .error = error, .list = elements };
-    CFSetApplyFunction(set, add_sequence_to_array, &context);
-    
-    if (!context.success) {
-        CFReleaseNull(elements);
-        return NULL;
-    }
-    
-    CFRange allOfThem = CFRangeMake(0, CFArrayGetCount(elements));
-    
-    CFArraySortValues(elements, allOfThem, cfdata_compare_contents, NULL);
+    CFIndex count = CFSetGetCount(set);
+    struct der_span *spans = NULL;
 
-    uint8_t* original_der_end = der_end;
-    
-    for(CFIndex position = CFArrayGetCount(elements); position > 0;) {
-        --position;
-        CFDataRef data = CFArrayGetValueAtIndex(elements, position);
-        der_end = ccder_encode_body(CFDataGetLength(data), CFDataGetBytePtr(data), der, der_end);
+    if (count > 0) {
+        spans = malloc(count * sizeof(*spans));
+        if (spans == NULL) {
+            SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("Failed to allocate set elements"), NULL, error);
+            return NULL;
+        }
     }
-    
-    CFReleaseNull(elements);
-    
-    return ccder_encode_constructed_tl(CCDER_CONSTRUCTED_CFSET, original_der_end, der, der_end);
-    
+
+    struct encode_context context = { .success = true, .error = error, .der = der, .der_end = der_end, .spans = spans };
+    CFSetApplyFunction(set, add_value_to_spans, &context);
+
+    if (context.success)
+        context.success = der_sort_set_elements(context.count, spans, error, context.der_end, der_end);
+
+    free(spans);
+
+    if (!context.success)
+        return NULL;
+
+    return ccder_encode_constructed_tl(CCDER_CONSTRUCTED_CFSET, der_end, der, context.der_end);
 }
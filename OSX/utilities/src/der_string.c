@@ -47,7 +47,10 @@ const uint8_t* der_decode_string(CFAllocatorRef allocator, CFOptionFlags mutabil
         return NULL;
     }
 
-    *string = CFStringCreateWithBytes(allocator, payload, payload_size, kCFStringEncodingUTF8, false);
+    if (mutability & kSecDERDecodeBorrowData)
+        *string = CFStringCreateWithBytesNoCopy(allocator, payload, payload_size, kCFStringEncodingUTF8, false, kCFAllocatorNull);
+    else
+        *string = CFStringCreateWithBytes(allocator, payload, payload_size, kCFStringEncodingUTF8, false);
 
     if (NULL == *string) {
         SecCFDERCreateError(kSecDERErrorAllocationFailure, CFSTR("String allocation failed"), NULL, error);
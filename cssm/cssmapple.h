@@ -403,6 +403,14 @@ enum {
 
     // Delete this database
     CSSM_APPLEFILEDL_DELETE_FILE,
+
+	// Toggle whether commits append the changed records to a journal next to
+	// the database instead of rewriting the whole file.  The input parameter
+	// is a CSSM_BOOL, where TRUE turns journaling on and FALSE turns it off.
+	// Only readers that know about the journal see journaled changes; code
+	// that reads the database file directly sees it as of the last full
+	// commit until the journal has been folded back into it.
+	CSSM_APPLEFILEDL_TOGGLE_JOURNAL,
 };
 
 /* UNLOCK_REFERRAL "type" attribute values */